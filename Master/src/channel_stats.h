@@ -0,0 +1,217 @@
+#ifndef CHANNEL_STATS_H
+#define CHANNEL_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// Streaming statistics per sensor channel
+//
+// Thresholds such as LDR_THRESHOLD_DIM or SOIL_MOISTURE_THRESHOLD are tuned
+// from how a channel behaves over hours, but only the latest frame is kept.
+// Every reading therefore updates a fixed set of estimators in constant time:
+// Welford's running mean and variance with min and max, P-square quantile
+// markers (Jain and Chlamtac) for the median, p90 and p99, and for on/off
+// channels the time spent in each state. Nothing is stored per reading, so
+// memory and update cost stay the same however long the window is. Windows
+// are tumbling: when one ends its totals are kept as the previous window and
+// a fresh one starts. Pure C++ with the clock passed in, so accuracy and cost
+// can be measured on the host.
+
+#ifndef STATS_WINDOW_MS
+#define STATS_WINDOW_MS 3600000UL   // Length of a statistics window (1 hour)
+#endif
+#define STATS_QUANTILES 3           // Quantiles tracked per channel
+#define STATS_STATES 3              // States tracked per on/off channel (light has off/dim/on)
+
+static const float statsQuantiles[STATS_QUANTILES] = {0.5f, 0.9f, 0.99f};
+static const char *const statsQuantileNames[STATS_QUANTILES] = {"p50", "p90", "p99"};
+
+// P-square estimate of one quantile: five markers whose heights follow the
+// quantile as readings come in, moved by a parabolic fit to their neighbours
+typedef struct stats_p2 {
+  float height[5];          // Marker heights; the first five readings, sorted, until count reaches 5
+  float position[5];        // Actual marker positions, 1-based
+  float desired[5];         // Desired marker positions
+  uint32_t count;
+} stats_p2;
+
+inline void p2Init(stats_p2 &p2) {
+  memset(&p2, 0, sizeof(p2));
+}
+
+inline void p2Add(stats_p2 &p2, float p, float x) {
+  if (p2.count < 5) {
+    // Insertion sort of the first readings
+    int i = p2.count++;
+    while (i > 0 && p2.height[i - 1] > x) {
+      p2.height[i] = p2.height[i - 1];
+      i--;
+    }
+    p2.height[i] = x;
+    if (p2.count == 5) {
+      for (int m = 0; m < 5; m++) {
+        p2.position[m] = m + 1;
+      }
+      p2.desired[0] = 1;
+      p2.desired[1] = 1 + 2 * p;
+      p2.desired[2] = 1 + 4 * p;
+      p2.desired[3] = 3 + 2 * p;
+      p2.desired[4] = 5;
+    }
+    return;
+  }
+  p2.count++;
+
+  // Cell the reading falls in, widening the extremes if needed
+  int k;
+  if (x < p2.height[0]) {
+    p2.height[0] = x;
+    k = 0;
+  } else if (x >= p2.height[4]) {
+    p2.height[4] = x;
+    k = 3;
+  } else {
+    k = 0;
+    while (x >= p2.height[k + 1]) {
+      k++;
+    }
+  }
+  for (int m = k + 1; m < 5; m++) {
+    p2.position[m]++;
+  }
+  const float step[5] = {0, p / 2, p, (1 + p) / 2, 1};
+  for (int m = 0; m < 5; m++) {
+    p2.desired[m] += step[m];
+  }
+
+  // Move the middle markers towards their desired positions
+  for (int m = 1; m < 4; m++) {
+    float d = p2.desired[m] - p2.position[m];
+    if ((d >= 1 && p2.position[m + 1] - p2.position[m] > 1) ||
+        (d <= -1 && p2.position[m - 1] - p2.position[m] < -1)) {
+      float s = d > 0 ? 1 : -1;
+      float below = p2.position[m] - p2.position[m - 1];
+      float above = p2.position[m + 1] - p2.position[m];
+      float q = p2.height[m] + s / (p2.position[m + 1] - p2.position[m - 1]) *
+                ((below + s) * (p2.height[m + 1] - p2.height[m]) / above +
+                 (above - s) * (p2.height[m] - p2.height[m - 1]) / below);
+      if (p2.height[m - 1] < q && q < p2.height[m + 1]) {
+        p2.height[m] = q;
+      } else {
+        int n = m + (int)s;  // Parabola overshoots: move linearly instead
+        p2.height[m] += s * (p2.height[n] - p2.height[m]) / (p2.position[n] - p2.position[m]);
+      }
+      p2.position[m] += s;
+    }
+  }
+}
+
+// Current estimate; exact while fewer than five readings were seen
+inline float p2Value(const stats_p2 &p2, float p) {
+  if (p2.count == 0) {
+    return NAN;
+  }
+  if (p2.count < 5) {
+    return p2.height[(int)(p * (p2.count - 1) + 0.5f)];
+  }
+  return p2.height[2];
+}
+
+// One window of one channel
+typedef struct stats_window {
+  unsigned long start;
+  uint32_t count;           // Readings
+  float mean;
+  float m2;                 // Sum of squared deviations from the mean (Welford)
+  float min;
+  float max;
+  stats_p2 quantiles[STATS_QUANTILES];
+  uint32_t stateMs[STATS_STATES]; // Time spent in each state
+} stats_window;
+
+typedef struct channel_stats {
+  bool hasStates;           // On/off channel: time in state is tracked
+  int8_t state;             // Current state, -1 before the first reading
+  unsigned long stateSince;
+  stats_window current;
+  stats_window previous;    // Last complete window; count 0 before the first one ends
+  uint32_t windows;         // Windows completed since boot
+} channel_stats;
+
+inline void statsWindowInit(stats_window &window, unsigned long now) {
+  memset(&window, 0, sizeof(window));
+  window.start = now;
+  window.min = INFINITY;
+  window.max = -INFINITY;
+  for (int q = 0; q < STATS_QUANTILES; q++) {
+    p2Init(window.quantiles[q]);
+  }
+}
+
+inline void statsInit(channel_stats &stats, bool hasStates, unsigned long now) {
+  stats.hasStates = hasStates;
+  stats.state = -1;
+  stats.stateSince = now;
+  stats.windows = 0;
+  statsWindowInit(stats.current, now);
+  statsWindowInit(stats.previous, now);
+}
+
+// Credit the time since the last state change to the current state
+inline void statsCreditState(channel_stats &stats, unsigned long now) {
+  if (stats.state >= 0) {
+    stats.current.stateMs[stats.state] += now - stats.stateSince;
+  }
+  stats.stateSince = now;
+}
+
+// End the current window if its time is up; call before every update and
+// read, and now and then so quiet channels roll over too
+inline void statsTick(channel_stats &stats, unsigned long now) {
+  if (now - stats.current.start < STATS_WINDOW_MS) {
+    return;
+  }
+  statsCreditState(stats, now);
+  stats.previous = stats.current;
+  statsWindowInit(stats.current, now);
+  stats.windows++;
+}
+
+// A new reading
+inline void statsAdd(channel_stats &stats, float value, unsigned long now) {
+  statsTick(stats, now);
+  stats_window &w = stats.current;
+  w.count++;
+  float delta = value - w.mean;
+  w.mean += delta / w.count;
+  w.m2 += delta * (value - w.mean);
+  w.min = value < w.min ? value : w.min;
+  w.max = value > w.max ? value : w.max;
+  for (int q = 0; q < STATS_QUANTILES; q++) {
+    p2Add(w.quantiles[q], statsQuantiles[q], value);
+  }
+
+  if (stats.hasStates) {
+    int state = value < 0 ? 0 : (value >= STATS_STATES ? STATS_STATES - 1 : (int)value);
+    if (state != stats.state) {
+      statsCreditState(stats, now);
+      stats.state = state;
+    }
+  }
+}
+
+inline float statsVariance(const stats_window &window) {
+  return window.count > 1 ? window.m2 / (window.count - 1) : 0;
+}
+
+// Time in `state` over the current window, up to `now`
+inline uint32_t statsStateMs(const channel_stats &stats, int state, unsigned long now) {
+  uint32_t ms = stats.current.stateMs[state];
+  if (state == stats.state) {
+    ms += now - stats.stateSince;
+  }
+  return ms;
+}
+
+#endif
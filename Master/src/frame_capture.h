@@ -0,0 +1,108 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Raw ESP-NOW frame capture
+//
+// A capture is a file header followed by one record per received frame: a
+// fixed 12-byte record header (receive time, sender MAC, RSSI, length) and
+// the frame bytes exactly as OnDataRecv got them. The receive callback only
+// appends records to a RAM ring; loop() drains the ring to LittleFS or to
+// serial, so flash and UART time never lands on the Wi-Fi task. Pure C++ so
+// the replay tool (tools/replay) reads the same definitions.
+
+#define CAPTURE_MAGIC "GHCP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_RING_SIZE 4096     // Bytes of records waiting to be drained
+#define CAPTURE_MAX_FRAME 250      // ESP-NOW payload limit
+#define CAPTURE_SERIAL_PREFIX "CAP " // Serial records are hex lines with this prefix
+
+typedef struct __attribute__((packed)) capture_file_header {
+  char magic[4];              // CAPTURE_MAGIC
+  uint16_t version;           // CAPTURE_VERSION
+  uint16_t recordHeaderSize;  // sizeof(capture_record), so readers can skip added fields
+} capture_file_header;
+
+typedef struct __attribute__((packed)) capture_record {
+  uint32_t time;              // Master millis() when the frame arrived
+  uint8_t mac[6];             // Sender
+  int8_t rssi;                // dBm, 0 if it was not heard in promiscuous mode
+  uint8_t length;             // Frame bytes that follow
+} capture_record;
+
+#define CAPTURE_MAX_RECORD (sizeof(capture_record) + CAPTURE_MAX_FRAME)
+
+// Byte ring of whole records
+typedef struct capture_ring {
+  uint8_t data[CAPTURE_RING_SIZE];
+  size_t head;                // Next byte to drain
+  size_t used;
+  uint32_t records;           // Records captured since capture started
+  uint32_t dropped;           // Records lost to a full ring
+} capture_ring;
+
+inline void captureRingInit(capture_ring &ring) {
+  ring.head = 0;
+  ring.used = 0;
+  ring.records = 0;
+  ring.dropped = 0;
+}
+
+inline void captureHeaderInit(capture_file_header &header) {
+  memcpy(header.magic, CAPTURE_MAGIC, 4);
+  header.version = CAPTURE_VERSION;
+  header.recordHeaderSize = sizeof(capture_record);
+}
+
+inline void captureRingCopyIn(capture_ring &ring, const void *src, size_t len) {
+  size_t tail = (ring.head + ring.used) % CAPTURE_RING_SIZE;
+  size_t first = CAPTURE_RING_SIZE - tail < len ? CAPTURE_RING_SIZE - tail : len;
+  memcpy(ring.data + tail, src, first);
+  memcpy(ring.data, (const uint8_t *)src + first, len - first);
+  ring.used += len;
+}
+
+inline void captureRingCopyOut(capture_ring &ring, void *dst, size_t len) {
+  size_t first = CAPTURE_RING_SIZE - ring.head < len ? CAPTURE_RING_SIZE - ring.head : len;
+  memcpy(dst, ring.data + ring.head, first);
+  memcpy((uint8_t *)dst + first, ring.data, len - first);
+  ring.head = (ring.head + len) % CAPTURE_RING_SIZE;
+  ring.used -= len;
+}
+
+// Append one frame; a record that does not fit is dropped whole
+inline bool captureWrite(capture_ring &ring, uint32_t time, const uint8_t *mac, int8_t rssi,
+                         const uint8_t *frame, int len) {
+  if (len < 0) {
+    return false;
+  }
+  capture_record record;
+  record.time = time;
+  memcpy(record.mac, mac, 6);
+  record.rssi = rssi;
+  record.length = len > CAPTURE_MAX_FRAME ? CAPTURE_MAX_FRAME : len;
+  if (ring.used + sizeof(record) + record.length > CAPTURE_RING_SIZE) {
+    ring.dropped++;
+    return false;
+  }
+  captureRingCopyIn(ring, &record, sizeof(record));
+  captureRingCopyIn(ring, frame, record.length);
+  ring.records++;
+  return true;
+}
+
+// Move the oldest record (header and frame) into `out`, which must hold
+// CAPTURE_MAX_RECORD bytes; returns its size, or 0 if the ring is empty
+inline size_t captureRead(capture_ring &ring, uint8_t *out) {
+  if (ring.used == 0) {
+    return 0;
+  }
+  captureRingCopyOut(ring, out, sizeof(capture_record));
+  const capture_record *record = (const capture_record *)out;
+  captureRingCopyOut(ring, out + sizeof(capture_record), record->length);
+  return sizeof(capture_record) + record->length;
+}
+
+#endif
@@ -3,12 +3,42 @@
 #include <esp_now.h>
 #include <ESPAsyncWebServer.h>
 #include "pageindex.h" // Include the HTML file
+#include "peer_liveness.h" // Per-slave online/degraded/offline tracking
+#include "response_pool.h" // Heap-free cached web responses
 #include <esp_wifi.h>
+#include <LittleFS.h>
+#include "rule_engine.h" // Automation rules compiled to bytecode
+#include "channel_stats.h" // Running statistics per channel for /stats
+#include "rate_control.h" // Per-slave ESP-NOW PHY rate selection
+#include "frame_capture.h" // Raw frame recording for tools/replay
+#include "relay.h" // Multi-hop routes to slaves that cannot hear us
+#include "ota_transfer.h" // Slave firmware updates over ESP-NOW
+#include "channel_migration.h" // Taking the slaves along when the router changes channel
+#include "telemetry_export.h" // Batched readings for the plant's monitoring
+#include "web_admission.h" // Shedding web load that would starve the ingest
+#include "master_failover.h" // Hot-standby master taking over from a failed primary
+#include "frame_auth.h" // Authenticated frames with a key per slave
+#if !__has_include("keys.h")
+#error "No keys.h: copy common/espnow_link/keys.h.example to keys.h and fill in your keys"
+#endif
+#include "keys.h" // The frame authentication keys, kept out of git
+#include <AsyncTCP.h>
+#include <mbedtls/sha256.h>
+#include <Preferences.h>
 
 // Network Credentials
 const char* wifi_network_ssid = "josip";  // Wi-Fi network SSID
 const char* wifi_network_password = "12345678"; // Wi-Fi network password
 
+// Telemetry export (see telemetry_export.h). Hosts are IP addresses, so no
+// DNS lookup can hold up loop(); leave a host empty to turn that uplink off.
+const char* export_mqtt_host = "";          // MQTT broker
+uint16_t export_mqtt_port = 1883;
+const char* export_mqtt_topic = "greenhouse/telemetry";
+const char* export_mqtt_client_id = "greenhouse-master";
+const char* export_udp_host = "";           // UDP collector
+uint16_t export_udp_port = 9870;
+
 // Access Point Configuration
 const char* soft_ap_ssid = "ESP32_WS";  // AP SSID
 const char* soft_ap_password = "helloesp32WS"; // AP Password
@@ -16,120 +46,2677 @@ IPAddress local_ip(192, 168, 1, 1);
 IPAddress gateway(192, 168, 1, 1);
 IPAddress subnet(255, 255, 255, 0);
 
-// LED Pins
-#define LED1_PIN 13
-#define LED2_PIN 18
+// LED Pins
+#define LED1_PIN 13
+#define LED2_PIN 18
+
+// Soil moisture reading above which the soil counts as dry (matches Slave 3)
+#define SOIL_DRY_THRESHOLD 1900
+
+// ESP-NOW Communication
+uint8_t slave1MAC[] = {0x88, 0x13, 0xBF, 0x0C, 0x42, 0x94}; // slave1 MAC: LDR slave
+uint8_t slave2MAC[] = {0xCC, 0x7B, 0x5C, 0x35, 0x48, 0xFC}; // "2slave" MAC: DHT slave
+uint8_t slave3MAC[] = {0xAC, 0x15, 0x18, 0xD4, 0xA6, 0xD4}; // slave3 MAC: Soil and Watering
+uint8_t broadcastMAC[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}; // Sync beacons go to every slave
+#define SLAVE_COUNT 3
+
+// Hot-standby pair (see master_failover.h): both masters run this firmware
+// and tell from their own MAC which one they are. Leave the standby all
+// zero for a single master. The slaves are given the same two addresses.
+uint8_t primaryMasterMAC[] = {0xFC, 0xE8, 0xC0, 0x74, 0x50, 0x14};
+uint8_t standbyMasterMAC[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+// Frame authentication (see frame_auth.h): the group key every node holds,
+// each slave's own key and the key of the master pair, from keys.h
+#if !defined(AUTH_GROUP_KEY) || !defined(AUTH_SLAVE1_KEY) || !defined(AUTH_SLAVE2_KEY) || !defined(AUTH_SLAVE3_KEY) || \
+    !defined(AUTH_PAIR_KEY)
+#error "keys.h must define AUTH_GROUP_KEY, AUTH_SLAVE1_KEY to AUTH_SLAVE3_KEY and AUTH_PAIR_KEY (see keys.h.example)"
+#endif
+const uint8_t authGroupKeyBytes[AUTH_KEY_SIZE] = AUTH_GROUP_KEY;
+const uint8_t authPairKeyBytes[AUTH_KEY_SIZE] = AUTH_PAIR_KEY;
+const uint8_t authSlaveKeyBytes[SLAVE_COUNT][AUTH_KEY_SIZE] = {AUTH_SLAVE1_KEY, AUTH_SLAVE2_KEY, AUTH_SLAVE3_KEY};
+
+// Login for the routes that change the system (POST /rules and /ota), from keys.h
+#if !defined(WEB_ADMIN_USER) || !defined(WEB_ADMIN_PASSWORD)
+#error "keys.h must define WEB_ADMIN_USER and WEB_ADMIN_PASSWORD (see keys.h.example)"
+#endif
+static_assert(sizeof(WEB_ADMIN_PASSWORD) > 1, "Set WEB_ADMIN_PASSWORD in keys.h");
+
+// Time sync: every SYNC_BEACON_INTERVAL the master broadcasts its millis(),
+// which the slaves use to stamp their samples in the master's timebase
+#define MSG_SYNC_BEACON 1          // Message type of a sync beacon
+#define SYNC_BEACON_INTERVAL 1000  // ms between beacons
+#define SYNC_UNSYNCED 0xFFFF       // sampleTimeError of a sample without a timestamp
+
+// Automation rules (see rule_engine.h) override the slaves' local control
+// with action commands. Overrides expire on the slave unless refreshed, so a
+// silent master hands control back to the slaves.
+#define MSG_ACTION 2                 // Message type of an action command
+#define ACTION_TTL_SECONDS 30        // How long a slave honours an override
+#define ACTION_REFRESH_INTERVAL 10000 // ms between re-sends of active overrides
+#define RULES_FILE "/rules.txt"
+#define RULES_UPLOAD_FILE "/rules.new"
+
+// Every frame starts with a frame_header. Routine status frames are bulk
+// traffic; alarm frames carry QOS_ALARM and skip every queue bulk data waits
+// in: the slave sends them at once and retries them, and we dispatch them
+// from their own queue and push them to dashboards before anything else.
+#define MSG_STATUS 3                 // Message type of a slave's status frame
+#define MSG_ALARM 4                  // Message type of an alarm raised or cleared by a slave
+#define QOS_BULK 0
+#define QOS_ALARM 1
+#define ALARM_WATER_LOW 0            // Water level below WATER_LEVEL_LOW_THRESHOLD (Slave 3)
+#define ALARM_OVER_TEMP 1            // Temperature far above THRESHOLD_TEMP (Slave 2)
+#define ALARM_PUMP_STUCK 2           // A pump running far longer than it should (Slave 3)
+#define ALARM_COUNT 3
+#define ALARM_RX_QUEUE_SIZE 8        // Alarm frames waiting for loop() to dispatch
+
+const char *alarmNames[ALARM_COUNT] = {"water_low", "over_temp", "pump_stuck"};
+
+// Frame capture (see frame_capture.h), switched at runtime from /capture.
+// A file capture rolls over to CAPTURE_OLD_FILE once it reaches
+// CAPTURE_FILE_LIMIT, so the last incident is always on flash.
+#define CAPTURE_FILE "/capture.bin"
+#define CAPTURE_OLD_FILE "/capture.old"
+#define CAPTURE_FILE_LIMIT 262144
+#define CAPTURE_DRAIN_BYTES 1024   // Output bytes (hex on serial) drained per loop() pass
+
+// Multi-hop relay (see relay.h): a slave out of our range sends through a
+// slave in the relay role, wrapped in a relay_header naming it as origin.
+// We unwrap such frames, remember which relay each slave was last heard
+// through and send its actions back the same way.
+#define MSG_RELAY 5                  // Message type of a frame wrapped for forwarding
+#define SEQ_RESTART_WINDOW 64        // A sequence number further back than this means the slave rebooted
+
+// Slave firmware updates (see ota_transfer.h): an image POSTed to /ota is
+// kept in OTA_IMAGE_FILE and streamed to one slave, or by broadcast to every
+// slave of a node type, from loop(). Updates go to slaves in direct range only.
+#define MSG_OTA 6                    // Message type of every firmware update frame
+#define OTA_IMAGE_FILE "/ota.bin"
+#define OTA_BURST 4                  // Frames sent per loop() pass
+
+// Channel migration (see channel_migration.h): we reconnect to the router
+// ourselves instead of letting the STA do it, so that when it has moved we
+// can announce the new channel on the old one before following it. Slaves
+// that lost us probe each channel; we answer a probe with a sync beacon.
+#define MSG_CHANNEL 7                // Message type of a channel notice or probe
+#define CHANNEL_OP_NOTICE 0
+#define CHANNEL_OP_PROBE 1
+#define CHANNEL_CHECK_INTERVAL 500   // ms between checks of the router connection
+#define CHANNEL_RETRY_INTERVAL 10000 // ms a reconnect may take, and between scans while the router is away
+
+// Hot standby (see master_failover.h): the active master of a pair tells
+// each slave its term under the slave's own key, as a beacon's term under
+// the group key could be anyone's
+#define MSG_TERM 8                   // Message type of a term announcement
+
+// Telemetry export: MQTT reconnects back off between these bounds, and the
+// broker hears from us at least every half keep-alive
+#define EXPORT_MQTT_RETRY_MIN 1000       // ms
+#define EXPORT_MQTT_RETRY_MAX 60000      // ms
+#define EXPORT_MQTT_KEEPALIVE 60         // s
+#define EXPORT_RATE_WINDOW 10000         // ms over which export throughput is measured
+
+// Used when no rules have been uploaded
+const char DEFAULT_RULES[] PROGMEM = R"rawliteral(# Greenhouse automation rules, one per line:
+#   if <condition> then <target> <value> [else <target> <value>]
+# Later rules override earlier ones for the same target.
+if refilling then watering off else watering auto
+)rawliteral";
+
+// Create AsyncWebServer object on port 80
+AsyncWebServer server(80);
+AsyncEventSource events("/events"); // Pushes alarms to open dashboards
+
+// Data Structure for ESP-NOW
+typedef struct frame_header {
+  uint8_t msgType;      // MSG_*
+  uint8_t qos;          // QOS_BULK or QOS_ALARM
+  uint16_t seq;         // Per-sender frame number, kept end to end; retried copies repeat it
+} frame_header;
+
+typedef struct struct_message1 {
+  frame_header header;        // MSG_STATUS
+  int ldrValue;
+  char lightStatus[20];
+  uint32_t sampleTime;        // Master-timebase ms when the reading was taken
+  uint16_t sampleTimeError;   // Error bound of sampleTime in ms (SYNC_UNSYNCED if unknown)
+} struct_message1;
+
+typedef struct struct_message2 {
+  frame_header header;        // MSG_STATUS
+  float temperature;
+  char fanStatus[20];
+  uint32_t sampleTime;        // Master-timebase ms when the reading was taken
+  uint16_t sampleTimeError;   // Error bound of sampleTime in ms (SYNC_UNSYNCED if unknown)
+} struct_message2;
+
+typedef struct struct_message3 {
+  frame_header header;        // MSG_STATUS
+  int soilMoistureValue;
+  char soilStatus[10];    // Soil status: Dry or Moist
+  char pumpStatus[20];    // Pump status: Watering or Off
+  int waterLevelValue;
+  char refillStatus[20];  // Refill status: Refilling or Full
+  uint32_t remainingCooldown; // Add remaining cooldown to the structure
+  uint32_t sampleTime;        // Master-timebase ms when the readings were taken
+  uint16_t sampleTimeError;   // Error bound of sampleTime in ms (SYNC_UNSYNCED if unknown)
+} struct_message3;
+
+typedef struct sync_beacon {
+  frame_header header;  // MSG_SYNC_BEACON
+  uint32_t masterTime;  // millis() when the beacon was sent
+  uint8_t hops;         // Relays it passed; 0 from us
+  uint8_t pathCost;     // Cost from its sender to us; 0 from us
+  uint8_t master[6];    // Master that sent it, us or our partner
+  uint16_t term;        // That master's failover term
+} sync_beacon;
+
+typedef struct action_command {
+  frame_header header;  // MSG_ACTION
+  uint8_t target;       // RuleTarget
+  uint8_t value;        // RuleValue; VALUE_AUTO hands control back to the slave
+  uint16_t ttlSeconds;  // Override expires after this long without a refresh
+} action_command;
+
+typedef struct alarm_frame {
+  frame_header header;      // MSG_ALARM, QOS_ALARM
+  uint8_t code;             // ALARM_*
+  uint8_t active;           // 1 when raised, 0 when cleared
+  uint8_t attempt;          // Send attempt this copy came from, 1 for the first
+  float value;              // Reading that raised or cleared the alarm
+  uint32_t sampleTime;      // Master-timebase ms when the condition was seen
+  uint16_t sampleTimeError; // Error bound of sampleTime in ms (SYNC_UNSYNCED if unknown)
+} alarm_frame;
+
+typedef struct relay_header {
+  frame_header header;      // MSG_RELAY, with the qos and seq of the frame inside
+  uint8_t hops;             // Relays passed so far
+  uint8_t origin[6];        // Node that sent the frame inside
+  uint8_t dest[6];          // Node it is for
+} relay_header;             // Followed by the frame itself
+
+typedef struct ota_offer {
+  frame_header header;      // MSG_OTA
+  uint8_t op;               // OTA_OP_OFFER
+  uint8_t nodeType;         // Slaves of this type take part (1 = LDR, 2 = DHT, 3 = soil and water)
+  uint16_t chunkCount;
+  uint32_t session;         // Same image, same session: an offer again resumes it
+  uint32_t imageSize;
+  uint8_t sha256[32];       // Hash of the whole image
+} ota_offer;
+
+typedef struct ota_chunk {
+  frame_header header;      // MSG_OTA
+  uint8_t op;               // OTA_OP_CHUNK
+  uint8_t length;           // Image bytes in data
+  uint16_t index;
+  uint32_t session;
+  uint32_t crc;             // CRC-32 of data
+  uint8_t data[OTA_CHUNK_SIZE];
+} ota_chunk;                // Sent without the unused tail of data
+
+typedef struct ota_control {
+  frame_header header;      // MSG_OTA
+  uint8_t op;               // OTA_OP_POLL, OTA_OP_COMMIT or OTA_OP_ABORT
+  uint8_t nodeType;
+  uint32_t session;
+} ota_control;
+
+typedef struct ota_ack {
+  frame_header header;      // MSG_OTA
+  uint8_t op;               // OTA_OP_ACK
+  uint8_t state;            // OtaState
+  uint16_t base;            // First chunk it misses
+  uint32_t session;
+  uint32_t bitmap;          // Chunks after base it has (bit i = base + i)
+} ota_ack;
+
+typedef struct channel_notice {
+  frame_header header;      // MSG_CHANNEL
+  uint8_t op;               // CHANNEL_OP_NOTICE from us, CHANNEL_OP_PROBE from a slave
+  uint8_t channel;          // Channel the network moves to (notice only)
+  uint16_t switchIn;        // ms from sending until the move (notice only)
+} channel_notice;
+
+typedef struct term_announce {
+  frame_header header;      // MSG_TERM
+  uint16_t term;            // Our failover term
+} term_announce;
+
+struct_message1 receivedDataSlave1; // Data received from slave 1 (LDR slave)
+struct_message2 receivedDataSlave2; // Data received from 2slave (DHT slave)
+struct_message3 receivedDataSlave3; // Data received from slave 3 (Soil and Watering)
+
+// State generation: bumped by OnDataRecv on every accepted frame so the web
+// handlers know when their cached responses are out of date
+volatile uint32_t stateGeneration = 0;
+portMUX_TYPE stateMux = portMUX_INITIALIZER_UNLOCKED; // Guards receivedDataSlaveN against the Wi-Fi task
+
+// Liveness of each slave (index 0 = Slave 1), also guarded by stateMux
+peer_liveness slaveLiveness[SLAVE_COUNT];
+
+// How well each slave's sample timestamps agree with our clock, also guarded by stateMux
+typedef struct sample_timing {
+  uint32_t sampleTime;     // Timestamp of the latest sample (master timebase, ms)
+  uint16_t errorBound;     // The slave's error bound on it, ms
+  long deliveryMs;         // Receive time minus sampleTime for the latest sample
+  long minDeliveryMs;      // Below zero means a timestamp from the future: sync error
+  long maxDeliveryMs;
+  uint32_t synced;         // Frames that carried a timestamp
+  uint32_t unsynced;       // Frames from a slave that had not synced yet
+} sample_timing;
+
+sample_timing slaveTiming[SLAVE_COUNT];
+unsigned long lastSyncBeacon = 0;
+
+// Hot standby; failover is guarded by stateMux, the rest is set up before
+// ESP-NOW starts. Frames the slaves send our partner are heard in
+// promiscuous mode, and a retransmission is known by its 802.11 sequence
+// number, kept per sender on the Wi-Fi task.
+failover_state failover;
+bool partnered = false;               // A standby is configured
+uint8_t partnerMAC[6];                // The other master of the pair
+volatile uint8_t failoverSeenRole = FAILOVER_STANDBY; // Role loop() last acted on, also read by /ota
+uint16_t overheardSeqCtrl[SLAVE_COUNT];
+uint32_t framesOverheard = 0;         // Frames for our partner taken in
+volatile uint8_t partnerMoveChannel = 0; // Channel our partner announced a move to, set by OnDataRecv
+volatile unsigned long partnerMoveAt = 0;
+unsigned long lastTermAnnounce = 0;
+
+// PHY rate of each slave's link (see rate_control.h), also guarded by stateMux.
+// The rate is applied from the sending task before a send to the slave (or
+// the relay it is reached through); beacons and notices go out at the most
+// robust rate.
+rate_control slaveRates[SLAVE_COUNT];
+const wifi_phy_rate_t ratePhy[RATE_LADDER_SIZE] = {
+  WIFI_PHY_RATE_1M_L, WIFI_PHY_RATE_2M_L, WIFI_PHY_RATE_6M,
+  WIFI_PHY_RATE_12M, WIFI_PHY_RATE_24M, WIFI_PHY_RATE_54M
+};
+#if RATE_PER_PEER
+uint8_t appliedRates[SLAVE_COUNT + 1]; // Ladder index set on each slave's peer, then the broadcast peer
+#else
+uint8_t appliedRate = 0xFF;            // Ladder index the interface is currently set to
+#endif
+volatile uint8_t sendsInFlight = 0;    // Frames given to esp_now_send whose callback has not run, under stateMux
+uint8_t *slaveMACs[SLAVE_COUNT] = {slave1MAC, slave2MAC, slave3MAC};
+
+// How each slave reaches us and what its sequence numbers say about the
+// path, also guarded by stateMux
+typedef struct slave_path {
+  int8_t via;               // Slave that relayed its last frame, -1 if it came direct
+  uint8_t hops;             // Relays that frame passed
+  uint32_t relayedFrames;   // Frames that came through a relay
+  uint16_t lastSeq;
+  bool seqSeen;
+  uint32_t seqGaps;         // Frames lost on the way, by sequence number
+  uint32_t seqDuplicates;   // Copies of frames we already had
+  uint32_t restarts;        // Sequence restarts (slave reboots)
+} slave_path;
+
+slave_path slavePaths[SLAVE_COUNT];
+uint8_t ownMAC[6];                    // Origin of the frames we wrap for relays
+uint16_t frameSeq = 0;                // Sequence number of our beacons and actions; loop() only
+
+// Frame authentication: the keys, with their subkeys worked out at boot;
+// the last counter of every sender, guarded by stateMux and saved to NVS
+// from loop(); the frames checked, Wi-Fi task only; our own counter,
+// loop() only, whose boot epoch is kept in NVS
+auth_key authGroupKey;
+auth_key authSlaveKeys[SLAVE_COUNT];
+auth_key authPairKey;
+auth_replay authReplay;
+Preferences authPrefs;
+uint32_t authCounter = 0;             // Next counter we seal with
+uint32_t authAccepted = 0;            // Frames whose trailer checked out
+uint32_t authRejected = 0;            // Frames without a trailer we could check, or with a wrong tag
+uint32_t authReplayed = 0;            // Frames with a good tag and a counter we had already seen
+
+// Running statistics for /stats (see channel_stats.h), one per rule channel,
+// fed from every frame; guarded by stateMux
+channel_stats channelStats[CH_COUNT];
+unsigned long statsLastTick = 0;      // loop() only
+
+// Firmware update session; otaSender is guarded by stateMux, the rest is loop() only
+ota_sender otaSender;
+const char *otaPhaseNames[] = {"idle", "offering", "sending", "committing", "done"};
+volatile bool otaRequested = false;   // Set by /ota once the image is stored
+uint8_t otaRequestedType = 0;         // Node type, or 0 for a single slave
+int8_t otaRequestedSlave = -1;
+uint8_t otaTarget[6];                 // A slave, or the broadcast address for a whole type
+uint8_t otaNodeType = 0;
+uint8_t otaSha256[32];
+File otaImage;
+unsigned long otaStartedAt = 0;
+unsigned long otaSeconds = 0;         // Duration of the last finished session
+
+// Channel migration state, loop() only apart from the probe flag
+channel_migration channelMigration;
+volatile bool probeAnswerDue = false; // A slave probed; set by OnDataRecv
+uint32_t probesAnswered = 0;
+unsigned long lastChannelCheck = 0;
+unsigned long routerWaitStarted = 0;  // When we last reconnected or scanned in vain, 0 if not waiting
+
+// Telemetry export; exportQueue is guarded by stateMux, the MQTT state is
+// set by the AsyncTCP callbacks, the rest is loop() only
+enum ExportMqttState {MQTT_DOWN, MQTT_CONNECTING, MQTT_UP};
+const char *exportMqttStateNames[] = {"down", "connecting", "up"};
+export_queue exportQueue;
+AsyncClient exportMqttClient;
+volatile uint8_t exportMqttState = MQTT_DOWN;
+uint8_t exportMqttSeen = MQTT_DOWN;     // State loop() last acted on
+unsigned long exportMqttLastAttempt = 0;
+unsigned long exportMqttBackoff = EXPORT_MQTT_RETRY_MIN;
+unsigned long exportMqttLastSent = 0;
+uint32_t exportMqttConnects = 0;        // Connections the broker accepted
+WiFiUDP exportUdp;
+uint32_t exportBatches = 0;
+uint32_t exportSamplesSent = 0;
+uint32_t exportBytesSent = 0;
+uint32_t exportSendErrors = 0;
+unsigned long exportRateStart = 0;
+uint32_t exportRateSamples = 0;         // exportSamplesSent at exportRateStart
+uint32_t exportSamplesPerMinute = 0;    // Over the last EXPORT_RATE_WINDOW
+
+// High-priority receive queue: alarm frames are queued by OnDataRecv and
+// dispatched by loop() before any other work, guarded by stateMux
+typedef struct alarm_event {
+  alarm_frame frame;
+  int8_t slave;             // Index of the sender
+  unsigned long receivedAt; // millis() when the frame arrived
+} alarm_event;
+
+alarm_event alarmRxQueue[ALARM_RX_QUEUE_SIZE];
+uint8_t alarmRxHead = 0;
+uint8_t alarmRxCount = 0;
+uint32_t alarmRxDrops = 0;            // Alarms lost to a full queue
+
+// Current alarms, written by loop() under stateMux
+typedef struct alarm_state {
+  bool active;
+  float value;              // Reading reported with the last transition
+  uint32_t since;           // Master-timebase ms of the last transition
+} alarm_state;
+
+alarm_state alarmTable[ALARM_COUNT];
+uint8_t activeAlarms = 0;             // Bit per ALARM_* code
+
+// Alarm delivery, updated by loop() only
+typedef struct alarm_stats {
+  uint32_t received;        // Alarm transitions dispatched
+  uint32_t duplicates;      // Retried copies of an alarm we already had
+  uint32_t retries;         // Extra attempts the slaves needed
+  uint32_t unsynced;        // Alarms without a timestamp, left out of the latency
+  long latencyMs;           // Condition seen on the slave to pushed to dashboards
+  long maxLatencyMs;
+  int64_t totalLatencyMs;
+  uint32_t timed;           // Alarms the latency figures cover
+  unsigned long maxDispatchMs; // Longest wait in the receive queue
+  uint16_t lastSeq[SLAVE_COUNT];
+  uint8_t lastCode[SLAVE_COUNT];
+  bool seen[SLAVE_COUNT];
+} alarm_stats;
+
+alarm_stats alarmStats;
+
+enum CaptureSink {CAPTURE_OFF, CAPTURE_TO_FILE, CAPTURE_TO_SERIAL};
+const char *captureSinkNames[] = {"off", "file", "serial"};
+volatile CaptureSink captureRequested = CAPTURE_OFF; // Set by /capture, applied by loop()
+volatile CaptureSink captureSink = CAPTURE_OFF;      // Sink loop() is draining to
+capture_ring captureRing;              // Guarded by stateMux
+File captureFile;                      // Open while capturing to a file; loop() only
+size_t captureFileBytes = 0;
+uint32_t captureBytesWritten = 0;
+
+// Last ESP-NOW frame heard in promiscuous mode, for the RSSI of captured
+// frames. Written and read on the Wi-Fi task only.
+uint8_t lastRxMAC[6];
+int8_t lastRxRssi = 0;
+
+// Watering state derived from the Slave 3 frame
+enum WateringState {WATERING_NOT_NEEDED, WATERING_ACTIVE, WATERING_COOLDOWN, WATERING_HELD};
+
+// Derived dashboard values, computed once per received frame
+typedef struct dashboard_view {
+  struct_message1 slave1;          // Snapshot of the raw frames the view was built from
+  struct_message2 slave2;
+  struct_message3 slave3;
+  bool soilDry;                    // soilMoistureValue above the dry threshold
+  WateringState watering;
+  unsigned long cooldownSeconds;   // Only meaningful for WATERING_COOLDOWN
+  PeerState link[SLAVE_COUNT];     // Liveness of each slave; values of an offline slave are stale
+  uint8_t alarms;                  // Bit per active ALARM_* code
+} dashboard_view;
+
+dashboard_view dashboardView;
+uint32_t dashboardViewGeneration = UINT32_MAX; // Generation dashboardView was built from
+
+// Web responses are rendered into fixed pooled buffers (see response_pool.h),
+// keyed by the generation of dashboardView
+#define STATUS_RESPONSE_SIZE 512   // /status text
+#define PAGE_FRAGMENT_SIZE 64      // Text substituted into PAGEINDEX
+#define METRICS_RESPONSE_SIZE 4096 // /metrics text
+#define STATS_RESPONSE_SIZE 4096   // /stats text
+#define SMALL_RESPONSE_SIZE 128    // Plain-text replies of the control routes
+
+char statusStorage[RESPONSE_POOL_SIZE * STATUS_RESPONSE_SIZE];
+char pageStorage[RESPONSE_POOL_SIZE * PAGE_FRAGMENT_SIZE];
+char metricsStorage[RESPONSE_POOL_SIZE * METRICS_RESPONSE_SIZE];
+char statsStorage[RESPONSE_POOL_SIZE * STATS_RESPONSE_SIZE];
+response_cache statusCache;
+response_cache pageCache;
+response_cache metricsCache;
+response_cache statsCache;
+
+// Active rule program; evaluated from loop(), replaced from the web server task
+rule_program rules;
+SemaphoreHandle_t rulesMutex;
+uint32_t rulesGeneration = UINT32_MAX;     // State generation the rules last saw
+unsigned long lastActionRefresh = 0;
+uint32_t rulesPasses = 0;                  // Evaluation passes that ran at least one rule
+unsigned long rulesLastMicros = 0;
+unsigned long rulesMaxMicros = 0;
+uint64_t rulesTotalMicros = 0;
+uint32_t actionsSent = 0;
+uint32_t actionErrors = 0;
+uint8_t actionTargets[TARGET_COUNT];       // Value each target was last sent with (0 is VALUE_AUTO); loop() only
+size_t rulesUploadSize = 0;                // Body bytes of the POST /rules being received
+
+// Largest free heap block seen at its lowest, sampled from loop()
+uint32_t heapLargestBlockMin = UINT32_MAX;
+
+// Admission control for the dashboard routes; only touched on the web server task
+web_admission webAdmission;
+
+// What an admitted request holds until its client goes away: its share of
+// the heap budget and the cached response it streams, if any. Pooled, so
+// its disconnect handler captures one pointer and std::function keeps it
+// without allocating. Web server task only.
+#define WEB_TICKETS 16               // Admitted requests in flight at most; AsyncTCP's connection limit
+typedef struct web_ticket {
+  uint32_t heap;
+  response_buffer *buffer;
+  bool used;
+} web_ticket;
+web_ticket webTickets[WEB_TICKETS];
+
+
+// Channel of the specified SSID among the `n` networks of the last scan
+int32_t scanned_wifi_channel(const char* ssid, int n) {
+  for (int i = 0; i < n; ++i) {
+    if (String(ssid) == WiFi.SSID(i)) {
+      return WiFi.channel(i);
+    }
+  }
+  return 0;
+}
+
+// Get Wi-Fi channel for the specified SSID
+int32_t get_wifi_channel(const char* ssid) {
+  return scanned_wifi_channel(ssid, WiFi.scanNetworks());
+}
+
+// Set Wi-Fi channel for ESP32
+void scan_and_set_wifi_channel() {
+  Serial.printf("\nScanning for SSID: %s\n", wifi_network_ssid);
+  int master_channel = get_wifi_channel(wifi_network_ssid);
+
+  if (master_channel == 0) {
+    Serial.println("SSID not found!");
+  } else {
+    Serial.printf("SSID found. Channel: %d\n", master_channel);
+
+    if (WiFi.channel() != master_channel) {
+      esp_wifi_set_promiscuous(true);
+      esp_wifi_set_channel(master_channel, WIFI_SECOND_CHAN_NONE);
+      esp_wifi_set_promiscuous(false);
+    }
+  }
+  Serial.printf("Current Wi-Fi channel: %d\n", WiFi.channel());
+}
+
+// Record the timestamp of a sample received at `now`; call under stateMux
+void recordSampleTiming(sample_timing &timing, uint32_t sampleTime, uint16_t errorBound, unsigned long now) {
+  if (errorBound == SYNC_UNSYNCED) {
+    timing.unsynced++;
+    return;
+  }
+  long delivery = (long)(now - sampleTime);
+  if (timing.synced == 0 || delivery < timing.minDeliveryMs) {
+    timing.minDeliveryMs = delivery;
+  }
+  if (timing.synced == 0 || delivery > timing.maxDeliveryMs) {
+    timing.maxDeliveryMs = delivery;
+  }
+  timing.sampleTime = sampleTime;
+  timing.errorBound = errorBound;
+  timing.deliveryMs = delivery;
+  timing.synced++;
+}
+
+// Index of the slave with this MAC, or -1
+int slaveIndex(const uint8_t *mac) {
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    if (memcmp(mac, slaveMACs[i], 6) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Work out the subkeys once, and start our counter in a new boot epoch.
+// The replay table holds our slaves with either key and the pair's beacons
+// with either key, nobody else.
+void initFrameAuth() {
+  authKeyInit(authGroupKey, authGroupKeyBytes);
+  authKeyInit(authPairKey, authPairKeyBytes);
+  authReplayInit(authReplay);
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    authKeyInit(authSlaveKeys[i], authSlaveKeyBytes[i]);
+    authAddSender(authReplay, slaveMACs[i], AUTH_KEY_NODE);
+    authAddSender(authReplay, slaveMACs[i], AUTH_KEY_GROUP);
+  }
+  authAddSender(authReplay, primaryMasterMAC, AUTH_KEY_GROUP);
+  if (memcmp(standbyMasterMAC, "\0\0\0\0\0\0", 6) != 0) {
+    authAddSender(authReplay, standbyMasterMAC, AUTH_KEY_GROUP);
+    authAddSender(authReplay, primaryMasterMAC, AUTH_KEY_PAIR);
+    authAddSender(authReplay, standbyMasterMAC, AUTH_KEY_PAIR);
+  }
+  authPrefs.begin("frame_auth");
+  authCounter = (uint32_t)(authPrefs.getUShort("epoch") + 1) << 16;
+  for (int i = 0; i < AUTH_SENDERS; i++) {
+    char key[8];
+    uint8_t saved[AUTH_SAVED_SIZE];
+    snprintf(key, sizeof(key), "s%d", i);
+    if (authPrefs.isKey(key) && authPrefs.getBytes(key, saved, sizeof(saved)) == sizeof(saved)) {
+      authRestore(authReplay, saved);
+    }
+  }
+}
+
+// Save the senders that are new in the replay table, or whose counter has
+// moved on by AUTH_SAVE_STEP, so a restart does not forget them; loop()
+// only, to keep flash writes out of the Wi-Fi task
+void saveAuthReplay() {
+  uint8_t saved[AUTH_SAVED_SIZE];
+  for (;;) {
+    portENTER_CRITICAL(&stateMux);
+    int index = authTakeUnsaved(authReplay, saved);
+    portEXIT_CRITICAL(&stateMux);
+    if (index < 0) {
+      return;
+    }
+    char key[8];
+    snprintf(key, sizeof(key), "s%d", index);
+    authPrefs.putBytes(key, saved, sizeof(saved));
+  }
+}
+
+// Our next counter; the first of each epoch stores it before it goes out
+uint32_t nextAuthCounter() {
+  uint32_t counter = authCounter++;
+  if ((counter & 0xFFFF) == 0) {
+    authPrefs.putUShort("epoch", counter >> 16);
+  }
+  return counter;
+}
+
+// Seal `frame`, `len` bytes with room for the trailer behind them, with
+// the key of `slave`, or the group key for -1; returns the length to send
+size_t sealFrame(uint8_t *frame, size_t len, int slave) {
+  if (!FRAME_AUTH) {
+    return len;
+  }
+  return authSeal(slave >= 0 ? authSlaveKeys[slave] : authGroupKey, slave >= 0 ? AUTH_KEY_NODE : AUTH_KEY_GROUP,
+                  nextAuthCounter(), ownMAC, frame, len);
+}
+
+// Hand a frame to ESP-NOW, counting it until its send callback runs
+esp_err_t sendCounted(const uint8_t *to, const uint8_t *frame, size_t len) {
+  portENTER_CRITICAL(&stateMux);
+  sendsInFlight++;
+  portEXIT_CRITICAL(&stateMux);
+  esp_err_t result = esp_now_send(to, frame, len);
+  if (result != ESP_OK) {
+    portENTER_CRITICAL(&stateMux);
+    sendsInFlight--;
+    portEXIT_CRITICAL(&stateMux);
+  }
+  return result;
+}
+
+// Send a copy of `data` sealed as sealFrame() does
+esp_err_t sendSealed(const uint8_t *to, int slave, const uint8_t *data, size_t len) {
+  uint8_t frame[RELAY_MAX_FRAME];
+  if (len + AUTH_TRAILER_SIZE > sizeof(frame)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  memcpy(frame, data, len);
+  return sendCounted(to, frame, sealFrame(frame, len, slave));
+}
+
+// Send our partner a copy of `data` sealed with the pair key, which no
+// slave holds
+esp_err_t sendToPartner(const uint8_t *data, size_t len) {
+  uint8_t frame[RELAY_MAX_FRAME];
+  if (len + AUTH_TRAILER_SIZE > sizeof(frame)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  memcpy(frame, data, len);
+  if (FRAME_AUTH) {
+    len = authSeal(authPairKey, AUTH_KEY_PAIR, nextAuthCounter(), ownMAC, frame, len);
+  }
+  return sendCounted(partnerMAC, frame, len);
+}
+
+// Check the trailer of a frame from `mac` before anything else in it is
+// looked at; returns its length without the trailer, or -1 to drop it,
+// and sets `keyId` to the key it was sealed with. A relayed frame was
+// sealed by its origin, inside the relay_header. A slave's own key is
+// taken for what slaves send, the group key only for beacons, notices and
+// probes, the pair key only for our partner's beacons and notices, sent
+// to us directly.
+int openFrame(const uint8_t *mac, const uint8_t *data, int len, int *keyId) {
+  *keyId = -1;
+  if (!FRAME_AUTH) {
+    return len;
+  }
+  int start = 0;
+  const uint8_t *origin = mac;
+  if (len > (int)sizeof(relay_header) && data[0] == MSG_RELAY) {
+    start = sizeof(relay_header);
+    origin = data + offsetof(relay_header, origin);
+  }
+  *keyId = authKeyId(data + start, len - start);
+  const auth_key *key = nullptr;
+  bool beaconOrNotice = data[start] == MSG_SYNC_BEACON || data[start] == MSG_CHANNEL;
+  if (*keyId == AUTH_KEY_NODE) {
+    int slave = slaveIndex(origin);
+    key = slave >= 0 ? &authSlaveKeys[slave] : nullptr;
+  } else if (*keyId == AUTH_KEY_GROUP && beaconOrNotice) {
+    key = &authGroupKey;
+  } else if (*keyId == AUTH_KEY_PAIR && beaconOrNotice && start == 0 && partnered && memcmp(origin, partnerMAC, 6) == 0) {
+    key = &authPairKey;
+  }
+  uint32_t counter;
+  int length = key != nullptr ? authOpen(*key, origin, data + start, len - start, &counter) : -1;
+  if (length < 0) {
+    authRejected++;
+    return -1;
+  }
+  portENTER_CRITICAL(&stateMux);
+  bool fresh = authFresh(authReplay, origin, *keyId, counter);
+  portEXIT_CRITICAL(&stateMux);
+  if (!fresh) {
+    authReplayed++;
+    return -1;
+  }
+  authAccepted++;
+  return start + length;
+}
+
+void OnDataRecv(const uint8_t *mac, const uint8_t *incomingData, int len);
+
+// Take in a frame a slave sent our partner as if it had come to us, once
+// however often it was retransmitted
+void overhear(int slave, const wifi_promiscuous_pkt_t *packet) {
+  int body = espnowBody(packet->payload, packet->rx_ctrl.sig_len - 4);  // Without the FCS
+  uint16_t seqCtrl = packet->payload[22] | packet->payload[23] << 8;
+  bool retry = packet->payload[1] & 0x08;
+  if (body < 0 || (retry && seqCtrl == overheardSeqCtrl[slave])) {
+    return;
+  }
+  overheardSeqCtrl[slave] = seqCtrl;
+  framesOverheard++;
+  OnDataRecv(lastRxMAC, packet->payload + ESPNOW_BODY_OFFSET, body);
+}
+
+// Promiscuous receive callback: take the RSSI of every ESP-NOW frame
+// (a vendor-specific action frame); it runs just before OnDataRecv. A
+// slave's frame for our partner never reaches OnDataRecv, so it is taken
+// in here.
+void OnPromiscuousRx(void *buf, wifi_promiscuous_pkt_type_t type) {
+  if (type != WIFI_PKT_MGMT) {
+    return;
+  }
+  const wifi_promiscuous_pkt_t *packet = (const wifi_promiscuous_pkt_t *)buf;
+  if (packet->payload[0] != 0xD0) {
+    return;
+  }
+  memcpy(lastRxMAC, packet->payload + 10, 6); // Source address
+  lastRxRssi = packet->rx_ctrl.rssi;
+  int slave = slaveIndex(lastRxMAC);
+  if (slave < 0) {
+    return;
+  }
+  portENTER_CRITICAL(&stateMux);
+  rateOnRssi(slaveRates[slave], packet->rx_ctrl.rssi);
+  portEXIT_CRITICAL(&stateMux);
+  if (partnered && memcmp(packet->payload + 4, partnerMAC, 6) == 0) {
+    overhear(slave, packet);
+  }
+}
+
+// ESP-NOW send callback: feed the delivery result to the slave's rate control
+void OnDataSent(const uint8_t *mac, esp_now_send_status_t status) {
+  portENTER_CRITICAL(&stateMux);
+  if (sendsInFlight > 0) {
+    sendsInFlight--;
+  }
+  portEXIT_CRITICAL(&stateMux);
+  int slave = slaveIndex(mac);
+  if (slave < 0) {
+    return;  // Broadcast
+  }
+  portENTER_CRITICAL(&stateMux);
+  bool changed = rateOnSendResult(slaveRates[slave], status == ESP_NOW_SEND_SUCCESS, millis());
+  uint8_t mbps = rateMbps(slaveRates[slave]);
+  portEXIT_CRITICAL(&stateMux);
+  if (changed) {
+    Serial.printf("Slave %d link rate: %u Mbps\n", slave + 1, mbps);
+  }
+}
+
+// Start listening for the RSSI of slave frames; call after the channel is set
+void startLinkMonitor() {
+  wifi_promiscuous_filter_t filter;
+  filter.filter_mask = WIFI_PROMIS_FILTER_MASK_MGMT;
+  esp_wifi_set_promiscuous_filter(&filter);
+  esp_wifi_set_promiscuous_rx_cb(OnPromiscuousRx);
+  esp_wifi_set_promiscuous(true);
+}
+
+// Set the PHY rate of the next frames to `to` (a slave or the broadcast
+// address) to ladder index `index`. With a single interface-wide rate the
+// switch waits until every frame already handed to ESP-NOW has called back,
+// so it never re-rates a queued frame; until then frames keep the current rate.
+void applyRate(const uint8_t *to, uint8_t index) {
+#if RATE_PER_PEER
+  int slot = memcmp(to, broadcastMAC, 6) == 0 ? SLAVE_COUNT : slaveIndex(to);
+  if (slot < 0 || index == appliedRates[slot]) {
+    return;
+  }
+  esp_now_rate_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.phymode = rateLadderMbps[index] <= 2 ? WIFI_PHY_MODE_11B : WIFI_PHY_MODE_11G;  // 1 and 2 Mbps are DSSS
+  config.rate = ratePhy[index];
+  if (esp_now_set_peer_rate_config(to, &config) == ESP_OK) {
+    appliedRates[slot] = index;
+  }
+#else
+  portENTER_CRITICAL(&stateMux);
+  bool idle = sendsInFlight == 0;
+  portEXIT_CRITICAL(&stateMux);
+  if (index != appliedRate && idle && esp_wifi_config_espnow_rate(WIFI_IF_STA, ratePhy[index]) == ESP_OK) {
+    appliedRate = index;
+  }
+#endif
+}
+
+// Send a frame to one slave, sealed with its key, at the rate its link
+// currently supports; a slave last heard through a relay gets it wrapped,
+// through that relay
+esp_err_t sendToSlave(int slave, const uint8_t *data, size_t len) {
+  portENTER_CRITICAL(&stateMux);
+  int via = slavePaths[slave].via;
+  int next = via >= 0 ? via : slave;
+  uint8_t index = slaveRates[next].index;
+  portEXIT_CRITICAL(&stateMux);
+  applyRate(slaveMACs[next], index);
+  if (via < 0) {
+    return sendSealed(slaveMACs[slave], slave, data, len);
+  }
+
+  uint8_t frame[RELAY_MAX_FRAME];
+  if (sizeof(relay_header) + len + AUTH_TRAILER_SIZE > sizeof(frame)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  relay_header relay;
+  relay.header.msgType = MSG_RELAY;
+  relay.header.qos = ((const frame_header *)data)->qos;
+  relay.header.seq = ((const frame_header *)data)->seq;
+  relay.hops = 0;
+  memcpy(relay.origin, ownMAC, 6);
+  memcpy(relay.dest, slaveMACs[slave], 6);
+  memcpy(frame, &relay, sizeof(relay));
+  memcpy(frame + sizeof(relay), data, len);
+  return sendCounted(slaveMACs[via], frame, sizeof(relay) + sealFrame(frame + sizeof(relay), len, slave));
+}
+
+// Light mode as a number: 0 off, 1 dim, 2 on
+uint8_t lightLevel(const char *status) {
+  return strcmp(status, "ON") == 0 ? 2 : (strcmp(status, "DIM") == 0 ? 1 : 0);
+}
+
+// One reading of a channel, taken at `time` in our timebase: into its
+// statistics and, if there is an uplink to export to, onto the export
+// queue. Call with stateMux held.
+void recordReading(int channel, float value, uint32_t time, unsigned long now) {
+  statsAdd(channelStats[channel], value, now);
+  if (export_mqtt_host[0] != '\0' || export_udp_host[0] != '\0') {
+    exportPush(exportQueue, channel, value, time, now);
+  }
+}
+
+// Feed a slave's link state to its online channel when it changed. Call
+// with stateMux held.
+void recordLinkStats(int slave, unsigned long now) {
+  channel_stats &stats = channelStats[CH_SLAVE1_ONLINE + slave];
+  int online = slaveLiveness[slave].state == PEER_ONLINE;
+  if (stats.state != online) {
+    recordReading(CH_SLAVE1_ONLINE + slave, online, now, now);
+  }
+}
+
+// When a slave took its readings: its own timestamp, or when we received
+// them if it is not synced
+uint32_t readingTime(uint32_t sampleTime, uint16_t sampleTimeError, unsigned long now) {
+  return sampleTimeError == SYNC_UNSYNCED ? now : sampleTime;
+}
+
+// Feed a slave's latest frame to its channels' statistics and the export
+// queue. Call with stateMux held.
+void recordStats(int slave, unsigned long now) {
+  recordLinkStats(slave, now);
+  if (slave == 0) {
+    uint32_t time = readingTime(receivedDataSlave1.sampleTime, receivedDataSlave1.sampleTimeError, now);
+    recordReading(CH_LDR, receivedDataSlave1.ldrValue, time, now);
+    recordReading(CH_LIGHT, lightLevel(receivedDataSlave1.lightStatus), time, now);
+  } else if (slave == 1) {
+    uint32_t time = readingTime(receivedDataSlave2.sampleTime, receivedDataSlave2.sampleTimeError, now);
+    recordReading(CH_TEMPERATURE, receivedDataSlave2.temperature, time, now);
+    recordReading(CH_FAN, strcmp(receivedDataSlave2.fanStatus, "ON") == 0, time, now);
+  } else {
+    uint32_t time = readingTime(receivedDataSlave3.sampleTime, receivedDataSlave3.sampleTimeError, now);
+    recordReading(CH_SOIL, receivedDataSlave3.soilMoistureValue, time, now);
+    recordReading(CH_SOIL_DRY, receivedDataSlave3.soilMoistureValue > SOIL_DRY_THRESHOLD, time, now);
+    recordReading(CH_WATER_LEVEL, receivedDataSlave3.waterLevelValue, time, now);
+    recordReading(CH_REFILLING, strcmp(receivedDataSlave3.refillStatus, "Refilling") == 0, time, now);
+    recordReading(CH_WATERING, strcmp(receivedDataSlave3.pumpStatus, "Watering") == 0, time, now);
+    recordReading(CH_COOLDOWN, receivedDataSlave3.remainingCooldown / 1000, time, now);
+  }
+}
+
+// Set up the statistics; on/off channels also track time in each state
+void initStats(unsigned long now) {
+  for (int c = 0; c < CH_COUNT; c++) {
+    bool hasStates = c != CH_LDR && c != CH_TEMPERATURE && c != CH_SOIL && c != CH_WATER_LEVEL && c != CH_COOLDOWN;
+    statsInit(channelStats[c], hasStates, now);
+  }
+}
+
+// Note how a slave's frame reached us and what its sequence number says
+// about frames lost or repeated on the way. Call with stateMux held.
+void trackPath(int slave, int via, uint8_t hops, uint16_t seq) {
+  slave_path &path = slavePaths[slave];
+  path.via = via;
+  path.hops = hops;
+  if (via >= 0) {
+    path.relayedFrames++;
+  }
+  if (!path.seqSeen) {
+    path.seqSeen = true;
+    path.lastSeq = seq;
+    return;
+  }
+  uint16_t ahead = seq - path.lastSeq;
+  if (ahead == 0 || ahead > (uint16_t)(0 - SEQ_RESTART_WINDOW)) {
+    path.seqDuplicates++;  // Same frame again, or one overtaken on another path
+    return;
+  }
+  if (ahead >= 0x8000) {
+    path.restarts++;
+  } else {
+    path.seqGaps += ahead - 1;
+  }
+  path.lastSeq = seq;
+}
+
+// Put an alarm frame on the high-priority receive queue; when the queue is
+// full the oldest alarm gives way
+void queueAlarm(int slave, const uint8_t *incomingData, unsigned long now) {
+  portENTER_CRITICAL(&stateMux);
+  if (alarmRxCount == ALARM_RX_QUEUE_SIZE) {
+    alarmRxHead = (alarmRxHead + 1) % ALARM_RX_QUEUE_SIZE;
+    alarmRxCount--;
+    alarmRxDrops++;
+  }
+  alarm_event &event = alarmRxQueue[(alarmRxHead + alarmRxCount) % ALARM_RX_QUEUE_SIZE];
+  memcpy(&event.frame, incomingData, sizeof(event.frame));
+  event.slave = slave;
+  event.receivedAt = now;
+  alarmRxCount++;
+  portEXIT_CRITICAL(&stateMux);
+}
+
+// Record a received frame for loop() to write out
+void captureFrame(const uint8_t *mac, const uint8_t *incomingData, int len, unsigned long now) {
+  int8_t rssi = memcmp(mac, lastRxMAC, 6) == 0 ? lastRxRssi : 0;
+  portENTER_CRITICAL(&stateMux);
+  captureWrite(captureRing, now, mac, rssi, incomingData, len);
+  portEXIT_CRITICAL(&stateMux);
+}
+
+// Unified ESP-NOW Receive Callback
+void OnDataRecv(const uint8_t *mac, const uint8_t *incomingData, int len) {
+  unsigned long now = millis();
+  if (captureSink != CAPTURE_OFF) {
+    captureFrame(mac, incomingData, len, now);
+  }
+
+  // Nothing in a frame is looked at before its trailer checks out
+  int keyId;
+  len = openFrame(mac, incomingData, len, &keyId);
+  if (len < 0) {
+    return;
+  }
+  // Only a frame under the pair key is our partner's word; unchecked, its address is taken for it
+  bool fromPartner = keyId == AUTH_KEY_PAIR || (!FRAME_AUTH && partnered && memcmp(mac, partnerMAC, 6) == 0);
+
+  // Our partner's beacons are its heartbeat; its copies for the slaves, and
+  // our own passed on by a relay, end here
+  if (len == sizeof(sync_beacon) && incomingData[0] == MSG_SYNC_BEACON) {
+    sync_beacon beacon;
+    memcpy(&beacon, incomingData, sizeof(beacon));
+    if (fromPartner && memcmp(beacon.master, partnerMAC, 6) == 0) {
+      portENTER_CRITICAL(&stateMux);
+      failoverOnPartnerBeacon(failover, beacon.term, now);
+      portEXIT_CRITICAL(&stateMux);
+    }
+    return;
+  }
+
+  // A slave looking for us on this channel: loop() answers with a beacon.
+  // Our partner moving channel: loop() moves along. Our own notices, passed
+  // on by a relay, end here too.
+  if (len == sizeof(channel_notice) && incomingData[0] == MSG_CHANNEL) {
+    channel_notice notice;
+    memcpy(&notice, incomingData, sizeof(notice));
+    if (notice.op == CHANNEL_OP_PROBE) {
+      probeAnswerDue = true;
+    } else if (fromPartner) {
+      partnerMoveAt = now + notice.switchIn;
+      partnerMoveChannel = notice.channel;
+    }
+    return;
+  }
+
+  // Firmware update progress, possibly from a slave we have no status frames from
+  if (len == sizeof(ota_ack) && incomingData[0] == MSG_OTA) {
+    ota_ack ack;
+    memcpy(&ack, incomingData, sizeof(ack));
+    if (ack.op == OTA_OP_ACK) {
+      portENTER_CRITICAL(&stateMux);
+      otaSenderOnAck(otaSender, mac, ack.session, ack.state, ack.base, ack.bitmap, now);
+      portEXIT_CRITICAL(&stateMux);
+    }
+    return;
+  }
+
+  // A relayed frame is handled as if its origin had sent it to us directly
+  int via = -1;
+  uint8_t hops = 0;
+  relay_header relay;
+  if (len > (int)sizeof(relay_header) && incomingData[0] == MSG_RELAY) {
+    memcpy(&relay, incomingData, sizeof(relay));
+    via = slaveIndex(mac);  // Actions can only go back through a relay we have as a peer
+    hops = relay.hops;
+    mac = relay.origin;
+    incomingData += sizeof(relay);
+    len -= sizeof(relay);
+  }
+  int slave = slaveIndex(mac);
+  if (slave >= 0 && len >= (int)sizeof(frame_header)) {
+    frame_header header;
+    memcpy(&header, incomingData, sizeof(header));
+    portENTER_CRITICAL(&stateMux);
+    trackPath(slave, via, hops, header.seq);
+    portEXIT_CRITICAL(&stateMux);
+  }
+
+  // Alarms go straight to their own queue, ahead of the logging below
+  if (len == sizeof(alarm_frame) && incomingData[0] == MSG_ALARM) {
+    if (slave >= 0) {
+      queueAlarm(slave, incomingData, now);
+    }
+    return;
+  }
+
+  Serial.print("Data received from: ");
+  for (int i = 0; i < 6; i++) {
+    Serial.printf("%02X", mac[i]);
+    if (i < 5) Serial.print(":");
+  }
+  Serial.println();
+
+  // Identify the sender based on the MAC address
+  if (memcmp(mac, slave1MAC, 6) == 0 && len == sizeof(receivedDataSlave1)) {
+    // Data from Slave 1 (LDR slave)
+    portENTER_CRITICAL(&stateMux);
+    memcpy(&receivedDataSlave1, incomingData, sizeof(receivedDataSlave1));
+    livenessOnFrame(slaveLiveness[0], now);
+    recordSampleTiming(slaveTiming[0], receivedDataSlave1.sampleTime, receivedDataSlave1.sampleTimeError, now);
+    recordStats(0, now);
+    stateGeneration++;
+    portEXIT_CRITICAL(&stateMux);
+    Serial.printf("LDR Value: %d, Light Status: %s\n", receivedDataSlave1.ldrValue, receivedDataSlave1.lightStatus);
+  } else if (memcmp(mac, slave2MAC, 6) == 0 && len == sizeof(receivedDataSlave2)) {
+    // Data from 2slave (DHT slave)
+    portENTER_CRITICAL(&stateMux);
+    memcpy(&receivedDataSlave2, incomingData, sizeof(receivedDataSlave2));
+    livenessOnFrame(slaveLiveness[1], now);
+    recordSampleTiming(slaveTiming[1], receivedDataSlave2.sampleTime, receivedDataSlave2.sampleTimeError, now);
+    recordStats(1, now);
+    stateGeneration++;
+    portEXIT_CRITICAL(&stateMux);
+    Serial.printf("Temperature: %.2f, Fan Status: %s\n", receivedDataSlave2.temperature, receivedDataSlave2.fanStatus);
+  } else if (memcmp(mac, slave3MAC, 6) == 0 && len == sizeof(receivedDataSlave3)) {
+    // Data from Slave 3 (Soil and Watering)
+    portENTER_CRITICAL(&stateMux);
+    memcpy(&receivedDataSlave3, incomingData, sizeof(receivedDataSlave3));
+    livenessOnFrame(slaveLiveness[2], now);
+    recordSampleTiming(slaveTiming[2], receivedDataSlave3.sampleTime, receivedDataSlave3.sampleTimeError, now);
+    recordStats(2, now);
+    stateGeneration++;
+    portEXIT_CRITICAL(&stateMux);
+
+    unsigned long remainingCooldown = receivedDataSlave3.remainingCooldown; // Get remaining cooldown
+
+    // Update the display format
+    Serial.printf("Water Level: %d\n", receivedDataSlave3.waterLevelValue);
+    Serial.printf("Refill Status: %s\n", receivedDataSlave3.refillStatus);
+    Serial.printf("Soil Status: %s\n", receivedDataSlave3.soilStatus);
+    Serial.printf("Pump Status: %s\n", receivedDataSlave3.pumpStatus);
+
+    // Only display the remaining cooldown if it's not 0 (i.e., soil is dry and recently watered)
+    if (remainingCooldown > 0) {
+      Serial.printf("Remaining Cooldown: %lu ms\n", remainingCooldown);  // Display remaining cooldown
+    } else {
+      Serial.println("No cooldown, soil is moist.");
+    }
+
+  } else {
+    Serial.println("Unknown MAC address or frame");
+  }
+}
+
+// Re-evaluate every slave's liveness; a state change invalidates the caches
+void updatePeerLiveness() {
+  unsigned long now = millis();
+  portENTER_CRITICAL(&stateMux);
+  bool changed = false;
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    if (livenessEvaluate(slaveLiveness[i], now)) {
+      recordLinkStats(i, now);
+      changed = true;
+    }
+  }
+  if (changed) {
+    stateGeneration++;
+  }
+  portEXIT_CRITICAL(&stateMux);
+}
+
+// Copy the latest frames, link states and alarms if the state generation moved past
+// `seen`; returns false (copying nothing) if it did not
+bool snapshotState(uint32_t seen, uint32_t &generation, struct_message1 &slave1,
+                   struct_message2 &slave2, struct_message3 &slave3, PeerState link[SLAVE_COUNT],
+                   uint8_t &alarms) {
+  portENTER_CRITICAL(&stateMux);
+  generation = stateGeneration;
+  bool stale = (generation != seen);
+  if (stale) {
+    memcpy(&slave1, &receivedDataSlave1, sizeof(receivedDataSlave1));
+    memcpy(&slave2, &receivedDataSlave2, sizeof(receivedDataSlave2));
+    memcpy(&slave3, &receivedDataSlave3, sizeof(receivedDataSlave3));
+    for (int i = 0; i < SLAVE_COUNT; i++) {
+      link[i] = slaveLiveness[i].state;
+    }
+    alarms = activeAlarms;
+  }
+  portEXIT_CRITICAL(&stateMux);
+  return stale;
+}
+
+// Rebuild dashboardView if a frame arrived since it was last built.
+// Runs on the web server task only; the snapshot is taken under stateMux.
+void refreshDashboardView() {
+  updatePeerLiveness();
+
+  uint32_t generation;
+  if (!snapshotState(dashboardViewGeneration, generation, dashboardView.slave1,
+                     dashboardView.slave2, dashboardView.slave3, dashboardView.link,
+                     dashboardView.alarms)) {
+    return;
+  }
+
+  dashboardView.soilDry = dashboardView.slave3.soilMoistureValue > SOIL_DRY_THRESHOLD;
+  dashboardView.cooldownSeconds = 0;
+  if (!dashboardView.soilDry) {
+    dashboardView.watering = WATERING_NOT_NEEDED;
+  } else if (strcmp(dashboardView.slave3.pumpStatus, "Watering") == 0) {
+    dashboardView.watering = WATERING_ACTIVE;
+  } else if (strcmp(dashboardView.slave3.pumpStatus, "Held") == 0) {
+    dashboardView.watering = WATERING_HELD;
+  } else {
+    dashboardView.watering = WATERING_COOLDOWN;
+    dashboardView.cooldownSeconds = dashboardView.slave3.remainingCooldown / 1000;
+  }
+  dashboardViewGeneration = generation;
+}
+
+// Render the /status text from dashboardView
+void renderStatus(text_writer &out) {
+  const dashboard_view &v = dashboardView;
+  const char *waterForPlant;
+  switch (v.watering) {
+    case WATERING_ACTIVE:
+      waterForPlant = "Soil is dry. Watering the plant...";
+      break;
+    case WATERING_COOLDOWN:
+      waterForPlant = "Soil is dry, but watering is on hold until cooldown interval expires.";
+      break;
+    case WATERING_HELD:
+      waterForPlant = "Soil is dry, but watering is held by an automation rule.";
+      break;
+    default:
+      waterForPlant = "Soil is moist. No watering needed.";
+      break;
+  }
+
+  writeText(out, "Slave1_Light_Status: %s, Slave2_Temperature: %.2f, Slave2_Fan_Status: %s, "
+                 "Slave3_Water_Level: %d, Slave3_Water_Container: %s, Slave3_Soil_Status: %s, "
+                 "Slave3_Water_For_Plant: %s",
+            v.slave1.lightStatus, v.slave2.temperature, v.slave2.fanStatus,
+            v.slave3.waterLevelValue, v.slave3.refillStatus, v.soilDry ? "Dry" : "Moist",
+            waterForPlant);
+
+  if (v.watering == WATERING_COOLDOWN) {
+    writeText(out, ", Remaining cooldown: %lu seconds", v.cooldownSeconds);  // Append cooldown message if applicable
+  }
+
+  // Link state of each slave, so clients can tell live values from stale ones
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    writeText(out, ", Slave%d_Link: %s", i + 1, peerStateName(v.link[i]));
+  }
+
+  // Active alarms last, so existing clients keep their field positions
+  writeText(out, ", Alarms:");
+  for (int a = 0; a < ALARM_COUNT; a++) {
+    if (v.alarms & (1 << a)) {
+      writeText(out, " %s", alarmNames[a]);
+    }
+  }
+  if (!v.alarms) {
+    writeText(out, " none");
+  }
+}
+
+// Render the text substituted for %WATER_FOR_PLANT% in the HTML page; the
+// rest of PAGEINDEX is streamed from flash around it
+void renderPage(text_writer &out) {
+  switch (dashboardView.watering) {
+    case WATERING_ACTIVE:
+      writeText(out, "Watering");
+      break;
+    case WATERING_COOLDOWN:
+      writeText(out, "Waiting for cooldown");
+      break;
+    case WATERING_HELD:
+      writeText(out, "Held by rule");
+      break;
+    default:
+      writeText(out, "No watering needed");
+      break;
+  }
+}
+
+// Append the counters of one response cache to the /metrics text
+void writeCacheMetrics(text_writer &out, const char *name, const response_cache &cache) {
+  uint32_t requests = cache.hits + cache.rebuilds;
+  writeText(out,
+            "%s_cache_hits %u\n%s_cache_rebuilds %u\n%s_cache_hit_rate %.3f\n"
+            "%s_pool_exhausted %u\n%s_truncations %u\n"
+            "%s_rebuild_us_last %lu\n%s_rebuild_us_max %lu\n%s_rebuild_us_avg %lu\n",
+            name, (unsigned)cache.hits, name, (unsigned)cache.rebuilds,
+            name, requests ? (float)cache.hits / requests : 0.0f,
+            name, (unsigned)cache.poolExhausted, name, (unsigned)cache.truncations,
+            name, cache.lastRebuildMicros, name, cache.maxRebuildMicros,
+            name, cache.rebuilds ? (unsigned long)(cache.totalRebuildMicros / cache.rebuilds) : 0UL);
+}
+
+// Append the liveness estimator of every slave to the /metrics text
+void writePeerMetrics(text_writer &out) {
+  peer_liveness peers[SLAVE_COUNT];
+  portENTER_CRITICAL(&stateMux);
+  memcpy(peers, slaveLiveness, sizeof(peers));
+  portEXIT_CRITICAL(&stateMux);
+
+  unsigned long now = millis();
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    const peer_liveness &p = peers[i];
+    writeText(out,
+              "slave%d_state %s\nslave%d_frames %u\nslave%d_last_seen_ms %lu\n"
+              "slave%d_interval_ms_mean %.1f\nslave%d_interval_ms_dev %.1f\n"
+              "slave%d_timeout_ms %lu\nslave%d_offline_events %u\n",
+              i + 1, peerStateName(p.state), i + 1, (unsigned)p.frames,
+              i + 1, p.frames ? now - p.lastSeen : 0UL,
+              i + 1, p.meanInterval, i + 1, p.devInterval,
+              i + 1, livenessTimeout(p), i + 1, (unsigned)p.offlineEvents);
+  }
+}
+
+// Append how far each slave's sample timestamps are from our receive time
+void writeTimingMetrics(text_writer &out) {
+  sample_timing timings[SLAVE_COUNT];
+  portENTER_CRITICAL(&stateMux);
+  memcpy(timings, slaveTiming, sizeof(timings));
+  portEXIT_CRITICAL(&stateMux);
+
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    const sample_timing &t = timings[i];
+    writeText(out,
+              "slave%d_sample_time %lu\nslave%d_sample_error_ms %u\nslave%d_delivery_ms %ld\n"
+              "slave%d_delivery_ms_min %ld\nslave%d_delivery_ms_max %ld\n"
+              "slave%d_synced_frames %u\nslave%d_unsynced_frames %u\n",
+              i + 1, (unsigned long)t.sampleTime, i + 1, (unsigned)t.errorBound, i + 1, t.deliveryMs,
+              i + 1, t.minDeliveryMs, i + 1, t.maxDeliveryMs,
+              i + 1, (unsigned)t.synced, i + 1, (unsigned)t.unsynced);
+  }
+}
+
+// Append the link quality and PHY rate chosen for every slave
+void writeRateMetrics(text_writer &out) {
+  rate_control rates[SLAVE_COUNT];
+  portENTER_CRITICAL(&stateMux);
+  memcpy(rates, slaveRates, sizeof(rates));
+  portEXIT_CRITICAL(&stateMux);
+
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    const rate_control &r = rates[i];
+    writeText(out,
+              "slave%d_rssi %.1f\nslave%d_rate_mbps %u\nslave%d_delivery %.3f\nslave%d_rate_changes %u\n",
+              i + 1, r.hasRssi ? r.rssi : 0.0f, i + 1, (unsigned)rateMbps(r),
+              i + 1, r.delivery, i + 1, (unsigned)r.changes);
+  }
+}
+
+// Append each slave's path to us and the frames lost or repeated on it
+void writeRelayMetrics(text_writer &out) {
+  slave_path paths[SLAVE_COUNT];
+  portENTER_CRITICAL(&stateMux);
+  memcpy(paths, slavePaths, sizeof(paths));
+  portEXIT_CRITICAL(&stateMux);
+
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    const slave_path &p = paths[i];
+    writeText(out,
+              "slave%d_hops %u\nslave%d_via %d\nslave%d_relayed_frames %u\n"
+              "slave%d_seq_gaps %u\nslave%d_seq_duplicates %u\nslave%d_seq_restarts %u\n",
+              i + 1, (unsigned)p.hops, i + 1, p.via + 1, i + 1, (unsigned)p.relayedFrames,
+              i + 1, (unsigned)p.seqGaps, i + 1, (unsigned)p.seqDuplicates, i + 1, (unsigned)p.restarts);
+  }
+}
+
+// Append alarm delivery and latency
+void writeAlarmMetrics(text_writer &out) {
+  portENTER_CRITICAL(&stateMux);
+  uint32_t drops = alarmRxDrops;
+  uint8_t alarms = activeAlarms;
+  portEXIT_CRITICAL(&stateMux);
+
+  const alarm_stats &a = alarmStats;
+  writeText(out,
+            "alarms_received %u\nalarm_duplicates %u\nalarm_retries %u\nalarm_rx_drops %u\n"
+            "alarm_latency_ms_last %ld\nalarm_latency_ms_max %ld\nalarm_latency_ms_avg %ld\n"
+            "alarm_unsynced %u\nalarm_dispatch_ms_max %lu\n",
+            (unsigned)a.received, (unsigned)a.duplicates, (unsigned)a.retries, (unsigned)drops,
+            a.latencyMs, a.maxLatencyMs, a.timed ? (long)(a.totalLatencyMs / a.timed) : 0L,
+            (unsigned)a.unsynced, a.maxDispatchMs);
+  for (int i = 0; i < ALARM_COUNT; i++) {
+    writeText(out, "alarm_%s %d\n", alarmNames[i], (alarms >> i) & 1);
+  }
+}
+
+// Append the progress of the current or last firmware update
+void writeOtaMetrics(text_writer &out) {
+  portENTER_CRITICAL(&stateMux);
+  uint8_t phase = otaSender.phase;
+  uint8_t receivers = otaSender.peerCount;
+  int updated = otaSenderUpdated(otaSender);
+  uint16_t chunks = otaSender.chunkCount;
+  uint32_t sent = otaSender.chunksSent;
+  uint32_t resent = otaSender.chunksResent;
+  uint16_t low = otaSender.windowBase;
+  portEXIT_CRITICAL(&stateMux);
+  writeText(out,
+            "ota_phase %s\nota_receivers %u\nota_updated %d\nota_chunks %u\nota_chunks_acked %u\n"
+            "ota_chunks_sent %u\nota_chunks_resent %u\nota_seconds_last %lu\n",
+            otaPhaseNames[phase], (unsigned)receivers, updated, (unsigned)chunks, (unsigned)low,
+            (unsigned)sent, (unsigned)resent, otaSeconds);
+}
+
+// Append the export queue and what the uplinks carried
+void writeExportMetrics(text_writer &out) {
+  portENTER_CRITICAL(&stateMux);
+  uint16_t depth = exportQueue.count;
+  uint16_t maxDepth = exportQueue.maxDepth;
+  uint32_t queued = exportQueue.queued;
+  uint32_t dropped = exportQueue.dropped;
+  portEXIT_CRITICAL(&stateMux);
+  writeText(out,
+            "export_queue_depth %u\nexport_queue_depth_max %u\nexport_queue_size %u\nexport_samples_queued %u\n"
+            "export_samples_dropped %u\nexport_samples_sent %u\nexport_samples_per_min %u\nexport_batches_sent %u\n"
+            "export_bytes_sent %u\nexport_send_errors %u\nexport_mqtt %s\nexport_mqtt_connects %u\n",
+            (unsigned)depth, (unsigned)maxDepth, (unsigned)EXPORT_QUEUE_SIZE, (unsigned)queued,
+            (unsigned)dropped, (unsigned)exportSamplesSent, (unsigned)exportSamplesPerMinute, (unsigned)exportBatches,
+            (unsigned)exportBytesSent, (unsigned)exportSendErrors,
+            export_mqtt_host[0] ? exportMqttStateNames[exportMqttState] : "off", (unsigned)exportMqttConnects);
+}
+
+// Append the channel we are on and how we got there
+void writeChannelMetrics(text_writer &out) {
+  writeText(out, "wifi_channel %u\nchannel_moves_announced %u\nchannel_moves_unannounced %u\nchannel_probes_answered %u\n",
+            (unsigned)channelMigration.channel, (unsigned)channelMigration.announced,
+            (unsigned)channelMigration.unannounced, (unsigned)probesAnswered);
+}
+
+// Append the state of the frame capture
+void writeCaptureMetrics(text_writer &out) {
+  portENTER_CRITICAL(&stateMux);
+  uint32_t records = captureRing.records;
+  uint32_t dropped = captureRing.dropped;
+  portEXIT_CRITICAL(&stateMux);
+  writeText(out, "capture_sink %s\ncapture_records %u\ncapture_dropped %u\ncapture_bytes %u\n",
+            captureSinkNames[captureSink], (unsigned)records, (unsigned)dropped, (unsigned)captureBytesWritten);
+}
+
+// Append rule engine cost and the value of every target
+void writeRuleMetrics(text_writer &out) {
+  writeText(out,
+            "rules_count %u\nrules_passes %u\nrules_evaluated_last %u\n"
+            "rules_eval_us_last %lu\nrules_eval_us_max %lu\nrules_eval_us_avg %lu\n"
+            "actions_sent %u\naction_errors %u\n",
+            (unsigned)rules.ruleCount, (unsigned)rulesPasses, (unsigned)rules.lastEvaluated,
+            rulesLastMicros, rulesMaxMicros,
+            rulesPasses ? (unsigned long)(rulesTotalMicros / rulesPasses) : 0UL,
+            (unsigned)actionsSent, (unsigned)actionErrors);
+  for (int t = 0; t < TARGET_COUNT; t++) {
+    writeText(out, "target_%s %s\n", ruleTargetNames[t], ruleValueNames[rules.targets[t]]);
+  }
+}
+
+// Append our part in the hot-standby pair
+void writeFailoverMetrics(text_writer &out) {
+  portENTER_CRITICAL(&stateMux);
+  failover_state state = failover;
+  portEXIT_CRITICAL(&stateMux);
+  writeText(out,
+            "failover_role %s\nfailover_term %u\nfailover_takeovers %u\nfailover_step_downs %u\n"
+            "failover_last_silence_ms %lu\nfailover_partner_silence_ms %lu\nframes_overheard %u\n",
+            !partnered ? "single" : (state.role == FAILOVER_ACTIVE ? "active" : "standby"), (unsigned)state.term,
+            (unsigned)state.takeovers, (unsigned)state.stepDowns, state.lastSilence,
+            partnered ? millis() - state.lastPartnerBeacon : 0UL, (unsigned)framesOverheard);
+}
+
+// Append how the frames we took in fared against their trailers
+void writeAuthMetrics(text_writer &out) {
+  writeText(out,
+            "auth_enabled %u\nauth_frames_accepted %u\nauth_frames_rejected %u\nauth_frames_replayed %u\n"
+            "auth_unknown_senders %u\nauth_epoch %u\n",
+            (unsigned)FRAME_AUTH, (unsigned)authAccepted, (unsigned)authRejected, (unsigned)authReplayed,
+            (unsigned)authReplay.unknown, (unsigned)(authCounter >> 16));
+}
+
+// Append what admission control let in and shed, and what the web holds now
+void writeWebMetrics(text_writer &out) {
+  const uint32_t *verdicts = webAdmission.verdicts;
+  writeText(out,
+            "web_admitted %u\nweb_shed_rate %u\nweb_shed_busy %u\nweb_shed_cpu %u\nweb_shed_memory %u\n"
+            "web_in_flight %u\nweb_in_flight_max %u\nweb_streams %u\nweb_upload_active %u\nweb_heap_held %u\n"
+            "web_cpu_ms %llu\n",
+            (unsigned)verdicts[WEB_ADMIT], (unsigned)verdicts[WEB_SHED_RATE], (unsigned)verdicts[WEB_SHED_BUSY],
+            (unsigned)verdicts[WEB_SHED_CPU], (unsigned)verdicts[WEB_SHED_MEMORY], (unsigned)webAdmission.inFlight,
+            (unsigned)webAdmission.maxInFlight, (unsigned)webAdmission.streams, webAdmission.upload != nullptr ? 1U : 0U,
+            (unsigned)webAdmission.heapHeld,
+            (unsigned long long)(webAdmission.cpuMicros / 1000));
+}
+
+// Render the /metrics text: cache effectiveness, peer liveness, sample timing, link rates, relay paths, alarms, firmware updates, channel, export, capture, failover, frame authentication, web admission and heap health
+void renderMetrics(text_writer &out) {
+  writeText(out, "state_generation %lu\n", (unsigned long)stateGeneration);
+  writeCacheMetrics(out, "status", statusCache);
+  writeCacheMetrics(out, "page", pageCache);
+  writePeerMetrics(out);
+  writeTimingMetrics(out);
+  writeRateMetrics(out);
+  writeRelayMetrics(out);
+  writeAlarmMetrics(out);
+  writeOtaMetrics(out);
+  writeChannelMetrics(out);
+  writeExportMetrics(out);
+  writeCaptureMetrics(out);
+  writeRuleMetrics(out);
+  writeFailoverMetrics(out);
+  writeAuthMetrics(out);
+  writeWebMetrics(out);
+  writeText(out, "heap_free %u\nheap_min_free %u\nheap_largest_block %u\nheap_largest_block_min %u\n",
+            (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMinFreeHeap(),
+            (unsigned)ESP.getMaxAllocHeap(), (unsigned)heapLargestBlockMin);
+}
+
+// Append one channel's figures for a window; `prefix` tells the windows apart
+void writeChannelStats(text_writer &out, const char *prefix, int channel, const channel_stats &stats,
+                       const stats_window &window, unsigned long now, bool current) {
+  const char *name = ruleChannelNames[channel];
+  writeText(out, "%s%s_count %u\n", prefix, name, (unsigned)window.count);
+  if (!stats.hasStates) {
+    if (window.count == 0) {
+      return;
+    }
+    writeText(out, "%s%s_mean %.2f\n%s%s_stddev %.2f\n%s%s_min %.2f\n%s%s_max %.2f\n",
+              prefix, name, window.mean, prefix, name, sqrtf(statsVariance(window)),
+              prefix, name, window.min, prefix, name, window.max);
+    for (int q = 0; q < STATS_QUANTILES; q++) {
+      writeText(out, "%s%s_%s %.2f\n", prefix, name, statsQuantileNames[q],
+                p2Value(window.quantiles[q], statsQuantiles[q]));
+    }
+    return;
+  }
+
+  // Share of the window spent in each state
+  // An on/off channel may hold one state for a whole window without a reading
+  unsigned long length = (current ? now : stats.current.start) - window.start;
+  if (length == 0 || stats.state < 0) {
+    return;
+  }
+  if (channel == CH_LIGHT) {
+    const char *levels[STATS_STATES] = {"off", "dim", "on"};
+    for (int state = 0; state < STATS_STATES; state++) {
+      uint32_t ms = current ? statsStateMs(stats, state, now) : window.stateMs[state];
+      writeText(out, "%s%s_%s_pct %.1f\n", prefix, name, levels[state], 100.0f * ms / length);
+    }
+  } else {
+    uint32_t ms = current ? statsStateMs(stats, 1, now) : window.stateMs[1];
+    writeText(out, "%s%s_on_pct %.1f\n", prefix, name, 100.0f * ms / length);
+  }
+}
+
+// Render the /stats text: every channel over the current window and, once
+// one has ended, the last complete window (last_ prefix). Each channel is
+// copied under stateMux on its own, so the lock is held only briefly.
+void renderStats(text_writer &out) {
+  unsigned long now = millis();
+  channel_stats stats;
+  portENTER_CRITICAL(&stateMux);
+  statsTick(channelStats[0], now);
+  unsigned long start = channelStats[0].current.start;
+  uint32_t windows = channelStats[0].windows;
+  portEXIT_CRITICAL(&stateMux);
+  writeText(out, "window_seconds %lu\nwindow_elapsed_seconds %lu\nwindows_completed %u\n",
+            (unsigned long)(STATS_WINDOW_MS / 1000), (now - start) / 1000, (unsigned)windows);
+
+  for (int pass = 0; pass < (windows > 0 ? 2 : 1); pass++) {
+    for (int c = 0; c < CH_COUNT; c++) {
+      portENTER_CRITICAL(&stateMux);
+      statsTick(channelStats[c], now);
+      memcpy(&stats, &channelStats[c], sizeof(stats));
+      portEXIT_CRITICAL(&stateMux);
+      writeChannelStats(out, pass == 0 ? "" : "last_", c, stats, pass == 0 ? stats.current : stats.previous,
+                        now, pass == 0);
+    }
+  }
+}
+
+// Answer a shed request: 429 for a client over its rate, 503 otherwise
+void shedRequest(AsyncWebServerRequest *request, uint8_t verdict, uint32_t retryAfter) {
+  char seconds[12];
+  snprintf(seconds, sizeof(seconds), "%u", (unsigned)retryAfter);
+  AsyncWebServerResponse *response = verdict == WEB_SHED_RATE
+    ? request->beginResponse(429, "text/plain", "Too many requests\n")
+    : request->beginResponse(503, "text/plain", "Busy, try again\n");
+  response->addHeader("Retry-After", seconds);
+  request->send(response);
+}
+
+typedef void (*AdmittedHandler)(AsyncWebServerRequest *request, web_ticket *ticket);
+
+// A route behind admission control (see web_admission.h). Shed requests are
+// answered before any work; an admitted one has its handler timed against
+// the web's CPU share and holds a ticket, with its heap and any cached
+// response, until the client goes away. The handler must not replace the
+// disconnect handler.
+ArRequestHandlerFunction admitted(size_t responseBytes, AdmittedHandler handler) {
+  return [responseBytes, handler](AsyncWebServerRequest *request) {
+    web_ticket *ticket = nullptr;
+    for (web_ticket &free : webTickets) {
+      if (!free.used) {
+        ticket = &free;
+        break;
+      }
+    }
+    uint32_t heap = webRequestHeap(responseBytes);
+    uint32_t retryAfter = 1;
+    webSetStreams(webAdmission, events.count());
+    uint8_t verdict = ticket == nullptr ? WEB_SHED_BUSY
+                                        : webAdmit(webAdmission, (uint32_t)request->client()->remoteIP(), heap,
+                                                   ESP.getFreeHeap(), millis(), &retryAfter);
+    if (verdict != WEB_ADMIT) {
+      shedRequest(request, verdict, retryAfter);
+      return;
+    }
+    ticket->used = true;
+    ticket->heap = heap;
+    ticket->buffer = nullptr;
+    request->onDisconnect([ticket]() {
+      responseRelease(ticket->buffer);
+      webDone(webAdmission, ticket->heap);
+      ticket->used = false;
+    });
+    unsigned long start = micros();
+    handler(request, ticket);
+    webCharge(webAdmission, micros() - start);
+  };
+}
+
+// Body handler side of an upload route: the first body bytes try for the
+// upload slot (see web_admission.h), which is given back when the client
+// goes away. Returns whether this request's body is to be stored.
+bool uploadBody(AsyncWebServerRequest *request, size_t index) {
+  if (index == 0) {
+    webSetStreams(webAdmission, events.count());
+    if (webUploadBegin(webAdmission, request, ESP.getFreeHeap()) == WEB_ADMIT) {
+      request->onDisconnect([request]() { webUploadEnd(webAdmission, request); });
+    }
+  }
+  return webUploadOwns(webAdmission, request);
+}
+
+// An upload route's login, checked by its body handler before the first
+// byte is stored and by its request handler, which asks for it with 401
+bool webAuthorized(AsyncWebServerRequest *request) {
+  return request->authenticate(WEB_ADMIN_USER, WEB_ADMIN_PASSWORD);
+}
+
+// Why POST /ota cannot go ahead: 409 while an update runs or on the
+// standby, 400 without a slave or type in range, with the answer's text in
+// *message; 0 if it can, with `slave` and `type` from the query
+int otaRefusal(AsyncWebServerRequest *request, int &slave, int &type, const char **message) {
+  slave = request->hasParam("slave") ? atoi(request->getParam("slave")->value().c_str()) : 0;
+  type = request->hasParam("type") ? atoi(request->getParam("type")->value().c_str()) : 0;
+  if (otaRequested || otaImage) {
+    *message = "An update is already running\n";
+    return 409;
+  }
+  if (failoverSeenRole != FAILOVER_ACTIVE) {
+    *message = "Standing by, update through the active master\n";
+    return 409;
+  }
+  if ((slave < 1 || slave > SLAVE_COUNT) && (type < 1 || type > SLAVE_COUNT)) {
+    *message = "Give slave=1..3 or type=1..3\n";
+    return 400;
+  }
+  return 0;
+}
+
+// Request handler side: answer an upload that holds no slot, with 415 for
+// a form-encoded body (the server keeps it from the body handler), 503 if
+// its body was refused and 400 if it had none. Returns whether it answered.
+bool uploadRefused(AsyncWebServerRequest *request) {
+  if (webUploadOwns(webAdmission, request)) {
+    return false;
+  }
+  if (request->contentType() == "application/x-www-form-urlencoded") {
+    request->send(415, "text/plain", "Send the body as application/octet-stream\n");
+  } else if (request->contentLength() > 0) {
+    shedRequest(request, WEB_SHED_BUSY, 1);
+  } else {
+    request->send(400, "text/plain", "Nothing in the request body\n");
+  }
+  return true;
+}
+
+// Set up the response pools; the HTML page is split around its placeholder
+void initResponseCaches() {
+  responseCacheInit(statusCache, statusStorage, STATUS_RESPONSE_SIZE, "text/plain", renderStatus, true);
+  responseCacheInit(pageCache, pageStorage, PAGE_FRAGMENT_SIZE, "text/html", renderPage, true);
+  responseCacheInit(metricsCache, metricsStorage, METRICS_RESPONSE_SIZE, "text/plain", renderMetrics, false);
+  responseCacheInit(statsCache, statsStorage, STATS_RESPONSE_SIZE, "text/plain", renderStats, false);
+
+  const char *placeholder = "%WATER_FOR_PLANT%";
+  const char *marker = strstr(PAGEINDEX, placeholder);
+  size_t pageLength = strlen(PAGEINDEX);
+  if (marker != nullptr) {
+    const char *suffix = marker + strlen(placeholder);
+    responseCacheWrap(pageCache, PAGEINDEX, marker - PAGEINDEX, suffix, PAGEINDEX + pageLength - suffix);
+  } else {
+    responseCacheWrap(pageCache, PAGEINDEX, pageLength, "", 0);
+  }
+}
+
+// Track how small the largest free heap block has become
+void sampleHeap() {
+  uint32_t largestBlock = ESP.getMaxAllocHeap();
+  if (largestBlock < heapLargestBlockMin) {
+    heapLargestBlockMin = largestBlock;
+  }
+}
+
+#ifdef HEAP_SOAK_TEST
+// On-device soak: drive the request path continuously with synthetic frames
+// and report whether the largest free heap block keeps shrinking. The web
+// server is not started in this build.
+#define SOAK_BATCH 1000              // Request cycles between heap samples
+#define SOAK_REPORT_INTERVAL 10000   // ms between serial reports
+
+char soakStatusStorage[RESPONSE_POOL_SIZE * STATUS_RESPONSE_SIZE];
+char soakPageStorage[RESPONSE_POOL_SIZE * PAGE_FRAGMENT_SIZE];
+response_cache soakStatusCache;
+response_cache soakPageCache;
+uint64_t soakRequests = 0;
+unsigned long soakLastReport = 0;
+
+// Stream a whole response through a small window, as AsyncTCP would
+void soakDrain(response_buffer *buffer) {
+  uint8_t window[128];
+  size_t total = responseLength(buffer);
+  for (size_t index = 0; index < total;) {
+    index += responseFill(buffer, window, sizeof(window), index);
+  }
+}
+
+// A synthetic frame: new readings for the next render
+void soakFrame() {
+  portENTER_CRITICAL(&stateMux);
+  receivedDataSlave2.temperature = 20.0f + (soakRequests % 150) / 10.0f;
+  receivedDataSlave3.soilMoistureValue = 1800 + soakRequests % 200;
+  stateGeneration++;
+  portEXIT_CRITICAL(&stateMux);
+}
+
+void runHeapSoak() {
+  if (soakRequests == 0) {
+    responseCacheInit(soakStatusCache, soakStatusStorage, STATUS_RESPONSE_SIZE, "text/plain", renderStatus, true);
+    responseCacheInit(soakPageCache, soakPageStorage, PAGE_FRAGMENT_SIZE, "text/html", renderPage, true);
+    responseCacheWrap(soakPageCache, pageCache.prefix, pageCache.prefixLength, pageCache.suffix, pageCache.suffixLength);
+  }
+
+  for (int i = 0; i < SOAK_BATCH; i++) {
+    // A new frame every tenth request, with overlapping responses in flight
+    if (i % 10 == 0) {
+      soakFrame();
+    }
+    refreshDashboardView();
+    response_buffer *status = responseAcquire(soakStatusCache, dashboardViewGeneration);
+    response_buffer *page = responseAcquire(soakPageCache, dashboardViewGeneration);
+    soakDrain(status);
+    soakDrain(page);
+    responseRelease(page);
+    responseRelease(status);
+    soakRequests += 2;
+  }
+  sampleHeap();
+
+  if (millis() - soakLastReport >= SOAK_REPORT_INTERVAL) {
+    soakLastReport = millis();
+    Serial.printf("Soak: requests=%llu heap_free=%u largest_block=%u largest_block_min=%u\n",
+                  soakRequests, (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMaxAllocHeap(),
+                  (unsigned)heapLargestBlockMin);
+  }
+}
+#endif
+
+// Dispatch queued alarms: update the alarm table, push each transition to
+// the dashboards and record its end-to-end latency. Runs first in loop().
+void dispatchAlarms() {
+  while (true) {
+    portENTER_CRITICAL(&stateMux);
+    if (alarmRxCount == 0) {
+      portEXIT_CRITICAL(&stateMux);
+      return;
+    }
+    alarm_event event = alarmRxQueue[alarmRxHead];
+    alarmRxHead = (alarmRxHead + 1) % ALARM_RX_QUEUE_SIZE;
+    alarmRxCount--;
+    portEXIT_CRITICAL(&stateMux);
+
+    const alarm_frame &frame = event.frame;
+    alarm_stats &stats = alarmStats;
+    int slave = event.slave;
+    if (frame.code >= ALARM_COUNT) {
+      continue;
+    }
+    // A retry whose first copy got through but whose ACK was lost
+    if (stats.seen[slave] && stats.lastSeq[slave] == frame.header.seq && stats.lastCode[slave] == frame.code) {
+      stats.duplicates++;
+      continue;
+    }
+    stats.seen[slave] = true;
+    stats.lastSeq[slave] = frame.header.seq;
+    stats.lastCode[slave] = frame.code;
+    stats.received++;
+    stats.retries += frame.attempt > 1 ? frame.attempt - 1 : 0;
+
+    portENTER_CRITICAL(&stateMux);
+    alarm_state &alarm = alarmTable[frame.code];
+    alarm.active = frame.active;
+    alarm.value = frame.value;
+    alarm.since = frame.sampleTimeError == SYNC_UNSYNCED ? event.receivedAt : frame.sampleTime;
+    if (frame.active) {
+      activeAlarms |= 1 << frame.code;
+    } else {
+      activeAlarms &= ~(1 << frame.code);
+    }
+    stateGeneration++;
+    portEXIT_CRITICAL(&stateMux);
+
+    char message[48];
+    snprintf(message, sizeof(message), "%s %s %.1f", alarmNames[frame.code],
+             frame.active ? "raised" : "cleared", frame.value);
+    events.send(message, "alarm", millis());
+
+    unsigned long now = millis();
+    if (now - event.receivedAt > stats.maxDispatchMs) {
+      stats.maxDispatchMs = now - event.receivedAt;
+    }
+    if (frame.sampleTimeError == SYNC_UNSYNCED) {
+      stats.unsynced++;
+    } else {
+      stats.latencyMs = (long)(now - frame.sampleTime);
+      stats.totalLatencyMs += stats.latencyMs;
+      stats.timed++;
+      if (stats.latencyMs > stats.maxLatencyMs) {
+        stats.maxLatencyMs = stats.latencyMs;
+      }
+    }
+    Serial.printf("Alarm from Slave %d: %s\n", slave + 1, message);
+  }
+}
+
+// Start a capture file with its header
+bool openCaptureFile() {
+  captureFile = LittleFS.open(CAPTURE_FILE, "w");
+  if (!captureFile) {
+    return false;
+  }
+  capture_file_header header;
+  captureHeaderInit(header);
+  captureFile.write((const uint8_t *)&header, sizeof(header));
+  captureFileBytes = sizeof(header);
+  return true;
+}
+
+// Apply a sink change requested from /capture
+void switchCaptureSink() {
+  CaptureSink requested = captureRequested;
+  if (requested == captureSink) {
+    return;
+  }
+  if (captureFile) {
+    captureFile.close();
+  }
+  if (requested == CAPTURE_TO_FILE && !openCaptureFile()) {
+    Serial.println("Error opening capture file");
+    requested = CAPTURE_OFF;
+    captureRequested = CAPTURE_OFF;
+  }
+  portENTER_CRITICAL(&stateMux);
+  captureRingInit(captureRing);
+  captureSink = requested;
+  portEXIT_CRITICAL(&stateMux);
+  captureBytesWritten = 0;
+  Serial.printf("Frame capture: %s\n", captureSinkNames[requested]);
+}
+
+// Write captured records out: to the capture file, or as hex lines on serial
+// that tools/replay picks out of the log. A pass stops after
+// CAPTURE_DRAIN_BYTES so a backlog never holds up loop(); the rest waits in
+// the ring for the next pass.
+void drainCapture() {
+  switchCaptureSink();
+  uint8_t record[CAPTURE_MAX_RECORD];
+  size_t drained = 0;
+  while (captureSink != CAPTURE_OFF && drained < CAPTURE_DRAIN_BYTES) {
+    portENTER_CRITICAL(&stateMux);
+    size_t length = captureRead(captureRing, record);
+    portEXIT_CRITICAL(&stateMux);
+    if (length == 0) {
+      return;
+    }
+
+    if (captureSink == CAPTURE_TO_SERIAL) {
+      char line[2 * CAPTURE_MAX_RECORD + 8];
+      size_t used = snprintf(line, sizeof(line), CAPTURE_SERIAL_PREFIX);
+      for (size_t i = 0; i < length; i++) {
+        used += snprintf(line + used, sizeof(line) - used, "%02X", record[i]);
+      }
+      Serial.println(line);
+      drained += used;
+    } else {
+      if (captureFileBytes + length > CAPTURE_FILE_LIMIT) {
+        // Keep the previous segment, start a new one
+        captureFile.close();
+        LittleFS.remove(CAPTURE_OLD_FILE);
+        LittleFS.rename(CAPTURE_FILE, CAPTURE_OLD_FILE);
+        if (!openCaptureFile()) {
+          captureRequested = CAPTURE_OFF;
+          switchCaptureSink();
+          return;
+        }
+      }
+      captureFile.write(record, length);
+      captureFileBytes += length;
+      drained += length;
+    }
+    captureBytesWritten += length;
+  }
+}
+
+// Start the firmware update requested from /ota: hash the stored image and
+// offer it. The session id comes from the hash, so offering the same image
+// again resumes a transfer that was broken off.
+void startOta() {
+  otaRequested = false;
+  if (otaImage) {
+    otaImage.close();
+  }
+  otaImage = LittleFS.open(OTA_IMAGE_FILE, "r");
+  if (!otaImage || otaImage.size() == 0 || otaImage.size() > OTA_MAX_IMAGE) {
+    Serial.println("Firmware update: no usable image");
+    return;
+  }
+
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  uint8_t block[512];
+  size_t read;
+  while ((read = otaImage.read(block, sizeof(block))) > 0) {
+    mbedtls_sha256_update(&sha, block, read);
+  }
+  mbedtls_sha256_finish(&sha, otaSha256);
+  mbedtls_sha256_free(&sha);
+
+  if (otaRequestedSlave >= 0) {
+    memcpy(otaTarget, slaveMACs[otaRequestedSlave], 6);
+    otaNodeType = otaRequestedSlave + 1;
+  } else {
+    memcpy(otaTarget, broadcastMAC, 6);
+    otaNodeType = otaRequestedType;
+  }
+  uint32_t session;
+  memcpy(&session, otaSha256, sizeof(session));
+  otaStartedAt = millis();
+  portENTER_CRITICAL(&stateMux);
+  otaSenderStart(otaSender, session | 1, otaImage.size(), otaStartedAt);
+  portEXIT_CRITICAL(&stateMux);
+  Serial.printf("Firmware update: %u bytes for node type %u\n", (unsigned)otaImage.size(), otaNodeType);
+}
+
+// Rate for update frames: the slave's own, or for a broadcast the slowest of the receivers
+uint8_t otaRate() {
+  portENTER_CRITICAL(&stateMux);
+  uint8_t index = RATE_LADDER_SIZE - 1;
+  bool any = false;
+  for (int i = 0; i < otaSender.peerCount; i++) {
+    if (!otaSender.peers[i].active) {
+      continue;
+    }
+    int slave = slaveIndex(otaSender.peers[i].mac);
+    uint8_t rate = slave >= 0 ? slaveRates[slave].index : 0;  // Unknown node: the basic rate
+    index = rate < index ? rate : index;
+    any = true;
+  }
+  portEXIT_CRITICAL(&stateMux);
+  return any ? index : 0;
+}
+
+// Send an offer or commit to every slave the update is for, sealed with
+// its own key. Only chunks and polls go to a whole type under the group
+// key: a node holding that key cannot start an update or switch partitions.
+esp_err_t sendToReceivers(const uint8_t *data, size_t len) {
+  int target = slaveIndex(otaTarget);
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    if (target >= 0 ? i != target : i + 1 != otaNodeType) {
+      continue;
+    }
+    applyRate(slaveMACs[i], 0);  // Every candidate must hear it
+    esp_err_t result = sendSealed(slaveMACs[i], i, data, len);
+    if (result != ESP_OK) {
+      return result;
+    }
+  }
+  return ESP_OK;
+}
+
+// Move the firmware update along: a few frames per pass, so the rest of
+// loop() keeps its timing
+void serviceOta() {
+  if (otaRequested) {
+    startOta();
+  }
+  if (!otaImage) {
+    return;
+  }
+
+  for (int burst = 0; burst < OTA_BURST; burst++) {
+    unsigned long now = millis();
+    uint16_t index = 0;
+    portENTER_CRITICAL(&stateMux);
+    uint8_t action = otaSenderPoll(otaSender, now, index);
+    uint8_t phase = otaSender.phase;
+    uint32_t session = otaSender.session;
+    portEXIT_CRITICAL(&stateMux);
+
+    esp_err_t result = ESP_OK;
+    if (action == OTA_SEND_NOTHING) {
+      if (phase == OTA_PHASE_DONE) {
+        otaImage.close();
+        otaSeconds = (now - otaStartedAt) / 1000;
+        Serial.printf("Firmware update done in %lu s: %d of %u nodes updated\n", otaSeconds,
+                      otaSenderUpdated(otaSender), (unsigned)otaSender.peerCount);
+      }
+      return;
+    } else if (action == OTA_SEND_OFFER) {
+      ota_offer offer;
+      offer.header.msgType = MSG_OTA;
+      offer.header.qos = QOS_BULK;
+      offer.header.seq = ++frameSeq;
+      offer.op = OTA_OP_OFFER;
+      offer.nodeType = otaNodeType;
+      offer.chunkCount = otaChunkCount(otaImage.size());
+      offer.session = session;
+      offer.imageSize = otaImage.size();
+      memcpy(offer.sha256, otaSha256, 32);
+      result = sendToReceivers((uint8_t *)&offer, sizeof(offer));
+    } else if (action == OTA_SEND_CHUNK) {
+      ota_chunk chunk;
+      chunk.header.msgType = MSG_OTA;
+      chunk.header.qos = QOS_BULK;
+      chunk.header.seq = ++frameSeq;
+      chunk.op = OTA_OP_CHUNK;
+      chunk.index = index;
+      chunk.session = session;
+      chunk.length = otaChunkLength(otaImage.size(), index);
+      otaImage.seek((size_t)index * OTA_CHUNK_SIZE);
+      if (otaImage.read(chunk.data, chunk.length) != chunk.length) {
+        return;
+      }
+      chunk.crc = otaCrc32(chunk.data, chunk.length);
+      applyRate(otaTarget, otaRate());
+      result = sendSealed(otaTarget, slaveIndex(otaTarget), (uint8_t *)&chunk, offsetof(ota_chunk, data) + chunk.length);
+      if (result == ESP_OK) {
+        portENTER_CRITICAL(&stateMux);
+        otaSenderSent(otaSender, index);
+        portEXIT_CRITICAL(&stateMux);
+      }
+    } else {
+      ota_control control;
+      control.header.msgType = MSG_OTA;
+      control.header.qos = QOS_BULK;
+      control.header.seq = ++frameSeq;
+      control.op = action == OTA_SEND_POLL ? OTA_OP_POLL : OTA_OP_COMMIT;
+      control.nodeType = otaNodeType;
+      control.session = session;
+      if (control.op == OTA_OP_COMMIT) {
+        result = sendToReceivers((uint8_t *)&control, sizeof(control));
+      } else {
+        applyRate(otaTarget, 0);
+        result = sendSealed(otaTarget, slaveIndex(otaTarget), (uint8_t *)&control, sizeof(control));
+      }
+    }
+    if (result != ESP_OK) {
+      return;  // Send queue full; carry on next pass
+    }
+  }
+}
+
+// Close statistics windows that ended, on channels that have gone quiet too
+void tickStats() {
+  unsigned long now = millis();
+  if (now - statsLastTick < 1000) {
+    return;
+  }
+  statsLastTick = now;
+  portENTER_CRITICAL(&stateMux);
+  for (int c = 0; c < CH_COUNT; c++) {
+    statsTick(channelStats[c], now);
+  }
+  portEXIT_CRITICAL(&stateMux);
+}
+
+// Broadcast our clock to the slaves
+void sendSyncBeacon() {
+  sync_beacon beacon;
+  beacon.header.msgType = MSG_SYNC_BEACON;
+  beacon.header.qos = QOS_BULK;
+  beacon.header.seq = ++frameSeq;
+  beacon.masterTime = millis();
+  beacon.hops = 0;
+  beacon.pathCost = 0;
+  memcpy(beacon.master, ownMAC, 6);
+  portENTER_CRITICAL(&stateMux);
+  beacon.term = failover.term;
+  portEXIT_CRITICAL(&stateMux);
+  applyRate(broadcastMAC, 0);  // Every slave must hear it, whatever its link quality
+  if (sendSealed(broadcastMAC, -1, (uint8_t *)&beacon, sizeof(beacon)) != ESP_OK) {
+    Serial.println("Error sending sync beacon");
+  }
+  if (partnered) {
+    sendToPartner((uint8_t *)&beacon, sizeof(beacon));  // Our heartbeat, under a key no slave could forge it with
+  }
+}
+
+// Tell each slave our term under its own key, so it moves to us at once
+// (see master_failover.h)
+void sendTermAnnouncements() {
+  term_announce announce;
+  announce.header.msgType = MSG_TERM;
+  announce.header.qos = QOS_BULK;
+  announce.header.seq = ++frameSeq;
+  portENTER_CRITICAL(&stateMux);
+  announce.term = failover.term;
+  portEXIT_CRITICAL(&stateMux);
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    if (sendToSlave(i, (uint8_t *)&announce, sizeof(announce)) != ESP_OK) {
+      Serial.printf("Error announcing the term to slave %d\n", i + 1);
+    }
+  }
+}
+
+// Tell the slaves, on the channel they are still on, that we move in `switchIn` ms
+void sendChannelNotice(uint8_t channel, uint16_t switchIn) {
+  channel_notice notice;
+  notice.header.msgType = MSG_CHANNEL;
+  notice.header.qos = QOS_BULK;
+  notice.header.seq = ++frameSeq;  // Each copy its own, so relays pass every copy on
+  notice.op = CHANNEL_OP_NOTICE;
+  notice.channel = channel;
+  notice.switchIn = switchIn;
+  applyRate(broadcastMAC, 0);
+  if (sendSealed(broadcastMAC, -1, (uint8_t *)&notice, sizeof(notice)) != ESP_OK) {
+    Serial.println("Error sending channel notice");
+  }
+  if (partnered) {
+    sendToPartner((uint8_t *)&notice, sizeof(notice));
+  }
+}
+
+// Keep ESP-NOW on the router's channel. While connected we only check that
+// the STA has not moved by itself; once the router is lost we scan for it
+// without blocking, and if it is on another channel announce the move, then
+// switch and reconnect. A standby neither announces nor answers probes.
+void serviceChannel(unsigned long now, bool active) {
+  if (probeAnswerDue) {
+    probeAnswerDue = false;
+    if (active) {
+      probesAnswered++;
+      sendSyncBeacon();
+    }
+  }
 
-// ESP-NOW Communication
-uint8_t slave1MAC[] = {0x88, 0x13, 0xBF, 0x0C, 0x42, 0x94}; // slave1 MAC: LDR slave
-uint8_t slave2MAC[] = {0xCC, 0x7B, 0x5C, 0x35, 0x48, 0xFC}; // "2slave" MAC: DHT slave
-uint8_t slave3MAC[] = {0xAC, 0x15, 0x18, 0xD4, 0xA6, 0xD4}; // slave3 MAC: Soil and Watering
+  if (channelMigration.newChannel != 0) {
+    if (migrationNoticeDue(channelMigration, now)) {
+      sendChannelNotice(channelMigration.newChannel, migrationNoticeSent(channelMigration, now));
+    }
+    if (migrationSwitchDue(channelMigration, now)) {
+      esp_wifi_set_channel(channelMigration.channel, WIFI_SECOND_CHAN_NONE);
+      WiFi.reconnect();
+      routerWaitStarted = now;
+      Serial.printf("Moved to channel %u with the router\n", channelMigration.channel);
+    }
+    return;
+  }
 
-// Create AsyncWebServer object on port 80
-AsyncWebServer server(80);
+  if (now - lastChannelCheck < CHANNEL_CHECK_INTERVAL) {
+    return;
+  }
+  lastChannelCheck = now;
+  if (WiFi.status() == WL_CONNECTED) {
+    routerWaitStarted = 0;
+    int32_t channel = WiFi.channel();
+    if (channelValid(channel) && channel != channelMigration.channel) {
+      migrationAdopt(channelMigration, channel);
+      Serial.printf("Followed the router to channel %u unannounced, slaves will sweep\n", (unsigned)channel);
+    }
+    return;
+  }
+  if (routerWaitStarted != 0 && now - routerWaitStarted < CHANNEL_RETRY_INTERVAL) {
+    return;  // Give the reconnect its time before scanning over it
+  }
 
-// Data Structure for ESP-NOW
-typedef struct struct_message1 {
-  int ldrValue;
-  char lightStatus[20];
-} struct_message1;
+  // Router lost: look for it with a scan that runs in the background
+  int16_t found = WiFi.scanComplete();
+  if (found == WIFI_SCAN_RUNNING) {
+    return;
+  }
+  if (found < 0) {
+    WiFi.scanNetworks(true);
+    return;
+  }
+  int32_t channel = scanned_wifi_channel(wifi_network_ssid, found);
+  WiFi.scanDelete();
+  if (!channelValid(channel)) {
+    routerWaitStarted = now;  // Not in range: scanning keeps ESP-NOW off our channel, so not too often
+    return;
+  }
+  if (channel == channelMigration.channel) {
+    WiFi.reconnect();
+    routerWaitStarted = now;
+    return;
+  }
+  if (!active) {
+    Serial.printf("Router moved to channel %u, following\n", (unsigned)channel);
+    migrationFollow(channelMigration, channel, now);  // The slaves are not ours to announce it to
+    return;
+  }
+  Serial.printf("Router moved to channel %u, announcing\n", (unsigned)channel);
+  migrationStart(channelMigration, channel, now);
+}
 
-typedef struct struct_message2 {
-  float temperature;
-  char fanStatus[20];
-} struct_message2;
+// Stand by while our partner beacons, take over once it has gone quiet,
+// and step down when it has taken over from us. Returns true while we are
+// the active master.
+bool serviceFailover(unsigned long now) {
+  if (partnerMoveChannel != 0) {
+    uint8_t channel = partnerMoveChannel;
+    partnerMoveChannel = 0;
+    if (channel != channelMigration.channel && channelMigration.newChannel == 0) {
+      migrationFollow(channelMigration, channel, partnerMoveAt);
+    }
+  }
+  portENTER_CRITICAL(&stateMux);
+  if (channelMigration.newChannel != 0) {
+    failoverHold(failover, now);  // Our partner is moving channel too: its silence means nothing
+  }
+  bool tookOver = failoverTick(failover, now);
+  uint8_t role = failover.role;
+  uint16_t term = failover.term;
+  unsigned long silence = failover.lastSilence;
+  portEXIT_CRITICAL(&stateMux);
 
-typedef struct struct_message3 {
-  int soilMoistureValue;
-  char soilStatus[10];    // Soil status: Dry or Moist
-  char pumpStatus[20];    // Pump status: Watering or Off
-  int waterLevelValue;
-  char refillStatus[20];  // Refill status: Refilling or Full
-  unsigned long remainingCooldown; // Add remaining cooldown to the structure
-} struct_message3;
+  if (tookOver) {
+    Serial.printf("Partner silent for %lu ms, taking over (term %u)\n", silence, (unsigned)term);
+    lastSyncBeacon = now - SYNC_BEACON_INTERVAL;  // Beacon at once: it moves the slaves to us
+    lastActionRefresh = now - ACTION_REFRESH_INTERVAL;
+    lastTermAnnounce = now - TERM_ANNOUNCE_INTERVAL;
+  } else if (role != failoverSeenRole && role == FAILOVER_STANDBY) {
+    Serial.printf("Partner took over (term %u), standing by\n", (unsigned)term);
+    exportMqttClient.close();  // The broker takes one connection per client id
+  }
+  failoverSeenRole = role;
+  return role == FAILOVER_ACTIVE;
+}
 
-struct_message1 receivedDataSlave1; // Data received from slave 1 (LDR slave)
-struct_message2 receivedDataSlave2; // Data received from 2slave (DHT slave)
-struct_message3 receivedDataSlave3; // Data received from slave 3 (Soil and Watering)
+// MQTT connection for the export, driven by AsyncTCP so connecting never
+// blocks loop(). CONNECT goes out once TCP is up; the broker's CONNACK
+// makes the uplink usable.
+void initExportMqtt() {
+  exportMqttClient.onConnect([](void *, AsyncClient *client) {
+    uint8_t packet[80];
+    size_t length = mqttConnect(packet, export_mqtt_client_id, EXPORT_MQTT_KEEPALIVE);
+    client->write((const char *)packet, length);
+  }, nullptr);
+  exportMqttClient.onData([](void *, AsyncClient *, void *data, size_t len) {
+    if (exportMqttState == MQTT_CONNECTING && mqttConnackAccepted((const uint8_t *)data, len)) {
+      exportMqttState = MQTT_UP;
+    }
+  }, nullptr);
+  exportMqttClient.onDisconnect([](void *, AsyncClient *) {
+    exportMqttState = MQTT_DOWN;
+  }, nullptr);
+}
+
+// Keep the MQTT uplink up: reconnect with backoff, ping when idle
+void serviceExportMqtt(unsigned long now) {
+  uint8_t state = exportMqttState;
+  if (state != exportMqttSeen) {
+    if (state == MQTT_UP) {
+      exportMqttBackoff = EXPORT_MQTT_RETRY_MIN;
+      exportMqttConnects++;
+      Serial.println("Telemetry export: MQTT connected");
+    } else if (exportMqttSeen == MQTT_UP) {
+      Serial.println("Telemetry export: MQTT connection lost");
+    }
+    exportMqttSeen = state;
+  }
+  if (state == MQTT_UP) {
+    if (now - exportMqttLastSent >= EXPORT_MQTT_KEEPALIVE * 1000UL / 2) {
+      uint8_t packet[2];
+      exportMqttClient.write((const char *)packet, mqttPingreq(packet));
+      exportMqttLastSent = now;
+    }
+    return;
+  }
+  if (now - exportMqttLastAttempt < exportMqttBackoff) {
+    return;
+  }
+  if (state == MQTT_CONNECTING) {
+    exportMqttClient.close(true);  // No CONNACK in a whole backoff period
+  }
+  exportMqttLastAttempt = now;
+  exportMqttBackoff = min(exportMqttBackoff * 2, (unsigned long)EXPORT_MQTT_RETRY_MAX);
+  if (WiFi.status() != WL_CONNECTED) {
+    exportMqttState = MQTT_DOWN;
+    return;
+  }
+  exportMqttState = MQTT_CONNECTING;
+  if (!exportMqttClient.connect(export_mqtt_host, export_mqtt_port)) {
+    exportMqttState = MQTT_DOWN;
+  }
+}
 
+// Send the next batch of readings to every uplink that is up. Batches wait
+// while none is, or while the MQTT connection has no room for one; the
+// queue then fills and its policy decides which readings give way.
+void serviceExport(unsigned long now, bool active) {
+  if (!active) {
+    // Our partner exports; keep what it may not have sent yet, for when we take over
+    portENTER_CRITICAL(&stateMux);
+    exportDiscard(exportQueue, failover.lastPartnerBeacon - EXPORT_FLUSH_MS);
+    portEXIT_CRITICAL(&stateMux);
+    return;
+  }
+  bool mqtt = export_mqtt_host[0] != '\0';
+  bool udp = export_udp_host[0] != '\0';
+  if (mqtt) {
+    serviceExportMqtt(now);
+  }
+  if (now - exportRateStart >= EXPORT_RATE_WINDOW) {
+    exportSamplesPerMinute = (exportSamplesSent - exportRateSamples) * 60000ULL / (now - exportRateStart);
+    exportRateSamples = exportSamplesSent;
+    exportRateStart = now;
+  }
 
-// Get Wi-Fi channel for the specified SSID
-int32_t get_wifi_channel(const char* ssid) {
-  int n = WiFi.scanNetworks();
-  for (int i = 0; i < n; ++i) {
-    if (String(ssid) == WiFi.SSID(i)) {
-      return WiFi.channel(i);
+  bool mqttUp = mqtt && exportMqttState == MQTT_UP;
+  bool udpUp = udp && WiFi.status() == WL_CONNECTED;
+  if (!mqttUp && !udpUp) {
+    return;
+  }
+
+  static export_sample batch[EXPORT_FLUSH_SAMPLES];
+  static char message[EXPORT_MESSAGE_SIZE];
+  static uint8_t packet[EXPORT_MESSAGE_SIZE + 64];
+  uint32_t first;
+  portENTER_CRITICAL(&stateMux);
+  int n = exportFlushDue(exportQueue, now) ? exportPeek(exportQueue, batch, EXPORT_FLUSH_SAMPLES, &first) : 0;
+  uint32_t dropped = exportQueue.dropped;
+  portEXIT_CRITICAL(&stateMux);
+  if (n == 0) {
+    return;
+  }
+
+  int encoded;
+  size_t length = exportEncodeBatch(message, sizeof(message), batch, n, ruleChannelNames,
+                                    exportBatches + 1, now, dropped, &encoded);
+  size_t packetLength = 0;
+  if (mqttUp) {
+    packetLength = mqttPublish(packet, sizeof(packet), export_mqtt_topic, (const uint8_t *)message, length);
+    if (exportMqttClient.space() < packetLength) {
+      return;  // Backpressure: the readings wait in the queue
     }
   }
-  return 0;
+
+  bool sent = false;
+  if (mqttUp) {
+    if (exportMqttClient.write((const char *)packet, packetLength) == packetLength) {
+      exportMqttLastSent = now;
+      exportBytesSent += packetLength;
+      sent = true;
+    } else {
+      exportSendErrors++;
+    }
+  }
+  if (udpUp) {
+    if (exportUdp.beginPacket(export_udp_host, export_udp_port) &&
+        exportUdp.write((const uint8_t *)message, length) == length && exportUdp.endPacket()) {
+      exportBytesSent += length;
+      sent = true;
+    } else {
+      exportSendErrors++;
+    }
+  }
+  if (!sent) {
+    return;  // Retried on the next pass
+  }
+  exportBatches++;
+  exportSamplesSent += encoded;
+  portENTER_CRITICAL(&stateMux);
+  exportCommit(exportQueue, first, encoded);
+  portEXIT_CRITICAL(&stateMux);
 }
 
-// Set Wi-Fi channel for ESP32
-void scan_and_set_wifi_channel() {
-  Serial.printf("\nScanning for SSID: %s\n", wifi_network_ssid);
-  int master_channel = get_wifi_channel(wifi_network_ssid);
+// Slave (index) that owns each rule target
+int targetSlave(int target) {
+  switch (target) {
+    case TARGET_LIGHT:
+      return 0;
+    case TARGET_FAN:
+      return 1;
+    default:
+      return 2;
+  }
+}
 
-  if (master_channel == 0) {
-    Serial.println("SSID not found!");
+// Tell the owning slave the current value of a rule target
+void sendAction(int target, uint8_t value) {
+  action_command command;
+  command.header.msgType = MSG_ACTION;
+  command.header.qos = QOS_BULK;
+  command.header.seq = ++frameSeq;
+  command.target = target;
+  command.value = value;
+  command.ttlSeconds = ACTION_TTL_SECONDS;
+  if (sendToSlave(targetSlave(target), (uint8_t *)&command, sizeof(command)) == ESP_OK) {
+    actionsSent++;
   } else {
-    Serial.printf("SSID found. Channel: %d\n", master_channel);
+    actionErrors++;
+    Serial.printf("Error sending action %s %s\n", ruleTargetNames[target], ruleValueNames[value]);
+  }
+}
 
-    if (WiFi.channel() != master_channel) {
-      esp_wifi_set_promiscuous(true);
-      esp_wifi_set_channel(master_channel, WIFI_SECOND_CHAN_NONE);
-      esp_wifi_set_promiscuous(false);
+// Compile rules from LittleFS (or DEFAULT_RULES if `path` is missing); call with rulesMutex held
+bool compileRules(const char *path, char *error, size_t errorSize) {
+  char line[RULE_LINE_SIZE];
+  int lineNumber = 0;
+  bool ok = true;
+  rulesBegin(rules);
+
+  File file = LittleFS.exists(path) ? LittleFS.open(path, "r") : File();
+  if (file) {
+    while (ok && file.available()) {
+      size_t length = file.readBytesUntil('\n', line, sizeof(line) - 1);
+      line[length] = '\0';
+      ok = rulesAddLine(rules, line, ++lineNumber, error, errorSize);
+    }
+    file.close();
+  } else {
+    const char *source = DEFAULT_RULES;
+    while (ok && *source) {
+      const char *end = strchr(source, '\n');
+      size_t length = end ? end - source : strlen(source);
+      if (length >= sizeof(line)) {
+        length = sizeof(line) - 1;
+      }
+      memcpy(line, source, length);
+      line[length] = '\0';
+      ok = rulesAddLine(rules, line, ++lineNumber, error, errorSize);
+      source = end ? end + 1 : source + length;
     }
   }
-  Serial.printf("Current Wi-Fi channel: %d\n", WiFi.channel());
+
+  ok = ok && rulesFinish(rules, error, errorSize);
+  if (!ok) {
+    rulesBegin(rules);  // Leave an empty, valid program behind
+  }
+  rulesGeneration = UINT32_MAX;  // Re-feed every channel to the new program
+  return ok;
 }
 
-// Unified ESP-NOW Receive Callback
-void OnDataRecv(const uint8_t *mac, const uint8_t *incomingData, int len) {
-  Serial.print("Data received from: ");
-  for (int i = 0; i < 6; i++) {
-    Serial.printf("%02X", mac[i]);
-    if (i < 5) Serial.print(":");
+// Load the stored rules at boot, falling back to the defaults
+void loadRules() {
+  char error[96];
+  xSemaphoreTake(rulesMutex, portMAX_DELAY);
+  if (!compileRules(RULES_FILE, error, sizeof(error))) {
+    Serial.printf("Stored rules rejected (%s), using defaults\n", error);
+    compileRules("", error, sizeof(error));
   }
-  Serial.println();
+  Serial.printf("Loaded %u automation rules\n", (unsigned)rules.ruleCount);
+  xSemaphoreGive(rulesMutex);
+}
 
-  // Identify the sender based on the MAC address
-  if (memcmp(mac, slave1MAC, 6) == 0) {
-    // Data from Slave 1 (LDR slave)
-    memcpy(&receivedDataSlave1, incomingData, sizeof(receivedDataSlave1));
-    Serial.printf("LDR Value: %d, Light Status: %s\n", receivedDataSlave1.ldrValue, receivedDataSlave1.lightStatus);
-  } else if (memcmp(mac, slave2MAC, 6) == 0) {
-    // Data from 2slave (DHT slave)
-    memcpy(&receivedDataSlave2, incomingData, sizeof(receivedDataSlave2));
-    Serial.printf("Temperature: %.2f, Fan Status: %s\n", receivedDataSlave2.temperature, receivedDataSlave2.fanStatus);
-  } else if (memcmp(mac, slave3MAC, 6) == 0) {
-    // Data from Slave 3 (Soil and Watering)
-    memcpy(&receivedDataSlave3, incomingData, sizeof(receivedDataSlave3));
+// Feed the latest state to the rules and send actions for targets that
+// changed; only rules reading a changed channel are re-run. Targets are
+// compared with what the slaves were last sent rather than with the previous
+// pass, so a target a replaced program no longer drives is released to
+// VALUE_AUTO instead of staying held until its TTL runs out.
+void runRules() {
+  struct_message1 slave1;
+  struct_message2 slave2;
+  struct_message3 slave3;
+  PeerState link[SLAVE_COUNT];
+  uint8_t alarms;
+  uint32_t generation;
+  if (!snapshotState(rulesGeneration, generation, slave1, slave2, slave3, link, alarms)) {
+    return;
+  }
 
-    // Adjust the display format for Slave 3 (Soil and Watering) data
-    String soilStatus = (receivedDataSlave3.soilMoistureValue > 1900) ? "Dry" : "Moist";
-    String refillStatus = String(receivedDataSlave3.refillStatus);
-    String pumpStatus = String(receivedDataSlave3.pumpStatus);
-    unsigned long remainingCooldown = receivedDataSlave3.remainingCooldown; // Get remaining cooldown
+  xSemaphoreTake(rulesMutex, portMAX_DELAY);
+  unsigned long start = micros();
+  rulesSetChannel(rules, CH_LDR, slave1.ldrValue);
+  rulesSetChannel(rules, CH_LIGHT, lightLevel(slave1.lightStatus));
+  rulesSetChannel(rules, CH_TEMPERATURE, slave2.temperature);
+  rulesSetChannel(rules, CH_FAN, strcmp(slave2.fanStatus, "ON") == 0);
+  rulesSetChannel(rules, CH_SOIL, slave3.soilMoistureValue);
+  rulesSetChannel(rules, CH_SOIL_DRY, slave3.soilMoistureValue > SOIL_DRY_THRESHOLD);
+  rulesSetChannel(rules, CH_WATER_LEVEL, slave3.waterLevelValue);
+  rulesSetChannel(rules, CH_REFILLING, strcmp(slave3.refillStatus, "Refilling") == 0);
+  rulesSetChannel(rules, CH_WATERING, strcmp(slave3.pumpStatus, "Watering") == 0);
+  rulesSetChannel(rules, CH_COOLDOWN, slave3.remainingCooldown / 1000);
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    rulesSetChannel(rules, CH_SLAVE1_ONLINE + i, link[i] == PEER_ONLINE);
+  }
+  rulesEvaluate(rules);
+  unsigned long elapsed = micros() - start;
+  uint8_t targets[TARGET_COUNT];
+  memcpy(targets, rules.targets, sizeof(targets));
+  bool ran = rules.lastEvaluated > 0;
+  rulesGeneration = generation;  // Under the mutex, so a program compiled after this pass still gets its re-feed
+  xSemaphoreGive(rulesMutex);
 
-    // Update the display format
-    Serial.printf("Water Level: %d\n", receivedDataSlave3.waterLevelValue);
-    Serial.printf("Refill Status: %s\n", receivedDataSlave3.refillStatus);
-    Serial.printf("Soil Status: %s\n", receivedDataSlave3.soilStatus);
-    Serial.printf("Pump Status: %s\n", receivedDataSlave3.pumpStatus);
-    
+  if (ran) {
+    rulesPasses++;
+    rulesLastMicros = elapsed;
+    rulesTotalMicros += elapsed;
+    if (elapsed > rulesMaxMicros) {
+      rulesMaxMicros = elapsed;
+    }
+  }
+  for (int t = 0; t < TARGET_COUNT; t++) {
+    if (targets[t] != actionTargets[t]) {
+      actionTargets[t] = targets[t];
+      sendAction(t, targets[t]);
+    }
+  }
+}
 
-    // Only display the remaining cooldown if it's not 0 (i.e., soil is dry and recently watered)
-    if (remainingCooldown > 0) {
-      Serial.printf("Remaining Cooldown: %lu ms\n", remainingCooldown);  // Display remaining cooldown
-    } else {
-      Serial.println("No cooldown, soil is moist.");
+// Re-send overrides that are still active before they expire on the slave
+void refreshActions() {
+  xSemaphoreTake(rulesMutex, portMAX_DELAY);
+  uint8_t targets[TARGET_COUNT];
+  memcpy(targets, rules.targets, sizeof(targets));
+  xSemaphoreGive(rulesMutex);
+
+  for (int t = 0; t < TARGET_COUNT; t++) {
+    if (targets[t] != VALUE_AUTO) {
+      sendAction(t, targets[t]);
     }
+  }
+}
 
-  } else {
-    Serial.println("Unknown MAC address");
+#ifdef RULE_BENCHMARK
+// Time incremental evaluation for growing synthetic rule sets and print the
+// cost per incoming frame. Runs once at boot, before the real rules load.
+void runRuleBenchmark() {
+  const int sizes[] = {16, 64, 128, 256};
+  const int frames = 2000;
+  char line[RULE_LINE_SIZE];
+  char error[96];
+
+  for (int size : sizes) {
+    rulesBegin(rules);
+    for (int i = 0; i < size; i++) {
+      // Two inputs per rule, spread over all channels and targets
+      snprintf(line, sizeof(line), "if %s > %d and %s < %d then %s %s",
+               ruleChannelNames[i % CH_COUNT], i, ruleChannelNames[(i * 7) % CH_COUNT], i * 3,
+               ruleTargetNames[i % 2], (i % 3) ? "on" : "off");
+      rulesAddLine(rules, line, i + 1, error, sizeof(error));
+    }
+    rulesFinish(rules, error, sizeof(error));
+    rulesEvaluate(rules);
+
+    unsigned long maxMicros = 0;
+    unsigned long totalMicros = 0;
+    uint32_t evaluated = 0;
+    for (int frame = 0; frame < frames; frame++) {
+      // A frame changes the channels of one slave
+      unsigned long start = micros();
+      rulesSetChannel(rules, frame % CH_COUNT, frame % 500);
+      rulesSetChannel(rules, (frame + 1) % CH_COUNT, frame % 300);
+      rulesEvaluate(rules);
+      unsigned long elapsed = micros() - start;
+      totalMicros += elapsed;
+      evaluated += rules.lastEvaluated;
+      if (elapsed > maxMicros) {
+        maxMicros = elapsed;
+      }
+    }
+    Serial.printf("Rule benchmark: rules=%d code_bytes=%u rules_per_frame=%.1f us_per_frame_avg=%.2f us_per_frame_max=%lu\n",
+                  size, (unsigned)rules.codeLength, (float)evaluated / frames,
+                  (float)totalMicros / frames, maxMicros);
+  }
+}
+#endif
+
+#ifdef STATS_BENCHMARK
+uint32_t benchSeed = 1;
+
+// Deterministic uniform [0, 1), so every run sees the same readings
+float benchUniform() {
+  benchSeed ^= benchSeed << 13;
+  benchSeed ^= benchSeed >> 17;
+  benchSeed ^= benchSeed << 5;
+  return (benchSeed >> 8) / 16777216.0f;
+}
+
+// Readings shaped like the sensors: ADC noise, a temperature curve, soil that
+// is wet most of the time and dry in bursts, and a long-tailed spread
+float benchReading(int shape) {
+  switch (shape) {
+    case 0:
+      return benchUniform() * 4095;
+    case 1: {
+      float sum = 0;
+      for (int i = 0; i < 12; i++) {
+        sum += benchUniform();
+      }
+      return 26 + (sum - 6) * 2;
+    }
+    case 2:
+      return (benchUniform() < 0.7f ? 1400 : 2000) + (benchUniform() - 0.5f) * 200;
+    default:
+      return -logf(1 - benchUniform()) * 100;
+  }
+}
+
+int compareFloats(const void *a, const void *b) {
+  float x = *(const float *)a;
+  float y = *(const float *)b;
+  return (x > y) - (x < y);
+}
+
+// Time statsAdd() and compare the quantile sketch with the exact quantiles
+// of the same readings, as a rank error: how far the share of readings below
+// the estimate is from the quantile asked for. Runs once at boot.
+void runStatsBenchmark() {
+  const char *shapes[] = {"uniform", "normal", "bimodal", "exponential"};
+  const int readings = 3600;  // An hour of frames at one per second
+  float *values = (float *)malloc(readings * sizeof(float));
+  if (values == nullptr) {
+    Serial.println("Stats benchmark: out of memory");
+    return;
+  }
+
+  for (int shape = 0; shape < 4; shape++) {
+    for (int i = 0; i < readings; i++) {
+      values[i] = benchReading(shape);
+    }
+    channel_stats stats;
+    statsInit(stats, false, 0);
+    unsigned long maxMicros = 0;
+    unsigned long start = micros();
+    for (int i = 0; i < readings; i++) {
+      unsigned long one = micros();
+      statsAdd(stats, values[i], i);
+      unsigned long elapsed = micros() - one;
+      maxMicros = elapsed > maxMicros ? elapsed : maxMicros;
+    }
+    unsigned long totalMicros = micros() - start;
+
+    qsort(values, readings, sizeof(float), compareFloats);
+    Serial.printf("Stats benchmark: %s readings=%d us_per_update_avg=%.2f us_per_update_max=%lu", shapes[shape],
+                  readings, (float)totalMicros / readings, maxMicros);
+    for (int q = 0; q < STATS_QUANTILES; q++) {
+      float estimate = p2Value(stats.current.quantiles[q], statsQuantiles[q]);
+      int below = 0;
+      while (below < readings && values[below] < estimate) {
+        below++;
+      }
+      float exact = values[(int)(statsQuantiles[q] * (readings - 1))];
+      Serial.printf(" %s=%.2f exact=%.2f rank_error=%.2f%%", statsQuantileNames[q], estimate, exact,
+                    100.0f * fabsf((float)below / readings - statsQuantiles[q]));
+    }
+    Serial.println();
   }
+  Serial.printf("Stats benchmark: bytes_per_channel=%u\n", (unsigned)sizeof(channel_stats));
+  free(values);
 }
+#endif
+
+#ifdef AUTH_BENCHMARK
+#define AUTH_BENCH_FRAMES 16         // Distinct sealed frames checked in turn
+
+uint8_t authBenchFrames[AUTH_BENCH_FRAMES][RELAY_MAX_FRAME];
+
+// Time sealing a frame, checking a good one and turning away a forged one,
+// for the frames we send and take in, and print the cost per frame next
+// to the bytes the trailer adds. Runs once at boot.
+void runAuthBenchmark() {
+  const char *names[] = {"beacon", "status", "relayed_alarm", "ota_chunk"};
+  const size_t sizes[] = {sizeof(sync_beacon), sizeof(struct_message3), sizeof(relay_header) + sizeof(alarm_frame),
+                          offsetof(ota_chunk, data) + OTA_CHUNK_SIZE};
+  const int frames = 4000;
+  auth_key key;
+  authKeyInit(key, authSlaveKeyBytes[0]);
+
+  for (int kind = 0; kind < 4; kind++) {
+    size_t size = sizes[kind];
+    for (int i = 0; i < AUTH_BENCH_FRAMES; i++) {
+      for (size_t b = 0; b < size; b++) {
+        authBenchFrames[i][b] = b + i;
+      }
+    }
+    unsigned long start = micros();
+    for (int i = 0; i < frames; i++) {
+      authSeal(key, AUTH_KEY_NODE, i, slave1MAC, authBenchFrames[i % AUTH_BENCH_FRAMES], size);
+    }
+    unsigned long sealMicros = micros() - start;
+
+    uint32_t counter;
+    int good = 0;
+    start = micros();
+    for (int i = 0; i < frames; i++) {
+      good += authOpen(key, slave1MAC, authBenchFrames[i % AUTH_BENCH_FRAMES], size + AUTH_TRAILER_SIZE, &counter) >= 0;
+    }
+    unsigned long openMicros = micros() - start;
+
+    for (int i = 0; i < AUTH_BENCH_FRAMES; i++) {
+      authBenchFrames[i][size + AUTH_TRAILER_SIZE - 1] ^= 1;  // Forged: the tag no longer matches
+    }
+    int forged = 0;
+    start = micros();
+    for (int i = 0; i < frames; i++) {
+      forged += authOpen(key, slave1MAC, authBenchFrames[i % AUTH_BENCH_FRAMES], size + AUTH_TRAILER_SIZE, &counter) < 0;
+    }
+    unsigned long rejectMicros = micros() - start;
 
+    Serial.printf("Auth benchmark: %s frame_bytes=%u trailer_bytes=%u overhead_pct=%.1f us_per_seal=%.2f "
+                  "us_per_open=%.2f us_per_reject=%.2f opened=%d rejected=%d\n",
+                  names[kind], (unsigned)size, (unsigned)AUTH_TRAILER_SIZE, 100.0f * AUTH_TRAILER_SIZE / size,
+                  (float)sealMicros / frames, (float)openMicros / frames, (float)rejectMicros / frames, good, forged);
+  }
+}
+#endif
 
 // Add ESP-NOW Peers
 void addESPNowPeers() {
@@ -159,6 +2746,24 @@ void addESPNowPeers() {
   if (esp_now_add_peer(&peerInfo) != ESP_OK) {
     Serial.println("Failed to add Slave 3");
   }
+
+  // Add the broadcast address for sync beacons
+  memcpy(peerInfo.peer_addr, broadcastMAC, 6);
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
+    Serial.println("Failed to add broadcast peer");
+  }
+
+  // Add our partner, for the copies of our beacons and notices
+  if (partnered) {
+    memcpy(peerInfo.peer_addr, partnerMAC, 6);
+    peerInfo.channel = 0;
+    peerInfo.encrypt = false;
+    if (esp_now_add_peer(&peerInfo) != ESP_OK) {
+      Serial.println("Failed to add partner master");
+    }
+  }
 }
 
 // Setup Function
@@ -167,8 +2772,21 @@ void setup() {
   pinMode(LED1_PIN, OUTPUT);
   pinMode(LED2_PIN, OUTPUT);
 
+  // Every slave starts offline until its first frame arrives
+  for (int i = 0; i < SLAVE_COUNT; i++) {
+    livenessInit(slaveLiveness[i], millis());
+    rateInit(slaveRates[i]);
+    slavePaths[i].via = -1;
+  }
+  otaSenderInit(otaSender);
+  initStats(millis());
+  exportQueueInit(exportQueue, EXPORT_DROP_POLICY);
+  initExportMqtt();
+  initFrameAuth();
+
   // Set Wi-Fi mode to AP+STA
   WiFi.mode(WIFI_AP_STA);
+  esp_wifi_get_mac(WIFI_IF_STA, ownMAC);
   WiFi.setSleep(WIFI_PS_NONE);
   WiFi.channel(1);  // Set initial channel
 
@@ -179,7 +2797,8 @@ void setup() {
   Serial.print("AP IP Address: ");
   Serial.println(WiFi.softAPIP());
 
-  // Connect to Wi-Fi network (STA)
+  // Connect to Wi-Fi network (STA); reconnects are ours (see serviceChannel)
+  WiFi.setAutoReconnect(false);
   WiFi.begin(wifi_network_ssid, wifi_network_password);
   while (WiFi.status() != WL_CONNECTED) {
     delay(500);
@@ -191,104 +2810,290 @@ void setup() {
 
   // Set Wi-Fi channel based on the master Wi-Fi network
   scan_and_set_wifi_channel();
+  migrationInit(channelMigration, WiFi.channel());
 
   // Initialize ESP-NOW
   if (esp_now_init() != ESP_OK) {
     Serial.println("Error initializing ESP-NOW");
     return;
   }
+#if RATE_PER_PEER
+  memset(appliedRates, 0xFF, sizeof(appliedRates));
+#endif
+
+  // One of a hot-standby pair: stand by until the network is found quiet
+  // (see master_failover.h)
+  partnered = memcmp(standbyMasterMAC, "\0\0\0\0\0\0", 6) != 0;
+  bool primary = memcmp(ownMAC, standbyMasterMAC, 6) != 0;
+  memcpy(partnerMAC, primary ? standbyMasterMAC : primaryMasterMAC, 6);
+  memset(overheardSeqCtrl, 0xFF, sizeof(overheardSeqCtrl));
+  failoverInit(failover, primary, partnered, millis());
+  failoverSeenRole = failover.role;
+  if (partnered) {
+    Serial.printf("Hot standby: %s, standing by\n", primary ? "primary" : "standby");
+  }
 
   // Register Unified ESP-NOW Receive Callback
   esp_now_register_recv_cb(OnDataRecv);
+  esp_now_register_send_cb(OnDataSent);
+  startLinkMonitor();
 
   // Add peers
   addESPNowPeers();
 
+  // Load the automation rules
+  rulesMutex = xSemaphoreCreateMutex();
+  if (!LittleFS.begin(true)) {
+    Serial.println("Error mounting LittleFS, rules will not persist");
+  }
+#ifdef RULE_BENCHMARK
+  runRuleBenchmark();
+#endif
+#ifdef STATS_BENCHMARK
+  runStatsBenchmark();
+#endif
+#ifdef AUTH_BENCHMARK
+  runAuthBenchmark();
+#endif
+  loadRules();
+
   // Setup Web Server
-  server.on("/status", HTTP_GET, [](AsyncWebServerRequest *request) {
-    String soilStatus;
-    String waterForPlant;
-    String waterContainer = String(receivedDataSlave3.refillStatus);  // Water container status
-    String cooldownMessage = "";
-
-    if (receivedDataSlave3.soilMoistureValue > 1900) {  // Soil is dry
-      soilStatus = "Dry";
-      if (receivedDataSlave3.pumpStatus == "Watering") {
-        waterForPlant = "Soil is dry. Watering the plant...";
-      } else {
-        waterForPlant = "Soil is dry, but watering is on hold until cooldown interval expires.";
-        cooldownMessage = "Remaining cooldown: " + String(receivedDataSlave3.remainingCooldown / 1000) + " seconds";
-      }
-    } else {  // Soil is moist
-      soilStatus = "Moist";
-      waterForPlant = "Soil is moist. No watering needed.";
-      cooldownMessage = "";  // No cooldown message needed
-    }
+  initResponseCaches();
 
-    // Build the status string
-    String status = "Slave1_Light_Status: " + String(receivedDataSlave1.lightStatus) + ", ";
-    status += "Slave2_Temperature: " + String(receivedDataSlave2.temperature) + ", ";
-    status += "Slave2_Fan_Status: " + String(receivedDataSlave2.fanStatus) + ", ";
-    status += "Slave3_Water_Level: " + String(receivedDataSlave3.waterLevelValue) + ", ";
-    status += "Slave3_Water_Container: " + waterContainer + ", ";
-    status += "Slave3_Soil_Status: " + soilStatus + ", ";
-    status += "Slave3_Water_For_Plant: " + waterForPlant;
+  // Every GET route goes through admission control; the uploads take the
+  // single upload slot, and event streams count against the same in-flight
+  // and heap budget (see web_admission.h).
+  webAdmissionInit(webAdmission, millis());
+  server.on("/status", HTTP_GET, admitted(STATUS_RESPONSE_SIZE, [](AsyncWebServerRequest *request, web_ticket *ticket) {
+    refreshDashboardView();
+    serveCached(request, statusCache, dashboardViewGeneration, &ticket->buffer); // Send formatted status
+  }));
 
-    if (!cooldownMessage.isEmpty()) {
-      status += ", " + cooldownMessage;  // Append cooldown message if applicable
+  // Route to serve the HTML page with updated Slave 3 data
+  server.on("/", HTTP_GET, admitted(WEB_SEND_WINDOW, [](AsyncWebServerRequest *request, web_ticket *ticket) {
+    refreshDashboardView();
+    serveCached(request, pageCache, dashboardViewGeneration, &ticket->buffer);  // Send the HTML page with updated content
+  }));
+
+  // Route to read the automation rules
+  server.on("/rules", HTTP_GET, admitted(WEB_SEND_WINDOW, [](AsyncWebServerRequest *request, web_ticket *) {
+    if (LittleFS.exists(RULES_FILE)) {
+      request->send(LittleFS, RULES_FILE, "text/plain");
+    } else {
+      request->send_P(200, "text/plain", DEFAULT_RULES);
     }
+  }));
 
-    request->send(200, "text/plain", status); // Send formatted status
+  // Route to replace the automation rules: the raw body is stored, compiled
+  // and only kept if it compiles; otherwise the previous rules are restored.
+  // A form-encoded body never reaches the body handler (the server parses it
+  // into parameters, and a text/plain one too if it looks like key=value),
+  // so it and an empty body are refused rather than taken for "no file",
+  // which would silently swap in DEFAULT_RULES.
+  server.on("/rules", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!webAuthorized(request)) {
+      request->requestAuthentication();
+      return;
+    }
+    if (uploadRefused(request)) {
+      return;
+    }
+    size_t received = rulesUploadSize;
+    rulesUploadSize = 0;
+    if (received == 0) {
+      LittleFS.remove(RULES_UPLOAD_FILE);
+      request->send(400, "text/plain", "No rules in the request body (send it as application/octet-stream)\n");
+      return;
+    }
+    char error[96];
+    xSemaphoreTake(rulesMutex, portMAX_DELAY);
+    bool ok = compileRules(RULES_UPLOAD_FILE, error, sizeof(error));
+    if (ok) {
+      LittleFS.remove(RULES_FILE);
+      LittleFS.rename(RULES_UPLOAD_FILE, RULES_FILE);
+      snprintf(error, sizeof(error), "%u rules loaded\n", (unsigned)rules.ruleCount);
+    } else {
+      char ignored[96];
+      LittleFS.remove(RULES_UPLOAD_FILE);
+      compileRules(RULES_FILE, ignored, sizeof(ignored));
+    }
+    xSemaphoreGive(rulesMutex);
+    request->send(ok ? 200 : 400, "text/plain", error);
+  }, nullptr, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if ((index == 0 && !webAuthorized(request)) || !uploadBody(request, index)) {
+      return;
+    }
+    if (index == 0) {
+      rulesUploadSize = 0;
+    }
+    File file = LittleFS.open(RULES_UPLOAD_FILE, index == 0 ? "w" : "a");
+    if (file) {
+      rulesUploadSize += file.write(data, len);
+      file.close();
+    }
   });
 
-  // Route to serve the HTML page with updated Slave 3 data
-server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-  String soilStatus;
-  String waterForPlant;  // This will be used for slave3PumpStatus
-  String cooldownMessage = "";
-
-  if (receivedDataSlave3.soilMoistureValue > 1900) {  // Soil is dry
-    soilStatus = "Dry";
-    if (receivedDataSlave3.pumpStatus == "Watering") {
-      waterForPlant = "Watering";  // Set the pump status to "Watering"
+  // Route to start or stop the frame capture: /capture?sink=file|serial|off.
+  // Without a parameter it only reports the current sink.
+  server.on("/capture", HTTP_GET, admitted(SMALL_RESPONSE_SIZE, [](AsyncWebServerRequest *request, web_ticket *) {
+    if (request->hasParam("sink")) {
+      const String &sink = request->getParam("sink")->value();
+      if (sink == "file") {
+        captureRequested = CAPTURE_TO_FILE;
+      } else if (sink == "serial") {
+        captureRequested = CAPTURE_TO_SERIAL;
+      } else if (sink == "off") {
+        captureRequested = CAPTURE_OFF;
+      } else {
+        request->send(400, "text/plain", "sink must be file, serial or off\n");
+        return;
+      }
+    }
+    char text[48];
+    snprintf(text, sizeof(text), "capture sink: %s\n", captureSinkNames[captureRequested]);
+    request->send(200, "text/plain", text);
+  }));
+
+  // Route to download the capture file (stop the capture first for a complete file)
+  server.on(CAPTURE_FILE, HTTP_GET, admitted(WEB_SEND_WINDOW, [](AsyncWebServerRequest *request, web_ticket *) {
+    if (LittleFS.exists(CAPTURE_FILE)) {
+      request->send(LittleFS, CAPTURE_FILE, "application/octet-stream");
     } else {
-      waterForPlant = "Waiting for cooldown";  // Set the pump status to "Waiting for cooldown"
-      cooldownMessage = "Remaining cooldown: " + String(receivedDataSlave3.remainingCooldown / 1000) + " seconds";
+      request->send(404, "text/plain", "No capture\n");
     }
-  } else {  // Soil is moist
-    soilStatus = "Moist";
-    waterForPlant = "No watering needed";  // Set the pump status to indicate no watering needed
-    cooldownMessage = "";  // No cooldown message needed
-  }
+  }));
 
-  // Generate the HTML page
-  String html = PAGEINDEX;
-  html.replace("%STATUS%", "Slave 1: " + String(receivedDataSlave1.lightStatus) + ", Slave 2: " + String(receivedDataSlave2.fanStatus) + ", Slave 3: " + waterForPlant);
-  html.replace("%SOIL_STATUS%", soilStatus);
-  html.replace("%WATER_LEVEL%", String(receivedDataSlave3.waterLevelValue));
-  html.replace("%COOLDOWN%", cooldownMessage);  // Add the cooldown message to the page
+  // Route to update slave firmware: POST the image to /ota?slave=N for one
+  // slave, or to /ota?type=N for every slave of node type N in range. GET
+  // /ota reports the progress.
+  server.on("/ota", HTTP_GET, admitted(SMALL_RESPONSE_SIZE, [](AsyncWebServerRequest *request, web_ticket *) {
+    char text[96];
+    portENTER_CRITICAL(&stateMux);
+    snprintf(text, sizeof(text), "%s: %u of %u chunks, %d of %u nodes updated\n",
+             otaPhaseNames[otaSender.phase], (unsigned)otaSender.windowBase, (unsigned)otaSender.chunkCount,
+             otaSenderUpdated(otaSender), (unsigned)otaSender.peerCount);
+    portEXIT_CRITICAL(&stateMux);
+    request->send(200, "text/plain", text);
+  }));
 
-  // Pass the updated waterForPlant status into the placeholder
-  html.replace("%WATER_FOR_PLANT%", waterForPlant);
+  // The login, the role and the parameters are checked before the first
+  // body byte is stored, so a refused request never touches the stored image.
+  server.on("/ota", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!webAuthorized(request)) {
+      request->requestAuthentication();
+      return;
+    }
+    int slave, type;
+    const char *message;
+    int refused = otaRefusal(request, slave, type, &message);
+    if (refused != 0) {
+      request->send(refused, "text/plain", message);
+      return;
+    }
+    if (uploadRefused(request)) {
+      return;
+    }
+    otaRequestedSlave = slave >= 1 && slave <= SLAVE_COUNT ? slave - 1 : -1;
+    otaRequestedType = type;
+    otaRequested = true;
+    request->send(202, "text/plain", "Update started, see /ota\n");
+  }, nullptr, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    int slave, type;
+    const char *message;
+    if (index == 0 && (!webAuthorized(request) || otaRefusal(request, slave, type, &message) != 0)) {
+      return;  // Never takes the upload slot, so nothing later is stored either
+    }
+    if (!uploadBody(request, index) || otaRequested || otaImage) {
+      return;  // Refused, or never overwrite the image being sent
+    }
+    File file = LittleFS.open(OTA_IMAGE_FILE, index == 0 ? "w" : "a");
+    if (file) {
+      file.write(data, len);
+      file.close();
+    }
+  });
 
-  request->send(200, "text/html", html);  // Send the HTML page with updated content
-});
+  // Alarm transitions are pushed to open dashboards as "alarm" events. A
+  // stream there is no room for is closed at once; its dashboard still
+  // polls /status, so it only misses the instant banner.
+  events.onConnect([](AsyncEventSourceClient *client) {
+    if (webAdmitStream(webAdmission, events.count(), ESP.getFreeHeap()) != WEB_ADMIT) {
+      client->close();
+    }
+  });
+  server.addHandler(&events);
 
+  // Route to report cache, peer liveness and heap metrics
+  server.on("/metrics", HTTP_GET, admitted(METRICS_RESPONSE_SIZE, [](AsyncWebServerRequest *request, web_ticket *ticket) {
+    serveCached(request, metricsCache, 0, &ticket->buffer);
+  }));
 
+  // Route to the running statistics of every channel
+  server.on("/stats", HTTP_GET, admitted(STATS_RESPONSE_SIZE, [](AsyncWebServerRequest *request, web_ticket *ticket) {
+    serveCached(request, statsCache, 0, &ticket->buffer);
+  }));
 
-  // Start server
+  // Start server. The soak build drives the request path from loop() instead,
+  // so the two never share dashboardView across tasks.
+#ifndef HEAP_SOAK_TEST
   server.begin();
+#endif
 }
 
 // Loop Function
 void loop() {
-  // Blink LEDs to show the system is running
-  digitalWrite(LED1_PIN, HIGH);
-  delay(500);
-  digitalWrite(LED1_PIN, LOW);
-  delay(500);
-  digitalWrite(LED2_PIN, HIGH);
-  delay(500);
-  digitalWrite(LED2_PIN, LOW);
-  delay(500);
+  // Catch slaves going silent even when nobody is polling the dashboard
+  updatePeerLiveness();
+  sampleHeap();
+
+#ifdef HEAP_SOAK_TEST
+  runHeapSoak();
+  return;
+#endif
+
+  // Alarms before anything else
+  dispatchAlarms();
+  drainCapture();
+  tickStats();
+  saveAuthReplay();
+
+  unsigned long now = millis();
+
+  // Of a hot-standby pair only the active master talks to the slaves
+  bool active = serviceFailover(now);
+  if (active) {
+    serviceOta();
+  }
+
+  // Keep the slaves' clocks locked to ours
+  if (active && now - lastSyncBeacon >= SYNC_BEACON_INTERVAL) {
+    lastSyncBeacon = now;
+    sendSyncBeacon();
+  }
+  if (active && partnered && now - lastTermAnnounce >= TERM_ANNOUNCE_INTERVAL) {
+    lastTermAnnounce = now;
+    sendTermAnnouncements();
+  }
+
+  // Stay on the router's channel, taking the slaves along
+  serviceChannel(now, active);
+
+  // Readings out to the plant's monitoring
+  serviceExport(now, active);
+
+  // Automation rules: re-run on new state, keep active overrides alive
+  if (active) {
+    runRules();
+    if (now - lastActionRefresh >= ACTION_REFRESH_INTERVAL) {
+      lastActionRefresh = now;
+      refreshActions();
+    }
+  }
+
+  // Blink LEDs to show the system is running: LED1 for 500 ms, pause, LED2 for 500 ms, pause.
+  // Timed from millis() so the loop never blocks the beacon.
+  int blinkPhase = (now / 500) % 4;
+  digitalWrite(LED1_PIN, blinkPhase == 0 ? HIGH : LOW);
+  digitalWrite(LED2_PIN, blinkPhase == 2 ? HIGH : LOW);
+  delay(10);
 }
\ No newline at end of file
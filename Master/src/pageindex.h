@@ -57,6 +57,34 @@ const char PAGEINDEX[] PROGMEM = R"rawliteral(
       color: #FF6347;
       font-style: italic;
     }
+
+    .status-box .link {
+      font-size: 14px;
+      color: #999;
+    }
+
+    .status-box .link.online {
+      color: #4CAF50;
+    }
+
+    .status-box .link.degraded {
+      color: #FFA500;
+    }
+
+    .status-box .link.offline {
+      color: #FF6347;
+    }
+
+    .alarm {
+      background-color: #FF6347;
+      color: #fff;
+      font-size: 22px;
+      font-weight: bold;
+      padding: 15px;
+      margin: 0 auto 20px;
+      border-radius: 15px;
+      max-width: 940px;
+    }
   </style>
   <script>
     // Function to fetch the latest data
@@ -64,42 +92,71 @@ const char PAGEINDEX[] PROGMEM = R"rawliteral(
   fetch("/status")
     .then(response => response.text())
     .then(data => {
-      const statusData = data.split(', ');
+      // "/status" is a list of "Key: Value" pairs
+      const statusData = {};
+      data.split(', ').forEach(field => {
+        const separator = field.indexOf(": ");
+        statusData[field.substring(0, separator)] = field.substring(separator + 2);
+      });
+
+      // Active alarms come first
+      showAlarms(statusData["Alarms"]);
 
       // Extract data for all slaves
-      const slave1Status = statusData[0].split(": ")[1];
-      const slave2Temp = statusData[1].split(": ")[1];
-      const slave2FanStatus = statusData[2].split(": ")[1];
-      const slave3WaterLevel = statusData[3].split(": ")[1];
-      const slave3RefillStatus = statusData[4].split(": ")[1];
-      const slave3SoilStatus = statusData[5].split(": ")[1];
-      const slave3PumpStatus = statusData[6].split(": ")[1]; // This will contain "Watering" or "Waiting for cooldown"
-      const remainingCooldown = statusData.length > 7 ? statusData[7].split(": ")[1] : "";
+      const slave1Status = statusData["Slave1_Light_Status"];
+      const slave2Temp = statusData["Slave2_Temperature"];
+      const slave2FanStatus = statusData["Slave2_Fan_Status"];
+      const slave3WaterLevel = statusData["Slave3_Water_Level"];
+      const slave3RefillStatus = statusData["Slave3_Water_Container"];
+      const slave3SoilStatus = statusData["Slave3_Soil_Status"];
+      const slave3PumpStatus = statusData["Slave3_Water_For_Plant"];
+      const remainingCooldown = statusData["Remaining cooldown"] || "";
+
+      // Values of a slave that is not online are the last ones it sent
+      const stale = link => link === "online" ? "" : " (stale)";
+      const slave1Stale = stale(statusData["Slave1_Link"]);
+      const slave2Stale = stale(statusData["Slave2_Link"]);
+      const slave3Stale = stale(statusData["Slave3_Link"]);
+      const linkElements = {
+        slave1Link: "Slave1_Link",
+        slave2Link: "Slave2_Link",
+        slave3WaterLink: "Slave3_Link",
+        slave3SoilLink: "Slave3_Link"
+      };
+      Object.keys(linkElements).forEach(id => {
+        const link = statusData[linkElements[id]];
+        const element = document.getElementById(id);
+        element.innerText = "Link: " + link;
+        element.className = "link " + link;
+      });
 
       // Update the content dynamically
-      document.getElementById("slave1Status").innerText = "Light Status: " + slave1Status;
-      document.getElementById("slave2Temp").innerText = "Temperature: " + slave2Temp + " °C";
-      document.getElementById("slave2FanStatus").innerText = "Fan Status: " + slave2FanStatus;
-      document.getElementById("slave3WaterLevel").innerText = "Water Level: " + slave3WaterLevel;
-      document.getElementById("slave3RefillStatus").innerText = "Water Container: " + slave3RefillStatus;
+      document.getElementById("slave1Status").innerText = "Light Status: " + slave1Status + slave1Stale;
+      document.getElementById("slave2Temp").innerText = "Temperature: " + slave2Temp + " °C" + slave2Stale;
+      document.getElementById("slave2FanStatus").innerText = "Fan Status: " + slave2FanStatus + slave2Stale;
+      document.getElementById("slave3WaterLevel").innerText = "Water Level: " + slave3WaterLevel + slave3Stale;
+      document.getElementById("slave3RefillStatus").innerText = "Water Container: " + slave3RefillStatus + slave3Stale;
 
       // Handle soil status and pump status with cooldown logic
       if (slave3SoilStatus === "Dry") {
-        if (remainingCooldown) {
-          document.getElementById("slave3SoilStatus").innerText = "Soil Status: Dry (Waiting for cooldown)";
-          document.getElementById("slave3PumpStatus").innerText = "Water for plant: Waiting for cooldown";
+        if (slave3PumpStatus.indexOf("held by an automation rule") >= 0) {
+          document.getElementById("slave3SoilStatus").innerText = "Soil Status: Dry (Held by rule)" + slave3Stale;
+          document.getElementById("slave3PumpStatus").innerText = "Water for plant: Held by rule" + slave3Stale;
+        } else if (remainingCooldown) {
+          document.getElementById("slave3SoilStatus").innerText = "Soil Status: Dry (Waiting for cooldown)" + slave3Stale;
+          document.getElementById("slave3PumpStatus").innerText = "Water for plant: Waiting for cooldown" + slave3Stale;
         } else {
-          document.getElementById("slave3SoilStatus").innerText = "Soil Status: Dry (Watering)";
-          document.getElementById("slave3PumpStatus").innerText = "Water for plant: Watering";
+          document.getElementById("slave3SoilStatus").innerText = "Soil Status: Dry (Watering)" + slave3Stale;
+          document.getElementById("slave3PumpStatus").innerText = "Water for plant: Watering" + slave3Stale;
         }
       } else {
-        document.getElementById("slave3SoilStatus").innerText = "Soil Status: " + slave3SoilStatus;
-        document.getElementById("slave3PumpStatus").innerText = "Water for plant: " + slave3PumpStatus;
+        document.getElementById("slave3SoilStatus").innerText = "Soil Status: " + slave3SoilStatus + slave3Stale;
+        document.getElementById("slave3PumpStatus").innerText = "Water for plant: " + slave3PumpStatus + slave3Stale;
       }
 
       // Show remaining cooldown message if it exists
       if (remainingCooldown) {
-        document.getElementById("cooldownMessage").innerText = "Remaining cooldown: " + remainingCooldown + " seconds";
+        document.getElementById("cooldownMessage").innerText = "Remaining cooldown: " + remainingCooldown;
         document.getElementById("cooldownMessage").style.display = "block";
       } else {
         document.getElementById("cooldownMessage").style.display = "none";  // Hide if no cooldown
@@ -108,30 +165,57 @@ const char PAGEINDEX[] PROGMEM = R"rawliteral(
     .catch(error => console.error('Error fetching data:', error));
 }
 
+    // Show the active alarms ("none" or a space-separated list)
+    function showAlarms(alarms) {
+      const banner = document.getElementById("alarmBanner");
+      if (alarms && alarms !== "none") {
+        banner.innerText = "Alarm: " + alarms.split(" ").join(", ").replace(/_/g, " ");
+        banner.style.display = "block";
+      } else {
+        banner.style.display = "none";
+      }
+    }
+
     // Call fetchData every 2 seconds
     setInterval(fetchData, 2000);
+
+    // Alarms are pushed as they happen, without waiting for the next poll
+    if (window.EventSource) {
+      const events = new EventSource("/events");
+      events.addEventListener("alarm", event => {
+        const [name, state] = event.data.split(" ");
+        if (state === "raised") {
+          showAlarms(name);
+        }
+        fetchData();
+      });
+    }
   </script>
 </head>
 <body>
   <div class="container">
     <h1>Green Green Grass of Home</h1>
+    <div id="alarmBanner" class="alarm" style="display:none;"></div>
     <div class="status-container">
       <div class="status-box">
         <h2>ESP-A</h2>
         <h2>LDR Sensor</h2>
         <p id="slave1Status">Light Status: Loading...</p>
+        <p id="slave1Link" class="link">Link: Loading...</p>
       </div>
       <div class="status-box">
         <h2>ESP-B</h2>
         <h2>DHT11</h2>
         <p id="slave2Temp">Temperature: Loading...</p>
         <p id="slave2FanStatus">Fan Status: Loading...</p>
+        <p id="slave2Link" class="link">Link: Loading...</p>
       </div>
       <div class="status-box">
         <h2>ESP-C.1</h2>
         <h2>Water Sensor</h2>
         <p id="slave3WaterLevel">Water Level: Loading...</p>
         <p id="slave3RefillStatus">Water Container: Loading...</p>
+        <p id="slave3WaterLink" class="link">Link: Loading...</p>
       </div>
 
       <div class="status-box">
@@ -140,6 +224,7 @@ const char PAGEINDEX[] PROGMEM = R"rawliteral(
         <p id="slave3SoilStatus">Soil Status: Loading...</p>
         <p id="slave3PumpStatus">Water for plant: %WATER_FOR_PLANT%</p>
         <p id="cooldownMessage" class="cooldown" style="display:none;"></p> <!-- Cooldown message -->
+        <p id="slave3SoilLink" class="link">Link: Loading...</p>
       </div>
     </div>
   </div>
@@ -0,0 +1,104 @@
+#ifndef PEER_LIVENESS_H
+#define PEER_LIVENESS_H
+
+#include <stdint.h>
+
+// Peer liveness tracking
+//
+// Every slave reports on its own fixed interval, so silence is the only sign
+// that a node has died. Each peer learns its normal inter-arrival time with
+// the same smoothed mean / mean-deviation estimator TCP uses for its RTO
+// (RFC 6298), and is only declared late once the silence exceeds what that
+// distribution explains. Pure C++ with the clock passed in, so it can be
+// driven from a host simulator with synthetic arrival traces.
+
+// Tuning
+#define LIVENESS_DEFAULT_INTERVAL_MS 1000 // Assumed interval before the first sample
+#define LIVENESS_DEV_FACTOR 4             // Timeout = mean + 4 * deviation
+#define LIVENESS_MIN_TIMEOUT_MS 1500      // Never suspect a peer sooner than this
+#define LIVENESS_OFFLINE_FACTOR 3         // Offline after 3 timeouts of silence
+
+enum PeerState {PEER_OFFLINE, PEER_DEGRADED, PEER_ONLINE};
+
+typedef struct peer_liveness {
+  unsigned long lastSeen;   // Clock of the last frame, in ms
+  uint32_t frames;          // Frames received since boot
+  uint32_t samples;         // Inter-arrival samples fed to the estimator
+  float meanInterval;       // Smoothed inter-arrival time, in ms
+  float devInterval;        // Smoothed mean deviation of the inter-arrival time, in ms
+  PeerState state;
+  uint32_t offlineEvents;   // Transitions into PEER_OFFLINE
+} peer_liveness;
+
+// Reset a peer to "never heard from" at boot time `now`
+inline void livenessInit(peer_liveness &peer, unsigned long now) {
+  peer.lastSeen = now;
+  peer.frames = 0;
+  peer.samples = 0;
+  peer.meanInterval = LIVENESS_DEFAULT_INTERVAL_MS;
+  peer.devInterval = LIVENESS_DEFAULT_INTERVAL_MS / 2;
+  peer.state = PEER_OFFLINE;
+  peer.offlineEvents = 0;
+}
+
+// Silence after which the peer counts as degraded
+inline unsigned long livenessTimeout(const peer_liveness &peer) {
+  unsigned long timeout = (unsigned long)(peer.meanInterval + LIVENESS_DEV_FACTOR * peer.devInterval);
+  return timeout < LIVENESS_MIN_TIMEOUT_MS ? LIVENESS_MIN_TIMEOUT_MS : timeout;
+}
+
+// Record a frame from the peer at time `now`
+inline void livenessOnFrame(peer_liveness &peer, unsigned long now) {
+  // The gap that ends an outage says nothing about the normal interval
+  if (peer.frames > 0 && peer.state != PEER_OFFLINE) {
+    float interval = (float)(now - peer.lastSeen);
+    if (peer.samples == 0) {
+      peer.meanInterval = interval;
+      peer.devInterval = interval / 2;
+    } else {
+      float error = interval - peer.meanInterval;
+      peer.meanInterval += error / 8;
+      peer.devInterval += ((error < 0 ? -error : error) - peer.devInterval) / 4;
+    }
+    peer.samples++;
+  }
+  peer.lastSeen = now;
+  peer.frames++;
+  peer.state = PEER_ONLINE;
+}
+
+// Re-evaluate the peer at time `now`; returns true if its state changed
+inline bool livenessEvaluate(peer_liveness &peer, unsigned long now) {
+  unsigned long silence = now - peer.lastSeen;
+  unsigned long timeout = livenessTimeout(peer);
+  PeerState state;
+  if (peer.frames == 0 || silence > timeout * LIVENESS_OFFLINE_FACTOR) {
+    state = PEER_OFFLINE;
+  } else if (silence > timeout) {
+    state = PEER_DEGRADED;
+  } else {
+    state = PEER_ONLINE;
+  }
+
+  if (state == peer.state) {
+    return false;
+  }
+  if (state == PEER_OFFLINE) {
+    peer.offlineEvents++;
+  }
+  peer.state = state;
+  return true;
+}
+
+inline const char *peerStateName(PeerState state) {
+  switch (state) {
+    case PEER_ONLINE:
+      return "online";
+    case PEER_DEGRADED:
+      return "degraded";
+    default:
+      return "offline";
+  }
+}
+
+#endif
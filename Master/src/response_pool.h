@@ -0,0 +1,210 @@
+#ifndef RESPONSE_POOL_H
+#define RESPONSE_POOL_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <stdarg.h>
+
+// Heap-free web responses
+//
+// Every endpoint owns a small pool of fixed buffers that it renders into, so
+// the request path never allocates from the general heap. A buffer stays
+// pinned while any response is still streaming from it; rendering always
+// goes to a free buffer, so an update never tears a response in flight.
+// A response can wrap the rendered text in static prefix/suffix text that is
+// streamed straight from flash (used for the HTML page).
+
+#define RESPONSE_POOL_SIZE 3 // Buffers per endpoint: one to render into plus responses in flight
+
+// Bounded text writer over a fixed buffer
+typedef struct text_writer {
+  char *data;
+  size_t capacity;
+  size_t length;
+  bool truncated;     // Set once something did not fit
+} text_writer;
+
+// printf into the writer; output that does not fit is dropped
+inline void writeText(text_writer &out, const char *format, ...) {
+  if (out.length + 1 >= out.capacity) {
+    out.truncated = true;
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(out.data + out.length, out.capacity - out.length, format, args);
+  va_end(args);
+  if (written < 0) {
+    return;
+  }
+  if ((size_t)written >= out.capacity - out.length) {
+    out.length = out.capacity - 1;
+    out.truncated = true;
+  } else {
+    out.length += written;
+  }
+}
+
+struct response_cache;
+
+typedef struct response_buffer {
+  char *data;
+  size_t capacity;
+  size_t length;
+  uint32_t generation;           // State generation the text was rendered from
+  uint8_t users;                 // Responses still streaming from this buffer
+  struct response_cache *cache;  // Owner, for the static prefix/suffix
+} response_buffer;
+
+// Rendered response for one endpoint, keyed by state generation
+typedef struct response_cache {
+  const char *contentType;
+  void (*render)(text_writer &out);
+  bool cacheable;                // false: render on every request (e.g. /metrics)
+  const char *prefix;            // Static text sent before the rendered part (flash)
+  size_t prefixLength;
+  const char *suffix;            // Static text sent after the rendered part (flash)
+  size_t suffixLength;
+  response_buffer buffers[RESPONSE_POOL_SIZE];
+  response_buffer *current;      // Most recently rendered buffer
+  uint32_t hits;                 // Requests served straight from current
+  uint32_t rebuilds;             // Requests that had to re-render
+  uint32_t poolExhausted;        // Re-renders skipped because every buffer was in flight
+  uint32_t truncations;          // Renders that did not fit their buffer
+  unsigned long lastRebuildMicros;
+  unsigned long maxRebuildMicros;
+  uint64_t totalRebuildMicros;
+} response_cache;
+
+// Attach `storage` (RESPONSE_POOL_SIZE * capacity bytes) to a cache
+inline void responseCacheInit(response_cache &cache, char *storage, size_t capacity,
+                              const char *contentType, void (*render)(text_writer &), bool cacheable) {
+  memset(&cache, 0, sizeof(cache));
+  cache.contentType = contentType;
+  cache.render = render;
+  cache.cacheable = cacheable;
+  for (int i = 0; i < RESPONSE_POOL_SIZE; i++) {
+    cache.buffers[i].data = storage + i * capacity;
+    cache.buffers[i].capacity = capacity;
+    cache.buffers[i].cache = &cache;
+  }
+}
+
+// Static text around the rendered part
+inline void responseCacheWrap(response_cache &cache, const char *prefix, size_t prefixLength,
+                              const char *suffix, size_t suffixLength) {
+  cache.prefix = prefix;
+  cache.prefixLength = prefixLength;
+  cache.suffix = suffix;
+  cache.suffixLength = suffixLength;
+}
+
+// Pin a buffer holding text for `generation`, re-rendering only if needed.
+// Returns nullptr only if nothing was ever rendered and the pool is busy.
+// Must be paired with responseRelease().
+inline response_buffer *responseAcquire(response_cache &cache, uint32_t generation) {
+  response_buffer *buffer = cache.current;
+  if (cache.cacheable && buffer != nullptr && buffer->generation == generation) {
+    cache.hits++;
+    buffer->users++;
+    return buffer;
+  }
+
+  response_buffer *fresh = nullptr;
+  for (int i = 0; i < RESPONSE_POOL_SIZE; i++) {
+    if (cache.buffers[i].users == 0 && &cache.buffers[i] != cache.current) {
+      fresh = &cache.buffers[i];
+      break;
+    }
+  }
+  if (fresh == nullptr && cache.current != nullptr && cache.current->users == 0) {
+    fresh = cache.current;
+  }
+
+  if (fresh == nullptr) {
+    // Every buffer is still streaming; the last render is the best we have
+    cache.poolExhausted++;
+    if (buffer != nullptr) {
+      buffer->users++;
+    }
+    return buffer;
+  }
+
+  unsigned long start = micros();
+  text_writer out = {fresh->data, fresh->capacity, 0, false};
+  cache.render(out);
+  unsigned long elapsed = micros() - start;
+
+  fresh->length = out.length;
+  fresh->generation = generation;
+  fresh->users = 1;
+  cache.current = fresh;
+  cache.rebuilds++;
+  if (out.truncated) {
+    cache.truncations++;
+  }
+  cache.lastRebuildMicros = elapsed;
+  cache.totalRebuildMicros += elapsed;
+  if (elapsed > cache.maxRebuildMicros) {
+    cache.maxRebuildMicros = elapsed;
+  }
+  return fresh;
+}
+
+inline void responseRelease(response_buffer *buffer) {
+  if (buffer != nullptr && buffer->users > 0) {
+    buffer->users--;
+  }
+}
+
+// Full body length: prefix + rendered text + suffix
+inline size_t responseLength(const response_buffer *buffer) {
+  return buffer->cache->prefixLength + buffer->length + buffer->cache->suffixLength;
+}
+
+// Copy up to maxLen body bytes starting at `index` into `out`
+inline size_t responseFill(const response_buffer *buffer, uint8_t *out, size_t maxLen, size_t index) {
+  const response_cache *cache = buffer->cache;
+  const char *segments[3] = {cache->prefix, buffer->data, cache->suffix};
+  size_t lengths[3] = {cache->prefixLength, buffer->length, cache->suffixLength};
+
+  size_t written = 0;
+  for (int i = 0; i < 3 && written < maxLen; i++) {
+    if (index >= lengths[i]) {
+      index -= lengths[i];
+      continue;
+    }
+    size_t chunk = lengths[i] - index;
+    if (chunk > maxLen - written) {
+      chunk = maxLen - written;
+    }
+    memcpy_P(out + written, segments[i] + index, chunk);
+    written += chunk;
+    index = 0;
+  }
+  return written;
+}
+
+// Answer `request` from the cache. The buffer is released when the client
+// goes away, or, given `held`, left there for the caller's disconnect
+// handler to release; a request keeps a single one.
+inline void serveCached(AsyncWebServerRequest *request, response_cache &cache, uint32_t generation,
+                        response_buffer **held = nullptr) {
+  response_buffer *buffer = responseAcquire(cache, generation);
+  if (buffer == nullptr) {
+    request->send(503);
+    return;
+  }
+
+  if (held != nullptr) {
+    *held = buffer;
+  } else {
+    request->onDisconnect([buffer]() { responseRelease(buffer); });
+  }
+  request->send(request->beginResponse(cache.contentType, responseLength(buffer),
+    [buffer](uint8_t *out, size_t maxLen, size_t index) -> size_t {
+      return responseFill(buffer, out, maxLen, index);
+    }));
+}
+
+#endif
@@ -0,0 +1,506 @@
+#ifndef RULE_ENGINE_H
+#define RULE_ENGINE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Automation rules
+//
+// Cross-sensor control logic lives on the master as a short list of rules,
+// one per line:
+//
+//   # comment
+//   if refilling then watering off else watering auto
+//   if temperature > 35 and not fan then fan on
+//
+// A condition compares channels (values decoded from the slave frames) and
+// numbers with < <= > >= == !=, combined with and / or / not and parentheses.
+// `on`/`true` are 1 and `off`/`false` are 0; a bare channel is true when
+// non-zero. Each rule compiles to a few bytes of stack bytecode. Rules are
+// indexed by the channels they read, so a frame only re-runs the rules whose
+// inputs actually changed. A rule without `else` asserts nothing while its
+// condition is false. When several rules drive the same target, the last one
+// that asserts something wins; with none asserting, the target is `auto`
+// (the slave's own local logic).
+//
+// Pure C++ with static storage, so it compiles and benchmarks on the host.
+
+#define RULE_MAX_RULES 256    // Rules per program
+#define RULE_CODE_SIZE 6144   // Bytecode bytes for all rules
+#define RULE_INDEX_SIZE 1024  // (channel, rule) pairs in the input index
+#define RULE_STACK_SIZE 16    // Evaluation stack depth
+#define RULE_LINE_SIZE 160    // Longest rule line
+
+// Channels rules can read
+enum RuleChannel {
+  CH_LDR,            // Slave 1 LDR reading
+  CH_LIGHT,          // Slave 1 light mode: 0 off, 1 dim, 2 on
+  CH_TEMPERATURE,    // Slave 2 temperature, °C
+  CH_FAN,            // Slave 2 fan relay: 1 on
+  CH_SOIL,           // Slave 3 soil moisture reading
+  CH_SOIL_DRY,       // 1 when the soil is dry
+  CH_WATER_LEVEL,    // Slave 3 water level reading
+  CH_REFILLING,      // 1 while the container refills
+  CH_WATERING,       // 1 while the watering pump runs
+  CH_COOLDOWN,       // Seconds until watering is allowed again
+  CH_SLAVE1_ONLINE,  // 1 while the slave is online
+  CH_SLAVE2_ONLINE,
+  CH_SLAVE3_ONLINE,
+  CH_COUNT
+};
+
+static const char *const ruleChannelNames[CH_COUNT] = {
+  "ldr", "light", "temperature", "fan", "soil", "soil_dry", "water_level",
+  "refilling", "watering", "cooldown", "slave1_online", "slave2_online", "slave3_online"
+};
+
+// Outputs rules can drive, one per actuator
+enum RuleTarget {TARGET_LIGHT, TARGET_FAN, TARGET_WATERING, TARGET_REFILL, TARGET_COUNT};
+
+static const char *const ruleTargetNames[TARGET_COUNT] = {"light", "fan", "watering", "refill"};
+
+// Values a target can be set to
+enum RuleValue : uint8_t {VALUE_AUTO, VALUE_OFF, VALUE_ON, VALUE_DIM, VALUE_COUNT, VALUE_NONE = 0xFF};
+
+static const char *const ruleValueNames[VALUE_COUNT] = {"auto", "off", "on", "dim"};
+
+// Which values each target accepts (bit per RuleValue)
+static const uint8_t ruleTargetValues[TARGET_COUNT] = {
+  (1 << VALUE_AUTO) | (1 << VALUE_OFF) | (1 << VALUE_ON) | (1 << VALUE_DIM),  // light
+  (1 << VALUE_AUTO) | (1 << VALUE_OFF) | (1 << VALUE_ON),                     // fan
+  (1 << VALUE_AUTO) | (1 << VALUE_OFF),                                       // watering: off holds it
+  (1 << VALUE_AUTO) | (1 << VALUE_OFF),                                       // refill: off holds it
+};
+
+enum RuleOp : uint8_t {
+  OP_CONST,  // followed by a 4-byte float
+  OP_LOAD,   // followed by a channel byte
+  OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+  OP_AND, OP_OR, OP_NOT
+};
+
+typedef struct rule_entry {
+  uint16_t codeOffset;
+  uint16_t codeLength;
+  uint8_t target;
+  uint8_t thenValue;
+  uint8_t elseValue;      // VALUE_NONE without an else branch
+  uint8_t output;         // Value currently asserted, VALUE_NONE if none
+  uint32_t lastPass;      // Evaluation pass that last ran this rule
+} rule_entry;
+
+typedef struct rule_program {
+  rule_entry rules[RULE_MAX_RULES];
+  uint16_t ruleCount;
+  uint8_t code[RULE_CODE_SIZE];
+  uint16_t codeLength;
+  uint16_t indexStart[CH_COUNT + 1];  // Rules reading channel c: index[indexStart[c]..indexStart[c+1])
+  uint16_t index[RULE_INDEX_SIZE];
+  uint16_t indexLength;
+  uint32_t ruleInputs[RULE_MAX_RULES]; // Channel bitmask per rule, only needed while building the index
+  float channels[CH_COUNT];
+  uint32_t changedChannels;           // Bitmask of channels changed since the last pass
+  uint32_t pass;
+  uint8_t targets[TARGET_COUNT];      // Effective value per target
+  uint32_t lastEvaluated;             // Rules run by the last pass
+} rule_program;
+
+// Tokenizer / parser state for one line
+typedef struct rule_parser {
+  rule_program *program;
+  const char *cursor;
+  char token[24];
+  bool isNumber;
+  int depth;           // Current stack depth
+  int maxDepth;
+  uint32_t inputs;     // Channels read by the rule being compiled
+  char *error;
+  size_t errorSize;
+  int line;
+  bool failed;
+} rule_parser;
+
+inline void ruleFail(rule_parser &p, const char *message) {
+  if (!p.failed) {
+    snprintf(p.error, p.errorSize, "line %d: %s", p.line, message);
+    p.failed = true;
+  }
+}
+
+inline void ruleNextToken(rule_parser &p) {
+  while (*p.cursor == ' ' || *p.cursor == '\t') {
+    p.cursor++;
+  }
+  p.isNumber = false;
+  size_t n = 0;
+  const char *c = p.cursor;
+  if (*c == '\0' || *c == '#' || *c == '\r' || *c == '\n') {
+    p.token[0] = '\0';
+    return;
+  }
+  if (isdigit((unsigned char)*c) || *c == '-' || *c == '.') {
+    char *end;
+    strtod(c, &end);
+    if (end == c) {
+      end = (char *)c + 1;
+    }
+    n = end - c;
+    p.isNumber = true;
+  } else if (isalpha((unsigned char)*c) || *c == '_') {
+    while (isalnum((unsigned char)c[n]) || c[n] == '_') {
+      n++;
+    }
+  } else if ((c[0] == '<' || c[0] == '>' || c[0] == '=' || c[0] == '!') && c[1] == '=') {
+    n = 2;
+  } else {
+    n = 1;
+  }
+  if (n >= sizeof(p.token)) {
+    ruleFail(p, "token too long");
+    n = sizeof(p.token) - 1;
+  }
+  memcpy(p.token, c, n);
+  p.token[n] = '\0';
+  p.cursor = c + n;
+}
+
+inline bool ruleAccept(rule_parser &p, const char *token) {
+  if (strcmp(p.token, token) == 0) {
+    ruleNextToken(p);
+    return true;
+  }
+  return false;
+}
+
+inline void ruleEmit(rule_parser &p, const void *bytes, size_t length) {
+  rule_program &prog = *p.program;
+  if (prog.codeLength + length > RULE_CODE_SIZE) {
+    ruleFail(p, "rule code space exhausted");
+    return;
+  }
+  memcpy(prog.code + prog.codeLength, bytes, length);
+  prog.codeLength += length;
+}
+
+inline void ruleEmitOp(rule_parser &p, uint8_t op, int stackChange) {
+  ruleEmit(p, &op, 1);
+  p.depth += stackChange;
+  if (p.depth > p.maxDepth) {
+    p.maxDepth = p.depth;
+  }
+}
+
+inline int ruleFindName(const char *const *names, int count, const char *name) {
+  for (int i = 0; i < count; i++) {
+    if (strcmp(names[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+inline void ruleParseOr(rule_parser &p);
+
+inline void ruleParseOperand(rule_parser &p) {
+  if (ruleAccept(p, "(")) {
+    ruleParseOr(p);
+    if (!ruleAccept(p, ")")) {
+      ruleFail(p, "expected )");
+    }
+    return;
+  }
+
+  float constant;
+  if (p.isNumber) {
+    constant = strtof(p.token, nullptr);
+  } else if (strcmp(p.token, "on") == 0 || strcmp(p.token, "true") == 0) {
+    constant = 1;
+  } else if (strcmp(p.token, "off") == 0 || strcmp(p.token, "false") == 0) {
+    constant = 0;
+  } else {
+    int channel = ruleFindName(ruleChannelNames, CH_COUNT, p.token);
+    if (channel < 0) {
+      ruleFail(p, p.token[0] ? "unknown channel" : "expected a value");
+      return;
+    }
+    uint8_t load[2] = {OP_LOAD, (uint8_t)channel};
+    ruleEmit(p, load, sizeof(load));
+    p.depth++;
+    if (p.depth > p.maxDepth) {
+      p.maxDepth = p.depth;
+    }
+    p.inputs |= 1UL << channel;
+    ruleNextToken(p);
+    return;
+  }
+
+  ruleEmitOp(p, OP_CONST, 1);
+  ruleEmit(p, &constant, sizeof(constant));
+  ruleNextToken(p);
+}
+
+inline void ruleParseCompare(rule_parser &p) {
+  static const char *const relations[] = {"<", "<=", ">", ">=", "==", "!="};
+  ruleParseOperand(p);
+  for (int i = 0; i < 6; i++) {
+    if (ruleAccept(p, relations[i])) {
+      ruleParseOperand(p);
+      ruleEmitOp(p, OP_LT + i, -1);
+      return;
+    }
+  }
+}
+
+inline void ruleParseNot(rule_parser &p) {
+  if (ruleAccept(p, "not")) {
+    ruleParseNot(p);
+    ruleEmitOp(p, OP_NOT, 0);
+  } else {
+    ruleParseCompare(p);
+  }
+}
+
+inline void ruleParseAnd(rule_parser &p) {
+  ruleParseNot(p);
+  while (!p.failed && ruleAccept(p, "and")) {
+    ruleParseNot(p);
+    ruleEmitOp(p, OP_AND, -1);
+  }
+}
+
+inline void ruleParseOr(rule_parser &p) {
+  ruleParseAnd(p);
+  while (!p.failed && ruleAccept(p, "or")) {
+    ruleParseAnd(p);
+    ruleEmitOp(p, OP_OR, -1);
+  }
+}
+
+// Parse "<target> <value>"; the target must match `target` unless it is -1
+inline int ruleParseAction(rule_parser &p, int target, uint8_t &value) {
+  int found = ruleFindName(ruleTargetNames, TARGET_COUNT, p.token);
+  if (found < 0) {
+    ruleFail(p, "unknown target");
+    return -1;
+  }
+  if (target >= 0 && found != target) {
+    ruleFail(p, "then and else must drive the same target");
+    return -1;
+  }
+  ruleNextToken(p);
+  int v = ruleFindName(ruleValueNames, VALUE_COUNT, p.token);
+  if (v < 0 || !(ruleTargetValues[found] & (1 << v))) {
+    ruleFail(p, "value not supported by this target");
+    return -1;
+  }
+  value = (uint8_t)v;
+  ruleNextToken(p);
+  return found;
+}
+
+// Start compiling a new program; clears all rules and runtime state
+inline void rulesBegin(rule_program &prog) {
+  memset(&prog, 0, sizeof(prog));
+  for (int t = 0; t < TARGET_COUNT; t++) {
+    prog.targets[t] = VALUE_AUTO;
+  }
+}
+
+// Compile one source line (blank lines and comments are fine). Returns false
+// and fills `error` if the line is invalid; the program is then unusable
+// until rulesBegin().
+inline bool rulesAddLine(rule_program &prog, const char *line, int lineNumber, char *error, size_t errorSize) {
+  rule_parser p;
+  memset(&p, 0, sizeof(p));
+  p.program = &prog;
+  p.cursor = line;
+  p.error = error;
+  p.errorSize = errorSize;
+  p.line = lineNumber;
+
+  ruleNextToken(p);
+  if (p.token[0] == '\0') {
+    return true;
+  }
+  if (prog.ruleCount >= RULE_MAX_RULES) {
+    ruleFail(p, "too many rules");
+    return false;
+  }
+  if (!ruleAccept(p, "if")) {
+    ruleFail(p, "expected if");
+    return false;
+  }
+
+  rule_entry &rule = prog.rules[prog.ruleCount];
+  rule.codeOffset = prog.codeLength;
+  ruleParseOr(p);
+  rule.codeLength = prog.codeLength - rule.codeOffset;
+
+  if (!p.failed && !ruleAccept(p, "then")) {
+    ruleFail(p, "expected then");
+  }
+  int target = -1;
+  if (!p.failed) {
+    target = ruleParseAction(p, -1, rule.thenValue);
+  }
+  rule.elseValue = VALUE_NONE;
+  if (!p.failed && ruleAccept(p, "else")) {
+    ruleParseAction(p, target, rule.elseValue);
+  }
+  if (!p.failed && p.token[0] != '\0') {
+    ruleFail(p, "unexpected text after rule");
+  }
+  if (!p.failed && p.maxDepth > RULE_STACK_SIZE) {
+    ruleFail(p, "condition nested too deeply");
+  }
+  if (p.failed) {
+    return false;
+  }
+
+  rule.target = (uint8_t)target;
+  rule.output = VALUE_NONE;
+  prog.ruleInputs[prog.ruleCount] = p.inputs;
+  prog.ruleCount++;
+  return true;
+}
+
+// Build the channel -> rules index once all lines are added
+inline bool rulesFinish(rule_program &prog, char *error, size_t errorSize) {
+  uint16_t length = 0;
+  for (int c = 0; c < CH_COUNT; c++) {
+    prog.indexStart[c] = length;
+    for (int r = 0; r < prog.ruleCount; r++) {
+      if (prog.ruleInputs[r] & (1UL << c)) {
+        if (length >= RULE_INDEX_SIZE) {
+          snprintf(error, errorSize, "rules read too many channels in total");
+          return false;
+        }
+        prog.index[length++] = r;
+      }
+    }
+  }
+  prog.indexStart[CH_COUNT] = length;
+  prog.indexLength = length;
+
+  // Every channel counts as changed so the first pass evaluates all rules
+  prog.changedChannels = (1UL << CH_COUNT) - 1;
+  return true;
+}
+
+// Update a channel; rules reading it run on the next rulesEvaluate()
+inline void rulesSetChannel(rule_program &prog, int channel, float value) {
+  if (prog.channels[channel] != value) {
+    prog.channels[channel] = value;
+    prog.changedChannels |= 1UL << channel;
+  }
+}
+
+inline bool ruleRun(const rule_program &prog, const rule_entry &rule) {
+  float stack[RULE_STACK_SIZE];
+  int top = 0;
+  const uint8_t *pc = prog.code + rule.codeOffset;
+  const uint8_t *end = pc + rule.codeLength;
+  while (pc < end) {
+    uint8_t op = *pc++;
+    switch (op) {
+      case OP_CONST:
+        memcpy(&stack[top++], pc, sizeof(float));
+        pc += sizeof(float);
+        break;
+      case OP_LOAD:
+        stack[top++] = prog.channels[*pc++];
+        break;
+      case OP_NOT:
+        stack[top - 1] = stack[top - 1] == 0;
+        break;
+      default: {
+        float b = stack[--top];
+        float a = stack[top - 1];
+        bool result = false;
+        switch (op) {
+          case OP_LT: result = a < b; break;
+          case OP_LE: result = a <= b; break;
+          case OP_GT: result = a > b; break;
+          case OP_GE: result = a >= b; break;
+          case OP_EQ: result = a == b; break;
+          case OP_NE: result = a != b; break;
+          case OP_AND: result = a != 0 && b != 0; break;
+          case OP_OR: result = a != 0 || b != 0; break;
+        }
+        stack[top - 1] = result;
+        break;
+      }
+    }
+  }
+  return top > 0 && stack[top - 1] != 0;
+}
+
+// Run the rules whose inputs changed and re-resolve the targets they drive.
+// Returns a bitmask of targets whose effective value changed.
+inline uint32_t rulesEvaluate(rule_program &prog) {
+  uint32_t changed = prog.changedChannels;
+  prog.changedChannels = 0;
+  prog.lastEvaluated = 0;
+  if (changed == 0) {
+    return 0;
+  }
+  bool firstPass = (prog.pass == 0);
+  prog.pass++;
+
+  // The first pass runs everything, including rules that read no channel
+  uint32_t touchedTargets = 0;
+  for (int c = firstPass ? CH_COUNT : 0; c <= CH_COUNT; c++) {
+    uint16_t start, end;
+    if (c == CH_COUNT) {
+      if (!firstPass) {
+        break;
+      }
+      start = 0;
+      end = prog.ruleCount;
+    } else if (changed & (1UL << c)) {
+      start = prog.indexStart[c];
+      end = prog.indexStart[c + 1];
+    } else {
+      continue;
+    }
+
+    for (uint16_t i = start; i < end; i++) {
+      rule_entry &rule = prog.rules[c == CH_COUNT ? i : prog.index[i]];
+      if (rule.lastPass == prog.pass) {
+        continue;  // Already run for another changed input
+      }
+      rule.lastPass = prog.pass;
+      prog.lastEvaluated++;
+      uint8_t output = ruleRun(prog, rule) ? rule.thenValue : rule.elseValue;
+      if (output != rule.output) {
+        rule.output = output;
+        touchedTargets |= 1UL << rule.target;
+      }
+    }
+  }
+
+  // Last asserting rule wins; only targets with a changed rule output are re-resolved
+  uint32_t changedTargets = 0;
+  for (int t = 0; t < TARGET_COUNT; t++) {
+    if (!(touchedTargets & (1UL << t))) {
+      continue;
+    }
+    uint8_t value = VALUE_AUTO;
+    for (int r = prog.ruleCount - 1; r >= 0; r--) {
+      if (prog.rules[r].target == t && prog.rules[r].output != VALUE_NONE) {
+        value = prog.rules[r].output;
+        break;
+      }
+    }
+    if (value != prog.targets[t]) {
+      prog.targets[t] = value;
+      changedTargets |= 1UL << t;
+    }
+  }
+  return changedTargets;
+}
+
+#endif
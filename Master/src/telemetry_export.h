@@ -0,0 +1,213 @@
+#ifndef TELEMETRY_EXPORT_H
+#define TELEMETRY_EXPORT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Telemetry export
+//
+// Every channel reading the master takes in is also queued for the plant's
+// monitoring, which gets it over the STA link by MQTT, UDP or both instead
+// of scraping /status. Readings wait in a fixed ring and leave in batches:
+// once EXPORT_FLUSH_SAMPLES readings are waiting, or the oldest has waited
+// EXPORT_FLUSH_MS, they go out as one compact text message. When the uplink
+// is slower than the readings, or down, the ring fills and then either new
+// readings are dropped or the oldest make way for them; memory stays fixed
+// and the receive path never waits for the uplink. A batch only leaves the
+// ring once it was handed to the uplink. The batch format and the few MQTT
+// packets needed (CONNECT, PUBLISH at QoS 0, PINGREQ) are encoded here in
+// pure C++, so they can be checked on the host.
+//
+// A batch message is one header line and one line per reading:
+//   greenhouse <batch> <sent_ms> <dropped>
+//   <channel> <value> <time_ms>
+// with times in the master's millis() timebase and `dropped` the readings
+// lost to a full ring since boot.
+
+#ifndef EXPORT_QUEUE_SIZE
+#define EXPORT_QUEUE_SIZE 256        // Readings waiting for the uplink
+#endif
+#ifndef EXPORT_FLUSH_SAMPLES
+#define EXPORT_FLUSH_SAMPLES 32      // Readings per batch
+#endif
+#ifndef EXPORT_FLUSH_MS
+#define EXPORT_FLUSH_MS 1000         // Longest a reading waits for its batch to fill
+#endif
+#define EXPORT_DROP_NEWEST 0         // Full ring: new readings are dropped
+#define EXPORT_DROP_OLDEST 1         // Full ring: the oldest reading makes way
+#ifndef EXPORT_DROP_POLICY
+#define EXPORT_DROP_POLICY EXPORT_DROP_OLDEST
+#endif
+#define EXPORT_MESSAGE_SIZE 1024     // Largest batch message
+#define EXPORT_LINE_SIZE 48          // Room one reading's line may need
+
+typedef struct export_sample {
+  uint32_t time;            // When the reading was taken, master timebase
+  uint32_t queuedAt;        // millis() when it was queued, for the flush deadline
+  float value;
+  uint8_t channel;
+} export_sample;
+
+typedef struct export_queue {
+  export_sample samples[EXPORT_QUEUE_SIZE];
+  uint16_t head;
+  uint16_t count;
+  uint32_t headIndex;       // Readings ever removed from the head, sent or dropped
+  uint8_t policy;           // EXPORT_DROP_NEWEST or EXPORT_DROP_OLDEST
+  uint16_t maxDepth;
+  uint32_t queued;          // Readings taken in
+  uint32_t dropped;         // Readings lost to a full ring
+} export_queue;
+
+inline void exportQueueInit(export_queue &queue, uint8_t policy) {
+  memset(&queue, 0, sizeof(queue));
+  queue.policy = policy;
+}
+
+// Queue a reading; returns false if it, or the oldest reading, was dropped
+inline bool exportPush(export_queue &queue, uint8_t channel, float value, uint32_t time, unsigned long now) {
+  bool kept = true;
+  if (queue.count == EXPORT_QUEUE_SIZE) {
+    queue.dropped++;
+    kept = false;
+    if (queue.policy == EXPORT_DROP_NEWEST) {
+      return false;
+    }
+    queue.head = (queue.head + 1) % EXPORT_QUEUE_SIZE;
+    queue.headIndex++;
+    queue.count--;
+  }
+  export_sample &sample = queue.samples[(queue.head + queue.count) % EXPORT_QUEUE_SIZE];
+  sample.channel = channel;
+  sample.value = value;
+  sample.time = time;
+  sample.queuedAt = now;
+  queue.count++;
+  queue.queued++;
+  if (queue.count > queue.maxDepth) {
+    queue.maxDepth = queue.count;
+  }
+  return kept;
+}
+
+// True once a full batch is waiting or the oldest reading has waited long enough
+inline bool exportFlushDue(const export_queue &queue, unsigned long now) {
+  return queue.count >= EXPORT_FLUSH_SAMPLES ||
+         (queue.count > 0 && now - queue.samples[queue.head].queuedAt >= EXPORT_FLUSH_MS);
+}
+
+// Copy up to `max` of the oldest readings without removing them; *first
+// gets the index to pass to exportCommit() once they are sent
+inline int exportPeek(const export_queue &queue, export_sample *out, int max, uint32_t *first) {
+  int n = queue.count < max ? queue.count : max;
+  for (int i = 0; i < n; i++) {
+    out[i] = queue.samples[(queue.head + i) % EXPORT_QUEUE_SIZE];
+  }
+  *first = queue.headIndex;
+  return n;
+}
+
+// Remove the `n` readings from `first` on that were sent, or whatever of
+// them is still queued if the oldest made way in the meantime
+inline void exportCommit(export_queue &queue, uint32_t first, int n) {
+  uint32_t end = first + n;
+  if ((int32_t)(end - queue.headIndex) <= 0) {
+    return;
+  }
+  uint32_t sent = end - queue.headIndex;
+  if (sent > queue.count) {
+    sent = queue.count;
+  }
+  queue.head = (queue.head + sent) % EXPORT_QUEUE_SIZE;
+  queue.headIndex += sent;
+  queue.count -= sent;
+}
+
+// Remove the readings queued before `before` without sending them, as a
+// standby master does with readings the active master has exported
+inline void exportDiscard(export_queue &queue, unsigned long before) {
+  while (queue.count > 0 && (long)(before - queue.samples[queue.head].queuedAt) > 0) {
+    queue.head = (queue.head + 1) % EXPORT_QUEUE_SIZE;
+    queue.headIndex++;
+    queue.count--;
+  }
+}
+
+// Write a batch message for `n` readings into `out`; *encoded gets how many
+// fitted. Returns its length.
+inline size_t exportEncodeBatch(char *out, size_t size, const export_sample *samples, int n,
+                                const char *const *channelNames, uint32_t batch, unsigned long sentAt,
+                                uint32_t dropped, int *encoded) {
+  size_t length = snprintf(out, size, "greenhouse %u %lu %u\n", (unsigned)batch, sentAt, (unsigned)dropped);
+  int i = 0;
+  while (i < n && length + EXPORT_LINE_SIZE <= size) {
+    const export_sample &sample = samples[i];
+    length += snprintf(out + length, size - length, "%s %g %u\n", channelNames[sample.channel],
+                       (double)sample.value, (unsigned)sample.time);
+    i++;
+  }
+  *encoded = i;
+  return length;
+}
+
+// MQTT 3.1.1: the remaining-length field, 7 bits per byte
+inline size_t mqttRemainingLength(uint8_t *out, size_t length) {
+  size_t n = 0;
+  do {
+    uint8_t byte = length % 128;
+    length /= 128;
+    out[n++] = byte | (length > 0 ? 0x80 : 0);
+  } while (length > 0);
+  return n;
+}
+
+inline size_t mqttString(uint8_t *out, const char *text) {
+  size_t length = strlen(text);
+  out[0] = length >> 8;
+  out[1] = length & 0xFF;
+  memcpy(out + 2, text, length);
+  return 2 + length;
+}
+
+// CONNECT with a clean session and no credentials, for a client id of up to
+// 48 characters; `out` needs 16 bytes plus the client id
+inline size_t mqttConnect(uint8_t *out, const char *clientId, uint16_t keepAliveSeconds) {
+  uint8_t body[64];
+  size_t length = mqttString(body, "MQTT");
+  body[length++] = 4;       // Protocol level 3.1.1
+  body[length++] = 0x02;    // Clean session
+  body[length++] = keepAliveSeconds >> 8;
+  body[length++] = keepAliveSeconds & 0xFF;
+  length += mqttString(body + length, clientId);
+  out[0] = 0x10;
+  size_t header = 1 + mqttRemainingLength(out + 1, length);
+  memcpy(out + header, body, length);
+  return header + length;
+}
+
+// PUBLISH at QoS 0; returns 0 if it does not fit in `size`
+inline size_t mqttPublish(uint8_t *out, size_t size, const char *topic, const uint8_t *payload, size_t payloadLength) {
+  size_t length = 2 + strlen(topic) + payloadLength;
+  if (length + 5 > size) {
+    return 0;
+  }
+  out[0] = 0x30;
+  size_t n = 1 + mqttRemainingLength(out + 1, length);
+  n += mqttString(out + n, topic);
+  memcpy(out + n, payload, payloadLength);
+  return n + payloadLength;
+}
+
+inline size_t mqttPingreq(uint8_t *out) {
+  out[0] = 0xC0;
+  out[1] = 0;
+  return 2;
+}
+
+// True if `data` starts with a CONNACK accepting the connection
+inline bool mqttConnackAccepted(const uint8_t *data, size_t length) {
+  return length >= 4 && data[0] == 0x20 && data[1] == 2 && data[3] == 0;
+}
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef WEB_ADMISSION_H
+#define WEB_ADMISSION_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Web admission control
+//
+// The web server shares the master's core and heap with the ESP-NOW ingest:
+// the async_tcp task runs above loop(), and every request and response it
+// streams takes heap that the Wi-Fi driver needs for its receive buffers.
+// So every dashboard request is admitted here before any work is done on
+// it, and shed with a short 429 or 503 otherwise:
+//  - each client (by IP address) gets a token bucket of WEB_CLIENT_RATE
+//    requests per second, with bursts of WEB_CLIENT_BURST (429);
+//  - at most WEB_MAX_IN_FLIGHT requests are answered at once (503);
+//  - the web gets WEB_CPU_SHARE percent of the CPU: the time spent in
+//    handlers, plus an estimate for the HTTP work around them, is charged
+//    to a bucket that drains at that rate, and requests wait while it is
+//    full (503);
+//  - requests in flight may hold WEB_HEAP_BUDGET bytes between them, and
+//    none is admitted that would leave less than WEB_HEAP_RESERVE free (503).
+// Uploads take the one upload slot for as long as their body streams to
+// flash, and open event streams count as requests in flight for as long as
+// they stay open, at most WEB_MAX_STREAMS of them.
+// What the web cannot take is left to the ingest. Pure C++ with the clock
+// and the free heap passed in, so it can be driven on the host.
+
+#ifndef WEB_ADMISSION
+#define WEB_ADMISSION 1              // 0 admits everything, to compare under load
+#endif
+#ifndef WEB_MAX_IN_FLIGHT
+#define WEB_MAX_IN_FLIGHT 6          // Requests answered at once
+#endif
+#ifndef WEB_CLIENT_RATE
+#define WEB_CLIENT_RATE 5            // Requests per second per client
+#endif
+#ifndef WEB_CLIENT_BURST
+#define WEB_CLIENT_BURST 10          // Requests a client may make at once after a pause
+#endif
+#ifndef WEB_CPU_SHARE
+#define WEB_CPU_SHARE 25             // Percent of the CPU the web may use
+#endif
+#ifndef WEB_HEAP_BUDGET
+#define WEB_HEAP_BUDGET 24576        // Heap bytes the requests in flight may hold
+#endif
+#ifndef WEB_HEAP_RESERVE
+#define WEB_HEAP_RESERVE 40960       // Free heap the web never takes
+#endif
+#ifndef WEB_MAX_STREAMS
+#define WEB_MAX_STREAMS 2            // Event streams open at once
+#endif
+#define WEB_CPU_WINDOW 100           // ms of web CPU time the bucket holds at WEB_CPU_SHARE
+#define WEB_REQUEST_COST_US 2000     // Estimated AsyncTCP and HTTP parser time per request
+#define WEB_REQUEST_HEAP 1024        // Estimated request, client and header allocations
+#define WEB_SEND_WINDOW 5744         // Largest chunk AsyncWebServer allocates to stream a response
+#define WEB_CLIENTS 16               // Clients with a bucket of their own; the rest share one
+#define WEB_UPLOAD_HEAP 4096         // Request, body buffers and open file of an upload
+#define WEB_STREAM_HEAP 2048         // Client and queued messages of an event stream
+
+enum WebVerdict {WEB_ADMIT, WEB_SHED_RATE, WEB_SHED_BUSY, WEB_SHED_CPU, WEB_SHED_MEMORY, WEB_VERDICTS};
+
+typedef struct web_client {
+  uint32_t address;
+  uint32_t tokens;               // Thousandths of a request
+  unsigned long lastSeen;
+} web_client;
+
+typedef struct web_admission {
+  web_client clients[WEB_CLIENTS];
+  uint8_t clientCount;
+  web_client crowd;              // Shared by clients that found the table full
+  uint8_t inFlight;
+  uint8_t maxInFlight;
+  uint8_t streams;               // Event streams open, as the event source last counted them
+  const void *upload;            // Request holding the upload slot, nullptr while it is free
+  uint32_t heapHeld;             // Bytes reserved by requests in flight
+  uint32_t cpuBucket;            // Handler time charged and not yet drained, us
+  unsigned long cpuDrained;      // When the bucket last drained
+  uint64_t cpuMicros;            // Handler time charged since boot, us
+  uint32_t verdicts[WEB_VERDICTS];
+} web_admission;
+
+inline void webAdmissionInit(web_admission &admission, unsigned long now) {
+  memset(&admission, 0, sizeof(admission));
+  admission.cpuDrained = now;
+  admission.crowd.tokens = WEB_CLIENT_BURST * 1000;
+  admission.crowd.lastSeen = now;
+}
+
+// Heap a request streaming `responseBytes` holds while in flight
+inline uint32_t webRequestHeap(size_t responseBytes) {
+  return WEB_REQUEST_HEAP + (responseBytes < WEB_SEND_WINDOW ? responseBytes : WEB_SEND_WINDOW);
+}
+
+// Top a bucket up for the time since it was last used
+inline void webRefill(web_client &client, unsigned long now) {
+  unsigned long idle = now - client.lastSeen;
+  uint32_t refill = idle < 1000UL * WEB_CLIENT_BURST ? idle * WEB_CLIENT_RATE : WEB_CLIENT_BURST * 1000;
+  client.tokens = client.tokens + refill < WEB_CLIENT_BURST * 1000 ? client.tokens + refill : WEB_CLIENT_BURST * 1000;
+  client.lastSeen = now;
+}
+
+// The bucket of `address`, refilled up to now. A new client takes the slot
+// of one whose bucket has filled up again, which loses nothing by it; if
+// every tracked client is still active it shares the crowd's bucket, so
+// coming from many addresses buys no extra rate.
+inline web_client &webClient(web_admission &admission, uint32_t address, unsigned long now) {
+  for (int i = 0; i < admission.clientCount; i++) {
+    if (admission.clients[i].address == address) {
+      webRefill(admission.clients[i], now);
+      return admission.clients[i];
+    }
+  }
+  web_client *client = nullptr;
+  if (admission.clientCount < WEB_CLIENTS) {
+    client = &admission.clients[admission.clientCount++];
+  } else {
+    for (int i = 0; i < WEB_CLIENTS && client == nullptr; i++) {
+      webRefill(admission.clients[i], now);
+      if (admission.clients[i].tokens == WEB_CLIENT_BURST * 1000) {
+        client = &admission.clients[i];
+      }
+    }
+  }
+  if (client == nullptr) {
+    webRefill(admission.crowd, now);
+    return admission.crowd;
+  }
+  client->address = address;
+  client->tokens = WEB_CLIENT_BURST * 1000;
+  client->lastSeen = now;
+  return *client;
+}
+
+inline void webDrainCpu(web_admission &admission, unsigned long now) {
+  unsigned long idle = now - admission.cpuDrained;
+  uint32_t drained = idle < 2 * WEB_CPU_WINDOW ? idle * 10 * WEB_CPU_SHARE : UINT32_MAX;  // us per ms at the share
+  admission.cpuBucket = admission.cpuBucket > drained ? admission.cpuBucket - drained : 0;
+  admission.cpuDrained = now;
+}
+
+// Decide on a request from `address` that will hold `heap` bytes, with
+// `freeHeap` free now. Anything but WEB_ADMIT sets *retryAfter to the
+// seconds the client should wait; WEB_ADMIT must be paired with webDone().
+inline uint8_t webAdmit(web_admission &admission, uint32_t address, uint32_t heap, uint32_t freeHeap,
+                        unsigned long now, uint32_t *retryAfter) {
+  uint8_t verdict = WEB_ADMIT;
+  *retryAfter = 1;
+  web_client &client = webClient(admission, address, now);
+  webDrainCpu(admission, now);
+  if (!WEB_ADMISSION) {
+    verdict = WEB_ADMIT;
+  } else if (client.tokens < 1000) {
+    verdict = WEB_SHED_RATE;
+    *retryAfter = (1000 - client.tokens + WEB_CLIENT_RATE * 1000 - 1) / (WEB_CLIENT_RATE * 1000);
+  } else if (admission.inFlight + admission.streams >= WEB_MAX_IN_FLIGHT) {
+    verdict = WEB_SHED_BUSY;
+  } else if (admission.cpuBucket >= WEB_CPU_WINDOW * 10 * WEB_CPU_SHARE) {
+    verdict = WEB_SHED_CPU;
+  } else if (admission.heapHeld + admission.streams * WEB_STREAM_HEAP + heap > WEB_HEAP_BUDGET ||
+             freeHeap < WEB_HEAP_RESERVE + heap) {
+    verdict = WEB_SHED_MEMORY;
+  }
+  if (client.tokens >= 1000) {
+    client.tokens -= 1000;  // Shed requests count against the client too
+  }
+  admission.verdicts[verdict]++;
+  if (verdict == WEB_ADMIT) {
+    admission.inFlight++;
+    admission.heapHeld += heap;
+    if (admission.inFlight > admission.maxInFlight) {
+      admission.maxInFlight = admission.inFlight;
+    }
+  }
+  return verdict;
+}
+
+// An admitted request's handler ran for `micros`
+inline void webCharge(web_admission &admission, unsigned long micros) {
+  admission.cpuBucket += micros + WEB_REQUEST_COST_US;
+  admission.cpuMicros += micros + WEB_REQUEST_COST_US;
+}
+
+// An admitted request's client went away
+inline void webDone(web_admission &admission, uint32_t heap) {
+  if (admission.inFlight > 0) {
+    admission.inFlight--;
+  }
+  admission.heapHeld = admission.heapHeld > heap ? admission.heapHeld - heap : 0;
+}
+
+// Decide on an upload (`request`) whose first body bytes just arrived. It
+// is refused while another holds the slot, and otherwise under the same
+// in-flight and heap limits as a request; WEB_ADMIT must be paired with
+// webUploadEnd(). Two uploads never interleave, whatever WEB_ADMISSION says.
+inline uint8_t webUploadBegin(web_admission &admission, const void *request, uint32_t freeHeap) {
+  uint8_t verdict = WEB_ADMIT;
+  if (admission.upload != nullptr) {
+    verdict = WEB_SHED_BUSY;
+  } else if (!WEB_ADMISSION) {
+    verdict = WEB_ADMIT;
+  } else if (admission.inFlight + admission.streams >= WEB_MAX_IN_FLIGHT) {
+    verdict = WEB_SHED_BUSY;
+  } else if (admission.heapHeld + admission.streams * WEB_STREAM_HEAP + WEB_UPLOAD_HEAP > WEB_HEAP_BUDGET ||
+             freeHeap < WEB_HEAP_RESERVE + WEB_UPLOAD_HEAP) {
+    verdict = WEB_SHED_MEMORY;
+  }
+  admission.verdicts[verdict]++;
+  if (verdict == WEB_ADMIT) {
+    admission.upload = request;
+    admission.inFlight++;
+    admission.heapHeld += WEB_UPLOAD_HEAP;
+    if (admission.inFlight > admission.maxInFlight) {
+      admission.maxInFlight = admission.inFlight;
+    }
+  }
+  return verdict;
+}
+
+inline bool webUploadOwns(const web_admission &admission, const void *request) {
+  return request != nullptr && admission.upload == request;
+}
+
+// The upload `request` was answered or its client went away
+inline void webUploadEnd(web_admission &admission, const void *request) {
+  if (webUploadOwns(admission, request)) {
+    admission.upload = nullptr;
+    webDone(admission, WEB_UPLOAD_HEAP);
+  }
+}
+
+// Update the count of open event streams; the event source closes them
+// without telling us, so it is taken afresh before every decision
+inline void webSetStreams(web_admission &admission, uint8_t open) {
+  admission.streams = open;
+}
+
+// Decide on a new event stream; `open` counts the streams open with it
+inline uint8_t webAdmitStream(web_admission &admission, uint8_t open, uint32_t freeHeap) {
+  uint8_t verdict = WEB_ADMIT;
+  admission.streams = open > 0 ? open - 1 : 0;
+  if (!WEB_ADMISSION) {
+    verdict = WEB_ADMIT;
+  } else if (admission.streams >= WEB_MAX_STREAMS || admission.inFlight + admission.streams >= WEB_MAX_IN_FLIGHT) {
+    verdict = WEB_SHED_BUSY;
+  } else if (admission.heapHeld + (admission.streams + 1) * WEB_STREAM_HEAP > WEB_HEAP_BUDGET ||
+             freeHeap < WEB_HEAP_RESERVE + WEB_STREAM_HEAP) {
+    verdict = WEB_SHED_MEMORY;
+  }
+  admission.verdicts[verdict]++;
+  if (verdict == WEB_ADMIT) {
+    admission.streams++;
+  }
+  return verdict;
+}
+
+#endif
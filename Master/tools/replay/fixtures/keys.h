@@ -0,0 +1,22 @@
+#ifndef KEYS_H
+#define KEYS_H
+
+// The keys fixtures/capture.bin was sealed with, for the replay tool and
+// the host tests only; never flash them (see keys.h.example in
+// common/espnow_link).
+
+#define AUTH_GROUP_KEY \
+  { 0x1E, 0x80, 0xEC, 0xF1, 0x47, 0x44, 0x1E, 0x3E, 0xD4, 0x21, 0x8F, 0xBF, 0xC3, 0xF5, 0x66, 0x11 }
+#define AUTH_SLAVE1_KEY \
+  { 0xCC, 0xBF, 0xB0, 0x69, 0xAE, 0x50, 0xC2, 0x7C, 0x2C, 0x9D, 0xA5, 0x10, 0xBB, 0x18, 0xC7, 0xD0 }
+#define AUTH_SLAVE2_KEY \
+  { 0x6B, 0xCB, 0xAF, 0xB5, 0x2B, 0xAC, 0x81, 0x3A, 0x3E, 0x3F, 0x50, 0xF3, 0x6D, 0xB8, 0x9E, 0xDB }
+#define AUTH_SLAVE3_KEY \
+  { 0xEC, 0x81, 0xF2, 0x61, 0x6F, 0xE5, 0xC3, 0xC0, 0x5F, 0xB2, 0xE4, 0xE3, 0x83, 0x3D, 0x6E, 0xC7 }
+#define AUTH_PAIR_KEY \
+  { 0x5A, 0x0D, 0x93, 0x27, 0xB6, 0x41, 0xE8, 0x7C, 0x12, 0xF4, 0x6E, 0xA9, 0x30, 0xC5, 0x8B, 0x5F }
+
+#define WEB_ADMIN_USER "admin"
+#define WEB_ADMIN_PASSWORD "replay"
+
+#endif
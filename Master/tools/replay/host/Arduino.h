@@ -0,0 +1,114 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Just enough of the Arduino-ESP32 core to build the master's main.cpp on
+// Linux for the replay tool. millis() and delay() run on the replay clock
+// (host_clock.h); micros() is real time, so measured durations are real.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+#include "host_clock.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define PROGMEM
+#define memcpy_P memcpy
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+
+using std::min;
+using std::max;
+
+class String {
+ public:
+  String() {}
+  String(const char *text) : text(text ? text : "") {}
+  const char *c_str() const { return text.c_str(); }
+  unsigned length() const { return text.size(); }
+  bool operator==(const String &other) const { return text == other.text; }
+  bool operator==(const char *other) const { return text == other; }
+
+ private:
+  std::string text;
+};
+
+class IPAddress {
+ public:
+  IPAddress() {}
+  IPAddress(int a, int b, int c, int d) : address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+  operator uint32_t() const { return address; }
+
+ private:
+  uint32_t address = 0;
+};
+
+// Serial output only shows with replay -v
+class HostSerial {
+ public:
+  void begin(unsigned long) {}
+  size_t printf(const char *format, ...) {
+    if (!hostVerbose) {
+      return 0;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vprintf(format, args);
+    va_end(args);
+    return written < 0 ? 0 : written;
+  }
+  size_t print(const char *text) { return printf("%s", text); }
+  size_t print(const String &text) { return printf("%s", text.c_str()); }
+  size_t print(int value) { return printf("%d", value); }
+  size_t println(const char *text = "") { return printf("%s\n", text); }
+  size_t println(const String &text) { return printf("%s\n", text.c_str()); }
+  size_t println(int value) { return printf("%d\n", value); }
+  size_t println(const IPAddress &) { return printf("\n"); }
+};
+inline HostSerial Serial;
+
+inline unsigned long millis() {
+  return hostClock.millis();
+}
+
+inline unsigned long micros() {
+  return hostClock.realMicros();
+}
+
+// While we wait the other tasks get the core, a tick at a time
+inline void delay(unsigned long ms) {
+  if (hostPollers.empty()) {
+    hostClock.advance(ms);
+    return;
+  }
+  do {
+    for (auto &poll : hostPollers) {
+      poll();
+    }
+    if (ms > 0) {
+      hostClock.advance(1);
+    }
+  } while (ms-- > 1);
+}
+
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+
+// The heap figures describe the ESP32, not this process; the free heap is
+// what a master typically has left once Wi-Fi and the web server are up
+#define HOST_FREE_HEAP 160000
+struct HostEsp {
+  uint32_t getFreeHeap() { return HOST_FREE_HEAP; }
+  uint32_t getMinFreeHeap() { return 0; }
+  uint32_t getMaxAllocHeap() { return 0; }
+};
+inline HostEsp ESP;
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef HOST_ASYNC_TCP_H
+#define HOST_ASYNC_TCP_H
+
+#include <functional>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Arduino.h"
+
+// A real TCP client, so the export can be pointed at a local broker. The
+// connect is made at once (it is local), and received data and a closed
+// connection are picked up on every delay(), as the AsyncTCP task would.
+
+class AsyncClient;
+typedef std::function<void(void *, AsyncClient *)> AcConnectHandler;
+typedef std::function<void(void *, AsyncClient *, void *data, size_t len)> AcDataHandler;
+
+#define HOST_TCP_SPACE 5744  // Send buffer AsyncTCP offers on the ESP32
+
+class AsyncClient {
+ public:
+  void onConnect(AcConnectHandler handler, void * = nullptr) { connectHandler = handler; }
+  void onDisconnect(AcConnectHandler handler, void * = nullptr) { disconnectHandler = handler; }
+  void onData(AcDataHandler handler, void * = nullptr) { dataHandler = handler; }
+
+  bool connect(const char *host, uint16_t port) {
+    if (!polled) {
+      polled = true;
+      hostPollers.push_back([this]() { poll(); });
+    }
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &address.sin_addr) != 1) {
+      return false;
+    }
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+      closeSocket();
+      return false;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    if (connectHandler) {
+      connectHandler(nullptr, this);
+    }
+    return true;
+  }
+
+  bool connected() { return fd >= 0; }
+  IPAddress remoteIP() const { return remote; }
+  size_t space() { return fd >= 0 ? HOST_TCP_SPACE : 0; }
+
+  IPAddress remote;  // Host only: the peer a web request comes from
+
+  size_t write(const char *data, size_t len) {
+    if (fd < 0) {
+      return 0;
+    }
+    ssize_t written = ::send(fd, data, len, MSG_NOSIGNAL);
+    return written < 0 ? 0 : written;
+  }
+
+  void close(bool = false) {
+    if (fd >= 0) {
+      closeSocket();
+      if (disconnectHandler) {
+        disconnectHandler(nullptr, this);
+      }
+    }
+  }
+
+ private:
+  void poll() {
+    uint8_t buffer[512];
+    while (fd >= 0) {
+      ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+      if (received > 0) {
+        if (dataHandler) {
+          dataHandler(nullptr, this, buffer, received);
+        }
+      } else {
+        if (received == 0) {
+          close();  // The peer closed the connection
+        }
+        break;
+      }
+    }
+  }
+
+  void closeSocket() {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    fd = -1;
+  }
+
+  int fd = -1;
+  bool polled = false;
+  AcConnectHandler connectHandler;
+  AcConnectHandler disconnectHandler;
+  AcDataHandler dataHandler;
+};
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef HOST_ESP_ASYNC_WEB_SERVER_H
+#define HOST_ESP_ASYNC_WEB_SERVER_H
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <map>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "AsyncTCP.h"
+#include "LittleFS.h"
+
+// Routes are registered as on the ESP32 and called in-process by
+// AsyncWebServer::get(), which streams the response through its filler the
+// way AsyncTCP would and then fires onDisconnect. open() and close() split
+// the two, to keep requests in flight the way slow clients do.
+//
+// What the shim does in place of the library runs inside a
+// HostLibraryScope, so heap_soak_test can tell the allocations the library
+// makes from those of our handlers.
+
+typedef enum { HTTP_GET = 1, HTTP_POST = 2 } WebRequestMethod;
+typedef std::function<size_t(uint8_t *, size_t, size_t)> AwsResponseFiller;
+typedef std::function<void(void)> ArDisconnectHandler;
+
+#define HOST_TCP_WINDOW 1436 // Bytes the filler is asked for per call
+
+// Above zero while the shim stands in for library code
+inline int hostLibraryDepth = 0;
+
+struct HostLibraryScope {
+  HostLibraryScope() { hostLibraryDepth++; }
+  ~HostLibraryScope() { hostLibraryDepth--; }
+};
+
+class AsyncWebServerResponse {
+ public:
+  void addHeader(const char *name, const char *value) { headers[name] = value; }
+
+  size_t length;
+  AwsResponseFiller filler;
+  int code = 200;
+  std::string content;
+  std::map<std::string, std::string> headers;
+};
+
+class AsyncWebParameter {
+ public:
+  explicit AsyncWebParameter(const char *text) : text(text) {}
+  const String &value() const { return text; }
+
+ private:
+  String text;
+};
+
+class AsyncWebServerRequest {
+ public:
+  void send(int code, const char * = "", const char *content = "") {
+    HostLibraryScope library;
+    status = code;
+    body = content;
+  }
+  void send(HostLittleFS &, const char *, const char *) {
+    HostLibraryScope library;
+    status = 404;
+  }
+  void send_P(int code, const char *, const char *content) {
+    send(code, "", content);
+  }
+  AsyncWebServerResponse *beginResponse(const char *, size_t length, AwsResponseFiller filler) {
+    HostLibraryScope library;
+    return new AsyncWebServerResponse{length, filler};
+  }
+  AsyncWebServerResponse *beginResponse(int code, const char *, const char *content) {
+    HostLibraryScope library;
+    return new AsyncWebServerResponse{strlen(content), nullptr, code, content};
+  }
+  void send(AsyncWebServerResponse *response) {
+    HostLibraryScope library;
+    status = response->code;
+    headers = response->headers;
+    body = response->content;
+    uint8_t window[HOST_TCP_WINDOW];
+    for (size_t index = 0; response->filler && index < response->length;) {
+      size_t chunk = response->filler(window, sizeof(window), index);
+      if (chunk == 0) {
+        break;
+      }
+      body.append((const char *)window, chunk);
+      index += chunk;
+    }
+    delete response;
+  }
+  bool hasParam(const char *name) { return params.count(name) > 0; }
+  AsyncWebParameter *getParam(const char *name) {
+    HostLibraryScope library;
+    parameter.reset(new AsyncWebParameter(params[name].c_str()));
+    return parameter.get();
+  }
+  const String &contentType() const { return type; }
+  size_t contentLength() const { return length; }
+  bool authenticate(const char *user, const char *password) {
+    HostLibraryScope library;
+    return login == std::string(user) + ":" + password;
+  }
+  void requestAuthentication() {
+    send(401);
+  }
+  void onDisconnect(ArDisconnectHandler callback) {
+    HostLibraryScope library;
+    disconnect = callback;
+  }
+  AsyncClient *client() { return &peer; }
+
+  int status = 0;
+  std::string body;
+  std::map<std::string, std::string> headers;
+  std::map<std::string, std::string> params;
+  ArDisconnectHandler disconnect;
+  AsyncClient peer;
+  String type;
+  size_t length = 0;
+  std::string login;  // Host only: "user:password" the client sent, empty for none
+
+ private:
+  std::unique_ptr<AsyncWebParameter> parameter;
+};
+
+typedef std::function<void(AsyncWebServerRequest *)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *, uint8_t *, size_t, size_t, size_t)> ArBodyHandlerFunction;
+
+class AsyncWebHandler {};
+
+class AsyncEventSourceClient {
+ public:
+  void close() {}
+};
+
+// Pushed events are counted, and shown with replay -v; no stream ever opens
+class AsyncEventSource : public AsyncWebHandler {
+ public:
+  explicit AsyncEventSource(const char *) {}
+  void onConnect(std::function<void(AsyncEventSourceClient *)>) {}
+  size_t count() const { return 0; }
+  void send(const char *message, const char *event, uint32_t) {
+    sent++;
+    Serial.printf("event %s: %s\n", event, message);
+  }
+
+  uint32_t sent = 0;
+};
+
+class AsyncWebServer {
+ public:
+  explicit AsyncWebServer(uint16_t) {}
+  void on(const char *path, WebRequestMethod method, ArRequestHandlerFunction handler) {
+    if (method == HTTP_GET) {
+      routes[path] = handler;
+    }
+  }
+  void on(const char *path, WebRequestMethod method, ArRequestHandlerFunction handler,
+          std::nullptr_t, ArBodyHandlerFunction body) {
+    if (method == HTTP_POST) {
+      uploads[path] = {handler, body};
+    } else {
+      on(path, method, handler);
+    }
+  }
+  void addHandler(AsyncWebHandler *) {}
+  void begin() {}
+
+  // Host only: serve a GET request from `client` and return it, response
+  // sent and the client still connected; nullptr for an unknown path
+  std::unique_ptr<AsyncWebServerRequest> open(const char *path, const std::map<std::string, std::string> &params = {},
+                                              IPAddress client = IPAddress()) {
+    std::unique_ptr<AsyncWebServerRequest> request;
+    ArRequestHandlerFunction *handler;
+    {
+      HostLibraryScope library;
+      auto route = routes.find(path);
+      if (route == routes.end()) {
+        return nullptr;
+      }
+      handler = &route->second;
+      request.reset(new AsyncWebServerRequest);
+      request->params = params;
+      request->peer.remote = client;
+    }
+    (*handler)(request.get());
+    return request;
+  }
+
+  // Host only: the client of an open() request goes away
+  void close(std::unique_ptr<AsyncWebServerRequest> request) {
+    if (request && request->disconnect) {
+      request->disconnect();
+    }
+  }
+
+  // Host only: POST `body` as application/octet-stream with the login
+  // "user:password" (empty for none), handing it to the body handler in
+  // HOST_TCP_WINDOW pieces as the library would, then answer it; returns
+  // the status, 0 for an unknown path
+  int post(const char *path, const std::map<std::string, std::string> &params, const std::string &body,
+           const std::string &login = "") {
+    auto route = uploads.find(path);
+    if (route == uploads.end()) {
+      return 0;
+    }
+    std::unique_ptr<AsyncWebServerRequest> request(new AsyncWebServerRequest);
+    request->params = params;
+    request->type = "application/octet-stream";
+    request->length = body.size();
+    request->login = login;
+    for (size_t index = 0; index < body.size(); index += HOST_TCP_WINDOW) {
+      size_t chunk = std::min(body.size() - index, (size_t)HOST_TCP_WINDOW);
+      route->second.body(request.get(), (uint8_t *)&body[index], chunk, index, body.size());
+    }
+    route->second.request(request.get());
+    int status = request->status;
+    close(std::move(request));
+    return status;
+  }
+
+  // Host only: serve a GET request and return the response body
+  std::string get(const char *path, const std::map<std::string, std::string> &params = {}) {
+    std::unique_ptr<AsyncWebServerRequest> request = open(path, params);
+    std::string body = request ? request->body : std::string();
+    close(std::move(request));
+    return body;
+  }
+
+ private:
+  struct upload_route {
+    ArRequestHandlerFunction request;
+    ArBodyHandlerFunction body;
+  };
+  std::map<std::string, ArRequestHandlerFunction> routes;
+  std::map<std::string, upload_route> uploads;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef HOST_LITTLEFS_H
+#define HOST_LITTLEFS_H
+
+#include <stdio.h>
+#include <string>
+#include "Arduino.h"
+
+// LittleFS backed by a host directory (replay -d); without one the
+// filesystem is empty and nothing can be written
+inline std::string hostFsRoot;
+
+class File {
+ public:
+  File() {}
+  explicit File(FILE *fp) : fp(fp) {}
+  operator bool() const { return fp != nullptr; }
+  int available() {
+    int c = fgetc(fp);
+    if (c == EOF) {
+      return 0;
+    }
+    ungetc(c, fp);
+    return 1;
+  }
+  size_t readBytesUntil(char terminator, char *buffer, size_t length) {
+    size_t count = 0;
+    int c;
+    while (count < length && (c = fgetc(fp)) != EOF && c != terminator) {
+      buffer[count++] = (char)c;
+    }
+    return count;
+  }
+  size_t write(const uint8_t *data, size_t length) { return fwrite(data, 1, length, fp); }
+  size_t read(uint8_t *data, size_t length) { return fread(data, 1, length, fp); }
+  bool seek(size_t position) { return fseek(fp, position, SEEK_SET) == 0; }
+  size_t size() {
+    long position = ftell(fp);
+    fseek(fp, 0, SEEK_END);
+    long end = ftell(fp);
+    fseek(fp, position, SEEK_SET);
+    return end < 0 ? 0 : end;
+  }
+  void close() {
+    if (fp != nullptr) {
+      fclose(fp);
+      fp = nullptr;
+    }
+  }
+
+ private:
+  FILE *fp = nullptr;
+};
+
+class HostLittleFS {
+ public:
+  bool begin(bool) { return true; }
+  bool exists(const char *path) {
+    FILE *fp = hostFsRoot.empty() ? nullptr : fopen((hostFsRoot + path).c_str(), "rb");
+    if (fp != nullptr) {
+      fclose(fp);
+    }
+    return fp != nullptr;
+  }
+  File open(const char *path, const char *mode) {
+    if (hostFsRoot.empty()) {
+      return File();
+    }
+    std::string hostMode = std::string(mode) + "b";
+    return File(fopen((hostFsRoot + path).c_str(), hostMode.c_str()));
+  }
+  bool remove(const char *path) { return !hostFsRoot.empty() && ::remove((hostFsRoot + path).c_str()) == 0; }
+  bool rename(const char *from, const char *to) {
+    return !hostFsRoot.empty() && ::rename((hostFsRoot + from).c_str(), (hostFsRoot + to).c_str()) == 0;
+  }
+};
+inline HostLittleFS LittleFS;
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef HOST_PREFERENCES_H
+#define HOST_PREFERENCES_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+
+// NVS kept in memory: every replay is one boot of a fresh device
+
+class Preferences {
+ public:
+  bool begin(const char *name, bool = false) {
+    space = name;
+    return true;
+  }
+  void end() {}
+  uint16_t getUShort(const char *key, uint16_t defaultValue = 0) {
+    auto found = values().find(space + "/" + key);
+    return found != values().end() ? found->second : defaultValue;
+  }
+  size_t putUShort(const char *key, uint16_t value) {
+    values()[space + "/" + key] = value;
+    return sizeof(value);
+  }
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0) {
+    auto found = values().find(space + "/" + key);
+    return found != values().end() ? found->second : defaultValue;
+  }
+  size_t putUInt(const char *key, uint32_t value) {
+    values()[space + "/" + key] = value;
+    return sizeof(value);
+  }
+  bool isKey(const char *key) {
+    std::string name = space + "/" + key;
+    return values().count(name) != 0 || blobs().count(name) != 0;
+  }
+  size_t getBytes(const char *key, void *buffer, size_t length) {
+    auto found = blobs().find(space + "/" + key);
+    if (found == blobs().end() || found->second.size() > length) {
+      return 0;
+    }
+    memcpy(buffer, found->second.data(), found->second.size());
+    return found->second.size();
+  }
+  size_t putBytes(const char *key, const void *value, size_t length) {
+    const uint8_t *bytes = (const uint8_t *)value;
+    blobs()[space + "/" + key].assign(bytes, bytes + length);
+    return length;
+  }
+
+ private:
+  static std::map<std::string, uint32_t> &values() {
+    static std::map<std::string, uint32_t> stored;
+    return stored;
+  }
+  static std::map<std::string, std::vector<uint8_t>> &blobs() {
+    static std::map<std::string, std::vector<uint8_t>> stored;
+    return stored;
+  }
+  std::string space;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "Arduino.h"
+#include "esp_wifi.h"
+
+#define WIFI_AP_STA 3
+#define WIFI_PS_NONE 0
+#define WL_CONNECTED 3
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+// Always connected, no networks in range
+class HostWiFi {
+ public:
+  bool mode(int) { return true; }
+  bool setSleep(int) { return true; }
+  int32_t channel() { return 1; }
+  int32_t channel(int) { return 1; }
+  bool softAP(const char *, const char *) { return true; }
+  bool softAPConfig(IPAddress, IPAddress, IPAddress) { return true; }
+  IPAddress softAPIP() { return IPAddress(); }
+  IPAddress localIP() { return IPAddress(); }
+  int begin(const char *, const char *) { return WL_CONNECTED; }
+  bool setAutoReconnect(bool) { return true; }
+  bool reconnect() { return true; }
+  int status() { return WL_CONNECTED; }
+  int16_t scanNetworks(bool async = false) { return 0; }
+  int16_t scanComplete() { return WIFI_SCAN_FAILED; }
+  void scanDelete() {}
+  String SSID(int) { return String(); }
+};
+inline HostWiFi WiFi;
+
+// A real UDP socket, so the export can be pointed at a local sink
+class WiFiUDP {
+ public:
+  int beginPacket(const char *host, uint16_t port) {
+    address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    packet.clear();
+    if (fd < 0) {
+      fd = socket(AF_INET, SOCK_DGRAM, 0);
+    }
+    return fd >= 0 && inet_pton(AF_INET, host, &address.sin_addr) == 1;
+  }
+  size_t write(const uint8_t *data, size_t len) {
+    packet.insert(packet.end(), data, data + len);
+    return len;
+  }
+  int endPacket() {
+    return sendto(fd, packet.data(), packet.size(), 0, (sockaddr *)&address, sizeof(address)) == (ssize_t)packet.size();
+  }
+
+ private:
+  int fd = -1;
+  sockaddr_in address = {};
+  std::vector<uint8_t> packet;
+};
+
+#endif
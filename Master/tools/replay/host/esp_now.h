@@ -0,0 +1,33 @@
+#ifndef HOST_ESP_NOW_H
+#define HOST_ESP_NOW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Frames the master sends are counted, not transmitted
+typedef enum { ESP_NOW_SEND_SUCCESS = 0, ESP_NOW_SEND_FAIL } esp_now_send_status_t;
+typedef struct {
+  uint8_t peer_addr[6];
+  uint8_t channel;
+  bool encrypt;
+} esp_now_peer_info_t;
+typedef void (*esp_now_recv_cb_t)(const uint8_t *mac, const uint8_t *data, int len);
+typedef void (*esp_now_send_cb_t)(const uint8_t *mac, esp_now_send_status_t status);
+
+inline esp_now_recv_cb_t hostRecvCb = nullptr;
+inline uint32_t hostFramesSent = 0;
+
+inline esp_err_t esp_now_init() { return ESP_OK; }
+inline esp_err_t esp_now_add_peer(const esp_now_peer_info_t *) { return ESP_OK; }
+inline esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb) {
+  hostRecvCb = cb;
+  return ESP_OK;
+}
+inline esp_err_t esp_now_register_send_cb(esp_now_send_cb_t) { return ESP_OK; }
+inline esp_err_t esp_now_send(const uint8_t *, const uint8_t *, size_t) {
+  hostFramesSent++;
+  return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef HOST_ESP_WIFI_H
+#define HOST_ESP_WIFI_H
+
+#include <stdint.h>
+#include <string.h>
+#include "esp_err.h"
+
+typedef enum { WIFI_IF_STA = 0, WIFI_IF_AP } wifi_interface_t;
+typedef enum { WIFI_SECOND_CHAN_NONE = 0 } wifi_second_chan_t;
+typedef enum {
+  WIFI_PHY_RATE_1M_L, WIFI_PHY_RATE_2M_L, WIFI_PHY_RATE_6M,
+  WIFI_PHY_RATE_12M, WIFI_PHY_RATE_24M, WIFI_PHY_RATE_54M
+} wifi_phy_rate_t;
+typedef enum { WIFI_PKT_MGMT, WIFI_PKT_CTRL, WIFI_PKT_DATA, WIFI_PKT_MISC } wifi_promiscuous_pkt_type_t;
+
+typedef struct {
+  signed rssi : 8;
+  unsigned sig_len : 12;
+} wifi_pkt_rx_ctrl_t;
+
+typedef struct {
+  wifi_pkt_rx_ctrl_t rx_ctrl;
+  uint8_t payload[];
+} wifi_promiscuous_pkt_t;
+
+typedef struct {
+  uint32_t filter_mask;
+} wifi_promiscuous_filter_t;
+#define WIFI_PROMIS_FILTER_MASK_MGMT 1
+
+typedef void (*wifi_promiscuous_cb_t)(void *buf, wifi_promiscuous_pkt_type_t type);
+inline wifi_promiscuous_cb_t hostPromiscuousCb = nullptr;
+
+inline esp_err_t esp_wifi_set_promiscuous(bool) { return ESP_OK; }
+inline esp_err_t esp_wifi_set_promiscuous_filter(const wifi_promiscuous_filter_t *) { return ESP_OK; }
+inline esp_err_t esp_wifi_set_promiscuous_rx_cb(wifi_promiscuous_cb_t cb) {
+  hostPromiscuousCb = cb;
+  return ESP_OK;
+}
+inline esp_err_t esp_wifi_set_channel(uint8_t, wifi_second_chan_t) { return ESP_OK; }
+inline esp_err_t esp_wifi_config_espnow_rate(wifi_interface_t, wifi_phy_rate_t) { return ESP_OK; }
+inline esp_err_t esp_wifi_get_mac(wifi_interface_t, uint8_t *mac) {
+  static const uint8_t hostMAC[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+  memcpy(mac, hostMAC, 6);
+  return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+// The replay tool is single-threaded: critical sections and mutexes are no-ops
+
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portMAX_DELAY 0xFFFFFFFF
+
+#endif
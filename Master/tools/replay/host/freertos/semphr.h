@@ -0,0 +1,21 @@
+#ifndef HOST_SEMPHR_H
+#define HOST_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+typedef void *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  static int mutex;
+  return &mutex;
+}
+
+inline int xSemaphoreTake(SemaphoreHandle_t, unsigned long) {
+  return 1;
+}
+
+inline int xSemaphoreGive(SemaphoreHandle_t) {
+  return 1;
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+#include <stdint.h>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <vector>
+
+// Replay clock: millis() follows the capture's receive times, and every
+// delay() moves it forward. With a speed factor the clock is paced against
+// the wall clock (1 = real time, 1000 = a thousand times faster); speed 0
+// runs as fast as the code allows.
+class host_clock {
+ public:
+  // Jump to `ms` and pace from here
+  void set(uint64_t ms) {
+    now = ms;
+    paceFrom = ms;
+    wallFrom = std::chrono::steady_clock::now();
+  }
+
+  void advance(uint64_t ms) {
+    now += ms;
+    if (speed > 0) {
+      auto due = wallFrom + std::chrono::microseconds((int64_t)((now - paceFrom) * 1000.0 / speed));
+      if (due > std::chrono::steady_clock::now()) {
+        std::this_thread::sleep_until(due);
+      }
+    }
+  }
+
+  unsigned long millis() const {
+    return (unsigned long)now;
+  }
+
+  unsigned long realMicros() const {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  double speed = 1;
+
+ private:
+  uint64_t now = 0;
+  uint64_t paceFrom = 0;
+  std::chrono::steady_clock::time_point wallFrom = std::chrono::steady_clock::now();
+};
+
+inline host_clock hostClock;
+inline bool hostVerbose = false;
+
+// Work the ESP32 does on its own tasks (network I/O) runs on every delay()
+inline std::vector<std::function<void()>> hostPollers;
+
+#endif
@@ -0,0 +1,625 @@
+// Replay a frame capture through the master firmware on Linux
+//
+// The master's own main.cpp is compiled against the shims in host/ and fed
+// the captured frames at their recorded times, through the same promiscuous
+// and ESP-NOW receive callbacks, with loop() running in between and the
+// dashboard polling its routes. At the end it prints /status, /metrics,
+// /stats and what the run cost. With -m or -u the telemetry export goes to
+// a real MQTT broker or UDP sink, -l adds web load from many clients to
+// see what it does to the ingest, and -f runs the master as a hot standby
+// whose primary fails. See the README for how to take a capture.
+//
+// Built with REPLAY_NO_MAIN, the tests in tests/ call runReplay() with
+// options of their own, one replay per process.
+
+#include "../../src/main.cpp"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+typedef struct replay_frame {
+  capture_record record;
+  std::vector<uint8_t> data;
+} replay_frame;
+
+// Binary capture, as written to CAPTURE_FILE
+static bool loadCaptureFile(FILE *fp, std::vector<replay_frame> &frames) {
+  capture_file_header header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, CAPTURE_MAGIC, 4) != 0) {
+    return false;
+  }
+  if (header.version != CAPTURE_VERSION || header.recordHeaderSize < sizeof(capture_record)) {
+    fprintf(stderr, "Unsupported capture version %u\n", header.version);
+    return false;
+  }
+
+  replay_frame frame;
+  while (fread(&frame.record, sizeof(frame.record), 1, fp) == 1) {
+    fseek(fp, header.recordHeaderSize - sizeof(capture_record), SEEK_CUR);
+    frame.data.resize(frame.record.length);
+    if (fread(frame.data.data(), 1, frame.data.size(), fp) != frame.data.size()) {
+      break;  // Truncated last record
+    }
+    frames.push_back(frame);
+  }
+  return true;
+}
+
+// Serial log: the CAPTURE_SERIAL_PREFIX lines, anywhere in the monitor output
+static void loadSerialLog(FILE *fp, std::vector<replay_frame> &frames) {
+  char line[4 * CAPTURE_MAX_RECORD];
+  uint8_t bytes[CAPTURE_MAX_RECORD];
+  while (fgets(line, sizeof(line), fp) != nullptr) {
+    const char *hex = strstr(line, CAPTURE_SERIAL_PREFIX);
+    if (hex == nullptr) {
+      continue;
+    }
+    hex += strlen(CAPTURE_SERIAL_PREFIX);
+    size_t length = 0;
+    unsigned value;
+    while (length < sizeof(bytes) && sscanf(hex, "%2x", &value) == 1) {
+      bytes[length++] = value;
+      hex += 2;
+    }
+    replay_frame frame;
+    if (length < sizeof(frame.record)) {
+      continue;
+    }
+    memcpy(&frame.record, bytes, sizeof(frame.record));
+    if (length != sizeof(frame.record) + frame.record.length) {
+      continue;  // Line cut short by the monitor
+    }
+    frame.data.assign(bytes + sizeof(frame.record), bytes + length);
+    frames.push_back(frame);
+  }
+}
+
+// Hand one frame to the callbacks the master registered, as the Wi-Fi task would
+static unsigned long deliver(const replay_frame &frame) {
+  if (hostPromiscuousCb != nullptr && frame.record.rssi != 0) {
+    uint8_t buffer[sizeof(wifi_promiscuous_pkt_t) + 24] = {0};
+    wifi_promiscuous_pkt_t *packet = (wifi_promiscuous_pkt_t *)buffer;
+    packet->rx_ctrl.rssi = frame.record.rssi;
+    packet->payload[0] = 0xD0;  // Action frame
+    memcpy(packet->payload + 10, frame.record.mac, 6);
+    hostPromiscuousCb(buffer, WIFI_PKT_MGMT);
+  }
+  unsigned long start = micros();
+  hostRecvCb(frame.record.mac, frame.data.data(), frame.data.size());
+  return micros() - start;
+}
+
+typedef struct route_timing {
+  const char *path;
+  uint32_t requests;
+  uint64_t totalMicros;
+  unsigned long maxMicros;
+} route_timing;
+
+static void poll(route_timing &route) {
+  unsigned long start = micros();
+  server.get(route.path);
+  unsigned long elapsed = micros() - start;
+  route.requests++;
+  route.totalMicros += elapsed;
+  route.maxMicros = elapsed > route.maxMicros ? elapsed : route.maxMicros;
+}
+
+// Web load (-l): clients fetching the dashboard routes in turn, each from
+// its own address, without waiting for answers. The async_tcp task runs
+// above loop() on the same core, so while it has requests to serve loop()
+// waits; frames still arrive on time, the Wi-Fi task being above both. A
+// request costs the ESP32 LOAD_REQUEST_US for the connection and parsing,
+// LOAD_SEND_US_PER_KB for its response, and LOAD_CPU_SCALE times the CPU
+// time its handler took here, so the host preempting us mid-request does
+// not count as the ESP32's work; the client then needs LOAD_CLIENT_RTT plus the
+// transfer to read it, holding its place in the server until it has.
+// lwIP refuses connections beyond LOAD_MAX_CONNECTIONS.
+#define LOAD_MAX_CONNECTIONS 16      // CONFIG_LWIP_MAX_ACTIVE_TCP
+#define LOAD_REQUEST_US 1000
+#define LOAD_SEND_US_PER_KB 250
+#define LOAD_CPU_SCALE 10
+#define LOAD_CLIENT_RTT 20           // ms
+#define LOAD_CLIENT_BYTES_PER_MS 250 // 2 Mbit/s
+
+typedef struct open_request {
+  std::unique_ptr<AsyncWebServerRequest> request;
+  unsigned long closeAt;
+} open_request;
+
+typedef struct web_load {
+  int clients = 0;
+  double rate = 0;              // Requests per second per client
+  std::vector<double> next;     // When each client sends its next request, ms
+  std::vector<int> route;       // Route each client fetches next
+  std::deque<int> waiting;      // Clients whose request waits for the core
+  size_t maxWaiting = 0;
+  std::vector<open_request> open;
+  uint64_t busyUntil = 0;       // us; the core is the web's until then
+  uint64_t busyMicros = 0;
+  uint32_t requests = 0;
+  uint32_t refused = 0;         // No connection to be had
+  uint32_t ok = 0;
+  uint32_t tooMany = 0;         // 429
+  uint32_t unavailable = 0;     // 503
+} web_load;
+
+static web_load load;
+static const char *const loadRoutes[] = {"/status", "/", "/metrics", "/stats"};
+
+// CPU time of this thread, us
+static uint64_t threadMicros() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Runs every ms: clients that read their response go away, new requests
+// queue up, and the queue is served while the core is free
+static void serveLoad() {
+  unsigned long now = millis();
+  for (size_t i = 0; i < load.open.size();) {
+    if ((long)(now - load.open[i].closeAt) >= 0) {
+      server.close(std::move(load.open[i].request));
+      load.open.erase(load.open.begin() + i);
+    } else {
+      i++;
+    }
+  }
+  for (int client = 0; client < load.clients; client++) {
+    while (load.next[client] <= now) {
+      if (load.waiting.size() + load.open.size() < LOAD_MAX_CONNECTIONS) {
+        load.waiting.push_back(client);
+      } else {
+        load.refused++;
+      }
+      load.next[client] += 1000.0 / load.rate;
+    }
+  }
+  load.maxWaiting = std::max(load.maxWaiting, load.waiting.size());
+  while (!load.waiting.empty() && load.busyUntil < (now + 1) * 1000ULL) {
+    int client = load.waiting.front();
+    load.waiting.pop_front();
+    const char *path = loadRoutes[load.route[client]++ % 4];
+    uint64_t start = threadMicros();
+    std::unique_ptr<AsyncWebServerRequest> request = server.open(path, {}, IPAddress(10, 0, 0, client + 1));
+    uint64_t handler = threadMicros() - start;
+    size_t bytes = request->body.size();
+    uint64_t cost = LOAD_REQUEST_US + bytes * LOAD_SEND_US_PER_KB / 1024 + (uint64_t)handler * LOAD_CPU_SCALE;
+    load.busyUntil = std::max<uint64_t>(load.busyUntil, now * 1000ULL) + cost;
+    load.busyMicros += cost;
+    load.requests++;
+    load.ok += request->status == 200;
+    load.tooMany += request->status == 429;
+    load.unavailable += request->status == 503;
+    load.open.push_back({std::move(request), now + LOAD_CLIENT_RTT + bytes / LOAD_CLIENT_BYTES_PER_MS});
+  }
+}
+
+static bool loadBusy() {
+  return !load.waiting.empty() || load.busyUntil > millis() * 1000ULL;
+}
+
+static void startLoad(unsigned long now) {
+  double period = 1000.0 / load.rate;
+  for (int client = 0; client < load.clients; client++) {
+    load.next.push_back(now + period * client / load.clients);
+    load.route.push_back(client % 4);
+  }
+  hostPollers.push_back([]() { serveLoad(); });
+}
+
+// Failover (-f): the master runs as the standby of a pair whose primary
+// beacons until `killAt` into the capture and then falls silent. Until the
+// standby takes over, the captured frames went to the primary and the
+// standby only overhears them, as 802.11 frames in promiscuous mode, each
+// missed with probability `loss`; from its first beacon on the slaves send
+// to it. The dead primary acks nothing, so a slave keeps the status frames
+// it sent it, the last FAILOVER_HELD_SAMPLES, and sends them to the standby
+// once it took over, each sealed again with a counter of its own. Counted
+// are the status frames (samples) the standby missed while the primary was
+// alive, and those it never got of the ones sent after it died.
+typedef struct held_sample {
+  replay_frame frame;
+  bool missed;                  // The standby did not overhear it
+} held_sample;
+
+typedef struct failover_run {
+  long killAt = -1;             // ms into the capture
+  double loss = 0;              // Overheard frames missed, 0..1
+  unsigned long killTime = 0;   // millis() of the primary's last beacon
+  unsigned long nextBeacon = 0;
+  uint16_t beaconSeq = 0;
+  uint16_t seqCtrl = 0;
+  uint32_t random = 1;
+  uint32_t samples[2] = {0, 0};  // Alive, dead
+  uint32_t missed[2] = {0, 0};
+  std::deque<held_sample> held[SLAVE_COUNT];
+  uint32_t lastCounter[SLAVE_COUNT] = {};   // Each slave's last auth counter
+  uint32_t counterShift[SLAVE_COUNT] = {};  // Counters its resent frames took
+} failover_run;
+
+static failover_run failoverRun;
+
+static bool isSample(const replay_frame &frame) {
+  const std::vector<uint8_t> &data = frame.data;
+  if (!data.empty() && data[0] == MSG_RELAY && data.size() > sizeof(relay_header)) {
+    return data[sizeof(relay_header)] == MSG_STATUS;
+  }
+  return !data.empty() && data[0] == MSG_STATUS;
+}
+
+// The primary's heartbeat, while it lives: the copy of its beacon it
+// seals for us with the pair key
+static void primaryBeacon() {
+  unsigned long now = millis();
+  if (hostRecvCb == nullptr || (long)(now - failoverRun.nextBeacon) < 0 || (long)(now - failoverRun.killTime) > 0) {
+    return;
+  }
+  failoverRun.nextBeacon = now + SYNC_BEACON_INTERVAL;
+  sync_beacon beacon = {};
+  beacon.header.msgType = MSG_SYNC_BEACON;
+  beacon.header.seq = ++failoverRun.beaconSeq;
+  beacon.masterTime = now;
+  memcpy(beacon.master, primaryMasterMAC, 6);
+  beacon.term = 1;
+  uint8_t frame[sizeof(beacon) + AUTH_TRAILER_SIZE];
+  memcpy(frame, &beacon, sizeof(beacon));
+  size_t length = sizeof(beacon);
+  if (FRAME_AUTH) {
+    length = authSeal(authPairKey, AUTH_KEY_PAIR, beacon.header.seq, primaryMasterMAC, frame, length);
+  }
+  hostRecvCb(primaryMasterMAC, frame, length);
+}
+
+// A frame a slave sealed itself, sent to the master directly: its counter
+static bool directCounter(const replay_frame &frame, int slave, uint32_t *counter) {
+  const std::vector<uint8_t> &data = frame.data;
+  if (!FRAME_AUTH || slave < 0 || data.empty() || data[0] == MSG_RELAY ||
+      authKeyId(data.data(), data.size()) != AUTH_KEY_NODE) {
+    return false;
+  }
+  *counter = authLoad32(data.data() + data.size() - AUTH_TRAILER_SIZE + 1);
+  return true;
+}
+
+// `frame` as its slave seals it once it resent held frames: with its
+// counter moved up past theirs
+static replay_frame resealed(const replay_frame &frame, uint32_t counter) {
+  int slave = slaveIndex(frame.record.mac);
+  replay_frame copy = frame;
+  size_t length = copy.data.size() - AUTH_TRAILER_SIZE;
+  authSeal(authSlaveKeys[slave], AUTH_KEY_NODE, counter, frame.record.mac, copy.data.data(), length);
+  return copy;
+}
+
+// A captured frame on its way to the master that took over
+static replay_frame toStandby(const replay_frame &frame) {
+  int slave = slaveIndex(frame.record.mac);
+  uint32_t counter;
+  if (!directCounter(frame, slave, &counter) || failoverRun.counterShift[slave] == 0) {
+    return frame;
+  }
+  return resealed(frame, counter + failoverRun.counterShift[slave]);
+}
+
+// The slaves' held status frames, once the standby's first beacon moved
+// them to it
+static void resendHeld() {
+  if (failover.takeovers == 0) {
+    return;
+  }
+  for (int slave = 0; slave < SLAVE_COUNT; slave++) {
+    std::deque<held_sample> &held = failoverRun.held[slave];
+    while (!held.empty()) {
+      uint32_t counter = failoverRun.lastCounter[slave] + ++failoverRun.counterShift[slave];
+      deliver(FRAME_AUTH ? resealed(held.front().frame, counter) : held.front().frame);
+      failoverRun.missed[1] -= held.front().missed;
+      held.pop_front();
+    }
+  }
+}
+
+// A captured frame as the standby overhears it on its way to the primary
+static void overhearFrame(const replay_frame &frame) {
+  bool dead = (long)(millis() - failoverRun.killTime) > 0;
+  bool sample = isSample(frame);
+  failoverRun.random = failoverRun.random * 1103515245 + 12345;
+  bool missed = (failoverRun.random >> 16) % 10000 < failoverRun.loss * 10000;
+  failoverRun.samples[dead] += sample;
+  failoverRun.missed[dead] += sample && missed;
+  int slave = slaveIndex(frame.record.mac);
+  uint32_t counter;
+  if (directCounter(frame, slave, &counter)) {
+    failoverRun.lastCounter[slave] = counter;
+  }
+  if (dead && slave >= 0 && !frame.data.empty() && frame.data[0] == MSG_STATUS) {
+    std::deque<held_sample> &held = failoverRun.held[slave];
+    if (held.size() == FAILOVER_HELD_SAMPLES) {
+      held.pop_front();
+    }
+    held.push_back({frame, missed});
+  }
+  if (missed) {
+    return;
+  }
+  uint8_t buffer[sizeof(wifi_promiscuous_pkt_t) + ESPNOW_BODY_OFFSET + RELAY_MAX_FRAME + 4] = {0};
+  wifi_promiscuous_pkt_t *packet = (wifi_promiscuous_pkt_t *)buffer;
+  static const uint8_t oui[3] = {0x18, 0xFE, 0x34};
+  uint8_t *p = packet->payload;
+  packet->rx_ctrl.rssi = frame.record.rssi != 0 ? frame.record.rssi : -60;
+  packet->rx_ctrl.sig_len = ESPNOW_BODY_OFFSET + frame.data.size() + 4;
+  p[0] = 0xD0;  // Action frame
+  memcpy(p + 4, primaryMasterMAC, 6);
+  memcpy(p + 10, frame.record.mac, 6);
+  memcpy(p + 16, broadcastMAC, 6);
+  uint16_t seqCtrl = ++failoverRun.seqCtrl << 4;
+  p[22] = seqCtrl & 0xFF;
+  p[23] = seqCtrl >> 8;
+  p[24] = 127;  // Vendor-specific category
+  memcpy(p + 25, oui, 3);
+  p[32] = 0xDD;  // Vendor-specific element
+  p[33] = frame.data.size() + 5;
+  memcpy(p + 34, oui, 3);
+  p[37] = 4;     // ESP-NOW
+  p[38] = 1;
+  memcpy(p + ESPNOW_BODY_OFFSET, frame.data.data(), frame.data.size());
+  hostPromiscuousCb(buffer, WIFI_PKT_MGMT);
+}
+
+// What a replay measured
+typedef struct replay_result {
+  double spanSeconds;           // Capture time replayed
+  double wallSeconds;
+  uint64_t recvMicros;          // Receive callbacks, total
+  unsigned long recvMaxMicros;
+  route_timing status;          // Dashboard polls
+  route_timing page;
+  double ingestAvg;             // ms from a frame's arrival to the loop() pass that dispatches it
+  unsigned long ingestP99;
+  unsigned long ingestMax;
+} replay_result;
+
+// Boot the master and feed it `frames` at their recorded times, with the
+// load (-l) and failover (-f) set up beforehand, polling the dashboard
+// every `pollInterval` ms of replay time (0 for never)
+static replay_result runReplay(const std::vector<replay_frame> &frames, unsigned long pollInterval) {
+  replay_result result = {};
+  result.status = {"/status", 0, 0, 0};
+  result.page = {"/", 0, 0, 0};
+
+  // Boot the master shortly before the first frame; setup() waits about a second
+  uint32_t first = frames.front().record.time;
+  hostClock.set(first > 2000 ? first - 2000 : 0);
+  if (failoverRun.killAt >= 0) {
+    esp_wifi_get_mac(WIFI_IF_STA, standbyMasterMAC);  // We are the standby
+    failoverRun.killTime = first + failoverRun.killAt;
+    hostPollers.push_back([]() { primaryBeacon(); });
+    hostPollers.push_back([]() { resendHeld(); });
+  }
+  setup();
+  if (load.clients > 0) {
+    startLoad(millis());
+  }
+
+  unsigned long nextPoll = millis() + pollInterval;
+  unsigned long wallStart = micros();
+  std::vector<unsigned long> arrivals;    // Frames loop() has not had a pass over yet
+  std::vector<unsigned long> ingestMs;    // Arrival to the next loop() pass, per frame
+
+  // loop() advances the clock 10 ms per pass; land exactly on each frame's time
+  auto runUntil = [&](unsigned long until) {
+    while ((long)(until - millis()) > 0) {
+      if (loadBusy()) {
+        delay(1);  // The web server has the core
+      } else if ((long)(until - millis()) >= 10) {
+        for (unsigned long arrival : arrivals) {
+          ingestMs.push_back(millis() - arrival);
+        }
+        arrivals.clear();
+        loop();
+      } else {
+        delay(until - millis());
+      }
+      if (pollInterval > 0 && (long)(millis() - nextPoll) >= 0) {
+        nextPoll += pollInterval;
+        poll(result.status);
+        poll(result.page);
+      }
+    }
+  };
+
+  for (const replay_frame &frame : frames) {
+    runUntil(frame.record.time);
+    if (failoverRun.killAt >= 0 && failover.takeovers == 0) {
+      overhearFrame(frame);
+      continue;
+    }
+    unsigned long elapsed = deliver(failoverRun.killAt >= 0 ? toStandby(frame) : frame);
+    arrivals.push_back(millis());
+    result.recvMicros += elapsed;
+    result.recvMaxMicros = elapsed > result.recvMaxMicros ? elapsed : result.recvMaxMicros;
+  }
+  runUntil(millis() + EXPORT_FLUSH_MS + 100);  // Let loop() dispatch and export what the last frames queued
+  for (unsigned long arrival : arrivals) {
+    ingestMs.push_back(millis() - arrival);      // Frames loop() never got to
+  }
+  result.wallSeconds = (micros() - wallStart) / 1e6;
+  result.spanSeconds = (frames.back().record.time - first) / 1000.0;
+  if (!ingestMs.empty()) {
+    std::sort(ingestMs.begin(), ingestMs.end());
+    double total = 0;
+    for (unsigned long ms : ingestMs) {
+      total += ms;
+    }
+    result.ingestAvg = total / ingestMs.size();
+    result.ingestP99 = ingestMs[ingestMs.size() * 99 / 100];
+    result.ingestMax = ingestMs.back();
+  }
+  return result;
+}
+
+// Read a capture, binary or a serial log; false if it holds no frames
+static bool readCapture(const char *path, std::vector<replay_frame> &frames) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == nullptr) {
+    perror(path);
+    return false;
+  }
+  if (!loadCaptureFile(fp, frames)) {
+    rewind(fp);
+    loadSerialLog(fp, frames);
+  }
+  fclose(fp);
+  if (frames.empty()) {
+    fprintf(stderr, "%s: no frames\n", path);
+    return false;
+  }
+  return true;
+}
+
+#ifndef REPLAY_NO_MAIN
+// Split "kill_ms:loss_percent" for -f
+static bool failoverTarget(const char *arg) {
+  const char *colon = strchr(arg, ':');
+  failoverRun.killAt = atol(arg);
+  failoverRun.loss = colon != nullptr ? atof(colon + 1) / 100 : 0;
+  return failoverRun.killAt >= 0 && failoverRun.loss >= 0 && failoverRun.loss <= 1;
+}
+
+// Split "clients:rate" for -l
+static bool loadTarget(const char *arg) {
+  const char *colon = strchr(arg, ':');
+  if (colon == nullptr) {
+    return false;
+  }
+  load.clients = atoi(arg);
+  load.rate = atof(colon + 1);
+  return load.clients > 0 && load.rate > 0;
+}
+
+// Split "host:port" for the export; the strings live until exit
+static bool exportTarget(const char *arg, const char **host, uint16_t *port) {
+  static std::string hosts[2];
+  static int used = 0;
+  const char *colon = strrchr(arg, ':');
+  if (colon == nullptr || used == 2) {
+    return false;
+  }
+  hosts[used].assign(arg, colon - arg);
+  *host = hosts[used++].c_str();
+  *port = atoi(colon + 1);
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: replay [-s speed] [-p poll_ms] [-d dir] [-m host:port] [-u host:port] [-l clients:rate]\n"
+          "              [-f kill_ms[:loss_pct]] [-v] capture\n"
+          "  capture     capture.bin from the master, or a serial log with CAP lines\n"
+          "  -s speed    1 = real time (default), 1000 = 1000x, 0 = as fast as possible\n"
+          "  -p poll_ms  replay-time interval between dashboard polls (default 2000, 0 = none)\n"
+          "  -d dir      directory standing in for LittleFS, e.g. holding rules.txt\n"
+          "  -m host:port  export telemetry to this MQTT broker (IP address)\n"
+          "  -u host:port  export telemetry to this UDP sink (IP address)\n"
+          "  -l clients:rate  web load: that many clients, each making rate requests per second\n"
+          "  -f kill_ms[:loss_pct]  run as a hot standby whose primary dies kill_ms into the capture;\n"
+          "              loss_pct of the frames it overhears are missed\n"
+          "  -v          show the master's serial output and pushed events\n");
+}
+
+int main(int argc, char **argv) {
+  unsigned long pollInterval = 2000;
+  int option;
+  while ((option = getopt(argc, argv, "s:p:d:m:u:l:f:v")) != -1) {
+    switch (option) {
+      case 's':
+        hostClock.speed = atof(optarg);
+        break;
+      case 'p':
+        pollInterval = strtoul(optarg, nullptr, 10);
+        break;
+      case 'd':
+        hostFsRoot = optarg;
+        break;
+      case 'm':
+        if (!exportTarget(optarg, &export_mqtt_host, &export_mqtt_port)) {
+          usage();
+          return 2;
+        }
+        break;
+      case 'u':
+        if (!exportTarget(optarg, &export_udp_host, &export_udp_port)) {
+          usage();
+          return 2;
+        }
+        break;
+      case 'l':
+        if (!loadTarget(optarg)) {
+          usage();
+          return 2;
+        }
+        break;
+      case 'f':
+        if (!failoverTarget(optarg)) {
+          usage();
+          return 2;
+        }
+        break;
+      case 'v':
+        hostVerbose = true;
+        break;
+      default:
+        usage();
+        return 2;
+    }
+  }
+  if (optind != argc - 1) {
+    usage();
+    return 2;
+  }
+
+  std::vector<replay_frame> frames;
+  if (!readCapture(argv[optind], frames)) {
+    return 1;
+  }
+  replay_result result = runReplay(frames, pollInterval);
+  double spanSeconds = result.spanSeconds;
+  double wallSeconds = result.wallSeconds;
+
+  printf("--- /status\n%s\n", server.get("/status").c_str());
+  printf("--- /metrics\n%s", server.get("/metrics").c_str());
+  printf("--- /stats\n%s", server.get("/stats").c_str());
+  printf("--- replay\n");
+  printf("frames %zu\ncapture_seconds %.1f\nwall_seconds %.3f\nspeedup %.0f\n",
+         frames.size(), spanSeconds, wallSeconds, wallSeconds > 0 ? spanSeconds / wallSeconds : 0.0);
+  printf("recv_us_avg %.2f\nrecv_us_max %lu\nframes_sent %u\nevents_pushed %u\n",
+         (double)result.recvMicros / frames.size(), result.recvMaxMicros, (unsigned)hostFramesSent,
+         (unsigned)events.sent);
+  for (const route_timing *route : {&result.status, &result.page}) {
+    printf("poll %s requests %u us_avg %.2f us_max %lu\n", route->path, (unsigned)route->requests,
+           route->requests ? (double)route->totalMicros / route->requests : 0.0, route->maxMicros);
+  }
+  printf("ingest_ms_avg %.2f\ningest_ms_p99 %lu\ningest_ms_max %lu\n", result.ingestAvg, result.ingestP99,
+         result.ingestMax);
+  if (failoverRun.killAt >= 0) {
+    printf("failover_kill_ms %ld\nfailover_takeover_ms %ld\nfailover_samples_alive %u\nfailover_samples_missed_alive %u\n"
+           "failover_samples_dead %u\nfailover_samples_lost %u\n",
+           failoverRun.killAt, failover.takeovers ? (long)(failover.activeSince - failoverRun.killTime) : -1L,
+           (unsigned)failoverRun.samples[0], (unsigned)failoverRun.missed[0], (unsigned)failoverRun.samples[1],
+           (unsigned)failoverRun.missed[1]);
+  }
+  if (load.clients > 0) {
+    printf("load_clients %d\nload_rate %.1f\nload_requests %u\nload_refused %u\nload_ok %u\nload_429 %u\n"
+           "load_503 %u\nload_cpu_pct %.1f\nload_waiting_max %zu\n",
+           load.clients, load.rate, (unsigned)load.requests, (unsigned)load.refused, (unsigned)load.ok, (unsigned)load.tooMany,
+           (unsigned)load.unavailable, spanSeconds > 0 ? load.busyMicros / (spanSeconds * 1e4) : 0.0,
+           load.maxWaiting);
+  }
+  return 0;
+}
+#endif
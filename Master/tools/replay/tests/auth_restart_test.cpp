@@ -0,0 +1,129 @@
+// Replay protection across a restart with frame_auth.h (user-042): a
+// receiver hears 24 senders, more than its table holds, each sealing frames
+// with a counter of its own. It knows 8 of them beforehand, as a master
+// knows its slaves, and gives the others an entry at their first frame
+// while there is room, as a slave does the relays it hears. It saves its
+// table the way loop() does, a few frames late, restarts at a random
+// moment and loads what it saved. Checked, over 1000 restarts: no sender
+// loses its entry to another, so the frames of those heard least are
+// dropped when played back as well; a sender that found no room had none
+// of its frames taken; of the frames heard before the restart only those
+// that came in after loop()'s last pass can be taken again; and a sender
+// that kept running loses fewer than AUTH_SAVE_STEP frames.
+#include "check.h"
+#include "frame_auth.h"
+
+#include <map>
+#include <vector>
+
+#define SENDERS 24
+#define KNOWN 8                   // Senders with an entry from the start
+#define RESTARTS 1000
+#define SAVE_LAG 3                // Frames heard between passes of loop()
+
+typedef std::map<int, std::vector<uint8_t>> saved_table;  // What NVS holds, by entry
+
+// loop()'s pass: returns the entries written
+static uint32_t save(auth_replay &replay, saved_table &flash) {
+  uint8_t saved[AUTH_SAVED_SIZE];
+  uint32_t writes = 0;
+  int index;
+  while ((index = authTakeUnsaved(replay, saved)) >= 0) {
+    flash[index].assign(saved, saved + sizeof(saved));
+    writes++;
+  }
+  return writes;
+}
+
+// A frame from `mac`; the first of an unknown sender gets it an entry if one is free
+static bool take(auth_replay &replay, const uint8_t *mac, uint32_t counter) {
+  authAddSender(replay, mac, AUTH_KEY_NODE);
+  return authFresh(replay, mac, AUTH_KEY_NODE, counter);
+}
+
+static void addKnown(auth_replay &replay, uint8_t macs[][6]) {
+  authReplayInit(replay);
+  for (int s = 0; s < KNOWN; s++) {
+    authAddSender(replay, macs[s], AUTH_KEY_NODE);
+  }
+}
+
+int main() {
+  uint32_t replayedTotal = 0, lostWorst = 0, writes = 0, frameTotal = 0, refusedTotal = 0;
+  for (int restart = 0; restart < RESTARTS; restart++) {
+    auth_replay replay;
+    saved_table flash;
+    uint32_t counters[SENDERS];
+    uint32_t heard[SENDERS];      // Last counter of each sender the receiver took
+    uint8_t macs[SENDERS][6];
+    for (int s = 0; s < SENDERS; s++) {
+      counters[s] = (uint32_t)(1 + testRandom() % 50) << 16;
+      heard[s] = 0;
+      uint8_t mac[6] = {0x02, 0, 0, 0, 1, (uint8_t)s};
+      memcpy(macs[s], mac, 6);
+    }
+    addKnown(replay, macs);
+
+    // Most frames come from the first senders, the rest now and then
+    int frames = 500 + testRandom() % 5000;
+    frameTotal += frames;
+    for (int f = 0; f < frames; f++) {
+      int s = testChance(0.9) ? testRandom() % 12 : testRandom() % SENDERS;
+      uint32_t counter = ++counters[s];
+      if (take(replay, macs[s], counter)) {
+        heard[s] = counter;
+      }
+      if (f % SAVE_LAG == 0) {
+        writes += save(replay, flash);
+      }
+    }
+
+    // Before the restart: every sender's frames played back, the least
+    // heard ones included
+    for (int s = 0; s < SENDERS; s++) {
+      if (heard[s] == 0) {
+        CHECK(s >= KNOWN);
+        refusedTotal++;     // Found the table full
+        continue;
+      }
+      for (uint32_t counter = heard[s] - 200; counter <= heard[s]; counter++) {
+        auth_replay copy = replay;
+        CHECK(!take(copy, macs[s], counter));
+      }
+    }
+
+    // Restart: a fresh table loaded from flash
+    addKnown(replay, macs);
+    for (const auto &entry : flash) {
+      authRestore(replay, entry.second.data());
+    }
+
+    for (int s = 0; s < SENDERS; s++) {
+      if (heard[s] == 0) {
+        continue;   // Nothing of it was taken, so there is nothing to play back
+      }
+      // The frames it sent last, played back: only those heard after the
+      // last pass of loop() may get through
+      uint32_t replayed = 0;
+      for (uint32_t counter = heard[s] - 200; counter <= heard[s]; counter++) {
+        auth_replay copy = replay;
+        replayed += take(copy, macs[s], counter);
+      }
+      CHECK(replayed < SAVE_LAG);
+      replayedTotal += replayed;
+
+      // The sender goes on: frames until one is taken
+      uint32_t lost = 0;
+      while (!take(replay, macs[s], ++counters[s])) {
+        lost++;
+      }
+      CHECK(lost < AUTH_SAVE_STEP);
+      lostWorst = lost > lostWorst ? lost : lostWorst;
+    }
+  }
+  printf("%d restarts, %d senders for %d entries: %u flash writes for %u frames, %u senders without room, %u old "
+         "frames taken again, at most %u new frames lost per sender (step %d)\n",
+         RESTARTS, SENDERS, AUTH_SENDERS, (unsigned)writes, (unsigned)frameTotal, (unsigned)refusedTotal,
+         (unsigned)replayedTotal, (unsigned)lostWorst, AUTH_SAVE_STEP);
+  return 0;
+}
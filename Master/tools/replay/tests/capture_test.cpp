@@ -0,0 +1,83 @@
+// Frame capture drain (user-033): the frames of the checked-in capture are
+// pushed into the capture ring as fast as the receive callback would take
+// them in a burst, and drainCapture() writes them to a file pass by pass.
+// Checked: no pass writes more than CAPTURE_DRAIN_BYTES plus the record that
+// crosses it, nothing is dropped, and the file comes out byte for byte the
+// capture that went in.
+#include "../../../src/main.cpp"
+#include "check.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#define FIXTURE "fixtures/capture.bin"
+
+static std::vector<uint8_t> readFile(const std::string &path) {
+  std::vector<uint8_t> bytes;
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (fp == nullptr) {
+    return bytes;
+  }
+  uint8_t buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    bytes.insert(bytes.end(), buffer, buffer + length);
+  }
+  fclose(fp);
+  return bytes;
+}
+
+int main() {
+  std::vector<uint8_t> fixture = readFile(FIXTURE);
+  CHECK(fixture.size() > sizeof(capture_file_header));
+
+  char dir[] = "/tmp/capture_test.XXXXXX";
+  CHECK(mkdtemp(dir) != nullptr);
+  hostFsRoot = dir;
+  setup();
+  captureRequested = CAPTURE_TO_FILE;
+  drainCapture();  // Opens the file
+  CHECK(captureSink == CAPTURE_TO_FILE);
+
+  size_t offset = sizeof(capture_file_header);
+  uint32_t records = 0;
+  uint32_t passes = 0;
+  uint32_t maxPass = 0;
+  while (offset < fixture.size() || captureRing.used > 0) {
+    // Fill the ring up, as a burst of frames would
+    while (offset < fixture.size()) {
+      capture_record record;
+      memcpy(&record, &fixture[offset], sizeof(record));
+      if (captureRing.used + sizeof(record) + record.length > CAPTURE_RING_SIZE) {
+        break;
+      }
+      captureWrite(captureRing, record.time, record.mac, record.rssi, &fixture[offset + sizeof(record)], record.length);
+      offset += sizeof(record) + record.length;
+      records++;
+    }
+    uint32_t before = captureBytesWritten;
+    drainCapture();
+    uint32_t pass = captureBytesWritten - before;
+    CHECK(pass > 0);
+    maxPass = pass > maxPass ? pass : maxPass;
+    passes++;
+  }
+  uint32_t dropped = captureRing.dropped;
+  captureRequested = CAPTURE_OFF;
+  drainCapture();  // Closes the file
+
+  std::vector<uint8_t> written = readFile(std::string(dir) + CAPTURE_FILE);
+  printf("%u records, %u bytes drained in %u passes, at most %u bytes a pass (limit %u), %u dropped\n",
+         (unsigned)records, (unsigned)(written.size() - sizeof(capture_file_header)), (unsigned)passes,
+         (unsigned)maxPass, (unsigned)CAPTURE_DRAIN_BYTES, (unsigned)dropped);
+  CHECK(maxPass <= CAPTURE_DRAIN_BYTES + CAPTURE_MAX_RECORD);
+  CHECK(passes > 1);
+  CHECK(dropped == 0);
+  CHECK(written == fixture);
+
+  unlink((std::string(dir) + CAPTURE_FILE).c_str());
+  rmdir(dir);
+  return 0;
+}
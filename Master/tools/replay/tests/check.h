@@ -0,0 +1,30 @@
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// The host tests print the figures they measure and stop at the first
+// broken expectation, so make test fails on it
+#define CHECK(condition)                                                          \
+  do {                                                                            \
+    if (!(condition)) {                                                           \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      exit(1);                                                                    \
+    }                                                                             \
+  } while (0)
+
+// Repeatable pseudo-random numbers, the same on every host
+static inline uint32_t testRandom() {
+  static uint32_t state = 1;
+  state = state * 1103515245 + 12345;
+  return (state >> 16) & 0x7FFF;
+}
+
+// True with probability p
+static inline bool testChance(double p) {
+  return testRandom() < p * 32768;
+}
+
+#endif
@@ -0,0 +1,153 @@
+// Host heap soak (user-028): the esp32dev_soak build's request loop, run
+// here for millions of requests with every heap allocation counted. Once
+// the response pools are warm the request path must not touch the heap at
+// all, which is what keeps the ESP32's largest free block from shrinking.
+// Then the real /status, /, /metrics and /stats routes, through the web
+// server shim: admission, the pools and the disconnect that releases
+// them. What the library allocates for a request (the shim's
+// HostLibraryScope) is counted apart; our own code must allocate nothing.
+#include "../../../src/main.cpp"
+#include "check.h"
+
+#include <new>
+
+// The operators below pair new with free(); that is what they replace
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+#define SOAK_WARMUP_PASSES 10     // loop() passes before counting
+#define SOAK_PASSES 1000          // loop() passes counted, SOAK_BATCH request cycles each
+#define SOAK_WEB_WARMUP 1000      // Routed requests before counting
+#define SOAK_WEB_REQUESTS 200000  // Routed requests counted
+#define SOAK_WEB_CLIENTS 16
+#define SOAK_WEB_STEP_MS 20       // Between requests: 50 a second from 16 clients, within their rate
+
+static uint64_t heapAllocations = 0;
+static uint64_t heapBytes = 0;
+static uint64_t libraryAllocations = 0;
+
+extern "C" void *__real_malloc(size_t size);
+extern "C" void *__real_calloc(size_t count, size_t size);
+extern "C" void *__real_realloc(void *pointer, size_t size);
+
+static void countAllocation(size_t size) {
+  if (hostLibraryDepth > 0) {
+    libraryAllocations++;
+    return;
+  }
+  heapAllocations++;
+  heapBytes += size;
+}
+
+extern "C" void *__wrap_malloc(size_t size) {
+  countAllocation(size);
+  return __real_malloc(size);
+}
+
+extern "C" void *__wrap_calloc(size_t count, size_t size) {
+  countAllocation(count * size);
+  return __real_calloc(count, size);
+}
+
+extern "C" void *__wrap_realloc(void *pointer, size_t size) {
+  countAllocation(size);
+  return __real_realloc(pointer, size);
+}
+
+void *operator new(size_t size) {
+  void *pointer = __wrap_malloc(size);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+  free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept {
+  free(pointer);
+}
+
+// Routed requests with two in flight at a time, a new frame every tenth;
+// returns how many were answered 200
+static uint32_t soakRoutes(int requests) {
+  static const char *const routes[] = {"/status", "/", "/metrics", "/stats"};
+  static std::unique_ptr<AsyncWebServerRequest> inFlight[2];
+  uint32_t ok = 0;
+  for (int i = 0; i < requests; i++) {
+    if (i % 10 == 0) {
+      soakFrame();
+    }
+    IPAddress client(10, 0, 0, 1 + i % SOAK_WEB_CLIENTS);
+    std::unique_ptr<AsyncWebServerRequest> request = server.open(routes[i % 4], {}, client);
+    ok += request->status == 200;
+    server.close(std::move(inFlight[i % 2]));
+    inFlight[i % 2] = std::move(request);
+    hostClock.advance(SOAK_WEB_STEP_MS);
+    soakRequests++;
+  }
+  return ok;
+}
+
+int main() {
+  setup();
+  for (int i = 0; i < SOAK_WARMUP_PASSES; i++) {
+    loop();
+  }
+
+  CHECK(heapAllocations > 0);  // Booting allocates, so the counting works
+  uint64_t allocationsBefore = heapAllocations;
+  uint64_t bytesBefore = heapBytes;
+  uint64_t requestsBefore = soakRequests;
+  unsigned long start = micros();
+  for (int i = 0; i < SOAK_PASSES; i++) {
+    loop();
+  }
+  double seconds = (micros() - start) / 1e6;
+  uint64_t requests = soakRequests - requestsBefore;
+  uint64_t allocations = heapAllocations - allocationsBefore;
+
+  printf("requests %llu in %.1f s: heap allocations %llu (%llu bytes), renders %u, pool exhausted %u, "
+         "truncated %u\n",
+         (unsigned long long)requests, seconds, (unsigned long long)allocations,
+         (unsigned long long)(heapBytes - bytesBefore),
+         (unsigned)(soakStatusCache.rebuilds + soakPageCache.rebuilds),
+         (unsigned)(soakStatusCache.poolExhausted + soakPageCache.poolExhausted),
+         (unsigned)(soakStatusCache.truncations + soakPageCache.truncations));
+  CHECK(requests >= 1000000);
+  CHECK(allocations == 0);
+  CHECK(soakStatusCache.poolExhausted == 0 && soakPageCache.poolExhausted == 0);
+  CHECK(soakStatusCache.truncations == 0 && soakPageCache.truncations == 0);
+
+  // The routes as the web server calls them
+  hostClock.speed = 0;
+  soakRoutes(SOAK_WEB_WARMUP);
+  allocationsBefore = heapAllocations;
+  bytesBefore = heapBytes;
+  uint64_t libraryBefore = libraryAllocations;
+  uint32_t ok = soakRoutes(SOAK_WEB_REQUESTS);
+  allocations = heapAllocations - allocationsBefore;
+  printf("routed requests %u: %u answered 200, heap allocations %llu (%llu bytes), by the library %llu, "
+         "pool exhausted %u\n",
+         (unsigned)SOAK_WEB_REQUESTS, (unsigned)ok, (unsigned long long)allocations,
+         (unsigned long long)(heapBytes - bytesBefore), (unsigned long long)(libraryAllocations - libraryBefore),
+         (unsigned)(statusCache.poolExhausted + pageCache.poolExhausted + metricsCache.poolExhausted +
+                    statsCache.poolExhausted));
+  CHECK(ok == SOAK_WEB_REQUESTS);
+  CHECK(allocations == 0);
+  CHECK(libraryAllocations > libraryBefore);  // The library's are counted apart, not missed
+  return 0;
+}
@@ -0,0 +1,76 @@
+// Detection latency of peer_liveness.h (user-027): a slave reporting on its
+// interval with jitter must never be flagged, and once it dies it must be
+// offline within a few intervals.
+#include "check.h"
+#include "peer_liveness.h"
+
+#define JITTER_MS 60              // Ordinary jitter on top of the interval
+#define RUN_FRAMES 20000          // Frames before the node dies
+#define EVALUATE_MS 100           // How often loop() re-evaluates
+
+// Feed `frames` frames `interval` ms apart from `now`; returns the clock of the last one
+static unsigned long runAlive(peer_liveness &peer, unsigned long now, unsigned long interval, int frames,
+                              uint32_t &falseAlarms) {
+  unsigned long lastFrame = now;
+  for (int i = 0; i < frames; i++) {
+    livenessOnFrame(peer, now);
+    lastFrame = now;
+    unsigned long next = now + interval + testRandom() % JITTER_MS;
+    for (unsigned long t = now; t < next; t += EVALUATE_MS) {
+      livenessEvaluate(peer, t);
+      if (i > 0 && peer.state != PEER_ONLINE) {
+        falseAlarms++;
+      }
+    }
+    now = next;
+  }
+  return lastFrame;
+}
+
+// Time from the last frame until the peer is offline, and until degraded
+static void runDead(peer_liveness &peer, unsigned long lastFrame, unsigned long &degradedAfter,
+                    unsigned long &offlineAfter) {
+  degradedAfter = 0;
+  for (unsigned long t = lastFrame;; t += EVALUATE_MS) {
+    livenessEvaluate(peer, t);
+    if (peer.state == PEER_DEGRADED && degradedAfter == 0) {
+      degradedAfter = t - lastFrame;
+    }
+    if (peer.state == PEER_OFFLINE) {
+      offlineAfter = t - lastFrame;
+      return;
+    }
+  }
+}
+
+int main() {
+  const unsigned long intervals[] = {1000, 2000, 5000};
+  for (unsigned long interval : intervals) {
+    peer_liveness peer;
+    livenessInit(peer, 0);
+    uint32_t falseAlarms = 0;
+    unsigned long lastFrame = runAlive(peer, 3000, interval, RUN_FRAMES, falseAlarms);
+    unsigned long degradedAfter, offlineAfter;
+    runDead(peer, lastFrame, degradedAfter, offlineAfter);
+    printf("interval %lu ms: false alarms %u, timeout %lu ms, degraded after %lu ms, offline after %lu ms "
+           "(%.1f intervals)\n",
+           interval, (unsigned)falseAlarms, livenessTimeout(peer), degradedAfter, offlineAfter,
+           (double)offlineAfter / interval);
+    CHECK(falseAlarms == 0);
+    CHECK(peer.offlineEvents == 1);
+    CHECK(offlineAfter <= 5 * interval);
+  }
+
+  // A node that comes back is online with its first frame
+  peer_liveness peer;
+  livenessInit(peer, 0);
+  uint32_t falseAlarms = 0;
+  unsigned long now = runAlive(peer, 3000, 1000, 100, falseAlarms);
+  livenessEvaluate(peer, now + 60000);
+  CHECK(falseAlarms == 0);
+  CHECK(peer.state == PEER_OFFLINE);
+  livenessOnFrame(peer, now + 60000);
+  livenessEvaluate(peer, now + 60000);
+  CHECK(peer.state == PEER_ONLINE);
+  return 0;
+}
@@ -0,0 +1,71 @@
+// Web load against the ESP-NOW ingest (user-040): the replay tool's -l
+// model over fixtures/capture.bin, with admission control on, at 4 to 64
+// clients making 5 requests a second each, at 16 making 20, and at 32
+// making 20, which without admission control keeps the core busy enough to
+// hold loop() back by 40 ms. The ingest latency is the time from a frame's
+// arrival to the loop() pass that dispatches it. Checked: its 99th
+// percentile and worst case stay within LOAD_P99_MS and LOAD_MAX_MS at
+// every load, while the web is still answered.
+#define REPLAY_NO_MAIN
+#include "../replay.cpp"
+#include "check.h"
+
+#include <sys/wait.h>
+
+#define FIXTURE "fixtures/capture.bin"
+#define LOAD_P99_MS 10
+#define LOAD_MAX_MS 20
+
+typedef struct load_outcome {
+  replay_result replay;
+  uint32_t requests;
+  uint32_t ok;
+  uint32_t shed;                // 429 and 503
+} load_outcome;
+
+// One replay per process, the master's state being global
+static load_outcome replayUnderLoad(const std::vector<replay_frame> &frames, int clients, double rate) {
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  pid_t child = fork();
+  CHECK(child >= 0);
+  if (child == 0) {
+    close(fds[0]);
+    hostClock.speed = 0;
+    load.clients = clients;
+    load.rate = rate;
+    load_outcome outcome;
+    outcome.replay = runReplay(frames, 0);
+    outcome.requests = load.requests;
+    outcome.ok = load.ok;
+    outcome.shed = load.tooMany + load.unavailable;
+    _exit(write(fds[1], &outcome, sizeof(outcome)) == sizeof(outcome) ? 0 : 1);
+  }
+  close(fds[1]);
+  load_outcome outcome;
+  CHECK(read(fds[0], &outcome, sizeof(outcome)) == sizeof(outcome));
+  close(fds[0]);
+  int status;
+  CHECK(waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  return outcome;
+}
+
+int main() {
+  std::vector<replay_frame> frames;
+  CHECK(readCapture(FIXTURE, frames));
+
+  const struct {
+    int clients;
+    double rate;
+  } loads[] = {{4, 5}, {16, 5}, {32, 5}, {64, 5}, {16, 20}, {32, 20}};
+  for (const auto &l : loads) {
+    load_outcome outcome = replayUnderLoad(frames, l.clients, l.rate);
+    printf("%2d clients x %2.0f req/s: ingest_ms avg %.2f, p99 %lu, max %lu; %u requests, %u answered, %u shed\n",
+           l.clients, l.rate, outcome.replay.ingestAvg, outcome.replay.ingestP99, outcome.replay.ingestMax,
+           (unsigned)outcome.requests, (unsigned)outcome.ok, (unsigned)outcome.shed);
+    CHECK(outcome.replay.ingestP99 <= LOAD_P99_MS);
+    CHECK(outcome.replay.ingestMax <= LOAD_MAX_MS);
+    CHECK(outcome.ok > 0);
+  }
+  return 0;
+}
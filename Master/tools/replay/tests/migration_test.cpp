@@ -0,0 +1,138 @@
+// Channel migration with channel_migration.h (user-038): the master and
+// three slaves, over a thousand router channel changes each, announced on
+// the old channel or made by the STA before the master could warn anyone,
+// with and without frame loss. The outage of a slave runs from the master's
+// switch to the first beacon the slave hears on the new channel. Checked:
+// no slave is ever stranded, an announced move costs no more than one probe
+// answer when nothing is lost, an unannounced one no more than
+// RECOVERY_SILENCE plus one sweep, and with 10% loss, where a lost probe or
+// answer (one in five) costs another sweep, 99% of outages stay within three.
+#include "check.h"
+#include "channel_migration.h"
+
+#include <algorithm>
+#include <vector>
+
+#define SLAVES 3
+#define TRIALS 1000               // Router channel changes per case
+#define OLD_CHANNEL 6
+#define BEACON_INTERVAL 1000      // ms
+#define PROBE_ANSWER_MS 15        // From a probe to the master's beacon in reply
+#define FOUND_AFTER 6000          // ms from the router's move to the master's scan finding it
+#define SCAN_MS 2000              // The scan; no beacons meanwhile
+#define STA_FOLLOW_MS 200         // An unannounced move: the STA is on the new channel this soon
+#define TRIAL_MS 40000
+#define SWEEP_MS (CHANNEL_COUNT * RECOVERY_DWELL)
+
+typedef struct outage_result {
+  unsigned long worst;
+  unsigned long p99;
+  double mean;
+  uint32_t sweeps;
+} outage_result;
+
+static outage_result runMigration(double loss, bool announced) {
+  outage_result result = {0, 0, 0, 0};
+  std::vector<unsigned long> outages;
+  for (int trial = 0; trial < TRIALS; trial++) {
+    channel_migration master;
+    migrationInit(master, OLD_CHANNEL);
+    channel_recovery slaves[SLAVES];
+    for (channel_recovery &slave : slaves) {
+      recoveryInit(slave, OLD_CHANNEL, 0);
+    }
+    uint8_t newChannel = CHANNEL_FIRST + testRandom() % CHANNEL_COUNT;
+    if (newChannel == OLD_CHANNEL) {
+      newChannel = 11;
+    }
+    unsigned long routerMove = 10000 + testRandom() % 1000;
+    unsigned long found = routerMove + (announced ? FOUND_AFTER : STA_FOLLOW_MS);
+    unsigned long lastBeacon = 0;
+    unsigned long switched = 0;
+    unsigned long answerAt[SLAVES] = {0};   // Beacon in reply to a probe, 0 for none
+    unsigned long back[SLAVES] = {0};       // Outage, once over
+
+    for (unsigned long now = 1; now < TRIAL_MS; now++) {
+      bool scanning = announced && now >= found && now < found + SCAN_MS;
+      if (!announced && now == found) {
+        migrationAdopt(master, newChannel);
+        switched = now;
+      }
+      if (announced && now == found + SCAN_MS) {
+        migrationStart(master, newChannel, now);
+      }
+      if (migrationNoticeDue(master, now)) {
+        uint16_t switchIn = migrationNoticeSent(master, now);
+        for (channel_recovery &slave : slaves) {
+          if (slave.channel == master.channel && !testChance(loss)) {
+            recoveryOnNotice(slave, master.newChannel, now + switchIn);
+          }
+        }
+      }
+      if (migrationSwitchDue(master, now)) {
+        switched = now;
+      }
+
+      bool beacon = !scanning && now - lastBeacon >= BEACON_INTERVAL;
+      if (beacon) {
+        lastBeacon = now;
+      }
+      for (int i = 0; i < SLAVES; i++) {
+        channel_recovery &slave = slaves[i];
+        bool heard = beacon || answerAt[i] == now;
+        if (answerAt[i] == now) {
+          answerAt[i] = 0;
+        }
+        if (heard && slave.channel == master.channel && !testChance(loss)) {
+          recoveryOnBeacon(slave, now);
+          if (switched != 0 && back[i] == 0) {
+            back[i] = now - switched;
+          }
+        }
+        uint8_t probe = recoveryTick(slave, now);
+        if (probe != 0 && probe == master.channel && !scanning && !testChance(loss)) {
+          answerAt[i] = now + PROBE_ANSWER_MS;
+        }
+      }
+    }
+
+    for (int i = 0; i < SLAVES; i++) {
+      CHECK(slaves[i].channel == master.channel);  // Never stranded
+      CHECK(back[i] != 0);
+      result.sweeps += slaves[i].sweeps;
+      outages.push_back(back[i]);
+    }
+  }
+  std::sort(outages.begin(), outages.end());
+  double total = 0;
+  for (unsigned long outage : outages) {
+    total += outage;
+  }
+  result.mean = total / outages.size();
+  result.p99 = outages[outages.size() * 99 / 100];
+  result.worst = outages.back();
+  return result;
+}
+
+int main() {
+  const struct {
+    double loss;
+    bool announced;
+    unsigned long bound;   // Outage allowed, ms: the worst without loss, the 99th percentile with it
+  } cases[] = {
+    {0, true, PROBE_ANSWER_MS},
+    {0, false, RECOVERY_SILENCE + SWEEP_MS},
+    {0.1, true, RECOVERY_SILENCE + 3 * SWEEP_MS},
+    {0.1, false, RECOVERY_SILENCE + 3 * SWEEP_MS},
+  };
+  for (const auto &c : cases) {
+    outage_result result = runMigration(c.loss, c.announced);
+    printf("%2.0f%% loss, %s: mean outage %.0f ms, 99%% %lu ms, worst %lu ms (bound %lu), %u sweeps over %d slave "
+           "moves\n",
+           c.loss * 100, c.announced ? "announced" : "unannounced", result.mean, result.p99, result.worst, c.bound,
+           (unsigned)result.sweeps, TRIALS * SLAVES);
+    CHECK((c.loss > 0 ? result.p99 : result.worst) <= c.bound);
+    CHECK(c.loss > 0 || !c.announced || result.sweeps == 0);
+  }
+  return 0;
+}
@@ -0,0 +1,205 @@
+// Firmware distribution with ota_transfer.h (user-035), end to end on the
+// host: the master's sender and each slave's receiver, its receive queue
+// and a flash image of its own, over a broadcast channel that loses frames
+// and acks and now and then corrupts a chunk. A slave commits only if what
+// it wrote matches the image byte for byte. Checked: every node is updated,
+// fleet update time follows image size rather than node count, corrupted
+// chunks are caught, a transfer broken off resumes where it stopped, and a
+// node that dies is given up without holding the others back.
+#include "check.h"
+#include "ota_transfer.h"
+
+#include <vector>
+
+#define STEP_MS 2                 // Time per pass of the master's loop
+#define BURST 4                   // Frames the master may send per pass
+#define SESSION 42
+#define GIVE_UP_MS 900000         // A transfer that takes longer has failed
+
+typedef struct ota_run {
+  int nodes;
+  double loss;                    // Frames and acks lost, 0..1
+  double corrupt;                 // Chunks that arrive with a bad CRC, 0..1
+  uint32_t imageSize;
+  unsigned long restartAt;        // Master reboots and offers again, 0 for never
+  unsigned long killAt;           // Node 0 dies, 0 for never
+} ota_run;
+
+typedef struct ota_result {
+  uint32_t frames;                // Everything the master put on the air
+  uint32_t chunksSent;
+  uint32_t chunksResent;
+  uint32_t crcErrors;
+  uint32_t freshOffers;           // Offers that made a node start the image over
+  int updated;
+  double seconds;
+} ota_result;
+
+typedef struct ota_node {
+  ota_receiver rx;
+  ota_rx_queue queue;
+  std::vector<uint8_t> flash;
+  bool alive;
+} ota_node;
+
+static ota_result runOta(const ota_run &run) {
+  std::vector<uint8_t> image(run.imageSize);
+  for (uint8_t &byte : image) {
+    byte = testRandom();
+  }
+  uint8_t sha256[32] = {0};
+  memcpy(sha256, &run.imageSize, sizeof(run.imageSize));  // Only compared, never computed here
+
+  std::vector<ota_node> nodes(run.nodes);
+  for (ota_node &node : nodes) {
+    otaReceiverInit(node.rx);
+    node.queue = ota_rx_queue();
+    node.flash.assign(run.imageSize, 0xFF);
+    node.alive = true;
+  }
+
+  ota_sender tx;
+  otaSenderStart(tx, SESSION, run.imageSize, 0);
+  ota_result result = {0, 0, 0, 0, 0, 0, 0};
+  uint32_t chunksBefore = 0, resentBefore = 0;  // From before a restart
+
+  auto ack = [&](int n, unsigned long now) {
+    if (testChance(run.loss)) {
+      return;
+    }
+    uint8_t mac[6] = {0x02, 0, 0, 0, 0, (uint8_t)n};
+    otaSenderOnAck(tx, mac, nodes[n].rx.session, nodes[n].rx.state, nodes[n].rx.base, otaReceiverBitmap(nodes[n].rx),
+                   now);
+  };
+
+  unsigned long now = 0;
+  for (; tx.phase != OTA_PHASE_DONE && now < GIVE_UP_MS; now += STEP_MS) {
+    if (run.restartAt != 0 && now == run.restartAt) {
+      chunksBefore = tx.chunksSent;
+      resentBefore = tx.chunksResent;
+      otaSenderStart(tx, SESSION, run.imageSize, now);
+    }
+    if (run.killAt != 0 && now == run.killAt) {
+      nodes[0].alive = false;
+    }
+
+    for (int burst = 0; burst < BURST; burst++) {
+      uint16_t chunk = 0;
+      uint8_t action = otaSenderPoll(tx, now, chunk);
+      if (action == OTA_SEND_NOTHING) {
+        break;
+      }
+      result.frames++;
+      const uint8_t *data = action == OTA_SEND_CHUNK ? &image[(size_t)chunk * OTA_CHUNK_SIZE] : nullptr;
+      size_t length = action == OTA_SEND_CHUNK ? otaChunkLength(run.imageSize, chunk) : 0;
+      uint32_t crc = data ? otaCrc32(data, length) : 0;
+      for (int n = 0; n < run.nodes; n++) {
+        ota_node &node = nodes[n];
+        if (!node.alive || testChance(run.loss)) {
+          continue;
+        }
+        switch (action) {
+          case OTA_SEND_OFFER:
+            result.freshOffers += otaReceiverOffer(node.rx, SESSION, run.imageSize, sha256);
+            ack(n, now);
+            break;
+          case OTA_SEND_POLL:
+            ack(n, now);
+            break;
+          case OTA_SEND_COMMIT:
+            if (node.rx.state == OTA_COMPLETE) {
+              node.rx.state = node.flash == image ? OTA_VERIFIED : OTA_FAILED;
+            }
+            ack(n, now);
+            break;
+          case OTA_SEND_CHUNK: {
+            uint8_t frame[OTA_CHUNK_SIZE];
+            memcpy(frame, data, length);
+            if (testChance(run.corrupt)) {
+              frame[testRandom() % length] ^= 0x20;
+            }
+            if (otaReceiverWants(node.rx, SESSION, chunk, frame, length, crc)) {
+              otaRxPush(node.queue, chunk, frame, length);
+            }
+            break;
+          }
+        }
+      }
+      if (action == OTA_SEND_CHUNK) {
+        otaSenderSent(tx, chunk);
+      }
+    }
+
+    // Each slave's loop writes what its receive callback queued
+    for (int n = 0; n < run.nodes; n++) {
+      ota_node &node = nodes[n];
+      ota_rx_chunk chunk;
+      while (node.alive && otaRxPop(node.queue, chunk)) {
+        memcpy(&node.flash[(size_t)chunk.index * OTA_CHUNK_SIZE], chunk.data, chunk.length);
+        if (otaReceiverWritten(node.rx, chunk.index)) {
+          ack(n, now);
+        }
+      }
+    }
+  }
+
+  result.chunksSent = chunksBefore + tx.chunksSent;
+  result.chunksResent = resentBefore + tx.chunksResent;
+  for (const ota_node &node : nodes) {
+    result.crcErrors += node.rx.crcErrors;
+    CHECK(node.rx.state != OTA_VERIFIED || node.flash == image);
+  }
+  result.updated = otaSenderUpdated(tx);
+  result.seconds = now / 1000.0;
+  return result;
+}
+
+static void report(const char *what, const ota_run &run, const ota_result &result) {
+  printf("%s: %d nodes, %u KB, %.0f%% loss: %u frames, %u chunks sent (%u resent) for %u, %u CRC errors, "
+         "%d updated in %.1f s\n",
+         what, run.nodes, (unsigned)(run.imageSize / 1000), run.loss * 100, (unsigned)result.frames,
+         (unsigned)result.chunksSent, (unsigned)result.chunksResent, (unsigned)otaChunkCount(run.imageSize),
+         (unsigned)result.crcErrors, result.updated, result.seconds);
+}
+
+int main() {
+  // Fleet size: one broadcast serves every node
+  const int fleets[] = {1, 3, 8};
+  ota_result fleet[3];
+  for (int i = 0; i < 3; i++) {
+    ota_run run = {fleets[i], 0.05, 0, 300000, 0, 0};
+    fleet[i] = runOta(run);
+    report("fleet", run, fleet[i]);
+    CHECK(fleet[i].updated == fleets[i]);
+    CHECK(fleet[i].frames <= fleet[0].frames * 3 / 2);
+  }
+
+  // Image size: a third of the image, about a third of the frames
+  ota_run small = {3, 0.05, 0, 100000, 0, 0};
+  ota_result smallResult = runOta(small);
+  report("size", small, smallResult);
+  CHECK(smallResult.updated == 3);
+  CHECK(smallResult.frames * 5 <= fleet[1].frames * 2);
+
+  // Corrupted chunks are rejected by their CRC and sent again
+  ota_run corrupt = {3, 0.05, 0.01, 300000, 0, 0};
+  ota_result corruptResult = runOta(corrupt);
+  report("corrupt", corrupt, corruptResult);
+  CHECK(corruptResult.updated == 3);
+  CHECK(corruptResult.crcErrors > 0);
+
+  // The master restarts half way: the receivers keep what they have
+  ota_run restart = {3, 0.05, 0, 300000, 8000, 0};
+  ota_result restartResult = runOta(restart);
+  report("restart", restart, restartResult);
+  CHECK(restartResult.updated == 3);
+  CHECK(restartResult.freshOffers == 3);  // Only the first offer started anything
+  CHECK(restartResult.chunksSent <= otaChunkCount(restart.imageSize) * 13 / 10);
+
+  // A node dies: it is given up and the rest finish
+  ota_run kill = {3, 0.05, 0, 300000, 0, 8000};
+  ota_result killResult = runOta(kill);
+  report("dead node", kill, killResult);
+  CHECK(killResult.updated == 2);
+  return 0;
+}
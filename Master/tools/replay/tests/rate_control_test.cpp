@@ -0,0 +1,111 @@
+// Rate selection of rate_control.h (user-031) on synthetic link traces: an
+// hour of sends once a second at a fixed mean RSSI with +-3 dB of noise,
+// where a frame's chance of delivery falls off as the RSSI nears the true
+// sensitivity of the rate it went at. Strong links must end up fast, weak
+// ones slow, every link must keep its delivery high, and the rate must not
+// flap. A link that fades must drop within a few sends.
+#include "check.h"
+#include "rate_control.h"
+
+#include <cmath>
+
+#define TRACE_MS 3600000          // One hour per trace
+#define SEND_INTERVAL 1000        // ms between sends
+#define RSSI_NOISE_DB 3           // +- around the trace's mean
+
+// Delivery probability at `rssi` for ladder rate `index`: the radio really
+// manages 6 dB below the floor rate_control.h assumes; 1 Mbps nearly always
+static double deliveryChance(uint8_t index, double rssi) {
+  if (index == 0) {
+    return 0.99;
+  }
+  double margin = rssi - (rateLadderMinRssi[index] - 6);
+  return 1 / (1 + exp(-margin));
+}
+
+typedef struct trace_result {
+  double delivery;                     // Share of sends delivered
+  uint32_t changes;                    // Rate changes over the hour
+  uint32_t time[RATE_LADDER_SIZE];     // Sends at each rate
+  uint8_t mostUsed;                    // Ladder index used most
+} trace_result;
+
+static trace_result runTrace(double meanRssi) {
+  rate_control rc;
+  rateInit(rc);
+  trace_result result = {0, 0, {0}, 0};
+  uint32_t sends = 0, delivered = 0;
+  for (unsigned long now = 0; now < TRACE_MS; now += SEND_INTERVAL) {
+    double rssi = meanRssi + (int)(testRandom() % (2 * RSSI_NOISE_DB + 1)) - RSSI_NOISE_DB;
+    rateOnRssi(rc, (int)rssi);
+    bool ok = testChance(deliveryChance(rc.index, rssi));
+    result.time[rc.index]++;
+    sends++;
+    delivered += ok;
+    rateOnSendResult(rc, ok, now);
+  }
+  result.delivery = (double)delivered / sends;
+  result.changes = rc.changes;
+  for (uint8_t i = 1; i < RATE_LADDER_SIZE; i++) {
+    if (result.time[i] > result.time[result.mostUsed]) {
+      result.mostUsed = i;
+    }
+  }
+  return result;
+}
+
+int main() {
+  const struct {
+    double rssi;
+    uint8_t minMbps;   // The rate it should mostly run at, at least
+    uint8_t maxMbps;   // and at most
+  } traces[] = {{-55, 54, 54}, {-68, 24, 54}, {-76, 12, 24}, {-86, 1, 6}, {-93, 1, 2}};
+
+  for (const auto &trace : traces) {
+    trace_result result = runTrace(trace.rssi);
+    printf("rssi %4.0f dBm: mostly %2u Mbps, delivery %.3f, %u changes/h, sends:", trace.rssi,
+           rateLadderMbps[result.mostUsed], result.delivery, (unsigned)result.changes);
+    for (uint8_t i = 0; i < RATE_LADDER_SIZE; i++) {
+      printf(" %uM %u", rateLadderMbps[i], (unsigned)result.time[i]);
+    }
+    printf("\n");
+    CHECK(rateLadderMbps[result.mostUsed] >= trace.minMbps && rateLadderMbps[result.mostUsed] <= trace.maxMbps);
+    CHECK(result.delivery >= 0.9);
+    CHECK(result.changes <= 60);
+  }
+
+  // A strong link that fades to -88 dBm: down to a robust rate within a
+  // few sends, from failures and from the RSSI alone
+  rate_control rc;
+  rateInit(rc);
+  unsigned long now = 0;
+  for (; now < 600000; now += SEND_INTERVAL) {
+    rateOnRssi(rc, -55);
+    rateOnSendResult(rc, true, now);
+  }
+  CHECK(rateMbps(rc) == 54);
+  int sendsToDrop = 0;
+  while (rateMbps(rc) > 2) {
+    rateOnRssi(rc, -88);
+    rateOnSendResult(rc, testChance(deliveryChance(rc.index, -88)), now);
+    now += SEND_INTERVAL;
+    sendsToDrop++;
+    CHECK(sendsToDrop <= 20);
+  }
+  printf("fade from -55 to -88 dBm: at %u Mbps after %d sends\n", rateMbps(rc), sendsToDrop);
+
+  // Strong RSSI, but 54 Mbps loses 3 in 4 frames to interference: the
+  // failed climbs back off, so it settles at 24 Mbps rather than flapping
+  rateInit(rc);
+  uint32_t at54 = 0;
+  for (now = 0; now < TRACE_MS; now += SEND_INTERVAL) {
+    rateOnRssi(rc, -55);
+    at54 += rateMbps(rc) == 54;
+    rateOnSendResult(rc, rateMbps(rc) == 54 ? testChance(0.25) : true, now);
+  }
+  printf("54 Mbps jammed: %u of %u sends at 54 Mbps, %u changes/h, backoff %lu ms\n", (unsigned)at54,
+         (unsigned)(TRACE_MS / SEND_INTERVAL), (unsigned)rc.changes, rc.backoff);
+  CHECK(at54 < 100);
+  CHECK(rc.changes <= 40);
+  return 0;
+}
@@ -0,0 +1,325 @@
+// Multi-hop relaying with relay.h (user-034) on a simulated bus: the master
+// and five bays 2.5 m apart down the greenhouse, only the first two in the
+// master's range. Beacons, status frames up and actions down go over lossy
+// links, unicasts with the ESP-NOW retry on a lost ack, through the parent
+// selection, duplicate suppression and routes the slaves use. Half way
+// through, the second bay (a relay) dies and the bays behind it must find
+// another way. Checked: every bay reaches the master and back, no relay
+// passes a frame on twice, sequence numbers come through unchanged, the hop
+// limit holds, beacons are passed on once per relay, the latency per hop,
+// how long the bays behind the dead relay are cut off, and that a bay only
+// leaves a parent it still hears for a clearly cheaper one.
+#include "check.h"
+#include "relay.h"
+
+#include <cmath>
+#include <map>
+#include <set>
+#include <utility>
+
+#define NODES 6                   // The master and five bays
+#define MASTER 0
+#define LEAF 5                    // The last bay does not relay
+#define SPACING 2.5               // Metres between neighbours
+#define MIN_RSSI -94              // Nothing below this is heard
+#define BEACON_INTERVAL 1000      // ms
+#define STATUS_INTERVAL 1000      // ms, each bay
+#define ACTION_INTERVAL 5000      // ms, the master to each bay
+#define HOP_DELAY 2               // ms a relay holds a frame before sending it on
+#define SEND_ATTEMPTS 3           // ESP-NOW unicast tries while the ack is lost
+#define WARMUP_MS 10000           // Before the counting starts
+#define RUN_MS 600000             // Ten minutes
+#define KILLED 2                  // The relay that dies
+#define KILL_AT 300000
+#define RECOVERY_BOUND (RELAY_CANDIDATE_TIMEOUT + 2 * BEACON_INTERVAL)
+
+#define TYPE_BEACON 1             // Message types, as in the firmware
+#define TYPE_ACTION 2
+#define TYPE_STATUS 3
+
+// A frame arriving at `to` from its neighbour `from`
+typedef struct bus_frame {
+  uint8_t type;
+  int to;
+  int from;
+  int origin;            // Status: the bay that sent it; action: the bay it is for
+  uint16_t seq;          // The origin's sequence number, kept end to end
+  uint8_t hops;          // Relays passed
+  uint8_t pathCost;      // Beacon only
+  unsigned long sentAt;  // When the origin sent it
+} bus_frame;
+
+typedef struct bus_node {
+  uint8_t mac[6];
+  bool relay;
+  bool alive;
+  relay_parent parent;
+  relay_dedup dedup;
+  relay_routes routes;
+  uint16_t seq;
+  std::set<std::pair<int, uint16_t>> forwarded;  // (origin, seq) passed on
+  uint32_t forwards;
+  uint32_t beaconsRelayed;
+  uint32_t switches;     // Parent changes away from a parent still heard
+  int parentAtKill;
+} bus_node;
+
+// What got through for each bay
+typedef struct bay_stats {
+  uint32_t sent;
+  std::set<uint16_t> received;                   // At the master
+  uint8_t maxHops;
+  unsigned long maxLatency[RELAY_MAX_HOPS + 1];  // By relays passed
+  uint32_t actionsSent;
+  std::set<uint16_t> actionsReceived;
+  unsigned long lastHeard;                       // At the master
+  unsigned long worstSilence;                    // Longest gap after the kill
+} bay_stats;
+
+static bus_node nodes[NODES];
+static bay_stats bays[NODES];
+static std::multimap<unsigned long, bus_frame> airborne;
+static uint32_t beaconsSent = 0;
+static uint16_t masterSeq = 0;
+
+static int rssiBetween(int a, int b) {
+  return -40 - (int)lround(10 * SPACING * abs(a - b));
+}
+
+// Delivery falls off over the last 8 dB above MIN_RSSI
+static bool heard(int from, int to) {
+  int rssi = rssiBetween(from, to);
+  if (!nodes[to].alive || rssi < MIN_RSSI) {
+    return false;
+  }
+  return testChance(rssi >= MIN_RSSI + 8 ? 0.98 : 0.5 + 0.06 * (rssi - MIN_RSSI));
+}
+
+static int nodeOf(const uint8_t *mac) {
+  for (int i = 0; i < NODES; i++) {
+    if (memcmp(nodes[i].mac, mac, 6) == 0) {
+      return i;
+    }
+  }
+  CHECK(false);
+  return -1;
+}
+
+static void broadcast(int from, bus_frame frame, unsigned long at) {
+  frame.from = from;
+  for (int to = 0; to < NODES; to++) {
+    if (to != from && heard(from, to)) {
+      frame.to = to;
+      airborne.insert({at + 1, frame});
+    }
+  }
+}
+
+// A frame whose ack is lost is sent again, so the receiver may get it twice
+static void unicast(int from, int to, bus_frame frame, unsigned long at) {
+  frame.from = from;
+  frame.to = to;
+  for (int attempt = 0; attempt < SEND_ATTEMPTS; attempt++) {
+    bool delivered = heard(from, to);
+    if (delivered) {
+      airborne.insert({at + 1 + attempt, frame});
+    }
+    if (delivered && heard(to, from)) {
+      break;
+    }
+  }
+}
+
+// Pass a frame on once: false if it was seen before or has no way on
+static bool relayOnce(int self, const bus_frame &frame, const uint8_t *origin) {
+  bus_node &node = nodes[self];
+  if (!node.relay || relayIsDuplicate(node.dedup, origin, frame.type, frame.seq)) {
+    return false;
+  }
+  if (frame.type == TYPE_STATUS) {
+    CHECK(node.forwarded.insert({frame.origin, frame.seq}).second);  // Never passed on twice
+  }
+  return true;
+}
+
+static void onBeacon(int self, const bus_frame &beacon, unsigned long now) {
+  bus_node &node = nodes[self];
+  relayOnBeacon(node.parent, nodes[beacon.from].mac, beacon.hops, beacon.pathCost, rssiBetween(beacon.from, self), now);
+
+  // No flapping: a parent still heard is only left for a clearly cheaper one
+  const relay_candidate *before = relayParentOf(node.parent);
+  bool beforeValid = before != nullptr && now - before->lastHeard <= RELAY_CANDIDATE_TIMEOUT &&
+                     before->hops <= RELAY_MAX_HOPS;
+  uint8_t beforeCost = relayPathCost(node.parent);
+  if (relaySelectParent(node.parent, now)) {
+    node.switches += beforeValid;
+    CHECK(!beforeValid || relayPathCost(node.parent) + RELAY_SWITCH_MARGIN <= beforeCost);
+  }
+  const relay_candidate *parent = relayParentOf(node.parent);
+  if (parent == nullptr || nodeOf(parent->mac) != beacon.from || !relayOnce(self, beacon, nodes[MASTER].mac)) {
+    return;
+  }
+  bus_frame copy = beacon;
+  copy.hops = beacon.hops + 1;
+  copy.pathCost = relayPathCost(node.parent);
+  node.beaconsRelayed++;
+  broadcast(self, copy, now + HOP_DELAY);
+}
+
+static void onStatus(int self, const bus_frame &frame, unsigned long now) {
+  if (self == MASTER) {
+    bay_stats &bay = bays[frame.origin];
+    relayLearnRoute(nodes[MASTER].routes, nodes[frame.origin].mac, nodes[frame.from].mac, now);
+    if (frame.sentAt < WARMUP_MS || !bay.received.insert(frame.seq).second) {
+      return;  // A retried copy; the master drops it by its sequence number
+    }
+    CHECK(frame.hops <= RELAY_MAX_HOPS);
+    bay.maxHops = frame.hops > bay.maxHops ? frame.hops : bay.maxHops;
+    unsigned long latency = now - frame.sentAt;
+    bay.maxLatency[frame.hops] = latency > bay.maxLatency[frame.hops] ? latency : bay.maxLatency[frame.hops];
+    if (now > KILL_AT && now - bay.lastHeard > bay.worstSilence) {
+      bay.worstSilence = now - bay.lastHeard;
+    }
+    bay.lastHeard = now;
+    return;
+  }
+  bus_node &node = nodes[self];
+  if (frame.hops >= RELAY_MAX_HOPS || !relayOnce(self, frame, nodes[frame.origin].mac)) {
+    return;
+  }
+  const relay_candidate *parent = relayParentOf(node.parent);
+  if (parent == nullptr) {
+    return;
+  }
+  relayLearnRoute(node.routes, nodes[frame.origin].mac, nodes[frame.from].mac, now);
+  bus_frame copy = frame;
+  copy.hops++;
+  node.forwards++;
+  unicast(self, nodeOf(parent->mac), copy, now + HOP_DELAY);
+}
+
+static void onAction(int self, const bus_frame &frame, unsigned long now) {
+  if (self == frame.origin) {
+    bays[self].actionsReceived.insert(frame.seq);
+    return;
+  }
+  if (!relayOnce(self, frame, nodes[MASTER].mac)) {
+    return;
+  }
+  const uint8_t *next = relayFindRoute(nodes[self].routes, nodes[frame.origin].mac, now);
+  if (next != nullptr) {
+    unicast(self, nodeOf(next), frame, now + HOP_DELAY);
+  }
+}
+
+static void deliver(const bus_frame &frame, unsigned long now) {
+  if (!nodes[frame.to].alive) {
+    return;
+  }
+  if (frame.type == TYPE_BEACON && frame.to != MASTER) {
+    onBeacon(frame.to, frame, now);
+  } else if (frame.type == TYPE_STATUS) {
+    onStatus(frame.to, frame, now);
+  } else if (frame.type == TYPE_ACTION && frame.to != MASTER) {
+    onAction(frame.to, frame, now);
+  }
+}
+
+int main() {
+  for (int i = 0; i < NODES; i++) {
+    bus_node &node = nodes[i];
+    memset(node.mac, 0, 6);
+    node.mac[0] = 0x02;
+    node.mac[5] = i;
+    node.relay = i != MASTER && i != LEAF;
+    node.alive = true;
+    relayParentInit(node.parent);
+    relayDedupInit(node.dedup);
+    relayRoutesInit(node.routes);
+    node.seq = 0;
+    node.forwards = 0;
+    node.beaconsRelayed = 0;
+    node.switches = 0;
+    node.parentAtKill = -1;
+    bays[i] = bay_stats();
+  }
+
+  for (unsigned long now = 0; now < RUN_MS; now++) {
+    while (!airborne.empty() && airborne.begin()->first <= now) {
+      bus_frame frame = airborne.begin()->second;
+      airborne.erase(airborne.begin());
+      deliver(frame, now);
+    }
+
+    if (now == KILL_AT) {
+      nodes[KILLED].alive = false;
+      for (int i = 1; i < NODES; i++) {
+        const relay_candidate *parent = relayParentOf(nodes[i].parent);
+        nodes[i].parentAtKill = parent ? nodeOf(parent->mac) : -1;
+      }
+    }
+    if (now % BEACON_INTERVAL == 0) {
+      bus_frame beacon = {TYPE_BEACON, 0, MASTER, MASTER, ++masterSeq, 0, 0, now};
+      beaconsSent++;
+      broadcast(MASTER, beacon, now);
+    }
+    for (int i = 1; i < NODES; i++) {
+      bus_node &node = nodes[i];
+      if (!node.alive) {
+        continue;
+      }
+      if (now % STATUS_INTERVAL == (unsigned long)i * 100) {
+        const relay_candidate *parent = relayParentOf(node.parent);
+        bus_frame status = {TYPE_STATUS, 0, i, i, ++node.seq, 0, 0, now};
+        bays[i].sent += now >= WARMUP_MS;
+        if (parent != nullptr) {
+          unicast(i, nodeOf(parent->mac), status, now);
+        }
+      }
+      if (now % ACTION_INTERVAL == (unsigned long)i * 100 + 50 && now >= WARMUP_MS) {
+        const uint8_t *next = relayFindRoute(nodes[MASTER].routes, node.mac, now);
+        bus_frame action = {TYPE_ACTION, 0, MASTER, i, ++masterSeq, 0, 0, now};
+        bays[i].actionsSent++;
+        if (next != nullptr) {
+          unicast(MASTER, nodeOf(next), action, now);
+        }
+      }
+    }
+  }
+
+  for (int i = 1; i < NODES; i++) {
+    const bus_node &node = nodes[i];
+    const bay_stats &bay = bays[i];
+    printf("bay %d%s: parent %d (was %d), %u parent changes (%u while it was heard), delivered %u/%u, max %u relays, latency",
+           i, node.relay ? " relay" : "", relayParentOf(node.parent) ? nodeOf(relayParentOf(node.parent)->mac) : -1,
+           node.parentAtKill, (unsigned)node.parent.changes, (unsigned)node.switches, (unsigned)bay.received.size(), (unsigned)bay.sent,
+           bay.maxHops);
+    for (int hops = 0; hops <= RELAY_MAX_HOPS; hops++) {
+      if (bay.maxLatency[hops] > 0) {
+        printf(" %d:%lu ms", hops, bay.maxLatency[hops]);
+      }
+    }
+    printf(", actions %u/%u, forwarded %u, beacons relayed %u/%u",
+           (unsigned)bay.actionsReceived.size(), (unsigned)bay.actionsSent, (unsigned)node.forwards,
+           (unsigned)node.beaconsRelayed, (unsigned)beaconsSent);
+    if (i != KILLED) {
+      printf(", longest silence after the kill %lu ms", bay.worstSilence);
+    }
+    printf("\n");
+
+    // Sequence numbers arrive unchanged, so what the master has is a subset of what was sent
+    CHECK(bay.received.empty() || *bay.received.rbegin() <= node.seq);
+    for (int hops = 0; hops <= RELAY_MAX_HOPS; hops++) {
+      CHECK(bay.maxLatency[hops] <= (unsigned long)(hops + 1) * SEND_ATTEMPTS + hops * HOP_DELAY);
+    }
+    CHECK(node.beaconsRelayed <= beaconsSent);
+    if (i == KILLED) {
+      continue;
+    }
+    CHECK(bay.received.size() >= bay.sent * 95 / 100);
+    CHECK(bay.actionsReceived.size() >= bay.actionsSent * 90 / 100);
+    CHECK(bay.worstSilence <= RECOVERY_BOUND);
+  }
+  CHECK(bays[LEAF].maxHops == RELAY_MAX_HOPS);  // The far bay is at the limit, not beyond
+  return 0;
+}
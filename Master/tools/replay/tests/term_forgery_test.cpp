@@ -0,0 +1,110 @@
+// Forged failover terms (user-042): the master's firmware as the primary
+// of a pair, active, hears beacons and channel notices naming its partner.
+// Checked: one sealed with the group key, as any node could forge it, with
+// a far higher term does not make it stand down, nor does one that claims
+// the pair key without holding it, and a forged notice does not move it;
+// the partner's own beacon under the pair key does, and played back is
+// dropped. Standing by, forged beacons do not keep it from taking over once
+// its partner is quiet. A slave (master_failover.h) that follows it is not
+// moved by the forged beacon while it hears its master, and is at once by
+// its partner's term announcement.
+#include "../../../src/main.cpp"
+#include "check.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#define FORGED_TERM 100
+
+static uint32_t counter = 1 << 16;
+
+// `data` from our partner, sealed as `keyId` with `key`
+static void deliver(const void *data, size_t len, const auth_key &key, uint8_t keyId) {
+  uint8_t frame[RELAY_MAX_FRAME];
+  memcpy(frame, data, len);
+  size_t length = authSeal(key, keyId, ++counter, partnerMAC, frame, len);
+  hostRecvCb(partnerMAC, frame, length);
+}
+
+static sync_beacon partnerBeacon(uint16_t term) {
+  sync_beacon beacon = {};
+  beacon.header.msgType = MSG_SYNC_BEACON;
+  beacon.masterTime = millis();
+  memcpy(beacon.master, partnerMAC, 6);
+  beacon.term = term;
+  return beacon;
+}
+
+int main() {
+  char dir[] = "/tmp/term_forgery_test.XXXXXX";
+  CHECK(mkdtemp(dir) != nullptr);
+  hostFsRoot = dir;
+  hostClock.speed = 0;
+  esp_wifi_get_mac(WIFI_IF_STA, primaryMasterMAC);  // We are the primary
+  uint8_t standby[6] = {0x02, 0, 0, 0, 0, 2};
+  memcpy(standbyMasterMAC, standby, 6);
+  setup();
+  CHECK(partnered && failover.role == FAILOVER_STANDBY);
+  hostClock.advance(FAILOVER_SILENCE);
+  CHECK(serviceFailover(millis()));
+  uint16_t term = failover.term;
+
+  master_choice slave;
+  masterChoiceInit(slave, primaryMasterMAC, millis());
+  CHECK(masterOnAnnounce(slave, primaryMasterMAC, term, millis()) == MASTER_FOLLOW);
+
+  // A node holding the group key claims our partner took over
+  sync_beacon forged = partnerBeacon(FORGED_TERM);
+  uint32_t rejected = authRejected;
+  deliver(&forged, sizeof(forged), authGroupKey, AUTH_KEY_GROUP);
+  deliver(&forged, sizeof(forged), authGroupKey, AUTH_KEY_PAIR);
+  bool active = serviceFailover(millis());
+  printf("forged beacon, term %d against our %u: %s, %u rejected\n", FORGED_TERM, (unsigned)term,
+         active ? "still active" : "stood down", (unsigned)(authRejected - rejected));
+  CHECK(active);
+  CHECK(failover.term == term && failover.stepDowns == 0);
+  CHECK(authRejected - rejected == 1);
+  uint8_t verdict = masterOnBeacon(slave, forged.master, millis());
+  printf("slave hearing it: %s\n", verdict == MASTER_IGNORE ? "ignored" : "moved");
+  CHECK(verdict == MASTER_IGNORE);
+  CHECK(memcmp(slave.active, primaryMasterMAC, 6) == 0 && slave.term == term);
+
+  channel_notice notice = {};
+  notice.header.msgType = MSG_CHANNEL;
+  notice.op = CHANNEL_OP_NOTICE;
+  notice.channel = 11;
+  deliver(&notice, sizeof(notice), authGroupKey, AUTH_KEY_GROUP);
+  CHECK(partnerMoveChannel == 0);
+
+  // Our partner took over for real, and says so under the pair key
+  sync_beacon genuine = partnerBeacon(term + 1);
+  deliver(&genuine, sizeof(genuine), authPairKey, AUTH_KEY_PAIR);
+  active = serviceFailover(millis());
+  printf("partner's beacon, term %u: %s\n", (unsigned)(term + 1), active ? "still active" : "stood down");
+  CHECK(!active);
+  CHECK(failover.term == term + 1 && failover.stepDowns == 1);
+  uint32_t replayed = authReplayed;
+  uint8_t frame[RELAY_MAX_FRAME];
+  memcpy(frame, &genuine, sizeof(genuine));
+  size_t length = authSeal(authPairKey, AUTH_KEY_PAIR, counter, partnerMAC, frame, sizeof(genuine));
+  hostRecvCb(partnerMAC, frame, length);
+  CHECK(authReplayed == replayed + 1);
+  verdict = masterOnAnnounce(slave, partnerMAC, term + 1, millis());
+  printf("slave hearing its announcement: %s\n", verdict == MASTER_SWITCH ? "moved" : "stayed");
+  CHECK(verdict == MASTER_SWITCH && memcmp(slave.active, partnerMAC, 6) == 0);
+
+  // Our partner goes quiet while forged beacons keep coming
+  unsigned long quietFrom = millis();
+  while (!serviceFailover(millis())) {
+    CHECK(millis() - quietFrom <= FAILOVER_SILENCE);
+    forged = partnerBeacon(term + 1);
+    deliver(&forged, sizeof(forged), authGroupKey, AUTH_KEY_GROUP);
+    hostClock.advance(100);
+  }
+  printf("partner quiet, forged beacons on: took over after %lu ms, term %u\n", millis() - quietFrom,
+         (unsigned)failover.term);
+  CHECK(failover.term == term + 2);
+
+  rmdir(dir);
+  return 0;
+}
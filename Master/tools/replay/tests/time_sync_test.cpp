@@ -0,0 +1,83 @@
+// Sync accuracy of the slaves' time_sync.h (user-029) with injected clock
+// drift: a slave whose clock runs fast or slow against the master's, with
+// beacons delayed by up to SYNC_PATH_DELAY_MS, must stamp its samples within
+// the error bound it reports, and that bound must stay a few ms.
+#include "check.h"
+#include "time_sync.h"
+
+#define BEACON_INTERVAL 1000      // ms, as the master sends them
+#define SAMPLE_INTERVAL 370       // ms between the samples we check
+#define RUN_MS 4000000            // Over an hour of slave time
+#define MASTER_OFFSET 123456789   // Master clock at our zero
+
+typedef struct sync_result {
+  uint32_t samples;
+  double maxError;     // Largest difference from the true master time, ms
+  uint16_t maxBound;   // Largest bound reported
+  uint32_t violations; // Samples off by more than their bound
+} sync_result;
+
+// Master time at our local time `local`, with our clock off by `ppm`
+static double trueMasterTime(unsigned long local, double ppm) {
+  return MASTER_OFFSET + local * (1 + ppm * 1e-6);
+}
+
+static sync_result runSync(double ppm, unsigned long maxDelay, uint8_t hops) {
+  time_sync sync;
+  timeSyncInit(sync);
+  sync_result result = {0, 0, 0, 0};
+  unsigned long arrival = 0;  // Of the beacon on its way, 0 if none
+  uint32_t beaconTime = 0;
+  for (unsigned long local = 5000; local < RUN_MS; local++) {
+    if (local % BEACON_INTERVAL == 0) {
+      // The beacon carries the master's time when sent and arrives late
+      arrival = local + (maxDelay ? testRandom() % (maxDelay + 1) : 0);
+      beaconTime = (uint32_t)trueMasterTime(local, ppm);
+    }
+    if (arrival != 0 && local == arrival) {
+      timeSyncUpdate(sync, arrival, beaconTime, hops);
+      arrival = 0;
+    }
+    if (local % SAMPLE_INTERVAL == 0 && local > 20000) {
+      uint16_t bound;
+      uint32_t stamp = timeSyncMaster(sync, local, &bound);
+      double error = fabs((double)(int32_t)(stamp - (uint32_t)trueMasterTime(local, ppm)));
+      result.samples++;
+      result.maxError = error > result.maxError ? error : result.maxError;
+      result.maxBound = bound > result.maxBound ? bound : result.maxBound;
+      result.violations += error > bound;
+    }
+  }
+  return result;
+}
+
+int main() {
+  const double drifts[] = {0, 80, -300};
+  for (double ppm : drifts) {
+    for (unsigned long delay = 0; delay <= SYNC_PATH_DELAY_MS; delay += SYNC_PATH_DELAY_MS) {
+      for (uint8_t hops = 0; hops <= 2; hops += 2) {
+        sync_result result = runSync(ppm, delay * (hops + 1), hops);
+        printf("drift %+5.0f ppm, delay 0-%lu ms, %u hops: %u samples, max error %.0f ms, max bound %u ms, "
+               "violations %u\n",
+               ppm, delay * (hops + 1), hops, (unsigned)result.samples, result.maxError, result.maxBound,
+               (unsigned)result.violations);
+        CHECK(result.violations == 0);
+        CHECK(result.maxBound <= 4 + 3 * SYNC_PATH_DELAY_MS * (hops + 1));
+        CHECK(hops > 0 || result.maxError <= 4);
+      }
+    }
+  }
+
+  // Unsynced before the first beacon, after SYNC_TIMEOUT without one, and
+  // after a reset for a new master
+  time_sync sync;
+  timeSyncInit(sync);
+  uint16_t bound;
+  CHECK(timeSyncMaster(sync, 1000, &bound) == 1000 && bound == SYNC_UNSYNCED);
+  timeSyncUpdate(sync, 2000, 502000, 0);
+  CHECK(timeSyncMaster(sync, 2500, &bound) == 502500 && bound != SYNC_UNSYNCED);
+  CHECK(timeSyncMaster(sync, 2000 + SYNC_TIMEOUT, &bound) == 2000 + SYNC_TIMEOUT && bound == SYNC_UNSYNCED);
+  timeSyncReset(sync);
+  CHECK(timeSyncMaster(sync, 2500, &bound) == 2500 && bound == SYNC_UNSYNCED);
+  return 0;
+}
@@ -0,0 +1,101 @@
+// Upload routes (user-035): POST /ota and POST /rules through the web
+// server shim, the body handed to the body handler piece by piece before
+// the request handler answers, as on the ESP32. Checked: without the login,
+// with a wrong one, with a bad slave or on a standby master the request is
+// refused and the stored image is left as it was; a good one is stored and
+// starts the update, and a second one then leaves it alone. POST /rules
+// needs the login too.
+#include "../../../src/main.cpp"
+#include "check.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+#define LOGIN WEB_ADMIN_USER ":" WEB_ADMIN_PASSWORD
+
+static std::string readFile(const std::string &path) {
+  std::string bytes;
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (fp == nullptr) {
+    return bytes;
+  }
+  char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    bytes.append(buffer, length);
+  }
+  fclose(fp);
+  return bytes;
+}
+
+static void writeFile(const std::string &path, const std::string &bytes) {
+  FILE *fp = fopen(path.c_str(), "wb");
+  CHECK(fp != nullptr);
+  fwrite(bytes.data(), 1, bytes.size(), fp);
+  fclose(fp);
+}
+
+int main() {
+  char dir[] = "/tmp/web_upload_test.XXXXXX";
+  CHECK(mkdtemp(dir) != nullptr);
+  hostFsRoot = dir;
+  std::string image = std::string(dir) + OTA_IMAGE_FILE;
+  writeFile(image, "stored image");
+  hostClock.speed = 0;
+  setup();
+  CHECK(failoverSeenRole == FAILOVER_ACTIVE);
+
+  std::string firmware(20000, '\0');
+  for (char &byte : firmware) {
+    byte = testRandom();
+  }
+  const struct {
+    const char *what;
+    std::map<std::string, std::string> params;
+    std::string login;
+    bool standby;
+    int status;
+  } refused[] = {
+    {"no login", {{"slave", "1"}}, "", false, 401},
+    {"wrong password", {{"slave", "1"}}, WEB_ADMIN_USER ":wrong", false, 401},
+    {"no slave or type", {}, LOGIN, false, 400},
+    {"slave out of range", {{"slave", "9"}}, LOGIN, false, 400},
+    {"standby", {{"type", "2"}}, LOGIN, true, 409},
+  };
+  for (const auto &c : refused) {
+    failoverSeenRole = c.standby ? FAILOVER_STANDBY : FAILOVER_ACTIVE;
+    int status = server.post("/ota", c.params, firmware, c.login);
+    printf("POST /ota, %s: %d\n", c.what, status);
+    CHECK(status == c.status);
+    CHECK(readFile(image) == "stored image");
+    CHECK(!otaRequested);
+  }
+  failoverSeenRole = FAILOVER_ACTIVE;
+
+  int status = server.post("/ota", {{"slave", "1"}}, firmware, LOGIN);
+  printf("POST /ota, with the login: %d\n", status);
+  CHECK(status == 202);
+  CHECK(otaRequested);
+  CHECK(readFile(image) == firmware);
+
+  status = server.post("/ota", {{"slave", "2"}}, std::string(1000, 'x'), LOGIN);
+  printf("POST /ota, while an update runs: %d\n", status);
+  CHECK(status == 409);
+  CHECK(readFile(image) == firmware);
+
+  std::string rules = std::string(dir) + RULES_FILE;
+  status = server.post("/rules", {}, "if refilling then watering off\n", "");
+  printf("POST /rules, no login: %d\n", status);
+  CHECK(status == 401);
+  CHECK(readFile(rules).empty());
+  status = server.post("/rules", {}, "if refilling then watering off\n", LOGIN);
+  printf("POST /rules, with the login: %d\n", status);
+  CHECK(status == 200);
+  CHECK(readFile(rules) == "if refilling then watering off\n");
+
+  unlink(image.c_str());
+  unlink(rules.c_str());
+  rmdir(dir);
+  return 0;
+}
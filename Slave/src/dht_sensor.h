@@ -0,0 +1,22 @@
+#ifndef DHT_SENSOR_H
+#define DHT_SENSOR_H
+
+#include <DHT.h>
+
+// DHT temperature sensor (see drivers.h). Kept apart so only the node that
+// has one pulls in the DHT library.
+template <uint8_t Pin, uint8_t Type>
+struct DhtSensor {
+  static DHT device;
+  static void begin() {
+    device.begin();
+  }
+  static float readTemperature() {
+    return device.readTemperature();  // Celsius; NAN if the read failed
+  }
+};
+
+template <uint8_t Pin, uint8_t Type>
+DHT DhtSensor<Pin, Type>::device(Pin, Type);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef DRIVERS_H
+#define DRIVERS_H
+
+#include <Arduino.h>
+
+// Sensor and actuator drivers
+//
+// Every driver is a class template over its pins and settings with only
+// static inline members, so a node built from them compiles to the same
+// pinMode / analogRead / digitalWrite / ledc calls a hand-written sketch
+// would make: no objects, no virtual calls, and a driver no node uses is
+// never instantiated. The nodes (node_*.h) pick and configure them.
+
+// Analog sensor on an ADC pin (LDR, soil moisture, water level)
+template <uint8_t Pin>
+struct AnalogInput {
+  static void begin() {
+    pinMode(Pin, INPUT);
+  }
+  static int read() {
+    return analogRead(Pin);
+  }
+};
+
+// Relay module driving a fan or a pump; ActiveLow for boards that switch on a low input
+template <uint8_t Pin, bool ActiveLow>
+struct RelayOutput {
+  static void begin() {
+    pinMode(Pin, OUTPUT);
+    set(false);  // Off until the node decides otherwise
+  }
+  static void set(bool on) {
+    digitalWrite(Pin, on != ActiveLow ? HIGH : LOW);
+  }
+};
+
+// PWM output through an LEDC channel (dimmable light)
+template <uint8_t Pin, uint8_t Channel, uint32_t Frequency, uint8_t Resolution>
+struct PwmOutput {
+  static void begin() {
+    pinMode(Pin, OUTPUT);
+    ledcSetup(Channel, Frequency, Resolution);
+    ledcAttachPin(Pin, Channel);
+  }
+  static void write(uint32_t duty) {
+    ledcWrite(Channel, duty);
+  }
+};
+
+#endif
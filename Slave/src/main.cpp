@@ -0,0 +1,1397 @@
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include "rate_control.h" // ESP-NOW PHY rate selection for the link to our parent
+#include "relay.h" // Multi-hop forwarding for bays out of the master's range
+#include "ota_transfer.h" // Firmware updates from the master
+#include "channel_migration.h" // Following the master when the router changes channel
+#include "master_failover.h" // Moving to the standby master when it takes over
+#include "frame_auth.h" // Authenticated frames with a key of our own
+#if !__has_include("keys.h")
+#error "No keys.h: copy common/espnow_link/keys.h.example to keys.h and fill in your keys"
+#endif
+#include "keys.h" // The frame authentication keys, kept out of git
+#include "time_sync.h" // Master-timebase timestamps for our samples
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#include <Preferences.h>
+
+// One firmware for every slave. The node it runs as, with its sensors,
+// actuators, status frame and local control, is picked at build time (see
+// node_config.h); everything in this file is shared.
+
+// Master's MAC Address (Replace with actual MAC)
+uint8_t masterMAC[] = {0xFC, 0xE8, 0xC0, 0x74, 0x50, 0x14}; // Replace with master MAC
+
+// Hot-standby master (see master_failover.h), all zero if there is none.
+// Our frames go to whichever of the two is active.
+uint8_t standbyMAC[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+// Frame authentication (see frame_auth.h): the group key from keys.h, the
+// same on every node and the masters. Our own key is NODE_AUTH_KEY in the
+// node header.
+#ifndef AUTH_GROUP_KEY
+#error "keys.h must define AUTH_GROUP_KEY (see keys.h.example)"
+#endif
+const uint8_t authGroupKeyBytes[AUTH_KEY_SIZE] = AUTH_GROUP_KEY;
+
+// Wi-Fi Network SSID (Define the SSID you're connecting to)
+const char* wifi_network_ssid = "josip";  // Wi-Fi network SSID
+const char* wifi_network_password = "12345678"; // Wi-Fi network password
+
+// Every frame starts with a header (see the master). Alarm frames carry
+// QOS_ALARM and go out ahead of routine status frames.
+#define MSG_STATUS 3         // Message type of our status frame
+#define MSG_ALARM 4          // Message type of an alarm raised or cleared
+#define QOS_BULK 0
+#define QOS_ALARM 1
+
+typedef struct frame_header {
+  uint8_t msgType;      // MSG_*
+  uint8_t qos;          // QOS_BULK or QOS_ALARM
+  uint16_t seq;         // Our frame number, kept end to end; retried copies repeat it
+} frame_header;
+
+// Get Wi-Fi channel for the specified SSID
+int32_t get_wifi_channel(const char* ssid) {
+  int n = WiFi.scanNetworks();
+  for (int i = 0; i < n; ++i) {
+    if (String(ssid) == WiFi.SSID(i)) {
+      return WiFi.channel(i);
+    }
+  }
+  return 0;
+}
+
+// Set Wi-Fi channel for ESP32
+void scan_and_set_wifi_channel() {
+  Serial.printf("\nScanning for SSID: %s\n", wifi_network_ssid);
+  int slave_channel = get_wifi_channel(wifi_network_ssid);
+
+  if (slave_channel == 0) {
+    Serial.println("SSID not found!");
+  } else {
+    Serial.printf("SSID found. Channel: %d\n", slave_channel);
+
+    if (WiFi.channel() != slave_channel) {
+      esp_wifi_set_promiscuous(true);
+      esp_wifi_set_channel(slave_channel, WIFI_SECOND_CHAN_NONE);
+      esp_wifi_set_promiscuous(false);
+    }
+  }
+  Serial.printf("Current Wi-Fi channel: %d\n", WiFi.channel());
+}
+
+// Time sync (see time_sync.h): the master broadcasts its millis() in
+// beacons and every sample carries a master-timebase timestamp.
+#define MSG_SYNC_BEACON 1          // Message type of a master sync beacon
+
+typedef struct sync_beacon {
+  frame_header header;  // MSG_SYNC_BEACON
+  uint32_t masterTime;  // Master millis() when the beacon was sent, plus the time relays held it
+  uint8_t hops;         // Relays it passed
+  uint8_t pathCost;     // Cost from its sender to the master (see relay.h)
+  uint8_t master[6];    // Master that sent it
+  uint16_t term;        // That master's failover term
+} sync_beacon;
+
+time_sync timeSync;
+portMUX_TYPE syncMux = portMUX_INITIALIZER_UNLOCKED;
+
+void updateTimeSync(unsigned long localTime, uint32_t beaconTime, uint8_t hops) {
+  portENTER_CRITICAL(&syncMux);
+  timeSyncUpdate(timeSync, localTime, beaconTime, hops);
+  portEXIT_CRITICAL(&syncMux);
+}
+
+void resetTimeSync() {
+  portENTER_CRITICAL(&syncMux);
+  timeSyncReset(timeSync);
+  portEXIT_CRITICAL(&syncMux);
+}
+
+// Current time in the master timebase; *errorBound gets the bound in ms
+uint32_t masterTime(uint16_t *errorBound) {
+  portENTER_CRITICAL(&syncMux);
+  unsigned long now = millis(); // Read under the lock so a new beacon can't be newer than now
+  uint32_t time = timeSyncMaster(timeSync, now, errorBound);
+  portEXIT_CRITICAL(&syncMux);
+  return time;
+}
+
+// Automation overrides: rules on the master can take over an actuator with
+// action commands. An override lapses after its TTL unless the master
+// refreshes it, so a silent master hands control back to the local logic.
+#define MSG_ACTION 2         // Message type of an action command
+#define TARGET_LIGHT 0       // Action targets
+#define TARGET_FAN 1
+#define TARGET_WATERING 2
+#define TARGET_REFILL 3
+#define VALUE_AUTO 0         // Action values; VALUE_AUTO means local logic
+#define VALUE_OFF 1
+#define VALUE_ON 2
+#define VALUE_DIM 3
+
+typedef struct action_command {
+  frame_header header;  // MSG_ACTION
+  uint8_t target;       // TARGET_*
+  uint8_t value;        // VALUE_*
+  uint16_t ttlSeconds;  // Override lapses after this long without a refresh
+} action_command;
+
+typedef struct actuator_override {
+  uint8_t value;          // VALUE_AUTO while the local logic is in charge
+  unsigned long expires;  // millis() when the override lapses
+} actuator_override;
+
+portMUX_TYPE overrideMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Take over an actuator as commanded by the master
+void setOverride(actuator_override &o, const action_command &command) {
+  portENTER_CRITICAL(&overrideMux);
+  o.value = command.value;
+  o.expires = millis() + command.ttlSeconds * 1000UL;
+  portEXIT_CRITICAL(&overrideMux);
+}
+
+// Current override value, VALUE_AUTO once it has lapsed
+uint8_t overrideValue(actuator_override &o) {
+  portENTER_CRITICAL(&overrideMux);
+  if (o.value != VALUE_AUTO && (long)(millis() - o.expires) >= 0) {
+    o.value = VALUE_AUTO;
+  }
+  uint8_t value = o.value;
+  portEXIT_CRITICAL(&overrideMux);
+  return value;
+}
+
+void raiseAlarm(uint8_t code, bool active, float value);
+
+// The node this build runs as
+#include "node_config.h"
+
+struct_message myData;
+
+// Multi-hop relay (see relay.h): our frames go to our parent, the master
+// unless it is out of range, wrapped in a relay_header when the parent is a
+// relay. With RELAY_ROLE we also forward frames for bays that cannot hear
+// the master themselves, and pass our parent's beacons on to them; without
+// it the forwarding path and its queue are not built at all.
+#ifndef RELAY_ROLE
+#define RELAY_ROLE false     // true: forward frames for other bays; set per env with -D RELAY_ROLE=true
+#endif
+#define MSG_RELAY 5          // Message type of a frame wrapped for forwarding
+
+typedef struct relay_header {
+  frame_header header;      // MSG_RELAY, with the qos and seq of the frame inside
+  uint8_t hops;             // Relays passed so far
+  uint8_t origin[6];        // Node that sent the frame inside
+  uint8_t dest[6];          // Node it is for
+} relay_header;             // Followed by the frame itself
+
+uint8_t broadcastMAC[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint8_t ownMAC[6];
+uint8_t parentMAC[6];        // Where our frames go, guarded by relayMux
+relay_parent relayParent;    // Candidate parents, guarded by relayMux
+master_choice masterChoice;  // The master our frames go to, guarded by relayMux
+uint32_t reportedMasterSwitches = 0; // loop() only, for the serial log
+
+// A master's failover term comes under our own key in a term announcement;
+// the one in a beacon is under the group key, which every node holds, and
+// is not believed (see master_failover.h)
+#define MSG_TERM 8           // Message type of a term announcement
+
+typedef struct term_announce {
+  frame_header header;      // MSG_TERM
+  uint16_t term;            // The sending master's failover term
+} term_announce;
+#if RELAY_ROLE
+relay_queue relayQueue;      // Frames to forward, guarded by relayMux
+relay_routes relayRoutes;    // Routes down to the bays below us; Wi-Fi task only
+relay_dedup relayDedup;      // Frames already forwarded; Wi-Fi task only
+#endif
+portMUX_TYPE relayMux = portMUX_INITIALIZER_UNLOCKED;
+uint16_t frameSeq = 0;       // Sequence number of our last frame; starts random so a reboot is not mistaken for a repeat
+
+// Frame authentication: the keys, with their subkeys worked out at boot;
+// the last counter of both masters and of the relays whose beacons we
+// heard, our possible parents, guarded by authMux and saved to NVS
+// from loop(); our own counter, loop() only, whose boot epoch is kept in NVS
+auth_key authGroupKey;
+auth_key authNodeKey;
+auth_replay authReplay;
+portMUX_TYPE authMux = portMUX_INITIALIZER_UNLOCKED;
+Preferences authPrefs;
+uint32_t authCounter = 0;           // Next counter we seal with
+volatile uint32_t authRejected = 0; // Frames without a trailer we could check, or with a wrong tag
+volatile uint32_t authReplayed = 0; // Frames with a good tag and a counter we had already seen
+uint32_t reportedAuthRejected = 0;  // loop() only, for the serial log
+uint32_t reportedAuthReplayed = 0;
+
+// Last ESP-NOW frame heard in promiscuous mode, for the RSSI of beacons.
+// Written and read on the Wi-Fi task only.
+uint8_t lastRxMAC[6];
+int8_t lastRxRssi = 0;
+
+// Channel migration (see channel_migration.h): the master announces a move
+// to a new channel and we switch with it; if we missed that, we sweep the
+// channels once beacons stop, probing each, until a beacon answers. A relay
+// passes notices on and answers probes with its parent's last beacon.
+#define MSG_CHANNEL 7        // Message type of a channel notice or probe
+#define CHANNEL_OP_NOTICE 0
+#define CHANNEL_OP_PROBE 1
+
+typedef struct channel_notice {
+  frame_header header;      // MSG_CHANNEL
+  uint8_t op;               // CHANNEL_OP_NOTICE from the master, CHANNEL_OP_PROBE from us
+  uint8_t channel;          // Channel the network moves to (notice only)
+  uint16_t switchIn;        // ms from sending until the move (notice only)
+} channel_notice;
+
+channel_recovery channelRecovery;   // Guarded by channelMux
+portMUX_TYPE channelMux = portMUX_INITIALIZER_UNLOCKED;
+channel_notice probeFrame;
+bool probePending = false;          // probeFrame is waiting to go out
+uint16_t probeSeq = 0;              // Probes are numbered apart from our data frames
+uint32_t reportedSweeps = 0;        // loop() only, for the serial log
+uint32_t reportedRecoveries = 0;
+uint32_t reportedMigrations = 0;
+#if RELAY_ROLE
+sync_beacon parentBeacon;           // Last beacon from our parent, for answering probes; Wi-Fi task only
+unsigned long parentBeaconAt = 0;
+#endif
+
+bool isParent(const uint8_t *mac) {
+  portENTER_CRITICAL(&relayMux);
+  bool parent = memcmp(mac, parentMAC, 6) == 0;
+  portEXIT_CRITICAL(&relayMux);
+  return parent;
+}
+
+// Either master of the pair, active or not
+bool isMaster(const uint8_t *mac) {
+  return memcmp(mac, masterMAC, 6) == 0 ||
+         (memcmp(standbyMAC, "\0\0\0\0\0\0", 6) != 0 && memcmp(mac, standbyMAC, 6) == 0);
+}
+
+// Copy the address of the master that is active now
+void activeMaster(uint8_t *mac) {
+  portENTER_CRITICAL(&relayMux);
+  memcpy(mac, masterChoice.active, 6);
+  portEXIT_CRITICAL(&relayMux);
+}
+
+// A beacon from the master or a relay: every one rates a candidate parent,
+// our parent's also sets our clock. A beacon of the other master moves us
+// to it once ours has gone quiet, with a new tree of parents and a new
+// clock.
+void onBeacon(const uint8_t *mac, const uint8_t *incomingData, unsigned long receivedAt) {
+  sync_beacon beacon;
+  memcpy(&beacon, incomingData, sizeof(beacon));
+  if (!isMaster(beacon.master)) {
+    return;
+  }
+  int rssi = memcmp(mac, lastRxMAC, 6) == 0 ? lastRxRssi : RELAY_RSSI_UNKNOWN;
+  portENTER_CRITICAL(&channelMux);
+  recoveryOnBeacon(channelRecovery, receivedAt);  // Whoever sent it, the network is on this channel
+  portEXIT_CRITICAL(&channelMux);
+  portENTER_CRITICAL(&relayMux);
+  uint8_t verdict = masterOnBeacon(masterChoice, beacon.master, receivedAt);
+  if (verdict == MASTER_SWITCH) {
+    relayParentInit(relayParent);
+  }
+  if (verdict != MASTER_IGNORE) {
+    relayOnBeacon(relayParent, mac, beacon.hops, beacon.pathCost, rssi, receivedAt);
+  }
+  bool fromParent = memcmp(mac, parentMAC, 6) == 0;
+#if RELAY_ROLE
+  uint8_t pathCost = relayPathCost(relayParent);
+#endif
+  portEXIT_CRITICAL(&relayMux);
+  if (verdict == MASTER_SWITCH) {
+    resetTimeSync();
+  }
+  if (verdict == MASTER_IGNORE || !fromParent) {
+    return;
+  }
+  updateTimeSync(receivedAt, beacon.masterTime, beacon.hops);
+#if RELAY_ROLE
+  parentBeacon = beacon;
+  parentBeaconAt = receivedAt;
+
+  // Pass it on once for the bays below us; serviceTransmit() adds the time we held it
+  if (beacon.hops < RELAY_MAX_HOPS &&
+      !relayIsDuplicate(relayDedup, beacon.master, MSG_SYNC_BEACON, beacon.header.seq)) {
+    beacon.hops++;
+    beacon.pathCost = pathCost;
+    portENTER_CRITICAL(&relayMux);
+    relayQueuePush(relayQueue, broadcastMAC, QOS_BULK, (const uint8_t *)&beacon, sizeof(beacon), receivedAt);
+    portEXIT_CRITICAL(&relayMux);
+  }
+#endif
+}
+
+// A term announcement from either master, under our own key: a newer term
+// than ours moves us to it at once, as onBeacon() does once ours is quiet
+void onTermAnnounce(const uint8_t *master, const uint8_t *incomingData, unsigned long receivedAt) {
+  term_announce announce;
+  memcpy(&announce, incomingData, sizeof(announce));
+  portENTER_CRITICAL(&relayMux);
+  uint8_t verdict = masterOnAnnounce(masterChoice, master, announce.term, receivedAt);
+  if (verdict == MASTER_SWITCH) {
+    relayParentInit(relayParent);
+  }
+  portEXIT_CRITICAL(&relayMux);
+  if (verdict == MASTER_SWITCH) {
+    resetTimeSync();
+  }
+}
+
+#if RELAY_ROLE
+// A wrapped frame for another node: up to our parent if it is for the
+// master, else down the route its destination was last heard by. Each
+// frame is forwarded once and at most RELAY_MAX_HOPS times.
+void forwardFrame(const uint8_t *mac, const uint8_t *incomingData, int len, unsigned long receivedAt) {
+  relay_header relay;
+  memcpy(&relay, incomingData, sizeof(relay));
+  uint8_t msgType = incomingData[sizeof(relay)];
+  if (relay.hops >= RELAY_MAX_HOPS || memcmp(relay.origin, ownMAC, 6) == 0 ||
+      relayIsDuplicate(relayDedup, relay.origin, msgType, relay.header.seq)) {
+    return;
+  }
+  const uint8_t *to;
+  uint8_t parent[6];
+  if (isMaster(relay.dest)) {
+    relayLearnRoute(relayRoutes, relay.origin, mac, receivedAt);
+    portENTER_CRITICAL(&relayMux);
+    memcpy(parent, parentMAC, 6);
+    portEXIT_CRITICAL(&relayMux);
+    to = parent;
+  } else {
+    to = relayFindRoute(relayRoutes, relay.dest, receivedAt);
+    if (to == nullptr) {
+      return;
+    }
+  }
+  portENTER_CRITICAL(&relayMux);
+  relay_forward *frame = relayQueuePush(relayQueue, to, relay.header.qos, incomingData, len, receivedAt);
+  if (frame != nullptr) {
+    ((relay_header *)frame->data)->hops++;
+  }
+  portEXIT_CRITICAL(&relayMux);
+}
+#endif
+
+// A channel notice from the master, directly or through our parent, or a
+// probe from a bay looking for the network
+void onChannelFrame(const uint8_t *mac, const uint8_t *incomingData, unsigned long receivedAt) {
+  channel_notice notice;
+  memcpy(&notice, incomingData, sizeof(notice));
+  if (notice.op == CHANNEL_OP_PROBE) {
+#if RELAY_ROLE
+    // Answer with our parent's last beacon; serviceTransmit() adds the time we held it
+    if (parentBeaconAt != 0 && receivedAt - parentBeaconAt < RELAY_CANDIDATE_TIMEOUT &&
+        parentBeacon.hops < RELAY_MAX_HOPS) {
+      sync_beacon beacon = parentBeacon;
+      beacon.hops++;
+      portENTER_CRITICAL(&relayMux);
+      beacon.pathCost = relayPathCost(relayParent);
+      relayQueuePush(relayQueue, broadcastMAC, QOS_BULK, (const uint8_t *)&beacon, sizeof(beacon), parentBeaconAt);
+      portEXIT_CRITICAL(&relayMux);
+    }
+#endif
+    return;
+  }
+  if (notice.op != CHANNEL_OP_NOTICE || (!isMaster(mac) && !isParent(mac))) {
+    return;
+  }
+  portENTER_CRITICAL(&channelMux);
+  recoveryOnNotice(channelRecovery, notice.channel, receivedAt + notice.switchIn);
+  portEXIT_CRITICAL(&channelMux);
+
+#if RELAY_ROLE
+  // Pass it on once for the bays below us; serviceTransmit() takes off the time we held it
+  uint8_t master[6];
+  activeMaster(master);
+  if (!relayIsDuplicate(relayDedup, master, MSG_CHANNEL, notice.header.seq)) {
+    portENTER_CRITICAL(&relayMux);
+    relayQueuePush(relayQueue, broadcastMAC, QOS_BULK, incomingData, sizeof(notice), receivedAt);
+    portEXIT_CRITICAL(&relayMux);
+  }
+#endif
+}
+
+// Firmware updates from the master (see ota_transfer.h). The receive
+// callback checks offers and chunks and hands them over; loop() writes the
+// chunks to the update partition, acks, and on commit hashes the image and
+// boots it if the hash matches. Updates only come from a master in direct
+// range, never through a relay.
+#define MSG_OTA 6                  // Message type of every firmware update frame
+#define OTA_SECTOR_SIZE 4096       // Flash erase unit
+#define OTA_RESTART_DELAY 2000     // ms between a verified image and the restart, so repeated commits are still acked
+
+typedef struct ota_offer {
+  frame_header header;      // MSG_OTA
+  uint8_t op;               // OTA_OP_OFFER
+  uint8_t nodeType;
+  uint16_t chunkCount;
+  uint32_t session;
+  uint32_t imageSize;
+  uint8_t sha256[32];       // Hash of the whole image
+} ota_offer;
+
+typedef struct ota_chunk {
+  frame_header header;      // MSG_OTA
+  uint8_t op;               // OTA_OP_CHUNK
+  uint8_t length;           // Image bytes in data
+  uint16_t index;
+  uint32_t session;
+  uint32_t crc;             // CRC-32 of data
+  uint8_t data[OTA_CHUNK_SIZE];
+} ota_chunk;                // Received without the unused tail of data
+
+typedef struct ota_control {
+  frame_header header;      // MSG_OTA
+  uint8_t op;               // OTA_OP_POLL, OTA_OP_COMMIT or OTA_OP_ABORT
+  uint8_t nodeType;
+  uint32_t session;
+} ota_control;
+
+typedef struct ota_ack {
+  frame_header header;      // MSG_OTA
+  uint8_t op;               // OTA_OP_ACK
+  uint8_t state;            // OtaState
+  uint16_t base;            // First chunk we miss
+  uint32_t session;
+  uint32_t bitmap;          // Chunks after base we have (bit i = base + i)
+} ota_ack;
+
+ota_receiver otaRx;                       // Guarded by otaMux
+ota_rx_queue otaRxQueue;                  // Guarded by otaMux
+portMUX_TYPE otaMux = portMUX_INITIALIZER_UNLOCKED;
+ota_offer otaOffer;                       // Last offer for us, guarded by otaMux
+volatile bool otaOfferPending = false;
+volatile bool otaAckPending = false;      // The master polled
+volatile bool otaCommitPending = false;
+const esp_partition_t *otaPartition = nullptr;  // loop() only, like the rest below
+uint32_t otaErasedUpTo = 0;               // Partition bytes erased so far
+unsigned long otaRestartAt = 0;
+ota_ack otaAckFrame;
+bool otaAckReady = false;                 // otaAckFrame is waiting to go out
+uint16_t otaAckSeq = 0;                   // Acks are numbered apart from our data frames
+
+// A firmware update frame from the master
+void onOtaFrame(const uint8_t *incomingData, int len) {
+  uint8_t op = incomingData[sizeof(frame_header)];
+  if (op == OTA_OP_CHUNK && len > (int)offsetof(ota_chunk, data)) {
+    ota_chunk chunk;
+    memcpy(&chunk, incomingData, min((size_t)len, sizeof(chunk)));
+    if (len != (int)offsetof(ota_chunk, data) + chunk.length) {
+      return;
+    }
+    portENTER_CRITICAL(&otaMux);
+    if (otaReceiverWants(otaRx, chunk.session, chunk.index, chunk.data, chunk.length, chunk.crc)) {
+      otaRxPush(otaRxQueue, chunk.index, chunk.data, chunk.length);
+    }
+    portEXIT_CRITICAL(&otaMux);
+  } else if (op == OTA_OP_OFFER && len == sizeof(ota_offer)) {
+    if (((const ota_offer *)incomingData)->nodeType != NODE_TYPE) {
+      return;  // For another kind of node
+    }
+    portENTER_CRITICAL(&otaMux);
+    memcpy(&otaOffer, incomingData, sizeof(otaOffer));
+    otaOfferPending = true;
+    portEXIT_CRITICAL(&otaMux);
+  } else if (len == sizeof(ota_control)) {
+    ota_control control;
+    memcpy(&control, incomingData, sizeof(control));
+    portENTER_CRITICAL(&otaMux);
+    if (control.session == otaRx.session && otaRx.session != 0) {
+      if (op == OTA_OP_POLL) {
+        otaAckPending = true;
+      } else if (op == OTA_OP_COMMIT) {
+        otaCommitPending = true;
+      } else if (op == OTA_OP_ABORT) {
+        otaReceiverInit(otaRx);
+        otaRxQueue.count = 0;
+      }
+    }
+    portEXIT_CRITICAL(&otaMux);
+  }
+}
+
+// Write one chunk, erasing the sectors ahead of it on first use
+bool otaWriteChunk(const ota_rx_chunk &chunk) {
+  if (otaPartition == nullptr) {
+    return false;
+  }
+  uint32_t offset = (uint32_t)chunk.index * OTA_CHUNK_SIZE;
+  uint32_t end = offset + chunk.length;
+  if (end > otaErasedUpTo) {
+    uint32_t eraseEnd = (end + OTA_SECTOR_SIZE - 1) / OTA_SECTOR_SIZE * OTA_SECTOR_SIZE;
+    if (esp_partition_erase_range(otaPartition, otaErasedUpTo, eraseEnd - otaErasedUpTo) != ESP_OK) {
+      return false;
+    }
+    otaErasedUpTo = eraseEnd;
+  }
+  return esp_partition_write(otaPartition, offset, chunk.data, chunk.length) == ESP_OK;
+}
+
+// Hash what was written and compare it with the offer
+bool otaVerify(uint32_t imageSize, const uint8_t *expected) {
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  uint8_t block[512];
+  bool readable = true;
+  for (uint32_t offset = 0; offset < imageSize && readable; offset += sizeof(block)) {
+    size_t length = min((size_t)(imageSize - offset), sizeof(block));
+    readable = esp_partition_read(otaPartition, offset, block, length) == ESP_OK;
+    mbedtls_sha256_update(&sha, block, length);
+  }
+  uint8_t digest[32];
+  mbedtls_sha256_finish(&sha, digest);
+  mbedtls_sha256_free(&sha);
+  return readable && memcmp(digest, expected, 32) == 0;
+}
+
+// Firmware update work for loop(): take up an offer, write the chunks that
+// came in, switch partitions on commit, and ack when due
+void otaService() {
+  unsigned long now = millis();
+  if (otaRestartAt != 0 && (long)(now - otaRestartAt) >= 0) {
+    ESP.restart();
+  }
+  bool ackDue = otaAckPending;
+  otaAckPending = false;
+
+  if (otaOfferPending) {
+    portENTER_CRITICAL(&otaMux);
+    ota_offer offer = otaOffer;
+    otaOfferPending = false;
+    bool fresh = otaReceiverOffer(otaRx, offer.session, offer.imageSize, offer.sha256);
+    if (fresh) {
+      otaRxQueue.count = 0;
+    }
+    portEXIT_CRITICAL(&otaMux);
+    if (fresh) {
+      otaPartition = esp_ota_get_next_update_partition(NULL);
+      otaErasedUpTo = 0;
+      if (otaPartition == nullptr || otaPartition->size < offer.imageSize) {
+        portENTER_CRITICAL(&otaMux);
+        otaRx.state = OTA_FAILED;
+        portEXIT_CRITICAL(&otaMux);
+      }
+      Serial.printf("Firmware update: receiving %u bytes\n", (unsigned)offer.imageSize);
+    }
+    ackDue = true;
+  }
+
+  ota_rx_chunk chunk;
+  for (;;) {
+    portENTER_CRITICAL(&otaMux);
+    bool popped = otaRxPop(otaRxQueue, chunk);
+    portEXIT_CRITICAL(&otaMux);
+    if (!popped) {
+      break;
+    }
+    bool written = otaWriteChunk(chunk);
+    portENTER_CRITICAL(&otaMux);
+    if (written) {
+      ackDue |= otaReceiverWritten(otaRx, chunk.index);
+    } else {
+      otaRx.state = OTA_FAILED;
+      ackDue = true;
+    }
+    portEXIT_CRITICAL(&otaMux);
+  }
+
+  if (otaCommitPending) {
+    otaCommitPending = false;
+    portENTER_CRITICAL(&otaMux);
+    uint8_t state = otaRx.state;
+    portEXIT_CRITICAL(&otaMux);
+    if (state == OTA_COMPLETE) {
+      bool good = otaVerify(otaRx.imageSize, otaRx.sha256) && esp_ota_set_boot_partition(otaPartition) == ESP_OK;
+      portENTER_CRITICAL(&otaMux);
+      otaRx.state = good ? OTA_VERIFIED : OTA_FAILED;
+      portEXIT_CRITICAL(&otaMux);
+      Serial.println(good ? "Firmware update verified, restarting" : "Firmware update failed verification");
+      if (good) {
+        otaRestartAt = now + OTA_RESTART_DELAY;
+      }
+    }
+    ackDue = true;
+  }
+
+  if (!ackDue) {
+    return;
+  }
+  otaAckFrame.header.msgType = MSG_OTA;
+  otaAckFrame.header.qos = QOS_BULK;
+  otaAckFrame.header.seq = ++otaAckSeq;
+  otaAckFrame.op = OTA_OP_ACK;
+  portENTER_CRITICAL(&otaMux);
+  otaAckFrame.state = otaRx.state;
+  otaAckFrame.base = otaRx.base;
+  otaAckFrame.session = otaRx.session;
+  otaAckFrame.bitmap = otaReceiverBitmap(otaRx);
+  portEXIT_CRITICAL(&otaMux);
+  otaAckReady = true;  // serviceTransmit() sends it after any alarm
+}
+
+// Work out the subkeys once, and start our counter in a new boot epoch
+void initFrameAuth() {
+  authKeyInit(authGroupKey, authGroupKeyBytes);
+  authKeyInit(authNodeKey, NODE_AUTH_KEY);
+  authReplayInit(authReplay);
+  authAddSender(authReplay, masterMAC, AUTH_KEY_NODE);
+  authAddSender(authReplay, masterMAC, AUTH_KEY_GROUP);
+  if (memcmp(standbyMAC, "\0\0\0\0\0\0", 6) != 0) {
+    authAddSender(authReplay, standbyMAC, AUTH_KEY_NODE);
+    authAddSender(authReplay, standbyMAC, AUTH_KEY_GROUP);
+  }
+  authPrefs.begin("frame_auth");
+  authCounter = (uint32_t)(authPrefs.getUShort("epoch") + 1) << 16;
+  for (int i = 0; i < AUTH_SENDERS; i++) {
+    char key[8];
+    uint8_t saved[AUTH_SAVED_SIZE];
+    snprintf(key, sizeof(key), "s%d", i);
+    if (authPrefs.isKey(key) && authPrefs.getBytes(key, saved, sizeof(saved)) == sizeof(saved)) {
+      authRestore(authReplay, saved);
+    }
+  }
+}
+
+// Save the senders that are new in the replay table, or whose counter has
+// moved on by AUTH_SAVE_STEP, so a restart does not forget them; loop()
+// only, to keep flash writes out of the Wi-Fi task
+void saveAuthReplay() {
+  uint8_t saved[AUTH_SAVED_SIZE];
+  for (;;) {
+    portENTER_CRITICAL(&authMux);
+    int index = authTakeUnsaved(authReplay, saved);
+    portEXIT_CRITICAL(&authMux);
+    if (index < 0) {
+      return;
+    }
+    char key[8];
+    snprintf(key, sizeof(key), "s%d", index);
+    authPrefs.putBytes(key, saved, sizeof(saved));
+  }
+}
+
+// Our next counter; the first of each epoch stores it before it goes out
+uint32_t nextAuthCounter() {
+  uint32_t counter = authCounter++;
+  if ((counter & 0xFFFF) == 0) {
+    authPrefs.putUShort("epoch", counter >> 16);
+  }
+  return counter;
+}
+
+// Seal `frame`, `len` bytes with room for the trailer behind them, with
+// our own key or the group key; returns the length to send
+size_t sealFrame(uint8_t *frame, size_t len, uint8_t keyId) {
+  if (!FRAME_AUTH) {
+    return len;
+  }
+  return authSeal(keyId == AUTH_KEY_NODE ? authNodeKey : authGroupKey, keyId, nextAuthCounter(), ownMAC, frame, len);
+}
+
+// Check the trailer of a frame for us before anything else in it is looked
+// at; returns its length without the trailer, or -1 to drop it. A relayed
+// frame was sealed by its origin, inside the relay_header. Our own key is
+// only taken from a master. The group key only proves the sender is one of
+// ours, so it is only taken, never inside a relay_header, for firmware
+// update chunks and polls from a master (an offer or a commit must come
+// under our own key), beacons that are a master's own or passed a relay
+// (hops > 0), notices from a master or our parent (a relay passing them on),
+// and probes, which any bay sends. Only a relay's beacon gets it an entry
+// in the replay table; a probe from a bay without one is taken as it is, as
+// all it does is prompt a beacon.
+int openFrame(const uint8_t *mac, const uint8_t *data, int len) {
+  if (!FRAME_AUTH) {
+    return len;
+  }
+  int start = 0;
+  const uint8_t *origin = mac;
+  if (len > (int)sizeof(relay_header) && data[0] == MSG_RELAY) {
+    start = sizeof(relay_header);
+    origin = data + offsetof(relay_header, origin);
+  }
+  int keyId = authKeyId(data + start, len - start);
+  const auth_key *key = nullptr;
+  if (keyId == AUTH_KEY_NODE && isMaster(origin)) {
+    key = &authNodeKey;
+  } else if (keyId == AUTH_KEY_GROUP && start == 0 &&
+             (data[0] == MSG_SYNC_BEACON || data[0] == MSG_CHANNEL || (data[0] == MSG_OTA && isMaster(origin)))) {
+    key = &authGroupKey;
+  }
+  uint32_t counter;
+  int length = key != nullptr ? authOpen(*key, origin, data + start, len - start, &counter) : -1;
+  if (length >= 0 && key == &authGroupKey && data[0] == MSG_OTA) {
+    uint8_t op = data[sizeof(frame_header)];
+    length = op == OTA_OP_CHUNK || op == OTA_OP_POLL ? length : -1;
+  } else if (length >= 0 && key == &authGroupKey && !isMaster(origin)) {
+    // Only now that the tag holds is the frame itself looked at
+    if (data[0] == MSG_SYNC_BEACON && length == sizeof(sync_beacon)) {
+      length = data[offsetof(sync_beacon, hops)] > 0 ? length : -1;
+    } else if (data[0] == MSG_CHANNEL && length == sizeof(channel_notice)) {
+      length = data[offsetof(channel_notice, op)] == CHANNEL_OP_PROBE || isParent(origin) ? length : -1;
+    }
+  }
+  if (length < 0) {
+    authRejected++;
+    return -1;
+  }
+  bool relayBeacon = key == &authGroupKey && !isMaster(origin) && data[0] == MSG_SYNC_BEACON;
+  bool probe = key == &authGroupKey && data[0] == MSG_CHANNEL && data[offsetof(channel_notice, op)] == CHANNEL_OP_PROBE;
+  portENTER_CRITICAL(&authMux);
+  if (relayBeacon) {
+    authAddSender(authReplay, origin, keyId);
+  }
+  bool fresh = (probe && authFindSender(authReplay, origin, keyId) == nullptr) ||
+               authFresh(authReplay, origin, keyId, counter);
+  portEXIT_CRITICAL(&authMux);
+  if (!fresh) {
+    authReplayed++;
+    return -1;
+  }
+  return start + length;
+}
+
+// Log the frames dropped for their trailer since the last report
+void reportAuth() {
+  uint32_t rejected = authRejected;
+  uint32_t replayed = authReplayed;
+  if (rejected != reportedAuthRejected || replayed != reportedAuthReplayed) {
+    Serial.printf("Dropped %u forged and %u replayed frames\n", (unsigned)(rejected - reportedAuthRejected),
+                  (unsigned)(replayed - reportedAuthReplayed));
+    reportedAuthRejected = rejected;
+    reportedAuthReplayed = replayed;
+  }
+}
+
+// Callback for frames from the master, directly or through relays, and for
+// frames we relay
+void OnDataRecv(const uint8_t *mac, const uint8_t *incomingData, int len) {
+  unsigned long receivedAt = millis();
+
+  // A wrapped frame for another node goes on as its origin sealed it; only
+  // its destination holds the key to check it
+  if (len > (int)sizeof(relay_header) && incomingData[0] == MSG_RELAY &&
+      memcmp(incomingData + offsetof(relay_header, dest), ownMAC, 6) != 0) {
+#if RELAY_ROLE
+    forwardFrame(mac, incomingData, len, receivedAt);
+#endif
+    return;
+  }
+
+  // Nothing else in a frame is looked at before its trailer checks out
+  len = openFrame(mac, incomingData, len);
+  if (len < 0) {
+    return;
+  }
+  if (len == sizeof(sync_beacon) && incomingData[0] == MSG_SYNC_BEACON) {
+    onBeacon(mac, incomingData, receivedAt);
+    return;
+  }
+  if (len == sizeof(channel_notice) && incomingData[0] == MSG_CHANNEL) {
+    onChannelFrame(mac, incomingData, receivedAt);
+    return;
+  }
+  if (len > (int)sizeof(frame_header) && incomingData[0] == MSG_OTA) {
+    if (isMaster(mac)) {
+      onOtaFrame(incomingData, len);
+    }
+    return;
+  }
+  relay_header relay;
+  if (len > (int)sizeof(relay_header) && incomingData[0] == MSG_RELAY) {
+    // For us: handle what is inside as if its origin had sent it directly
+    memcpy(&relay, incomingData, sizeof(relay));
+    mac = relay.origin;
+    incomingData += sizeof(relay);
+    len -= sizeof(relay);
+  }
+  if (!isMaster(mac)) {
+    return;
+  }
+
+  if (len == sizeof(action_command) && incomingData[0] == MSG_ACTION) {
+    action_command command;
+    memcpy(&command, incomingData, sizeof(command));
+    nodeAction(command);
+  } else if (len == sizeof(term_announce) && incomingData[0] == MSG_TERM) {
+    onTermAnnounce(mac, incomingData, receivedAt);
+  }
+}
+
+// Link rate to our parent (see rate_control.h): RSSI comes from the parent's
+// frames heard in promiscuous mode, delivery from the send callback. The
+// rate is applied from loop() before the next send, not from the callback.
+rate_control parentRate;
+portMUX_TYPE rateMux = portMUX_INITIALIZER_UNLOCKED;
+volatile bool rateChanged = true;  // Report the initial rate on the first send
+uint8_t appliedRate = 0xFF;        // Ladder index last set (on appliedRatePeer with per-peer rates)
+#if RATE_PER_PEER
+uint8_t appliedRatePeer[6];
+#endif
+volatile uint8_t sendsInFlight = 0; // Frames given to esp_now_send whose callback has not run, under rateMux
+const wifi_phy_rate_t ratePhy[RATE_LADDER_SIZE] = {
+  WIFI_PHY_RATE_1M_L, WIFI_PHY_RATE_2M_L, WIFI_PHY_RATE_6M,
+  WIFI_PHY_RATE_12M, WIFI_PHY_RATE_24M, WIFI_PHY_RATE_54M
+};
+
+// Promiscuous receive callback: RSSI of ESP-NOW frames (vendor-specific
+// action frames); it runs just before OnDataRecv
+void OnPromiscuousRx(void *buf, wifi_promiscuous_pkt_type_t type) {
+  if (type != WIFI_PKT_MGMT) {
+    return;
+  }
+  const wifi_promiscuous_pkt_t *packet = (const wifi_promiscuous_pkt_t *)buf;
+  if (packet->payload[0] != 0xD0) {
+    return;
+  }
+  memcpy(lastRxMAC, packet->payload + 10, 6); // Source address
+  lastRxRssi = packet->rx_ctrl.rssi;
+  if (!isParent(lastRxMAC)) {
+    return;
+  }
+  portENTER_CRITICAL(&rateMux);
+  rateOnRssi(parentRate, packet->rx_ctrl.rssi);
+  portEXIT_CRITICAL(&rateMux);
+}
+
+// Start listening for the RSSI of our neighbours' frames; call after the channel is set
+void startLinkMonitor() {
+  rateInit(parentRate);
+  wifi_promiscuous_filter_t filter;
+  filter.filter_mask = WIFI_PROMIS_FILTER_MASK_MGMT;
+  esp_wifi_set_promiscuous_filter(&filter);
+  esp_wifi_set_promiscuous_rx_cb(OnPromiscuousRx);
+  esp_wifi_set_promiscuous(true);
+}
+
+// Set the PHY rate of the next frames to `to` to ladder index `index`. With a
+// single interface-wide rate the switch waits until the frame before has
+// called back (only a send that timed out can still be queued), so it never
+// re-rates a queued frame.
+void applyRate(const uint8_t *to, uint8_t index) {
+#if RATE_PER_PEER
+  if (index == appliedRate && memcmp(to, appliedRatePeer, 6) == 0) {
+    return;
+  }
+  esp_now_rate_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.phymode = rateLadderMbps[index] <= 2 ? WIFI_PHY_MODE_11B : WIFI_PHY_MODE_11G;  // 1 and 2 Mbps are DSSS
+  config.rate = ratePhy[index];
+  if (esp_now_set_peer_rate_config(to, &config) == ESP_OK) {
+    appliedRate = index;
+    memcpy(appliedRatePeer, to, 6);
+  }
+#else
+  portENTER_CRITICAL(&rateMux);
+  bool idle = sendsInFlight == 0;
+  portEXIT_CRITICAL(&rateMux);
+  if (index != appliedRate && idle && esp_wifi_config_espnow_rate(WIFI_IF_STA, ratePhy[index]) == ESP_OK) {
+    appliedRate = index;
+  }
+#endif
+}
+
+// Switch frames to our parent `to` to the rate its link currently supports
+void applyLinkRate(const uint8_t *to) {
+  portENTER_CRITICAL(&rateMux);
+  uint8_t index = parentRate.index;
+  portEXIT_CRITICAL(&rateMux);
+  applyRate(to, index);
+  if (rateChanged) {
+    rateChanged = false;
+    Serial.printf("Link rate to parent: %u Mbps\n", rateLadderMbps[index]);
+  }
+}
+
+// Make sure ESP-NOW will send to `mac`
+void addPeer(const uint8_t *mac) {
+  if (esp_now_is_peer_exist(mac)) {
+    return;
+  }
+  esp_now_peer_info_t peerInfo;
+  memset(&peerInfo, 0, sizeof(peerInfo));
+  memcpy(peerInfo.peer_addr, mac, 6);
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
+    Serial.println("Failed to add peer");
+  }
+}
+
+// Move to a clearly better parent when the beacons say so
+void updateParent() {
+  portENTER_CRITICAL(&relayMux);
+  bool changed = relaySelectParent(relayParent, millis());
+  const relay_candidate *parent = relayParentOf(relayParent);
+  if (changed && parent != nullptr) {
+    memcpy(parentMAC, parent->mac, 6);
+  }
+  uint8_t hops = relayHops(relayParent);
+  uint32_t switches = masterChoice.switches;
+  uint8_t master[6];
+  memcpy(master, masterChoice.active, 6);
+  portEXIT_CRITICAL(&relayMux);
+  if (switches != reportedMasterSwitches) {
+    reportedMasterSwitches = switches;
+    Serial.printf("Master %02X:%02X:%02X:%02X:%02X:%02X took over\n",
+                  master[0], master[1], master[2], master[3], master[4], master[5]);
+  }
+  if (!changed || parent == nullptr) {
+    return;  // With no candidate left we keep trying the last parent
+  }
+
+  addPeer(parentMAC);
+  portENTER_CRITICAL(&rateMux);
+  rateInit(parentRate);
+  portEXIT_CRITICAL(&rateMux);
+  rateChanged = true;
+  Serial.printf("Parent: %02X:%02X:%02X:%02X:%02X:%02X, %u relays from the master\n",
+                parentMAC[0], parentMAC[1], parentMAC[2], parentMAC[3], parentMAC[4], parentMAC[5], hops);
+}
+
+// Alarm transmit queue: transitions are queued by the node (see node_config.h) and go out
+// ahead of relayed frames and the pending status frame, one frame on the
+// air at a time. An alarm is sent at the most robust rate and retried until
+// delivered.
+#define ALARM_QUEUE_SIZE 4         // Alarm frames waiting to go out
+#define ALARM_MAX_ATTEMPTS 5       // Sends of one alarm before it is given up
+#define ALARM_RETRY_INTERVAL 20    // ms between attempts
+#define ALARM_POLL_INTERVAL 10     // ms between checks while waiting
+#define SEND_TIMEOUT 100           // ms to wait for the send callback
+
+typedef struct alarm_frame {
+  frame_header header;      // MSG_ALARM, QOS_ALARM
+  uint8_t code;             // ALARM_*
+  uint8_t active;           // 1 when raised, 0 when cleared
+  uint8_t attempt;          // Send attempt this copy came from, 1 for the first
+  float value;              // Reading that raised or cleared the alarm
+  uint32_t sampleTime;      // Master-timebase ms when the condition was seen
+  uint16_t sampleTimeError; // Error bound of sampleTime in ms (SYNC_UNSYNCED if unknown)
+} alarm_frame;
+
+alarm_frame alarmQueue[ALARM_QUEUE_SIZE];
+uint8_t alarmHead = 0;
+uint8_t alarmCount = 0;
+unsigned long alarmLastAttempt = 0;
+#if RELAY_ROLE
+unsigned long forwardLastAttempt = 0;
+#endif
+bool statusPending = false;     // myData is waiting to go out
+enum TxSource {TX_PROBE, TX_ALARM, TX_OTA, TX_FORWARD, TX_STATUS};
+bool txInFlight = false;        // A frame is on the air
+TxSource txSource = TX_STATUS;  // Queue it came from
+bool txRated = false;           // Sent at our parent's link rate, so its result feeds the rate control
+uint16_t txSeq = 0;             // Its sequence number
+unsigned long txStarted = 0;
+volatile int8_t txResult = -1;  // Set by OnDataSent: 1 delivered, 0 failed
+
+// Status frames the master did not ack. While it stays the active master
+// they were lost like any other frame and are dropped at the next one it
+// acks; once another master took over they are sent to it, oldest first,
+// in case it missed them while the silent one was still ours.
+struct_message sentStatus;      // The status frame on the air
+struct_message heldStatus[FAILOVER_HELD_SAMPLES];
+uint8_t heldHead = 0;
+uint8_t heldCount = 0;
+uint32_t heldSwitches = 0;      // masterChoice.switches when they were held
+
+uint32_t masterSwitches() {
+  portENTER_CRITICAL(&relayMux);
+  uint32_t switches = masterChoice.switches;
+  portEXIT_CRITICAL(&relayMux);
+  return switches;
+}
+
+// The status frame on the air left it
+void finishStatus(bool delivered) {
+  uint32_t switches = masterSwitches();
+  if (delivered) {
+    if (heldSwitches == switches) {
+      heldCount = 0;
+    }
+    return;
+  }
+  if (heldCount == FAILOVER_HELD_SAMPLES) {
+    heldHead = (heldHead + 1) % FAILOVER_HELD_SAMPLES;
+    heldCount--;
+  }
+  heldStatus[(heldHead + heldCount) % FAILOVER_HELD_SAMPLES] = sentStatus;
+  heldCount++;
+  heldSwitches = switches;  // All of them wait for the next master now
+}
+
+void popAlarm() {
+  alarmHead = (alarmHead + 1) % ALARM_QUEUE_SIZE;
+  alarmCount--;
+}
+
+// Start sending one frame to `to`. Only bulk frames to our parent go at the
+// adapted link rate; alarms and frames for anyone else at the most robust.
+void startSend(TxSource source, uint8_t qos, uint16_t seq, const uint8_t *to, const uint8_t *data, size_t len) {
+  txRated = qos == QOS_BULK && isParent(to);
+  if (txRated) {
+    applyLinkRate(to);
+  } else {
+    applyRate(to, 0);
+  }
+  txSource = source;
+  txSeq = seq;
+  txResult = -1;
+  txStarted = millis();
+  portENTER_CRITICAL(&rateMux);
+  sendsInFlight++;
+  portEXIT_CRITICAL(&rateMux);
+  txInFlight = esp_now_send(to, data, len) == ESP_OK;
+  if (!txInFlight) {
+    portENTER_CRITICAL(&rateMux);
+    sendsInFlight--;
+    portEXIT_CRITICAL(&rateMux);
+  }
+}
+
+// Start sending a copy of `data` sealed as ours with key `keyId`
+void startSendSealed(TxSource source, uint8_t qos, uint16_t seq, const uint8_t *to, const uint8_t *data, size_t len,
+                     uint8_t keyId) {
+  uint8_t frame[RELAY_MAX_FRAME];
+  memcpy(frame, data, len);
+  startSend(source, qos, seq, to, frame, sealFrame(frame, len, keyId));
+}
+
+// Start sending one of our own frames to the master, through our parent,
+// sealed with our key; every attempt gets a counter of its own
+void sendUp(TxSource source, const uint8_t *data, size_t len) {
+  const frame_header *header = (const frame_header *)data;
+  uint8_t parent[6];
+  uint8_t master[6];
+  portENTER_CRITICAL(&relayMux);
+  memcpy(parent, parentMAC, 6);
+  memcpy(master, masterChoice.active, 6);
+  portEXIT_CRITICAL(&relayMux);
+  if (memcmp(parent, master, 6) == 0) {
+    startSendSealed(source, header->qos, header->seq, parent, data, len, AUTH_KEY_NODE);
+    return;
+  }
+
+  uint8_t frame[RELAY_MAX_FRAME];
+  relay_header relay;
+  relay.header.msgType = MSG_RELAY;
+  relay.header.qos = header->qos;
+  relay.header.seq = header->seq;
+  relay.hops = 0;
+  memcpy(relay.origin, ownMAC, 6);
+  memcpy(relay.dest, master, 6);
+  memcpy(frame, &relay, sizeof(relay));
+  memcpy(frame + sizeof(relay), data, len);
+  size_t sealed = sealFrame(frame + sizeof(relay), len, AUTH_KEY_NODE);
+  startSend(source, header->qos, header->seq, parent, frame, sizeof(relay) + sealed);
+}
+
+#if RELAY_ROLE
+// Send the head of the relay queue; returns true while that queue holds the
+// air, retries included
+bool serviceForward(unsigned long now) {
+  relay_forward frame;
+  portENTER_CRITICAL(&relayMux);
+  bool waiting = relayQueue.count > 0;
+  bool ready = waiting && (relayQueue.frames[relayQueue.head].attempt == 0 ||
+                           now - forwardLastAttempt >= ALARM_RETRY_INTERVAL);
+  if (ready) {
+    relayQueue.frames[relayQueue.head].attempt++;
+    frame = relayQueue.frames[relayQueue.head];
+  }
+  portEXIT_CRITICAL(&relayMux);
+  if (!ready) {
+    return waiting;
+  }
+
+  if (frame.data[0] == MSG_SYNC_BEACON) {
+    sync_beacon *beacon = (sync_beacon *)frame.data;
+    beacon->masterTime += now - frame.heldSince;  // Still the master's time when it goes out
+  } else if (frame.data[0] == MSG_CHANNEL) {
+    channel_notice *notice = (channel_notice *)frame.data;
+    unsigned long held = now - frame.heldSince;
+    notice->switchIn = held < notice->switchIn ? notice->switchIn - held : 0;  // Still the same moment
+  }
+  forwardLastAttempt = now;
+  addPeer(frame.to);
+  uint16_t seq = ((const frame_header *)frame.data)->seq;
+  if (frame.data[0] == MSG_RELAY) {
+    startSend(TX_FORWARD, frame.qos, seq, frame.to, frame.data, frame.length);  // As its origin sealed it
+  } else {
+    startSendSealed(TX_FORWARD, frame.qos, seq, frame.to, frame.data, frame.length, AUTH_KEY_GROUP);  // Changed by us
+  }
+  return true;
+}
+
+// A forwarded frame left the air: alarms get the retries their origin would
+// have given them, everything else goes once
+void finishForward(bool delivered) {
+  portENTER_CRITICAL(&relayMux);
+  if (relayQueue.count > 0) {
+    relay_forward &head = relayQueue.frames[relayQueue.head];
+    if (delivered || head.qos != QOS_ALARM || head.attempt >= ALARM_MAX_ATTEMPTS) {
+      if (!delivered && memcmp(head.to, broadcastMAC, 6) != 0) {
+        relayQueue.dropped++;
+      }
+      relayQueuePop(relayQueue);
+    }
+  }
+  portEXIT_CRITICAL(&relayMux);
+}
+#endif
+
+// Put the next frame on the air: a probe while we look for the network,
+// then queued alarms, then firmware update acks, then frames we relay, then
+// held status frames and the status frame. Called from loop() and while waiting between readings.
+void serviceTransmit() {
+  unsigned long now = millis();
+  if (txInFlight) {
+    if (txResult < 0 && now - txStarted < SEND_TIMEOUT) {
+      return;  // Still on the air
+    }
+    txInFlight = false;
+    if (txSource == TX_ALARM && txResult == 1 && alarmCount > 0 && alarmQueue[alarmHead].header.seq == txSeq) {
+      popAlarm();
+    }
+#if RELAY_ROLE
+    if (txSource == TX_FORWARD) {
+      finishForward(txResult == 1);
+    }
+#endif
+    if (txSource == TX_STATUS) {
+      finishStatus(txResult == 1);
+    }
+  }
+
+  while (alarmCount > 0 && alarmQueue[alarmHead].attempt >= ALARM_MAX_ATTEMPTS) {
+    Serial.printf("Alarm %u undelivered after %d attempts\n", alarmQueue[alarmHead].code, ALARM_MAX_ATTEMPTS);
+    popAlarm();
+  }
+
+  if (probePending) {
+    probePending = false;  // One per channel we tune to; the sweep moves on if nobody answers
+    addPeer(broadcastMAC);
+    startSendSealed(TX_PROBE, QOS_BULK, probeFrame.header.seq, broadcastMAC, (const uint8_t *)&probeFrame,
+                    sizeof(probeFrame), AUTH_KEY_GROUP);
+  } else if (alarmCount > 0) {
+    alarm_frame &head = alarmQueue[alarmHead];
+    if (head.attempt > 0 && now - alarmLastAttempt < ALARM_RETRY_INTERVAL) {
+      return;  // The status frame keeps waiting while an alarm retries
+    }
+    head.attempt++;
+    alarmLastAttempt = now;
+    sendUp(TX_ALARM, (const uint8_t *)&head, sizeof(head));
+  } else if (otaAckReady) {
+    otaAckReady = false;  // Acks go once; the master polls for a lost one
+    uint8_t master[6];
+    activeMaster(master);
+    startSendSealed(TX_OTA, QOS_BULK, otaAckFrame.header.seq, master, (const uint8_t *)&otaAckFrame, sizeof(otaAckFrame),
+                    AUTH_KEY_NODE);
+#if RELAY_ROLE
+  } else if (serviceForward(now)) {
+    return;  // The status frame waits behind relayed frames
+#endif
+  } else if (heldCount > 0 && heldSwitches != masterSwitches()) {
+    sentStatus = heldStatus[heldHead];  // Ahead of the new one
+    heldHead = (heldHead + 1) % FAILOVER_HELD_SAMPLES;
+    heldCount--;
+    sendUp(TX_STATUS, (const uint8_t *)&sentStatus, sizeof(sentStatus));
+  } else if (statusPending) {
+    statusPending = false;
+    sentStatus = myData;
+    sendUp(TX_STATUS, (const uint8_t *)&sentStatus, sizeof(sentStatus));
+  }
+}
+
+// Queue an alarm transition and send it right away; when the queue is full
+// the oldest waiting alarm gives way
+void raiseAlarm(uint8_t code, bool active, float value) {
+  if (alarmCount == ALARM_QUEUE_SIZE) {
+    popAlarm();
+  }
+  alarm_frame &frame = alarmQueue[(alarmHead + alarmCount) % ALARM_QUEUE_SIZE];
+  frame.header.msgType = MSG_ALARM;
+  frame.header.qos = QOS_ALARM;
+  frame.header.seq = ++frameSeq;
+  frame.code = code;
+  frame.active = active;
+  frame.attempt = 0;
+  frame.value = value;
+  frame.sampleTime = masterTime(&frame.sampleTimeError);
+  alarmCount++;
+  Serial.printf("Alarm %u %s (%.1f)\n", code, active ? "raised" : "cleared", value);
+  serviceTransmit();
+}
+
+void OnDataSent(const uint8_t *mac, esp_now_send_status_t status) {
+  portENTER_CRITICAL(&rateMux);
+  if (sendsInFlight > 0) {
+    sendsInFlight--;
+  }
+  portEXIT_CRITICAL(&rateMux);
+  // Only sends at the link rate say anything about it
+  if (txRated) {
+    portENTER_CRITICAL(&rateMux);
+    if (rateOnSendResult(parentRate, status == ESP_NOW_SEND_SUCCESS, millis())) {
+      rateChanged = true;
+    }
+    portEXIT_CRITICAL(&rateMux);
+  }
+  txResult = status == ESP_NOW_SEND_SUCCESS;
+}
+
+// Initialize ESP-NOW
+void initESPNow() {
+  if (esp_now_init() != ESP_OK) {
+    Serial.println("Error initializing ESP-NOW");
+    return;
+  }
+
+  // The master is our parent until beacons show a better path
+  esp_now_peer_info_t peerInfo;
+  memset(&peerInfo, 0, sizeof(peerInfo));
+  memcpy(peerInfo.peer_addr, masterMAC, 6);
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+
+  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
+    Serial.println("Failed to add master as a peer");
+    return;
+  }
+  Serial.println("Master added as a peer!");
+  esp_wifi_get_mac(WIFI_IF_STA, ownMAC);
+  initFrameAuth();
+  memcpy(parentMAC, masterMAC, 6);
+  relayParentInit(relayParent);
+  masterChoiceInit(masterChoice, masterMAC, millis());
+  if (isMaster(standbyMAC)) {
+    addPeer(standbyMAC);
+  }
+  otaReceiverInit(otaRx);
+  otaRxQueue.head = 0;
+  otaRxQueue.count = 0;
+  otaRxQueue.dropped = 0;
+#if RELAY_ROLE
+  relayQueueInit(relayQueue);
+  relayRoutesInit(relayRoutes);
+  relayDedupInit(relayDedup);
+#endif
+  frameSeq = esp_random();
+
+  // Adapt the link rate from here on
+  startLinkMonitor();
+}
+
+// Send data to master
+void sendDataToMaster() {
+  myData.header.msgType = MSG_STATUS;
+  myData.header.qos = QOS_BULK;
+  myData.header.seq = ++frameSeq;
+  statusPending = true;  // Goes out as soon as no alarm is waiting
+  serviceTransmit();
+}
+
+// Follow a channel notice, or sweep once the network has gone quiet; every
+// channel we tune to gets a probe
+void serviceChannel() {
+  portENTER_CRITICAL(&channelMux);
+  uint8_t channel = recoveryTick(channelRecovery, millis());
+  uint32_t sweeps = channelRecovery.sweeps;
+  uint32_t recoveries = channelRecovery.recoveries;
+  uint32_t migrations = channelRecovery.migrations;
+  uint8_t current = channelRecovery.channel;
+  unsigned long outage = channelRecovery.lastOutage;
+  portEXIT_CRITICAL(&channelMux);
+
+  if (migrations != reportedMigrations) {
+    reportedMigrations = migrations;
+    Serial.printf("Moving to channel %u with the master\n", current);
+  }
+  if (sweeps != reportedSweeps) {
+    reportedSweeps = sweeps;
+    Serial.println("No beacons, sweeping the channels");
+  }
+  if (recoveries != reportedRecoveries) {
+    reportedRecoveries = recoveries;
+    Serial.printf("Found the network on channel %u after %lu ms\n", current, outage);
+  }
+  if (channel == 0) {
+    return;
+  }
+
+  esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+  probeFrame.header.msgType = MSG_CHANNEL;
+  probeFrame.header.qos = QOS_BULK;
+  probeFrame.header.seq = ++probeSeq;
+  probeFrame.op = CHANNEL_OP_PROBE;
+  probeFrame.channel = 0;
+  probeFrame.switchIn = 0;
+  probePending = true;
+}
+
+// Wait between readings while alarms, relayed frames, firmware updates and
+// the status frame keep moving, and the channel follows the network
+void serviceWait(unsigned long ms) {
+  unsigned long start = millis();
+  while (millis() - start < ms) {
+    serviceChannel();
+    updateParent();
+    otaService();
+    nodeWatch();
+    serviceTransmit();
+    delay(ALARM_POLL_INTERVAL);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  unsigned long setupStart = millis();
+
+  // Sensors and actuators of this node
+  nodeBegin();
+
+  // Setup WiFi (required for ESP-NOW)
+  WiFi.mode(WIFI_STA);
+  WiFi.setSleep(WIFI_PS_NONE);
+  WiFi.channel(1);  // Set initial channel
+
+  // Set Wi-Fi channel based on the master's Wi-Fi network
+  scan_and_set_wifi_channel();
+
+  // Initialize ESP-NOW; no beacon yet, so our samples are unsynced
+  timeSyncInit(timeSync);
+  initESPNow();
+  recoveryInit(channelRecovery, WiFi.channel(), millis());
+
+  // Register ESP-NOW send callback
+  esp_now_register_send_cb(OnDataSent);
+
+  // Register ESP-NOW receive callback (sync beacons and actions from the master)
+  esp_now_register_recv_cb(OnDataRecv);
+
+  // Boot time and image size, to compare node builds (see README)
+  Serial.printf("Node %s: setup started at %lu ms, ready at %lu ms, sketch %u bytes\n",
+                NODE_NAME, setupStart, millis(), (unsigned)ESP.getSketchSize());
+}
+
+void loop() {
+  // Read, control and report; alarms go out ahead of the status frame
+  if (nodeSample(myData)) {
+    sendDataToMaster();
+  }
+  reportAuth();
+  saveAuthReplay();
+
+  // Wait for the next reading; alarms, relayed frames and updates keep moving
+  serviceWait(1000);
+}
@@ -0,0 +1,105 @@
+#ifndef NODE_CLIMATE_H
+#define NODE_CLIMATE_H
+
+#include "drivers.h"
+#include "dht_sensor.h"
+
+// Climate bay (build env "dht11"): a DHT11 and an exhaust fan on a relay.
+// The fan runs above THRESHOLD_TEMP unless a master rule sets it, and an
+// alarm goes up when the temperature runs far past the threshold.
+
+// Pin definitions
+#define RELAY_PIN 2       // GPIO pin connected to the relay
+#define DHTPIN 4          // Pin where the DHT11 is connected
+#define DHTTYPE DHT11     // Define sensor type (DHT11)
+#define THRESHOLD_TEMP 32 // Example temperature threshold
+
+constexpr uint8_t NODE_TYPE = 2;         // Slave number on the master, and firmware update type
+constexpr const char *NODE_NAME = "dht11";
+
+// Key of our frames (see frame_auth.h), AUTH_SLAVE2_KEY in keys.h, the
+// same as the masters have for slave 2
+#ifndef AUTH_SLAVE2_KEY
+#error "keys.h must define AUTH_SLAVE2_KEY (see keys.h.example)"
+#endif
+constexpr uint8_t NODE_AUTH_KEY[AUTH_KEY_SIZE] = AUTH_SLAVE2_KEY;
+
+typedef DhtSensor<DHTPIN, DHTTYPE> Thermometer;
+typedef RelayOutput<RELAY_PIN, false> Fan;
+
+// Structure for ESP-NOW data
+typedef struct struct_message {
+  frame_header header;        // MSG_STATUS
+  float temperature;
+  char fanStatus[20];
+  uint32_t sampleTime;        // Master-timebase ms when the reading was taken
+  uint16_t sampleTimeError;   // Error bound of sampleTime in ms (SYNC_UNSYNCED if unknown)
+} struct_message;
+
+actuator_override fanOverride = {VALUE_AUTO, 0};
+
+// Over-temperature alarm, raised far above THRESHOLD_TEMP
+#define ALARM_OVER_TEMP 1
+#define ALARM_TEMP_MARGIN 8        // °C above THRESHOLD_TEMP that raise the alarm
+#define ALARM_TEMP_HYSTERESIS 2    // °C it must drop back before the alarm clears
+bool overTempAlarm = false;
+
+inline void nodeBegin() {
+  Fan::begin();
+  Thermometer::begin();
+}
+
+// Action from the master; runs on the Wi-Fi task
+inline void nodeAction(const action_command &command) {
+  if (command.target == TARGET_FAN) {
+    setOverride(fanOverride, command);
+  }
+}
+
+// The DHT is read once per reading, so its alarm is checked there
+inline void nodeWatch() {}
+
+inline void checkAlarms(float temperature) {
+  if (!overTempAlarm && temperature > THRESHOLD_TEMP + ALARM_TEMP_MARGIN) {
+    overTempAlarm = true;
+    raiseAlarm(ALARM_OVER_TEMP, true, temperature);
+  } else if (overTempAlarm && temperature < THRESHOLD_TEMP + ALARM_TEMP_MARGIN - ALARM_TEMP_HYSTERESIS) {
+    overTempAlarm = false;
+    raiseAlarm(ALARM_OVER_TEMP, false, temperature);
+  }
+}
+
+// Read the temperature, run the fan and fill in the status frame; false if
+// the DHT could not be read
+inline bool nodeSample(struct_message &status) {
+  float temperature = Thermometer::readTemperature();
+
+  // Check if the reading was successful
+  if (isnan(temperature)) {
+    Serial.println("Failed to read temperature from DHT sensor!");
+    return false;
+  }
+  status.sampleTime = masterTime(&status.sampleTimeError); // When the reading was taken
+  checkAlarms(temperature);  // An alarm goes out before anything else
+
+  // Check the temperature and control the relay; a master rule overrides
+  // the threshold while it is active
+  bool fanOn = temperature > THRESHOLD_TEMP;
+  uint8_t fanCommand = overrideValue(fanOverride);
+  if (fanCommand != VALUE_AUTO) {
+    fanOn = (fanCommand == VALUE_ON);
+  }
+  Fan::set(fanOn);
+  strcpy(status.fanStatus, fanOn ? "ON" : "OFF");
+
+  // Populate the structure with temperature and fan status
+  status.temperature = temperature;
+
+  Serial.print("Temperature: ");
+  Serial.print(status.temperature);
+  Serial.print(" °C, Fan Status: ");
+  Serial.println(status.fanStatus);
+  return true;
+}
+
+#endif
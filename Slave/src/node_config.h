@@ -0,0 +1,29 @@
+#ifndef NODE_CONFIG_H
+#define NODE_CONFIG_H
+
+// Node selection
+//
+// Every slave runs this one firmware; the PlatformIO env picks the node with
+// a NODE_* build flag (see platformio.ini). Only the chosen node's header is
+// compiled, so the drivers and libraries of the other nodes never reach the
+// image. A node header supplies:
+//   NODE_TYPE, NODE_NAME  constexpr slave number and name
+//   NODE_AUTH_KEY         constexpr key of its frames, also held by the masters
+//   struct_message        its status frame, as the master expects it
+//   nodeBegin()           set up its sensors and actuators
+//   nodeSample(status)    read, run the local control, fill in the frame;
+//                         false if there is no reading this time
+//   nodeAction(command)   take an action from the master (Wi-Fi task)
+//   nodeWatch()           checks between readings, e.g. alarms
+
+#if defined(NODE_LDR)
+#include "node_light.h"
+#elif defined(NODE_DHT11)
+#include "node_climate.h"
+#elif defined(NODE_SOIL_WATER)
+#include "node_irrigation.h"
+#else
+#error "Build with one of -D NODE_LDR, -D NODE_DHT11 or -D NODE_SOIL_WATER (pick a PlatformIO env)"
+#endif
+
+#endif
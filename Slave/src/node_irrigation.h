@@ -0,0 +1,202 @@
+#ifndef NODE_IRRIGATION_H
+#define NODE_IRRIGATION_H
+
+#include "drivers.h"
+
+// Irrigation bay (build env "soil_water"): soil moisture and water level
+// sensors, a watering pump and a refill pump for the water container. Dry
+// soil gets a dose of water at most once per wateringInterval; the
+// container refills below the low mark until it is full. Master rules can
+// hold either pump, and alarms go up for a low container or a pump that
+// keeps running.
+
+// Define GPIO pins
+#define SOIL_SENSOR_PIN 34
+#define WATER_LEVEL_SENSOR_PIN 35
+#define RELAY_PLANT_WATERING_PIN 25
+#define RELAY_REFILL_PIN 26
+
+// Define thresholds
+#define SOIL_MOISTURE_THRESHOLD 1900 // Adjust as per sensor calibration
+#define WATER_LEVEL_LOW_THRESHOLD 1300   // Adjust as per sensor calibration
+#define WATER_LEVEL_FULL_THRESHOLD 1550 // Adjust as per sensor calibration
+
+constexpr uint8_t NODE_TYPE = 3;         // Slave number on the master, and firmware update type
+constexpr const char *NODE_NAME = "soil_water";
+
+// Key of our frames (see frame_auth.h), AUTH_SLAVE3_KEY in keys.h, the
+// same as the masters have for slave 3
+#ifndef AUTH_SLAVE3_KEY
+#error "keys.h must define AUTH_SLAVE3_KEY (see keys.h.example)"
+#endif
+constexpr uint8_t NODE_AUTH_KEY[AUTH_KEY_SIZE] = AUTH_SLAVE3_KEY;
+
+typedef AnalogInput<SOIL_SENSOR_PIN> SoilSensor;
+typedef AnalogInput<WATER_LEVEL_SENSOR_PIN> WaterLevelSensor;
+typedef RelayOutput<RELAY_PLANT_WATERING_PIN, true> WateringPump;  // Relay board switches on a low input
+typedef RelayOutput<RELAY_REFILL_PIN, true> RefillPump;
+
+// Structure for ESP-NOW data
+typedef struct struct_message {
+  frame_header header;        // MSG_STATUS
+  int soilMoistureValue;
+  char soilStatus[10];    // Soil status: Dry or Moist
+  char pumpStatus[20];    // Pump status: Watering or Off
+  int waterLevelValue;
+  char refillStatus[20];  // Refill status: Refilling or Full
+  uint32_t remainingCooldown; // Add remaining cooldown to the structure
+  uint32_t sampleTime;        // Master-timebase ms when the reading was taken
+  uint16_t sampleTimeError;   // Error bound of sampleTime in ms (SYNC_UNSYNCED if unknown)
+} struct_message;
+
+// Timing variables
+unsigned long previousWateringTime = 0;
+unsigned long wateringInterval = 10000;  // Adjust to your actual desired interval
+#define WATERING_DURATION 5000 // How long the watering pump runs per dose (ms)
+bool isRefilling = false; // Tracks if refill pump is active
+bool isWatering = false; // Tracks if watering pump is active
+
+actuator_override wateringOverride = {VALUE_AUTO, 0}; // VALUE_OFF holds watering
+actuator_override refillOverride = {VALUE_AUTO, 0};   // VALUE_OFF holds refilling
+
+// Alarms: water level low, and a pump that keeps running
+#define ALARM_WATER_LOW 0
+#define ALARM_PUMP_STUCK 2
+#define ALARM_WATER_HYSTERESIS 50      // Level must recover this far above the low threshold to clear
+#define PUMP_STUCK_MARGIN 2000         // Watering pump still on this long past its dose (ms)
+#define REFILL_MAX_DURATION 120000     // Refill pump on this long without filling the tank (ms)
+bool waterLowAlarm = false;
+bool pumpStuckAlarm = false;
+unsigned long refillStartTime = 0;
+
+inline void nodeBegin() {
+  // Pumps off, sensors as inputs
+  WateringPump::begin();
+  RefillPump::begin();
+  SoilSensor::begin();
+  WaterLevelSensor::begin();
+}
+
+// Action from the master; runs on the Wi-Fi task
+inline void nodeAction(const action_command &command) {
+  if (command.target == TARGET_WATERING) {
+    setOverride(wateringOverride, command);
+  } else if (command.target == TARGET_REFILL) {
+    setOverride(refillOverride, command);
+  }
+}
+
+// Checked every reading and every ALARM_POLL_INTERVAL while waiting, so an
+// alarm does not wait for the next status frame
+inline void nodeWatch() {
+  unsigned long now = millis();
+  int waterLevel = WaterLevelSensor::read();
+  if (!waterLowAlarm && waterLevel < WATER_LEVEL_LOW_THRESHOLD) {
+    waterLowAlarm = true;
+    raiseAlarm(ALARM_WATER_LOW, true, waterLevel);
+  } else if (waterLowAlarm && waterLevel >= WATER_LEVEL_LOW_THRESHOLD + ALARM_WATER_HYSTERESIS) {
+    waterLowAlarm = false;
+    raiseAlarm(ALARM_WATER_LOW, false, waterLevel);
+  }
+
+  unsigned long wateringFor = isWatering ? now - previousWateringTime : 0;
+  unsigned long refillingFor = isRefilling ? now - refillStartTime : 0;
+  bool stuck = wateringFor > WATERING_DURATION + PUMP_STUCK_MARGIN || refillingFor > REFILL_MAX_DURATION;
+  if (stuck != pumpStuckAlarm) {
+    pumpStuckAlarm = stuck;
+    raiseAlarm(ALARM_PUMP_STUCK, stuck, max(wateringFor, refillingFor) / 1000.0f); // Seconds running
+  }
+}
+
+// Read both sensors, run the pumps and fill in the status frame
+inline bool nodeSample(struct_message &status) {
+  // Read soil moisture sensor value
+  int soilMoistureValue = SoilSensor::read();
+  // Read water level sensor value
+  int waterLevelValue = WaterLevelSensor::read();
+  status.sampleTime = masterTime(&status.sampleTimeError); // When the readings were taken
+
+  // Water level logic; a master rule can hold refilling
+  if (overrideValue(refillOverride) == VALUE_OFF) {
+    if (isRefilling) {
+      RefillPump::set(false);
+      isRefilling = false;
+    }
+    strcpy(status.refillStatus, "Held");
+  } else if (strcmp(status.refillStatus, "Held") == 0) {
+    strcpy(status.refillStatus, "Full"); // Hold released; refill restarts below the low threshold
+  } else if (waterLevelValue < WATER_LEVEL_LOW_THRESHOLD) {
+    if (!isRefilling) {
+      RefillPump::set(true);
+      strcpy(status.refillStatus, "Refilling");
+      isRefilling = true;
+      refillStartTime = millis();
+    }
+  } else if (waterLevelValue >= WATER_LEVEL_FULL_THRESHOLD) {
+    if (isRefilling) {
+      RefillPump::set(false);
+      strcpy(status.refillStatus, "Full");
+      isRefilling = false;
+    }
+  }
+
+  // Timing variables for watering cooldown (6 hours)
+  unsigned long currentTime = millis();    // Get current time
+
+  // Stop the watering pump once the dose is delivered, or at once if a master
+  // rule holds watering. Watering never blocks the loop, so the master keeps
+  // hearing from us while the pump runs.
+  bool wateringHeld = overrideValue(wateringOverride) == VALUE_OFF;
+  if (isWatering && (wateringHeld || currentTime - previousWateringTime >= WATERING_DURATION)) {
+    WateringPump::set(false);
+    isWatering = false;
+  }
+
+  // Soil moisture logic
+  if (soilMoistureValue > SOIL_MOISTURE_THRESHOLD) {  // Soil is dry
+    strcpy(status.soilStatus, "Dry");
+
+    if (isWatering) { // Dose still running
+      strcpy(status.pumpStatus, "Watering");
+      status.remainingCooldown = 0;
+    } else if (wateringHeld) { // A master rule holds watering
+      strcpy(status.pumpStatus, "Held");
+      status.remainingCooldown = 0;
+    } else if (currentTime - previousWateringTime > wateringInterval) { // Cooldown period is over
+      Serial.println("Soil is dry. Watering the plant...");
+      WateringPump::set(true); // On for WATERING_DURATION
+      isWatering = true;
+      previousWateringTime = currentTime; // Update last watering time
+      strcpy(status.pumpStatus, "Watering"); // Update pump status to "Watering"
+      status.remainingCooldown = 0; // Reset cooldown since watering just occurred
+    } else {
+      // Cooldown period not over, hold off watering
+      Serial.println("Soil is dry, but watering is on hold until cooldown interval expires.");
+      unsigned long remainingCooldown = wateringInterval - (currentTime - previousWateringTime);
+      Serial.print("Remaining cooldown: ");
+      Serial.println(remainingCooldown);  // Display remaining cooldown in milliseconds
+      strcpy(status.pumpStatus, "Off"); // Pump is not running
+      status.remainingCooldown = remainingCooldown; // Send cooldown to master
+    }
+  } else {  // Soil is moist
+    strcpy(status.soilStatus, "Moist");
+    Serial.println("Soil is moist. No watering needed.");
+    if (isWatering) {
+      strcpy(status.pumpStatus, "Watering"); // Let the running dose finish
+    } else {
+      WateringPump::set(false); // Ensure watering pump is OFF
+      strcpy(status.pumpStatus, "Off"); // Pump is off since soil is moist
+    }
+    status.remainingCooldown = 0; // No cooldown needed since no watering happened
+  }
+
+  // Populate the structure with sensor data
+  status.soilMoistureValue = soilMoistureValue;
+  status.waterLevelValue = waterLevelValue;
+
+  // Alarms go out ahead of the status frame
+  nodeWatch();
+  return true;
+}
+
+#endif
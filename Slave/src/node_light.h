@@ -0,0 +1,117 @@
+#ifndef NODE_LIGHT_H
+#define NODE_LIGHT_H
+
+#include "drivers.h"
+
+// Light bay (build env "ldr"): an LDR and a dimmable grow light. The light
+// is off, dimmed or fully on depending on how dark it is, unless a master
+// rule sets it.
+
+// Definitions
+#define LED_PIN 13
+#define LDR_PIN 34  // LDR Pin
+#define LDR_THRESHOLD_DIM 500
+#define LDR_THRESHOLD_FULL 1000
+
+constexpr uint8_t NODE_TYPE = 1;         // Slave number on the master, and firmware update type
+constexpr const char *NODE_NAME = "ldr";
+
+// Key of our frames (see frame_auth.h), AUTH_SLAVE1_KEY in keys.h, the
+// same as the masters have for slave 1
+#ifndef AUTH_SLAVE1_KEY
+#error "keys.h must define AUTH_SLAVE1_KEY (see keys.h.example)"
+#endif
+constexpr uint8_t NODE_AUTH_KEY[AUTH_KEY_SIZE] = AUTH_SLAVE1_KEY;
+
+typedef AnalogInput<LDR_PIN> LightSensor;
+typedef PwmOutput<LED_PIN, 0, 5000, 8> Lamp;  // Channel 0, 5 kHz, 8-bit duty
+
+// Structure for ESP-NOW data
+typedef struct struct_message {
+  frame_header header;        // MSG_STATUS
+  int ldrValue;
+  char lightStatus[20];
+  uint32_t sampleTime;        // Master-timebase ms when the reading was taken
+  uint16_t sampleTimeError;   // Error bound of sampleTime in ms (SYNC_UNSYNCED if unknown)
+} struct_message;
+
+// Modes
+enum LightMode {OFF, DIM, FULL_ON};
+LightMode currentMode = OFF;
+
+actuator_override lightOverride = {VALUE_AUTO, 0};
+
+inline void nodeBegin() {
+  LightSensor::begin();
+  Lamp::begin();
+}
+
+// Action from the master; runs on the Wi-Fi task
+inline void nodeAction(const action_command &command) {
+  if (command.target == TARGET_LIGHT) {
+    setOverride(lightOverride, command);
+  }
+}
+
+// Nothing to watch between readings
+inline void nodeWatch() {}
+
+// Read the LDR, set the light and fill in the status frame
+inline bool nodeSample(struct_message &status) {
+  int ldrValue = LightSensor::read();
+  status.sampleTime = masterTime(&status.sampleTimeError); // When the reading was taken
+
+  // Determine the light mode based on LDR value
+  if (ldrValue > LDR_THRESHOLD_FULL) {
+    currentMode = FULL_ON;
+    strcpy(status.lightStatus, "ON");
+  } else if (ldrValue > LDR_THRESHOLD_DIM) {
+    currentMode = DIM;
+    strcpy(status.lightStatus, "DIM");
+  } else {
+    currentMode = OFF;
+    strcpy(status.lightStatus, "OFF");
+  }
+
+  // A master rule overrides the LDR decision while it is active
+  switch (overrideValue(lightOverride)) {
+    case VALUE_OFF:
+      currentMode = OFF;
+      strcpy(status.lightStatus, "OFF");
+      break;
+    case VALUE_DIM:
+      currentMode = DIM;
+      strcpy(status.lightStatus, "DIM");
+      break;
+    case VALUE_ON:
+      currentMode = FULL_ON;
+      strcpy(status.lightStatus, "ON");
+      break;
+  }
+
+  // Apply the current mode
+  int pwmValueDim = map(ldrValue, LDR_THRESHOLD_DIM, LDR_THRESHOLD_FULL, 50, 200);
+  pwmValueDim = constrain(pwmValueDim, 50, 200); // A forced DIM can come with any LDR value
+  switch (currentMode) {
+    case OFF:
+      Lamp::write(0);  // LED OFF
+      break;
+    case DIM:
+      Lamp::write(pwmValueDim);  // Dim LED
+      break;
+    case FULL_ON:
+      Lamp::write(255);  // Fully ON LED
+      break;
+  }
+
+  // Populate the structure with LDR value and status
+  status.ldrValue = ldrValue;
+
+  Serial.print("LDR Value: ");
+  Serial.print(status.ldrValue);
+  Serial.print(", Light Status: ");
+  Serial.println(status.lightStatus);
+  return true;
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+#include <stdint.h>
+#include <math.h>
+
+// Time sync
+//
+// The master broadcasts its millis() in beacons. We fit its offset and drift
+// against our own clock by least squares over the last few beacons, so every
+// sample carries a master-timebase timestamp with an error bound: the path
+// delay of each hop the newest beacon took, the worst residual of the fit,
+// and unmodelled drift for the time since that beacon. Pure C++ with the
+// clock passed in, so the fit can be driven from a host simulator with
+// injected clock drift; the caller does the locking.
+
+// Tuning
+#define SYNC_WINDOW 8              // Beacons kept for the offset/drift fit
+#define SYNC_PATH_DELAY_MS 2       // Bound on beacon air time plus callback latency, per hop
+#define SYNC_DRIFT_BOUND 0.0001f   // Unmodelled drift between beacons (100 ppm)
+#define SYNC_TIMEOUT 30000         // Without a beacon for this long we are unsynced
+#define SYNC_UNSYNCED 0xFFFF       // sampleTimeError when no timestamp is available
+
+typedef struct time_sync {
+  unsigned long localTimes[SYNC_WINDOW]; // Our clock when each beacon arrived
+  long offsets[SYNC_WINDOW];             // Master time minus our time, per beacon
+  int count;
+  int next;
+  unsigned long refLocal;  // Our time at the newest beacon
+  long refOffset;          // Offset measured by the newest beacon
+  float refCorrection;     // Fit correction to refOffset (kept apart for float precision)
+  float drift;             // Fitted change of offset per local ms
+  float fitError;          // Largest residual of the fit, in ms
+  uint8_t refHops;         // Relays the newest beacon passed
+} time_sync;
+
+// Start the fit over: a new master's clock has nothing to do with the old one's
+inline void timeSyncReset(time_sync &sync) {
+  sync.count = 0;
+  sync.next = 0;
+}
+
+inline void timeSyncInit(time_sync &sync) {
+  timeSyncReset(sync);
+  sync.refLocal = 0;
+  sync.refOffset = 0;
+  sync.refCorrection = 0;
+  sync.drift = 0;
+  sync.fitError = 0;
+  sync.refHops = 0;
+}
+
+// Least-squares fit of offset against local time over the beacon window
+inline void timeSyncUpdate(time_sync &sync, unsigned long localTime, uint32_t beaconTime, uint8_t hops) {
+  sync.localTimes[sync.next] = localTime;
+  sync.offsets[sync.next] = (long)(beaconTime - localTime);
+  sync.next = (sync.next + 1) % SYNC_WINDOW;
+  if (sync.count < SYNC_WINDOW) {
+    sync.count++;
+  }
+
+  // Work relative to the newest beacon to keep the floats small
+  long newestOffset = (long)(beaconTime - localTime);
+  float meanX = 0, meanY = 0;
+  for (int i = 0; i < sync.count; i++) {
+    meanX += (long)(sync.localTimes[i] - localTime);
+    meanY += sync.offsets[i] - newestOffset;
+  }
+  meanX /= sync.count;
+  meanY /= sync.count;
+
+  float covariance = 0, variance = 0;
+  for (int i = 0; i < sync.count; i++) {
+    float dx = (long)(sync.localTimes[i] - localTime) - meanX;
+    covariance += dx * (sync.offsets[i] - newestOffset - meanY);
+    variance += dx * dx;
+  }
+  float drift = variance > 0 ? covariance / variance : 0;
+  float intercept = meanY - drift * meanX;
+
+  float fitError = 0;
+  for (int i = 0; i < sync.count; i++) {
+    float x = (long)(sync.localTimes[i] - localTime);
+    float residual = fabsf(sync.offsets[i] - newestOffset - (intercept + drift * x));
+    if (residual > fitError) {
+      fitError = residual;
+    }
+  }
+
+  sync.refLocal = localTime;
+  sync.refOffset = newestOffset;
+  sync.refCorrection = intercept;
+  sync.drift = drift;
+  sync.fitError = fitError;
+  sync.refHops = hops;
+}
+
+// Time `now` in the master timebase; *errorBound gets the bound in ms
+// (SYNC_UNSYNCED, with `now` returned, until beacons arrive)
+inline uint32_t timeSyncMaster(const time_sync &sync, unsigned long now, uint16_t *errorBound) {
+  unsigned long age = now - sync.refLocal;
+  if (sync.count == 0 || age >= SYNC_TIMEOUT) {
+    *errorBound = SYNC_UNSYNCED;
+    return now;
+  }
+  long offset = sync.refOffset + lroundf(sync.refCorrection + sync.drift * age);
+  float error = SYNC_PATH_DELAY_MS * (sync.refHops + 1) + 1 + sync.fitError + SYNC_DRIFT_BOUND * age;
+  *errorBound = (uint16_t)ceilf(error);
+  return now + offset;
+}
+
+#endif
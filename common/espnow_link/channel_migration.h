@@ -0,0 +1,222 @@
+#ifndef CHANNEL_MIGRATION_H
+#define CHANNEL_MIGRATION_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Coordinated channel migration
+//
+// ESP-NOW has to run on the channel of the router the master's STA is
+// connected to, and the router may move to another channel at any time.
+// When the master finds its router on a new channel it announces the move
+// on the old one, a few times, each copy saying how long until the switch,
+// and every node that hears a copy, directly or through a relay, switches
+// at that moment along with the master. A node that missed every copy, or
+// whose master followed the router without warning, finds its beacons gone
+// quiet and sweeps the channels: the ones the network used before and the
+// non-overlapping 1, 6 and 11 first, then the rest, sending a probe on each
+// and listening briefly for a beacon in reply. Its outage is then bounded
+// by RECOVERY_SILENCE plus one sweep. Pure C++ with the clock passed in, so
+// it can be driven from a host simulation.
+
+#define CHANNEL_FIRST 1
+#define CHANNEL_LAST 13
+#define CHANNEL_COUNT (CHANNEL_LAST - CHANNEL_FIRST + 1)
+#define CHANNEL_HISTORY 4            // Channels the network used before, tried first in a sweep
+#define MIGRATION_NOTICES 3          // Copies of a notice the master sends on the old channel
+#define MIGRATION_NOTICE_GAP 30      // ms between copies
+#define MIGRATION_SWITCH_DELAY 250   // ms from the first copy to the switch, time for 3 relays to pass it on
+#define RECOVERY_SILENCE 3500        // ms without any beacon before a node sweeps
+#define RECOVERY_DWELL 60            // ms on a channel waiting for an answer to our probe
+
+// The master's side: the channel ESP-NOW is on and a move in progress
+typedef struct channel_migration {
+  uint8_t channel;          // Channel the nodes are on
+  uint8_t newChannel;       // Channel being moved to, 0 when not moving
+  uint8_t noticesSent;
+  unsigned long lastNotice;
+  unsigned long switchAt;
+  uint32_t announced;       // Moves announced on the old channel
+  uint32_t unannounced;     // Moves the STA made before we could announce them
+} channel_migration;
+
+inline bool channelValid(int channel) {
+  return channel >= CHANNEL_FIRST && channel <= CHANNEL_LAST;
+}
+
+inline void migrationInit(channel_migration &migration, uint8_t channel) {
+  memset(&migration, 0, sizeof(migration));
+  migration.channel = channel;
+}
+
+// Start announcing a move to `channel`; the switch follows MIGRATION_SWITCH_DELAY later
+inline void migrationStart(channel_migration &migration, uint8_t channel, unsigned long now) {
+  migration.newChannel = channel;
+  migration.noticesSent = 0;
+  migration.switchAt = now + MIGRATION_SWITCH_DELAY;
+}
+
+// True when the next copy of the notice is due
+inline bool migrationNoticeDue(const channel_migration &migration, unsigned long now) {
+  return migration.newChannel != 0 && migration.noticesSent < MIGRATION_NOTICES &&
+         (migration.noticesSent == 0 || now - migration.lastNotice >= MIGRATION_NOTICE_GAP) &&
+         (long)(migration.switchAt - now) > 0;
+}
+
+// Move at `switchAt` along with a move another master announced, sending
+// no notices of our own
+inline void migrationFollow(channel_migration &migration, uint8_t channel, unsigned long switchAt) {
+  migration.newChannel = channel;
+  migration.noticesSent = MIGRATION_NOTICES;
+  migration.switchAt = switchAt;
+}
+
+// A copy went out; returns the ms until the switch it should carry
+inline uint16_t migrationNoticeSent(channel_migration &migration, unsigned long now) {
+  migration.noticesSent++;
+  migration.lastNotice = now;
+  return migration.switchAt - now;
+}
+
+// True, with the move done, once it is time to switch
+inline bool migrationSwitchDue(channel_migration &migration, unsigned long now) {
+  if (migration.newChannel == 0 || (long)(now - migration.switchAt) < 0) {
+    return false;
+  }
+  migration.channel = migration.newChannel;
+  migration.newChannel = 0;
+  migration.announced++;
+  return true;
+}
+
+// The STA is already on `channel`: there was no time to announce it
+inline void migrationAdopt(channel_migration &migration, uint8_t channel) {
+  migration.channel = channel;
+  migration.newChannel = 0;
+  migration.unannounced++;
+}
+
+// A node's side: follow notices, and sweep when the network has gone quiet
+typedef struct channel_recovery {
+  uint8_t channel;                   // Channel we are tuned to
+  uint8_t history[CHANNEL_HISTORY];  // Channels the network was found on, newest first; 0 for none
+  unsigned long lastBeacon;          // Last beacon heard, from anyone
+  uint8_t noticeChannel;             // Channel a notice told us to move to, 0 for none
+  unsigned long noticeSwitchAt;
+  bool moved;                        // Switched on a notice, no beacon heard since
+  bool sweeping;
+  uint8_t order[CHANNEL_COUNT];      // Channels in the order this pass tries them
+  uint8_t step;                      // Position in order
+  unsigned long stepStarted;
+  uint32_t migrations;               // Moves made on a notice
+  uint32_t sweeps;                   // Sweeps started
+  uint32_t recoveries;               // Sweeps that found the network
+  unsigned long lastOutage;          // ms between the beacons either side of the last move or sweep
+} channel_recovery;
+
+// Move `channel` to the front of the history
+inline void recoveryRemember(channel_recovery &recovery, uint8_t channel) {
+  int i = 0;
+  while (i < CHANNEL_HISTORY - 1 && recovery.history[i] != channel) {
+    i++;
+  }
+  for (; i > 0; i--) {
+    recovery.history[i] = recovery.history[i - 1];
+  }
+  recovery.history[0] = channel;
+}
+
+inline void recoveryInit(channel_recovery &recovery, uint8_t channel, unsigned long now) {
+  memset(&recovery, 0, sizeof(recovery));
+  recovery.channel = channel;
+  recovery.lastBeacon = now;
+  recoveryRemember(recovery, channel);
+}
+
+// Sweep order: the channel that just went quiet, in case only beacons were
+// lost or the master restarted, then the channels used before, newest
+// first, then 1, 6 and 11, then the rest
+inline void recoverySweepOrder(const channel_recovery &recovery, uint8_t *order) {
+  static const uint8_t likely[] = {1, 6, 11};
+  bool taken[CHANNEL_LAST + 1] = {false};
+  int count = 0;
+  taken[recovery.channel] = true;
+  order[count++] = recovery.channel;
+  for (int i = 0; i < CHANNEL_HISTORY; i++) {
+    uint8_t channel = recovery.history[i];
+    if (channelValid(channel) && !taken[channel]) {
+      taken[channel] = true;
+      order[count++] = channel;
+    }
+  }
+  for (int i = 0; i < (int)sizeof(likely); i++) {
+    if (!taken[likely[i]]) {
+      taken[likely[i]] = true;
+      order[count++] = likely[i];
+    }
+  }
+  for (int channel = CHANNEL_FIRST; channel <= CHANNEL_LAST; channel++) {
+    if (!taken[channel]) {
+      order[count++] = channel;
+    }
+  }
+}
+
+// A beacon, from the master or a relay, on the channel we are tuned to
+inline void recoveryOnBeacon(channel_recovery &recovery, unsigned long now) {
+  if (recovery.sweeping || recovery.moved) {
+    if (recovery.sweeping) {
+      recovery.recoveries++;
+    }
+    recovery.sweeping = false;
+    recovery.moved = false;
+    recovery.lastOutage = now - recovery.lastBeacon;
+    recoveryRemember(recovery, recovery.channel);
+  }
+  recovery.lastBeacon = now;
+}
+
+// A notice: the network moves to `channel` at `switchAt`
+inline void recoveryOnNotice(channel_recovery &recovery, uint8_t channel, unsigned long switchAt) {
+  if (channelValid(channel) && channel != recovery.channel && !recovery.sweeping) {
+    recovery.noticeChannel = channel;
+    recovery.noticeSwitchAt = switchAt;
+  }
+}
+
+// Call often. Returns the channel to tune to now, with a probe to send on
+// it, or 0 to stay where we are.
+inline uint8_t recoveryTick(channel_recovery &recovery, unsigned long now) {
+  if (recovery.noticeChannel != 0 && (long)(now - recovery.noticeSwitchAt) >= 0) {
+    recovery.channel = recovery.noticeChannel;
+    recovery.noticeChannel = 0;
+    recovery.moved = true;
+    recovery.migrations++;
+    recovery.stepStarted = now;
+    return recovery.channel;
+  }
+  if (!recovery.sweeping) {
+    if (now - recovery.lastBeacon < RECOVERY_SILENCE) {
+      if (recovery.moved && now - recovery.stepStarted >= RECOVERY_DWELL) {
+        recovery.stepStarted = now;  // Probe again: we may have switched just before the master
+        return recovery.channel;
+      }
+      return 0;
+    }
+    recovery.sweeping = true;
+    recovery.sweeps++;
+    recovery.noticeChannel = 0;
+    recoverySweepOrder(recovery, recovery.order);
+    recovery.step = 0;
+  } else if (now - recovery.stepStarted < RECOVERY_DWELL) {
+    return 0;
+  } else if (++recovery.step == CHANNEL_COUNT) {
+    recoverySweepOrder(recovery, recovery.order);  // Nothing anywhere: go round again
+    recovery.step = 0;
+  }
+  recovery.stepStarted = now;
+  recovery.channel = recovery.order[recovery.step];
+  return recovery.channel;
+}
+
+#endif
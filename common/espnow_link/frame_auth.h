@@ -0,0 +1,330 @@
+#ifndef FRAME_AUTH_H
+#define FRAME_AUTH_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Frame authentication
+//
+// ESP-NOW's own encryption only covers a handful of unicast peers and none
+// of the broadcasts, so every frame is authenticated here instead: it
+// carries a trailer of AUTH_TRAILER_SIZE bytes with the id of the key it
+// was sealed with, the sender's counter and a tag, and a receiver checks
+// the trailer before it looks at anything else in the frame. Two kinds of
+// key are used:
+//  - every slave has a key of its own, which only it and the masters hold;
+//    it seals the slave's status frames, alarms and firmware update acks
+//    and, the other way, the masters' actions and updates for it;
+//  - the group key, held by every node, seals what is broadcast: beacons,
+//    channel notices, probes and firmware updates for a node type;
+//  - the pair key, held by the two masters of a hot-standby pair only,
+//    seals what one master tells the other: its beacons and notices, so a
+//    node holding the group key cannot make a master stand down.
+// The tag covers the key id, the counter, the node that sealed the frame
+// and the frame, but not the relay_header around a frame on its way
+// through relays: relays change its hop count and cannot check it, not
+// holding the key, so it goes on as it came and its destination checks it.
+// A forged one can waste a relay's airtime, but nothing forged is ever
+// taken in. Beacons and notices a relay passes on are changed by it, so it
+// seals them again as their sender. The counter of a sender must grow from
+// frame to frame; a receiver keeps the last one of each sender and key it
+// takes frames from, so a recorded frame played back later is dropped. It
+// has an entry for each sender it knows beforehand (authAddSender(), a
+// master for each configured slave, a slave for both masters) and adds the
+// relays it hears beacons from while there is room, but never gives an
+// entry up: a sender whose entry was given away could have its recorded
+// frames played back. A frame from a sender with no entry is dropped. Its high
+// 16 bits count the sender's boots, kept in flash, so a restart does not
+// start the counter over. A receiver keeps its table in flash too, but not
+// frame by frame: an entry is saved when it is given to a sender, and its
+// counter again each time it has grown by AUTH_SAVE_STEP. After a restart
+// it takes everything up to the saved counter plus AUTH_SAVE_STEP as heard,
+// so a sender that kept running loses at most that many frames, and only
+// frames recorded in the last moments before the restart could be taken
+// twice.
+//
+// The tag is Chaskey-12 (Mouha et al.), a MAC built for 32-bit
+// microcontrollers: a 128-bit key, a 16-byte block and 12 rounds of 32-bit
+// additions, rotations and xors. The two subkeys it derives from the key
+// are computed once, in authKeyInit(), so a frame costs one permutation
+// per 16 bytes and nothing else. The tag is cut to 64 bits. Frames are
+// authenticated, not encrypted: readings are not secret, forged ones are
+// the risk. Pure C++, so it can be checked and timed on the host.
+
+#ifndef FRAME_AUTH
+#define FRAME_AUTH 1                 // 0 sends frames without trailers and takes them unchecked, to compare
+#endif
+#define AUTH_KEY_SIZE 16             // Bytes of a key
+#define AUTH_TAG_SIZE 8              // Bytes of the tag kept
+#define AUTH_TRAILER_SIZE (1 + 4 + AUTH_TAG_SIZE)  // Key id, counter, tag
+#ifndef AUTH_ROUNDS
+#define AUTH_ROUNDS 12
+#endif
+#define AUTH_KEY_GROUP 0             // Key ids
+#define AUTH_KEY_NODE 1
+#define AUTH_KEY_PAIR 2
+#ifndef AUTH_SENDERS
+#define AUTH_SENDERS 16              // Senders whose last counter a receiver keeps
+#endif
+#define AUTH_SAVE_STEP 32            // Counter growth between saves of a sender's entry
+#define AUTH_SAVED_SIZE (6 + 1 + 4)  // Bytes of a saved entry: sender, key id, counter
+
+// A key with the subkeys Chaskey derives from it
+typedef struct auth_key {
+  uint32_t k[4];
+  uint32_t k1[4];            // Used when the last block is full
+  uint32_t k2[4];            // Used when it is padded
+} auth_key;
+
+// A tag being computed
+typedef struct auth_mac {
+  uint32_t v[4];
+  uint8_t block[16];
+  uint8_t filled;            // Bytes in block not yet absorbed
+} auth_mac;
+
+// The last counter heard from one sender with one key
+typedef struct auth_sender {
+  uint8_t mac[6];
+  uint8_t keyId;
+  uint32_t counter;
+  bool used;
+  uint32_t saved;            // Counter last handed out to be saved
+  bool unsaved;              // Waiting to be saved
+} auth_sender;
+
+typedef struct auth_replay {
+  auth_sender senders[AUTH_SENDERS];
+  uint32_t unknown;          // Frames dropped for a sender with no entry
+} auth_replay;
+
+inline uint32_t authRotl(uint32_t x, int bits) {
+  return (x << bits) | (x >> (32 - bits));
+}
+
+inline uint32_t authLoad32(const uint8_t *bytes) {
+  return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+inline void authStore32(uint8_t *bytes, uint32_t value) {
+  bytes[0] = value;
+  bytes[1] = value >> 8;
+  bytes[2] = value >> 16;
+  bytes[3] = value >> 24;
+}
+
+// Multiply by x in GF(2^128)
+inline void authDouble(uint32_t *out, const uint32_t *in) {
+  out[0] = (in[0] << 1) ^ (in[3] >> 31 ? 0x87 : 0);
+  out[1] = (in[1] << 1) | (in[0] >> 31);
+  out[2] = (in[2] << 1) | (in[1] >> 31);
+  out[3] = (in[3] << 1) | (in[2] >> 31);
+}
+
+inline void authKeyInit(auth_key &key, const uint8_t *bytes) {
+  for (int i = 0; i < 4; i++) {
+    key.k[i] = authLoad32(bytes + 4 * i);
+  }
+  authDouble(key.k1, key.k);
+  authDouble(key.k2, key.k1);
+}
+
+inline void authPermute(uint32_t *v) {
+  for (int i = 0; i < AUTH_ROUNDS; i++) {
+    v[0] += v[1]; v[1] = authRotl(v[1], 5); v[1] ^= v[0]; v[0] = authRotl(v[0], 16);
+    v[2] += v[3]; v[3] = authRotl(v[3], 8); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = authRotl(v[3], 13); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = authRotl(v[1], 7); v[1] ^= v[2]; v[2] = authRotl(v[2], 16);
+  }
+}
+
+inline void authXorBlock(uint32_t *v, const uint8_t *block) {
+  for (int i = 0; i < 4; i++) {
+    v[i] ^= authLoad32(block + 4 * i);
+  }
+}
+
+inline void authBegin(auth_mac &mac, const auth_key &key) {
+  memcpy(mac.v, key.k, sizeof(mac.v));
+  mac.filled = 0;
+}
+
+// A full block is only absorbed once more data follows: the last block
+// is finished with a subkey
+inline void authAbsorb(auth_mac &mac, const uint8_t *data, size_t length) {
+  while (length > 0) {
+    if (mac.filled == 16) {
+      authXorBlock(mac.v, mac.block);
+      authPermute(mac.v);
+      mac.filled = 0;
+    }
+    size_t room = 16 - mac.filled;
+    size_t n = room < length ? room : length;
+    memcpy(mac.block + mac.filled, data, n);
+    mac.filled += n;
+    data += n;
+    length -= n;
+  }
+}
+
+// The full 16-byte tag
+inline void authFinish(auth_mac &mac, const auth_key &key, uint8_t *tag) {
+  const uint32_t *subkey = key.k1;
+  if (mac.filled < 16) {
+    mac.block[mac.filled] = 0x01;
+    memset(mac.block + mac.filled + 1, 0, 15 - mac.filled);
+    subkey = key.k2;
+  }
+  authXorBlock(mac.v, mac.block);
+  for (int i = 0; i < 4; i++) {
+    mac.v[i] ^= subkey[i];
+  }
+  authPermute(mac.v);
+  for (int i = 0; i < 4; i++) {
+    authStore32(tag + 4 * i, mac.v[i] ^ subkey[i]);
+  }
+}
+
+// Tag of `frame` as sealed by `origin` with key `keyId` and `counter`
+inline void authTag(const auth_key &key, uint8_t keyId, uint32_t counter, const uint8_t *origin,
+                    const uint8_t *frame, size_t length, uint8_t *tag) {
+  uint8_t prefix[11];
+  prefix[0] = keyId;
+  authStore32(prefix + 1, counter);
+  memcpy(prefix + 5, origin, 6);
+  auth_mac mac;
+  authBegin(mac, key);
+  authAbsorb(mac, prefix, sizeof(prefix));
+  authAbsorb(mac, frame, length);
+  uint8_t full[16];
+  authFinish(mac, key, full);
+  memcpy(tag, full, AUTH_TAG_SIZE);
+}
+
+// Append the trailer to `frame`, `length` bytes with room for
+// AUTH_TRAILER_SIZE more, sealed by `origin`; returns the sealed length
+inline size_t authSeal(const auth_key &key, uint8_t keyId, uint32_t counter, const uint8_t *origin,
+                       uint8_t *frame, size_t length) {
+  uint8_t *trailer = frame + length;
+  trailer[0] = keyId;
+  authStore32(trailer + 1, counter);
+  authTag(key, keyId, counter, origin, frame, length, trailer + 5);
+  return length + AUTH_TRAILER_SIZE;
+}
+
+// Key id of a sealed frame of `length` bytes, or -1 if it has no room for
+// a trailer and a message type
+inline int authKeyId(const uint8_t *frame, int length) {
+  return length > AUTH_TRAILER_SIZE ? frame[length - AUTH_TRAILER_SIZE] : -1;
+}
+
+// Check the trailer of `frame` as sealed by `origin` with `key`; returns
+// the length without it, with *counter set, or -1 if the tag is wrong.
+// The tags are compared in constant time.
+inline int authOpen(const auth_key &key, const uint8_t *origin, const uint8_t *frame, int length, uint32_t *counter) {
+  if (length <= AUTH_TRAILER_SIZE) {
+    return -1;
+  }
+  int payload = length - AUTH_TRAILER_SIZE;
+  const uint8_t *trailer = frame + payload;
+  *counter = authLoad32(trailer + 1);
+  uint8_t tag[AUTH_TAG_SIZE];
+  authTag(key, trailer[0], *counter, origin, frame, payload, tag);
+  uint8_t difference = 0;
+  for (int i = 0; i < AUTH_TAG_SIZE; i++) {
+    difference |= tag[i] ^ trailer[5 + i];
+  }
+  return difference == 0 ? payload : -1;
+}
+
+inline void authReplayInit(auth_replay &replay) {
+  memset(&replay, 0, sizeof(replay));
+}
+
+// The entry of `origin` and `keyId`, nullptr if it has none
+inline auth_sender *authFindSender(auth_replay &replay, const uint8_t *origin, uint8_t keyId) {
+  for (int i = 0; i < AUTH_SENDERS; i++) {
+    auth_sender &sender = replay.senders[i];
+    if (sender.used && sender.keyId == keyId && memcmp(sender.mac, origin, 6) == 0) {
+      return &sender;
+    }
+  }
+  return nullptr;
+}
+
+// Give `origin` an entry for frames sealed with `keyId`, if it has none
+// and one is free; returns false if it has none. For a sender known
+// beforehand, or only after a frame whose tag checked out, so a forger
+// cannot fill the table.
+inline bool authAddSender(auth_replay &replay, const uint8_t *origin, uint8_t keyId) {
+  if (authFindSender(replay, origin, keyId) != nullptr) {
+    return true;
+  }
+  for (int i = 0; i < AUTH_SENDERS; i++) {
+    auth_sender &sender = replay.senders[i];
+    if (!sender.used) {
+      memset(&sender, 0, sizeof(sender));
+      memcpy(sender.mac, origin, 6);
+      sender.keyId = keyId;
+      sender.used = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+// True if `origin` has an entry for `keyId` and `counter` is newer than the
+// last one it sealed with it, which it then becomes
+inline bool authFresh(auth_replay &replay, const uint8_t *origin, uint8_t keyId, uint32_t counter) {
+  auth_sender *sender = authFindSender(replay, origin, keyId);
+  if (sender == nullptr) {
+    replay.unknown++;
+    return false;
+  }
+  if (counter <= sender->counter) {
+    return false;
+  }
+  sender->counter = counter;
+  if (counter - sender->saved >= AUTH_SAVE_STEP) {
+    sender->unsaved = true;
+  }
+  return true;
+}
+
+// Index of the next entry waiting to be saved, -1 if there is none; the
+// AUTH_SAVED_SIZE bytes to save for it go to `saved`. Call with the table
+// locked and write them to flash after: the sender, key id and counter go
+// in one piece, so a restart half way through a save cannot pair a sender
+// with another's counter.
+inline int authTakeUnsaved(auth_replay &replay, uint8_t *saved) {
+  for (int i = 0; i < AUTH_SENDERS; i++) {
+    auth_sender &sender = replay.senders[i];
+    if (sender.used && sender.unsaved) {
+      sender.saved = sender.counter;
+      sender.unsaved = false;
+      memcpy(saved, sender.mac, 6);
+      saved[6] = sender.keyId;
+      authStore32(saved + 7, sender.counter);
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Put back an entry from the bytes saved for it before a restart, into the
+// sender's entry if it was added again, else a free one. Up to
+// AUTH_SAVE_STEP - 1 counters past the saved one may have been taken
+// without being saved, so those count as heard.
+inline void authRestore(auth_replay &replay, const uint8_t *saved) {
+  if (!authAddSender(replay, saved, saved[6])) {
+    return;
+  }
+  auth_sender &sender = *authFindSender(replay, saved, saved[6]);
+  uint32_t counter = authLoad32(saved + 7) + AUTH_SAVE_STEP - 1;
+  if (counter > sender.counter) {
+    sender.counter = counter;
+    sender.saved = counter;
+  }
+}
+
+#endif
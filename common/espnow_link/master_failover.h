@@ -0,0 +1,174 @@
+#ifndef MASTER_FAILOVER_H
+#define MASTER_FAILOVER_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Hot-standby master
+//
+// A second master may stand by next to the primary, on the same router and
+// channel. It does not need the slaves to send to it: in promiscuous mode it
+// hears the ESP-NOW frames the slaves and relays address to the primary and
+// takes each in as if it had been sent to it, so its readings, statistics,
+// alarms and peer registry follow the primary's frame by frame at no cost
+// in airtime. The active master's sync beacons are the heartbeat. Once the
+// standby has heard none for FAILOVER_SILENCE it takes over and beacons
+// itself; frames the slaves sent to the silent primary in the meantime were
+// heard all the same, and as the primary acked none of them a slave keeps
+// its last FAILOVER_HELD_SAMPLES status frames for the master that takes
+// over, in case the standby missed one. Beacons name the master that sent them and carry a
+// term, raised at every takeover; an active master that hears its partner
+// beacon with a higher term steps down. As every node holds the group key
+// a term is only believed under a key slaves do not hold: the masters send
+// each other a copy of every beacon sealed with the pair key, and the
+// active master tells each slave its term under that slave's own key at
+// takeover and every TERM_ANNOUNCE_INTERVAL. A slave follows the master
+// that announced the highest term and moves its unicast frames to it at
+// once; a group-key beacon only moves it once the master it follows has
+// been quiet for FAILOVER_SILENCE. Both masters boot standing by, so a
+// primary back from a crash leaves the network with the standby that
+// replaced it; at an equal term the configured primary wins. Pure C++ with
+// the clock passed in, so it can be driven from a host simulation.
+
+#define FAILOVER_SILENCE 3000        // ms without the active master's beacons before the standby takes over
+#define FAILOVER_HELD_SAMPLES 5      // Unacked status frames a slave keeps for the master that takes over
+#define TERM_ANNOUNCE_INTERVAL 5000  // ms between the active master's term announcements to each slave
+#define ESPNOW_BODY_OFFSET 39        // Start of the ESP-NOW payload in its action frame
+
+enum FailoverRole {FAILOVER_STANDBY, FAILOVER_ACTIVE};
+
+// A master's side
+typedef struct failover_state {
+  uint8_t role;                // FailoverRole
+  bool primary;                // Configured as the primary: wins at an equal term
+  uint16_t term;               // Ours while active, else the highest heard
+  unsigned long lastPartnerBeacon;
+  unsigned long activeSince;
+  unsigned long lastSilence;   // ms the partner had been quiet when we last took over
+  uint32_t takeovers;
+  uint32_t stepDowns;
+} failover_state;
+
+// Without a partner we are active from the start
+inline void failoverInit(failover_state &failover, bool primary, bool partnered, unsigned long now) {
+  memset(&failover, 0, sizeof(failover));
+  failover.primary = primary;
+  failover.lastPartnerBeacon = now;
+  if (!partnered) {
+    failover.role = FAILOVER_ACTIVE;
+    failover.activeSince = now;
+  }
+}
+
+// A beacon our partner sent with `term`, sealed with the pair key;
+// returns true if it made us step down
+inline bool failoverOnPartnerBeacon(failover_state &failover, uint16_t term, unsigned long now) {
+  bool stepDown = false;
+  if (failover.role == FAILOVER_ACTIVE) {
+    int16_t newer = term - failover.term;
+    if (newer < 0 || (newer == 0 && failover.primary)) {
+      return false;  // It will step down on our beacons
+    }
+    failover.role = FAILOVER_STANDBY;
+    failover.stepDowns++;
+    stepDown = true;
+  }
+  if ((int16_t)(term - failover.term) > 0) {
+    failover.term = term;
+  }
+  failover.lastPartnerBeacon = now;
+  return stepDown;
+}
+
+// The partner is busy and will not beacon for a moment (a channel move):
+// count its silence from now
+inline void failoverHold(failover_state &failover, unsigned long now) {
+  failover.lastPartnerBeacon = now;
+}
+
+// Call often; returns true when we take over
+inline bool failoverTick(failover_state &failover, unsigned long now) {
+  if (failover.role == FAILOVER_ACTIVE || now - failover.lastPartnerBeacon < FAILOVER_SILENCE) {
+    return false;
+  }
+  failover.role = FAILOVER_ACTIVE;
+  failover.term++;
+  failover.takeovers++;
+  failover.activeSince = now;
+  failover.lastSilence = now - failover.lastPartnerBeacon;
+  return true;
+}
+
+// A slave's side: the master its frames go to
+typedef struct master_choice {
+  uint8_t active[6];
+  uint8_t primary[6];          // Wins at an equal term
+  uint16_t term;
+  unsigned long lastHeard;
+  uint32_t switches;
+} master_choice;
+
+enum MasterVerdict {MASTER_IGNORE, MASTER_FOLLOW, MASTER_SWITCH};
+
+inline void masterChoiceInit(master_choice &choice, const uint8_t *primary, unsigned long now) {
+  memset(&choice, 0, sizeof(choice));
+  memcpy(choice.active, primary, 6);
+  memcpy(choice.primary, primary, 6);
+  choice.lastHeard = now;
+}
+
+// The term `master` announced under our own key. A newer one, or the
+// primary's equal to ours, moves us to it at once; the master we follow may
+// also announce a lower one, having restarted while nobody replaced it.
+inline uint8_t masterOnAnnounce(master_choice &choice, const uint8_t *master, uint16_t term, unsigned long now) {
+  if (memcmp(master, choice.active, 6) == 0) {
+    choice.term = term;
+    choice.lastHeard = now;
+    return MASTER_FOLLOW;
+  }
+  int16_t newer = term - choice.term;
+  if (newer < 0 || (newer == 0 && memcmp(master, choice.primary, 6) != 0)) {
+    return MASTER_IGNORE;
+  }
+  memcpy(choice.active, master, 6);
+  choice.term = term;
+  choice.lastHeard = now;
+  choice.switches++;
+  return MASTER_SWITCH;
+}
+
+// A beacon that `master` sent, sealed with the group key, so its term is
+// not believed: one of the master we follow keeps us with it, one of the
+// other moves us only once ours has been quiet for FAILOVER_SILENCE. The
+// term stays the last one announced, which the new master's announcement
+// raises.
+inline uint8_t masterOnBeacon(master_choice &choice, const uint8_t *master, unsigned long now) {
+  if (memcmp(master, choice.active, 6) == 0) {
+    choice.lastHeard = now;
+    return MASTER_FOLLOW;
+  }
+  if (now - choice.lastHeard < FAILOVER_SILENCE) {
+    return MASTER_IGNORE;
+  }
+  memcpy(choice.active, master, 6);
+  choice.lastHeard = now;
+  choice.switches++;
+  return MASTER_SWITCH;
+}
+
+// Length of the ESP-NOW payload in `frame`, an 802.11 frame of `length`
+// bytes (without its FCS) heard in promiscuous mode, or -1 if it is not an
+// ESP-NOW frame: an action frame of Espressif's vendor-specific category
+// holding their vendor element of type 4. The payload starts at
+// ESPNOW_BODY_OFFSET.
+inline int espnowBody(const uint8_t *frame, int length) {
+  static const uint8_t oui[3] = {0x18, 0xFE, 0x34};
+  if (length < ESPNOW_BODY_OFFSET || frame[0] != 0xD0 || frame[24] != 127 || memcmp(frame + 25, oui, 3) != 0 ||
+      frame[32] != 0xDD || memcmp(frame + 34, oui, 3) != 0 || frame[37] != 4) {
+    return -1;
+  }
+  int body = frame[33] - 5;  // The element's length covers its OUI, type and version
+  return body >= 0 && ESPNOW_BODY_OFFSET + body <= length ? body : -1;
+}
+
+#endif
@@ -0,0 +1,414 @@
+#ifndef OTA_TRANSFER_H
+#define OTA_TRANSFER_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Firmware distribution over ESP-NOW
+//
+// The master offers an image (size, SHA-256) to one slave or, by broadcast,
+// to every slave of a node type, then streams it in chunks that each carry
+// their own CRC-32. Receivers acknowledge with the first chunk they still
+// miss plus a bitmap of the OTA_WINDOW chunks after it, every OTA_ACK_EVERY
+// chunks and whenever polled. The sender only sends chunks inside the window
+// of its slowest receiver that some receiver still misses, so one broadcast
+// serves the whole group and lost chunks are resent selectively. A receiver
+// keeps what it has for as long as the session lasts, so a transfer broken
+// off and offered again resumes where it stopped. Once every receiver has
+// every chunk the master asks them to commit: each hashes what it wrote,
+// and only a matching image is made the boot partition.
+//
+// This file holds the protocol state on both ends; the frames and the flash
+// I/O live with the firmware. Pure C++ with the clock passed in, so a
+// transfer can be run end to end on the host.
+
+#define OTA_CHUNK_SIZE 200          // Image bytes per chunk frame
+#define OTA_MAX_IMAGE 0x1E0000      // Largest image, the size of an OTA app partition
+#define OTA_MAX_CHUNKS ((OTA_MAX_IMAGE + OTA_CHUNK_SIZE - 1) / OTA_CHUNK_SIZE)
+#define OTA_WINDOW 32               // Chunks past a receiver's first missing one it can take
+#define OTA_ACK_EVERY 8             // Chunks a receiver takes between unprompted acks
+#define OTA_MAX_RECEIVERS 8         // Nodes one session can update
+#define OTA_OFFER_INTERVAL 500      // ms between repeats of an offer or commit
+#define OTA_JOIN_TIME 2000          // ms receivers have to answer an offer
+#define OTA_ACK_TIMEOUT 150         // ms without progress before the window is polled and resent
+#define OTA_STALL_TIMEOUT 10000     // ms without an ack before a receiver is given up
+#define OTA_COMMIT_TIMEOUT 15000    // ms receivers have to verify and switch partitions
+#define OTA_RX_QUEUE_SIZE 8         // Chunks waiting for a receiver to write them
+
+// Frame operations (the op field of every OTA frame)
+#define OTA_OP_OFFER 0              // Master: image on offer
+#define OTA_OP_CHUNK 1              // Master: one chunk of it
+#define OTA_OP_POLL 2               // Master: ack now
+#define OTA_OP_COMMIT 3             // Master: verify and switch partitions
+#define OTA_OP_ABORT 4              // Master: session cancelled
+#define OTA_OP_ACK 5                // Receiver: progress report
+
+// Receiver states, reported in every ack
+enum OtaState {OTA_IDLE, OTA_RECEIVING, OTA_COMPLETE, OTA_VERIFIED, OTA_FAILED};
+
+// CRC-32 (IEEE 802.3), nibble table
+inline uint32_t otaCrc32(const uint8_t *data, size_t length) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+inline uint16_t otaChunkCount(uint32_t imageSize) {
+  return (imageSize + OTA_CHUNK_SIZE - 1) / OTA_CHUNK_SIZE;
+}
+
+// Bytes in chunk `index` of an image of `imageSize` bytes
+inline size_t otaChunkLength(uint32_t imageSize, uint16_t index) {
+  size_t offset = (size_t)index * OTA_CHUNK_SIZE;
+  return imageSize - offset < OTA_CHUNK_SIZE ? imageSize - offset : OTA_CHUNK_SIZE;
+}
+
+// ---------------------------------------------------------------- receiver
+
+typedef struct ota_receiver {
+  uint32_t session;           // Session being received, 0 for none
+  uint32_t imageSize;
+  uint16_t chunkCount;
+  uint8_t sha256[32];         // Expected hash of the whole image
+  uint8_t have[(OTA_MAX_CHUNKS + 7) / 8]; // Chunks written
+  uint16_t base;              // First chunk not yet written
+  uint16_t received;          // Chunks written
+  uint16_t sinceAck;          // Chunks written since the last ack
+  uint8_t state;              // OtaState
+  uint32_t crcErrors;         // Chunks rejected for a bad CRC
+  uint32_t duplicates;        // Chunks we already had
+} ota_receiver;
+
+inline void otaReceiverInit(ota_receiver &rx) {
+  memset(&rx, 0, sizeof(rx));
+  rx.state = OTA_IDLE;
+}
+
+inline bool otaHave(const ota_receiver &rx, uint16_t index) {
+  return (rx.have[index / 8] >> (index % 8)) & 1;
+}
+
+// An offer for us: returns true if it is a new image, whose partition the
+// caller must then prepare, false if it resumes the one we are receiving
+inline bool otaReceiverOffer(ota_receiver &rx, uint32_t session, uint32_t imageSize, const uint8_t *sha256) {
+  if (rx.session == session && rx.imageSize == imageSize && memcmp(rx.sha256, sha256, 32) == 0 &&
+      rx.state != OTA_FAILED) {
+    return false;
+  }
+  otaReceiverInit(rx);
+  rx.session = session;
+  rx.imageSize = imageSize;
+  rx.chunkCount = otaChunkCount(imageSize);
+  memcpy(rx.sha256, sha256, 32);
+  rx.state = imageSize > 0 && imageSize <= OTA_MAX_IMAGE ? OTA_RECEIVING : OTA_FAILED;
+  return rx.state == OTA_RECEIVING;
+}
+
+// Check a chunk as it arrives; true if it is good and still needed
+inline bool otaReceiverWants(ota_receiver &rx, uint32_t session, uint16_t index, const uint8_t *data,
+                             size_t length, uint32_t crc) {
+  if (rx.state != OTA_RECEIVING || session != rx.session || index >= rx.chunkCount ||
+      length != otaChunkLength(rx.imageSize, index)) {
+    return false;
+  }
+  if (otaHave(rx, index)) {
+    rx.duplicates++;
+    return false;
+  }
+  if (otaCrc32(data, length) != crc) {
+    rx.crcErrors++;
+    return false;
+  }
+  return true;
+}
+
+// A chunk is written; returns true when an ack is due
+inline bool otaReceiverWritten(ota_receiver &rx, uint16_t index) {
+  if (otaHave(rx, index)) {
+    return false;
+  }
+  rx.have[index / 8] |= 1 << (index % 8);
+  rx.received++;
+  rx.sinceAck++;
+  while (rx.base < rx.chunkCount && otaHave(rx, rx.base)) {
+    rx.base++;
+  }
+  if (rx.base == rx.chunkCount) {
+    rx.state = OTA_COMPLETE;
+    return true;
+  }
+  return rx.sinceAck >= OTA_ACK_EVERY;
+}
+
+// Progress for an ack: bit i of the bitmap is chunk base + i
+inline uint32_t otaReceiverBitmap(ota_receiver &rx) {
+  uint32_t bitmap = 0;
+  for (int i = 0; i < OTA_WINDOW && rx.base + i < rx.chunkCount; i++) {
+    if (otaHave(rx, rx.base + i)) {
+      bitmap |= 1UL << i;
+    }
+  }
+  rx.sinceAck = 0;
+  return bitmap;
+}
+
+// Chunks waiting to be written, pushed by the receive callback
+typedef struct ota_rx_chunk {
+  uint16_t index;
+  uint8_t length;
+  uint8_t data[OTA_CHUNK_SIZE];
+} ota_rx_chunk;
+
+typedef struct ota_rx_queue {
+  ota_rx_chunk chunks[OTA_RX_QUEUE_SIZE];
+  uint8_t head;
+  uint8_t count;
+  uint32_t dropped;           // Chunks lost to a full queue; the sender resends them
+} ota_rx_queue;
+
+inline bool otaRxPush(ota_rx_queue &queue, uint16_t index, const uint8_t *data, size_t length) {
+  if (queue.count == OTA_RX_QUEUE_SIZE) {
+    queue.dropped++;
+    return false;
+  }
+  ota_rx_chunk &chunk = queue.chunks[(queue.head + queue.count) % OTA_RX_QUEUE_SIZE];
+  chunk.index = index;
+  chunk.length = length;
+  memcpy(chunk.data, data, length);
+  queue.count++;
+  return true;
+}
+
+inline bool otaRxPop(ota_rx_queue &queue, ota_rx_chunk &chunk) {
+  if (queue.count == 0) {
+    return false;
+  }
+  chunk = queue.chunks[queue.head];
+  queue.head = (queue.head + 1) % OTA_RX_QUEUE_SIZE;
+  queue.count--;
+  return true;
+}
+
+// ------------------------------------------------------------------ sender
+
+enum OtaPhase {OTA_PHASE_IDLE, OTA_PHASE_OFFERING, OTA_PHASE_SENDING, OTA_PHASE_COMMITTING, OTA_PHASE_DONE};
+
+// What the sender wants put on the air next
+enum OtaAction {OTA_SEND_NOTHING, OTA_SEND_OFFER, OTA_SEND_CHUNK, OTA_SEND_POLL, OTA_SEND_COMMIT};
+
+typedef struct ota_peer {
+  uint8_t mac[6];
+  uint8_t state;              // OtaState it last reported
+  bool active;                // Still taking part
+  uint16_t base;              // First chunk it misses
+  uint32_t bitmap;            // Chunks after base it has (bit i = base + i)
+  unsigned long lastAck;
+} ota_peer;
+
+typedef struct ota_sender {
+  uint8_t phase;              // OtaPhase
+  uint32_t session;
+  uint32_t imageSize;
+  uint16_t chunkCount;
+  ota_peer peers[OTA_MAX_RECEIVERS];
+  uint8_t peerCount;
+  uint16_t cursor;            // Next chunk to consider within the window
+  uint16_t windowBase;        // First chunk the slowest receiver misses
+  unsigned long phaseStarted;
+  unsigned long lastRepeat;   // Last offer, commit or poll
+  unsigned long lastProgress; // Last ack that moved a window
+  uint32_t chunksSent;
+  uint32_t chunksResent;      // Sends of a chunk already sent once
+  uint16_t highestSent;       // One past the highest chunk sent so far
+} ota_sender;
+
+inline void otaSenderInit(ota_sender &tx) {
+  memset(&tx, 0, sizeof(tx));
+  tx.phase = OTA_PHASE_IDLE;
+}
+
+inline void otaSenderStart(ota_sender &tx, uint32_t session, uint32_t imageSize, unsigned long now) {
+  otaSenderInit(tx);
+  tx.phase = OTA_PHASE_OFFERING;
+  tx.session = session;
+  tx.imageSize = imageSize;
+  tx.chunkCount = otaChunkCount(imageSize);
+  tx.phaseStarted = now;
+  tx.lastRepeat = now - OTA_OFFER_INTERVAL;  // Offer at once
+  tx.lastProgress = now;
+}
+
+inline bool otaPeerMisses(const ota_peer &peer, uint16_t index) {
+  if (index < peer.base) {
+    return false;
+  }
+  return index - peer.base >= 32 || !((peer.bitmap >> (index - peer.base)) & 1);
+}
+
+// An ack from `mac`; receivers join while the offer is out
+inline void otaSenderOnAck(ota_sender &tx, const uint8_t *mac, uint32_t session, uint8_t state,
+                           uint16_t base, uint32_t bitmap, unsigned long now) {
+  if (tx.phase == OTA_PHASE_IDLE || session != tx.session) {
+    return;
+  }
+  ota_peer *peer = nullptr;
+  for (int i = 0; i < tx.peerCount; i++) {
+    if (memcmp(tx.peers[i].mac, mac, 6) == 0) {
+      peer = &tx.peers[i];
+    }
+  }
+  if (peer == nullptr) {
+    if (tx.phase != OTA_PHASE_OFFERING || tx.peerCount == OTA_MAX_RECEIVERS) {
+      return;
+    }
+    peer = &tx.peers[tx.peerCount++];
+    memcpy(peer->mac, mac, 6);
+    peer->active = state != OTA_FAILED;
+  }
+  if (!peer->active) {
+    return;
+  }
+  if (base > peer->base || bitmap != peer->bitmap || state != peer->state) {
+    tx.lastProgress = now;
+  }
+  peer->state = state;
+  peer->base = base;
+  peer->bitmap = bitmap;
+  peer->lastAck = now;
+  if (state == OTA_FAILED) {
+    peer->active = false;
+  }
+}
+
+// Active receivers; they all have every chunk when `complete`
+inline int otaSenderActive(ota_sender &tx, bool &complete) {
+  int active = 0;
+  complete = true;
+  for (int i = 0; i < tx.peerCount; i++) {
+    if (tx.peers[i].active) {
+      active++;
+      complete &= tx.peers[i].base >= tx.chunkCount;
+    }
+  }
+  return active;
+}
+
+// Decide what to send next; for OTA_SEND_CHUNK `chunk` gets its index. Call
+// otaSenderSent() once it is on the air.
+inline uint8_t otaSenderPoll(ota_sender &tx, unsigned long now, uint16_t &chunk) {
+  // Give up on receivers that went quiet
+  if (tx.phase == OTA_PHASE_SENDING || tx.phase == OTA_PHASE_COMMITTING) {
+    for (int i = 0; i < tx.peerCount; i++) {
+      ota_peer &peer = tx.peers[i];
+      if (peer.active && now - peer.lastAck > OTA_STALL_TIMEOUT) {
+        peer.active = false;
+        peer.state = OTA_FAILED;
+      }
+    }
+  }
+
+  bool complete;
+  int active = otaSenderActive(tx, complete);
+  switch (tx.phase) {
+    case OTA_PHASE_OFFERING:
+      if (now - tx.phaseStarted >= OTA_JOIN_TIME) {
+        tx.phase = active > 0 ? OTA_PHASE_SENDING : OTA_PHASE_DONE;
+        tx.phaseStarted = now;
+        tx.lastProgress = now;
+        return OTA_SEND_NOTHING;
+      }
+      if (now - tx.lastRepeat >= OTA_OFFER_INTERVAL) {
+        tx.lastRepeat = now;
+        return OTA_SEND_OFFER;
+      }
+      return OTA_SEND_NOTHING;
+
+    case OTA_PHASE_SENDING: {
+      if (active == 0) {
+        tx.phase = OTA_PHASE_DONE;
+        return OTA_SEND_NOTHING;
+      }
+      if (complete) {
+        tx.phase = OTA_PHASE_COMMITTING;
+        tx.phaseStarted = now;
+        tx.lastRepeat = now - OTA_OFFER_INTERVAL;
+        return OTA_SEND_NOTHING;
+      }
+      uint16_t low = tx.chunkCount;
+      for (int i = 0; i < tx.peerCount; i++) {
+        if (tx.peers[i].active && tx.peers[i].base < low) {
+          low = tx.peers[i].base;
+        }
+      }
+      if (low != tx.windowBase || tx.cursor < low) {
+        tx.windowBase = low;
+        tx.cursor = tx.cursor < low ? low : tx.cursor;
+      }
+      uint16_t end = low + OTA_WINDOW < tx.chunkCount ? low + OTA_WINDOW : tx.chunkCount;
+      for (uint16_t index = tx.cursor; index < end; index++) {
+        for (int i = 0; i < tx.peerCount; i++) {
+          if (tx.peers[i].active && otaPeerMisses(tx.peers[i], index)) {
+            chunk = index;
+            return OTA_SEND_CHUNK;
+          }
+        }
+      }
+      // Window sent: wait for acks, then poll and go over what is still missing
+      tx.cursor = end;
+      if (now - tx.lastProgress >= OTA_ACK_TIMEOUT && now - tx.lastRepeat >= OTA_ACK_TIMEOUT) {
+        tx.lastRepeat = now;
+        tx.cursor = low;
+        return OTA_SEND_POLL;
+      }
+      return OTA_SEND_NOTHING;
+    }
+
+    case OTA_PHASE_COMMITTING: {
+      bool settled = true;
+      for (int i = 0; i < tx.peerCount; i++) {
+        settled &= !tx.peers[i].active || tx.peers[i].state == OTA_VERIFIED;
+      }
+      if (settled || now - tx.phaseStarted >= OTA_COMMIT_TIMEOUT) {
+        tx.phase = OTA_PHASE_DONE;
+        return OTA_SEND_NOTHING;
+      }
+      if (now - tx.lastRepeat >= OTA_OFFER_INTERVAL) {
+        tx.lastRepeat = now;
+        return OTA_SEND_COMMIT;
+      }
+      return OTA_SEND_NOTHING;
+    }
+
+    default:
+      return OTA_SEND_NOTHING;
+  }
+}
+
+inline void otaSenderSent(ota_sender &tx, uint16_t chunk) {
+  tx.cursor = chunk + 1;
+  tx.chunksSent++;
+  if (chunk < tx.highestSent) {
+    tx.chunksResent++;
+  } else {
+    tx.highestSent = chunk + 1;
+  }
+}
+
+// Receivers that verified the image and switched partitions
+inline int otaSenderUpdated(const ota_sender &tx) {
+  int updated = 0;
+  for (int i = 0; i < tx.peerCount; i++) {
+    updated += tx.peers[i].active && tx.peers[i].state == OTA_VERIFIED;
+  }
+  return updated;
+}
+
+#endif
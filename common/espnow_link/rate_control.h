@@ -0,0 +1,131 @@
+#ifndef RATE_CONTROL_H
+#define RATE_CONTROL_H
+
+#include <stdint.h>
+
+// ESP-NOW PHY rate adaptation
+//
+// One rate_control per peer link. It is fed the RSSI of frames heard from
+// the peer and the result of every send to it. It walks a ladder of PHY
+// rates, dropping quickly when deliveries fail or the signal fades, and
+// climbing only after a clean run with a clear RSSI margin above the next
+// rate's requirement. A climb that fails is blocked for an exponentially
+// growing backoff, so a marginal link does not flap between two rates.
+// Pure C++ with the clock passed in, so it can be replayed against
+// synthetic link traces on the host.
+
+#define RATE_LADDER_SIZE 6
+#define RATE_RSSI_GAIN 0.2f        // Smoothing of the RSSI estimate
+#define RATE_DELIVERY_GAIN 0.1f    // Smoothing of the delivery ratio
+#define RATE_HYSTERESIS_DB 4       // Extra margin needed before climbing
+#define RATE_UP_SAMPLES 10         // Sends at the current rate before a climb is considered
+#define RATE_UP_DELIVERY 0.95f     // Delivery ratio needed to climb
+#define RATE_DOWN_DELIVERY 0.75f   // Delivery ratio that forces a drop
+#define RATE_DOWN_STREAK 3         // Consecutive failures that force a drop
+#define RATE_BACKOFF_MIN 10000     // ms a failed climb blocks the next one
+#define RATE_BACKOFF_MAX 300000
+
+// Ladder from most robust to fastest, with the RSSI (dBm) each rate needs
+// for reliable delivery of short ESP-NOW frames
+static const uint8_t rateLadderMbps[RATE_LADDER_SIZE] = {1, 2, 6, 12, 24, 54};
+static const int8_t rateLadderMinRssi[RATE_LADDER_SIZE] = {-128, -88, -84, -79, -73, -65};
+
+// From IDF 5.1 ESP-NOW takes a rate per peer (esp_now_set_peer_rate_config).
+// Older cores only have the interface-wide esp_wifi_config_espnow_rate,
+// which callers change only while no send is waiting for its callback.
+#if defined(ESP_IDF_VERSION_MAJOR) && (ESP_IDF_VERSION_MAJOR > 5 || (ESP_IDF_VERSION_MAJOR == 5 && ESP_IDF_VERSION_MINOR >= 1))
+#define RATE_PER_PEER 1
+#else
+#define RATE_PER_PEER 0
+#endif
+
+typedef struct rate_control {
+  uint8_t index;             // Current position in the ladder
+  bool hasRssi;
+  float rssi;                // Smoothed RSSI of frames from the peer, dBm
+  float delivery;            // Smoothed delivery ratio at the current rate
+  uint16_t samples;          // Sends at the current rate
+  uint8_t failStreak;        // Consecutive failed sends
+  bool climbed;              // Current rate was reached by a climb not yet proven
+  unsigned long upBlockedUntil;
+  unsigned long backoff;     // Block applied after the next failed climb, ms
+  uint32_t changes;          // Rate changes since boot
+} rate_control;
+
+inline void rateInit(rate_control &rc) {
+  rc.index = 0;
+  rc.hasRssi = false;
+  rc.rssi = -128;
+  rc.delivery = 1;
+  rc.samples = 0;
+  rc.failStreak = 0;
+  rc.climbed = false;
+  rc.upBlockedUntil = 0;
+  rc.backoff = RATE_BACKOFF_MIN;
+  rc.changes = 0;
+}
+
+inline void rateSetIndex(rate_control &rc, uint8_t index) {
+  rc.index = index;
+  rc.delivery = 1;
+  rc.samples = 0;
+  rc.failStreak = 0;
+  rc.changes++;
+}
+
+// Record the RSSI of a frame heard from the peer
+inline void rateOnRssi(rate_control &rc, int rssi) {
+  if (!rc.hasRssi) {
+    rc.rssi = rssi;
+    rc.hasRssi = true;
+  } else {
+    rc.rssi += (rssi - rc.rssi) * RATE_RSSI_GAIN;
+  }
+}
+
+// Record the result of a send at time `now`; returns true if the rate changed
+inline bool rateOnSendResult(rate_control &rc, bool delivered, unsigned long now) {
+  rc.delivery += ((delivered ? 1.0f : 0.0f) - rc.delivery) * RATE_DELIVERY_GAIN;
+  rc.failStreak = delivered ? 0 : rc.failStreak + 1;
+  if (rc.samples < 0xFFFF) {
+    rc.samples++;
+  }
+
+  // Drop: repeated failures, poor delivery, or a signal below what this rate needs
+  bool lossy = rc.failStreak >= RATE_DOWN_STREAK ||
+               (rc.samples >= RATE_DOWN_STREAK && rc.delivery < RATE_DOWN_DELIVERY);
+  bool faded = rc.hasRssi && rc.rssi < rateLadderMinRssi[rc.index];
+  if (rc.index > 0 && (lossy || faded)) {
+    if (rc.climbed && lossy) {
+      // The climb did not hold: block the next one for longer each time
+      rc.upBlockedUntil = now + rc.backoff;
+      rc.backoff = rc.backoff * 2 > RATE_BACKOFF_MAX ? RATE_BACKOFF_MAX : rc.backoff * 2;
+    }
+    rc.climbed = false;
+    rateSetIndex(rc, rc.index - 1);
+    return true;
+  }
+
+  // A rate that survived a full window after a climb is proven; relax the backoff
+  if (rc.climbed && rc.samples >= RATE_UP_SAMPLES) {
+    rc.climbed = false;
+    rc.backoff = RATE_BACKOFF_MIN;
+  }
+
+  // Climb: clean run, and the signal clears the next rate with margin
+  if (rc.index + 1 < RATE_LADDER_SIZE && rc.hasRssi &&
+      rc.samples >= RATE_UP_SAMPLES && rc.delivery >= RATE_UP_DELIVERY &&
+      rc.rssi >= rateLadderMinRssi[rc.index + 1] + RATE_HYSTERESIS_DB &&
+      (long)(now - rc.upBlockedUntil) >= 0) {
+    rateSetIndex(rc, rc.index + 1);
+    rc.climbed = true;
+    return true;
+  }
+  return false;
+}
+
+inline uint8_t rateMbps(const rate_control &rc) {
+  return rateLadderMbps[rc.index];
+}
+
+#endif
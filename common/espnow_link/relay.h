@@ -0,0 +1,286 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Multi-hop relay
+//
+// Slaves that cannot hear the master reach it through slaves in the relay
+// role. The master's sync beacons carry a hop count and a path cost; a relay
+// rebroadcasts the beacons of its own parent once, with its cost added. Each
+// slave picks as parent the sender with the cheapest path to the master, a
+// link's cost growing as its signal fades, and only moves to a new parent
+// that is clearly cheaper. Frames pass at most RELAY_MAX_HOPS relays and a
+// relay forwards each (origin, type, sequence number) once, so a loop or a
+// retry never multiplies traffic. Frames for the master go to the parent;
+// frames from the master follow the route their destination's own frames
+// came up by. Pure C++ with the clock passed in, so it can be driven from a
+// host simulation of a multi-bay topology.
+
+#define RELAY_MAX_HOPS 3             // Relays a frame may pass before it is dropped
+#define RELAY_SEEN_SIZE 16           // Recent frames remembered for duplicate suppression
+#define RELAY_CANDIDATES 4           // Possible parents tracked
+#define RELAY_CANDIDATE_TIMEOUT 3500 // ms without a beacon before a parent is forgotten
+#define RELAY_SWITCH_MARGIN 2        // Cost a new parent must save before we move
+#define RELAY_RSSI_GAIN 0.25f        // Smoothing of each candidate's RSSI
+#define RELAY_RSSI_UNKNOWN -85      // Assumed for a beacon whose RSSI was not heard
+#define RELAY_COST_UNREACHABLE 0xFF
+#define RELAY_ROUTES 8               // Nodes below a relay it can route frames down to
+#define RELAY_ROUTE_TIMEOUT 30000    // ms without a frame from a node before its route is dropped
+#define RELAY_QUEUE_SIZE 4           // Frames waiting for a relay to forward them
+#define RELAY_MAX_FRAME 250          // ESP-NOW payload limit
+
+// Frames already forwarded, by origin, message type and sequence number
+typedef struct relay_seen {
+  uint8_t origin[6];
+  uint8_t msgType;
+  uint16_t seq;
+  bool used;
+} relay_seen;
+
+typedef struct relay_dedup {
+  relay_seen entries[RELAY_SEEN_SIZE];
+  uint8_t next;          // Entry to overwrite next
+  uint32_t suppressed;   // Duplicates dropped
+} relay_dedup;
+
+typedef struct relay_candidate {
+  uint8_t mac[6];
+  uint8_t hops;          // Relays between the master and a node that takes this sender as parent
+  uint8_t pathCost;      // Cost from this sender to the master
+  float rssi;            // Smoothed RSSI of its beacons, dBm
+  unsigned long lastHeard;
+  bool used;
+} relay_candidate;
+
+typedef struct relay_parent {
+  relay_candidate candidates[RELAY_CANDIDATES];
+  int8_t current;        // Index of the parent in candidates, -1 for none
+  uint32_t changes;      // Parent changes since boot
+} relay_parent;
+
+inline void relayDedupInit(relay_dedup &dedup) {
+  memset(&dedup, 0, sizeof(dedup));
+}
+
+// True if this frame was already seen; otherwise remember it
+inline bool relayIsDuplicate(relay_dedup &dedup, const uint8_t *origin, uint8_t msgType, uint16_t seq) {
+  for (int i = 0; i < RELAY_SEEN_SIZE; i++) {
+    const relay_seen &entry = dedup.entries[i];
+    if (entry.used && entry.seq == seq && entry.msgType == msgType && memcmp(entry.origin, origin, 6) == 0) {
+      dedup.suppressed++;
+      return true;
+    }
+  }
+  relay_seen &entry = dedup.entries[dedup.next];
+  memcpy(entry.origin, origin, 6);
+  entry.msgType = msgType;
+  entry.seq = seq;
+  entry.used = true;
+  dedup.next = (dedup.next + 1) % RELAY_SEEN_SIZE;
+  return false;
+}
+
+// Cost of one link, roughly the expected transmissions per delivered frame:
+// 1 on a strong link, one more for every 4 dB below -70 dBm
+inline uint8_t relayLinkCost(float rssi) {
+  if (rssi >= -70) {
+    return 1;
+  }
+  int cost = 1 + (int)((-70 - rssi) / 4);
+  return cost > 16 ? 16 : cost;
+}
+
+inline uint8_t relayCandidateCost(const relay_candidate &candidate) {
+  int cost = candidate.pathCost + relayLinkCost(candidate.rssi);
+  return cost >= RELAY_COST_UNREACHABLE ? RELAY_COST_UNREACHABLE - 1 : cost;
+}
+
+inline void relayParentInit(relay_parent &parent) {
+  memset(&parent, 0, sizeof(parent));
+  parent.current = -1;
+}
+
+// Record a beacon heard from `mac` at time `now`
+inline void relayOnBeacon(relay_parent &parent, const uint8_t *mac, uint8_t hops, uint8_t pathCost,
+                          int rssi, unsigned long now) {
+  int slot = -1;
+  for (int i = 0; i < RELAY_CANDIDATES; i++) {
+    if (parent.candidates[i].used && memcmp(parent.candidates[i].mac, mac, 6) == 0) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    // New sender: take a free slot, else the one heard longest ago (never the parent)
+    for (int i = 0; i < RELAY_CANDIDATES; i++) {
+      if (i == parent.current) {
+        continue;
+      }
+      if (slot < 0 || (parent.candidates[slot].used &&
+          (!parent.candidates[i].used || parent.candidates[i].lastHeard < parent.candidates[slot].lastHeard))) {
+        slot = i;
+      }
+    }
+    relay_candidate &candidate = parent.candidates[slot];
+    memcpy(candidate.mac, mac, 6);
+    candidate.rssi = rssi;
+    candidate.used = true;
+  } else {
+    parent.candidates[slot].rssi += (rssi - parent.candidates[slot].rssi) * RELAY_RSSI_GAIN;
+  }
+  relay_candidate &candidate = parent.candidates[slot];
+  candidate.hops = hops;
+  candidate.pathCost = pathCost;
+  candidate.lastHeard = now;
+}
+
+// Forget silent candidates and move to a clearly cheaper parent; returns
+// true if the parent changed
+inline bool relaySelectParent(relay_parent &parent, unsigned long now) {
+  int best = -1;
+  for (int i = 0; i < RELAY_CANDIDATES; i++) {
+    relay_candidate &candidate = parent.candidates[i];
+    if (candidate.used && now - candidate.lastHeard > RELAY_CANDIDATE_TIMEOUT) {
+      candidate.used = false;
+    }
+    if (!candidate.used || candidate.hops > RELAY_MAX_HOPS || candidate.pathCost == RELAY_COST_UNREACHABLE) {
+      continue;
+    }
+    if (best < 0 || relayCandidateCost(candidate) < relayCandidateCost(parent.candidates[best])) {
+      best = i;
+    }
+  }
+
+  int current = parent.current;
+  bool currentValid = current >= 0 && parent.candidates[current].used &&
+                      parent.candidates[current].hops <= RELAY_MAX_HOPS &&
+                      parent.candidates[current].pathCost != RELAY_COST_UNREACHABLE;
+  if (currentValid && (best == current ||
+      relayCandidateCost(parent.candidates[best]) + RELAY_SWITCH_MARGIN > relayCandidateCost(parent.candidates[current]))) {
+    return false;
+  }
+  if (best == current) {
+    return false;
+  }
+  parent.current = best;
+  parent.changes++;
+  return true;
+}
+
+inline const relay_candidate *relayParentOf(const relay_parent &parent) {
+  return parent.current >= 0 ? &parent.candidates[parent.current] : nullptr;
+}
+
+// Our cost to the master through the current parent
+inline uint8_t relayPathCost(const relay_parent &parent) {
+  const relay_candidate *candidate = relayParentOf(parent);
+  return candidate ? relayCandidateCost(*candidate) : RELAY_COST_UNREACHABLE;
+}
+
+// Relays between the master and us
+inline uint8_t relayHops(const relay_parent &parent) {
+  const relay_candidate *candidate = relayParentOf(parent);
+  return candidate ? candidate->hops : RELAY_COST_UNREACHABLE;
+}
+
+// Routes down: the neighbour each node below us last sent a frame through
+typedef struct relay_route {
+  uint8_t dest[6];
+  uint8_t nextHop[6];
+  unsigned long lastHeard;
+  bool used;
+} relay_route;
+
+typedef struct relay_routes {
+  relay_route entries[RELAY_ROUTES];
+} relay_routes;
+
+inline void relayRoutesInit(relay_routes &routes) {
+  memset(&routes, 0, sizeof(routes));
+}
+
+// Remember that frames from `dest` arrive through `nextHop`
+inline void relayLearnRoute(relay_routes &routes, const uint8_t *dest, const uint8_t *nextHop, unsigned long now) {
+  int slot = -1;
+  for (int i = 0; i < RELAY_ROUTES; i++) {
+    relay_route &route = routes.entries[i];
+    if (route.used && memcmp(route.dest, dest, 6) == 0) {
+      slot = i;
+      break;
+    }
+    if (slot < 0 || (routes.entries[slot].used && (!route.used || route.lastHeard < routes.entries[slot].lastHeard))) {
+      slot = i;  // Free, or the stalest so far
+    }
+  }
+  relay_route &route = routes.entries[slot];
+  memcpy(route.dest, dest, 6);
+  memcpy(route.nextHop, nextHop, 6);
+  route.lastHeard = now;
+  route.used = true;
+}
+
+// Neighbour to send a frame for `dest` to, or nullptr if there is no fresh route
+inline const uint8_t *relayFindRoute(const relay_routes &routes, const uint8_t *dest, unsigned long now) {
+  for (int i = 0; i < RELAY_ROUTES; i++) {
+    const relay_route &route = routes.entries[i];
+    if (route.used && memcmp(route.dest, dest, 6) == 0) {
+      return now - route.lastHeard < RELAY_ROUTE_TIMEOUT ? route.nextHop : nullptr;
+    }
+  }
+  return nullptr;
+}
+
+// Frames a relay has taken in and not yet sent on. The receive callback
+// pushes, the transmit loop sends the head and pops it.
+typedef struct relay_forward {
+  uint8_t to[6];               // Next hop, or the broadcast address
+  uint8_t qos;                 // Class of the frame inside
+  uint8_t attempt;             // Sends so far
+  uint8_t length;
+  unsigned long heldSince;     // When it arrived, for beacons' time correction
+  uint8_t data[RELAY_MAX_FRAME];
+} relay_forward;
+
+typedef struct relay_queue {
+  relay_forward frames[RELAY_QUEUE_SIZE];
+  uint8_t head;
+  uint8_t count;
+  uint32_t forwarded;          // Frames taken in
+  uint32_t dropped;            // Frames lost to a full queue or a failed send
+} relay_queue;
+
+inline void relayQueueInit(relay_queue &queue) {
+  queue.head = 0;
+  queue.count = 0;
+  queue.forwarded = 0;
+  queue.dropped = 0;
+}
+
+// Queue a frame for `to`; returns nullptr, dropping it, if the queue is full.
+// The caller may patch the queued copy it gets back.
+inline relay_forward *relayQueuePush(relay_queue &queue, const uint8_t *to, uint8_t qos,
+                                     const uint8_t *data, size_t length, unsigned long now) {
+  if (queue.count == RELAY_QUEUE_SIZE || length > RELAY_MAX_FRAME) {
+    queue.dropped++;
+    return nullptr;
+  }
+  relay_forward &frame = queue.frames[(queue.head + queue.count) % RELAY_QUEUE_SIZE];
+  memcpy(frame.to, to, 6);
+  frame.qos = qos;
+  frame.attempt = 0;
+  frame.length = length;
+  frame.heldSince = now;
+  memcpy(frame.data, data, length);
+  queue.count++;
+  queue.forwarded++;
+  return &frame;
+}
+
+inline void relayQueuePop(relay_queue &queue) {
+  queue.head = (queue.head + 1) % RELAY_QUEUE_SIZE;
+  queue.count--;
+}
+
+#endif